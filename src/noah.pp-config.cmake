@@ -1,2 +1,5 @@
+include(CMakeFindDependencyMacro)
+find_dependency(Threads)
+
 get_filename_component(SELF_DIR "${CMAKE_CURRENT_LIST_FILE}" PATH)
 include(${SELF_DIR}/noah.pp.package.cmake)
\ No newline at end of file
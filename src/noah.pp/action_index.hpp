@@ -0,0 +1,515 @@
+#pragma once
+
+#include "global.hpp"
+#include "block_store.hpp"
+#include "kv_backend.hpp"
+#include "write_ahead_log.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  a copy of the node's action log, numbered by sequence, with the
+//  addresses each action touches. the actions go into a block_store,
+//  the addresses file has one line per action, "sequence address...",
+//  and is read back into memory on open. all methods may be called
+//  from any thread
+//
+//  with postings_backend, the sequences by address are kept in a
+//  kv_store of that backend in path/"postings" instead of in memory,
+//  keyed by the address and the sequence, and on open only the lines
+//  past the ones it has are read. a read only index keeps them in
+//  memory
+//
+//  prune() drops the actions before a sequence and first() is the
+//  lowest one kept. the addresses file is rewritten to start there,
+//  its first line tells the first sequence
+class action_index
+{
+public:
+    action_index(boost::filesystem::path const& path,
+                 bool read_only = false,
+                 std::string const& postings_backend = std::string())
+        : m_path(path)
+        , m_read_only(read_only)
+        , m_store(path / "actions", read_only)
+        , m_addresses_offset(0)
+        , m_addresses_length(0)
+        , m_addresses_first(0)
+    {
+        if (false == postings_backend.empty() && false == read_only)
+            m_postings_store = open_kv_store(postings_backend, path / "postings");
+        load_addresses();
+    }
+    action_index(action_index const&) = delete;
+
+    uint64_t length() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_store.length();
+    }
+
+    uint64_t first() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_store.first();
+    }
+
+    std::string at(uint64_t sequence) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_store.at(sequence).to_string();
+    }
+
+    //  up to max_count actions starting from sequence, or from first()
+    void range(uint64_t sequence, size_t max_count, std::vector<std::string>& actions) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (uint64_t index = std::max(sequence, m_store.first());
+             index < m_store.length() && max_count > 0;
+             ++index, --max_count)
+            actions.push_back(m_store.at(index).to_string());
+    }
+
+    //  the sequences of up to max_count actions touching the
+    //  address, starting from sequence
+    std::vector<uint64_t> by_address(std::string const& address,
+                                     uint64_t sequence,
+                                     size_t max_count) const
+    {
+        std::vector<uint64_t> result;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sequence = std::max(sequence, m_store.first());
+        if (m_postings_store)
+        {
+            std::string prefix = address + '\0';
+            uint64_t length = m_addresses_length;
+            m_postings_store->scan(prefix, prefix + sequence_key(sequence),
+                                   [&result, &prefix, length, max_count](std::string const& key, std::string const&)
+            {
+                uint64_t item = sequence_from_key(key.substr(prefix.size()));
+                //  left over from lines dropped on open
+                if (item >= length || result.size() >= max_count)
+                    return false;
+                result.push_back(item);
+                return true;
+            });
+            return result;
+        }
+
+        auto it = m_postings.find(address);
+        if (it == m_postings.end())
+            return result;
+
+        auto const& postings = it->second;
+        for (auto position = std::lower_bound(postings.begin(), postings.end(), sequence);
+             position != postings.end() && result.size() < max_count;
+             ++position)
+            result.push_back(*position);
+        return result;
+    }
+
+    //  the action gets the sequence length() had before the call
+    void push_back(std::string const& action, std::vector<std::string> const& addresses)
+    {
+        if (m_read_only)
+            throw std::logic_error("action_index::push_back on read only index");
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t sequence = m_store.length();
+
+        std::string line = std::to_string(sequence);
+        for (auto const& address : addresses)
+            line += " " + address;
+        line += "\n";
+
+        //  the addresses line is written before the action, open
+        //  drops what the action store does not have
+        m_addresses_file.write(line.data(), std::streamsize(line.size()));
+        m_store.push_back(action);
+        m_addresses_offset += line.size();
+        m_addresses_length = sequence + 1;
+
+        kv_store::batch changes;
+        add_postings(sequence, addresses, changes);
+        apply_postings(changes);
+    }
+
+    //  drops the actions from sequence on, not below first(). for the
+    //  write ahead log recovery, which pushes them back
+    void truncate(uint64_t sequence)
+    {
+        if (m_read_only)
+            throw std::logic_error("action_index::truncate on read only index");
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sequence = std::max(sequence, m_store.first());
+        if (sequence >= m_addresses_length && sequence >= m_store.length())
+            return;
+
+        auto path = m_path / "addresses";
+        m_addresses_file.close();
+        m_store.truncate(std::min(sequence, m_store.length()));
+        drop_lines(sequence);
+        m_addresses_file.open(path, std::ios_base::binary | std::ios_base::app);
+        if (!m_addresses_file)
+            throw std::runtime_error("cannot open: " + path.string());
+    }
+
+    //  the addresses file goes to disk first, so that on the next open
+    //  every stored action has its line. on return both are on disk
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_read_only)
+            return;
+        m_addresses_file.flush();
+        if (!m_addresses_file)
+            throw std::runtime_error("cannot write: " + (m_path / "addresses").string());
+        sync_file(m_path / "addresses");
+        m_store.flush();
+        if (m_postings_store)
+            m_postings_store->flush();
+    }
+
+    //  a read only index follows the writer, picks up what it has appended.
+    //  after the writer has pruned, the addresses are read again
+    void refresh()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t first = m_store.first();
+        m_store.refresh();
+        if (first != m_store.first())
+            reset_addresses();
+        read_addresses();
+    }
+
+    //  drops the actions before sequence, the last action is always kept.
+    //  the addresses file is replaced first and the store pruned after
+    //  it, the next open completes an interrupted call. returns the bytes
+    //  of disk reclaimed
+    uint64_t prune(uint64_t sequence)
+    {
+        if (m_read_only)
+            throw std::logic_error("action_index::prune on read only index");
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (0 == m_store.length())
+            return 0;
+        sequence = std::min(sequence, m_store.length() - 1);
+        if (sequence <= m_store.first())
+            return 0;
+
+        auto path = m_path / "addresses";
+        auto temporary = m_path / "addresses.tmp";
+        m_addresses_file.flush();
+        uint64_t result = boost::filesystem::file_size(path);
+        m_addresses_file.close();
+        {
+            boost::filesystem::ifstream from(path, std::ios_base::binary);
+            boost::filesystem::ofstream to(temporary, std::ios_base::binary | std::ios_base::trunc);
+            std::string line;
+            for (uint64_t line_sequence = m_addresses_first; std::getline(from, line); ++line_sequence)
+            {
+                if (line_sequence >= sequence)
+                    to << line << "\n";
+            }
+            to.close();
+            if (!to)
+                throw std::runtime_error("cannot write: " + temporary.string());
+        }
+        sync_file(temporary);
+        boost::filesystem::rename(temporary, path);
+        result -= boost::filesystem::file_size(path);
+
+        m_addresses_file.open(path, std::ios_base::binary | std::ios_base::app);
+        if (!m_addresses_file)
+            throw std::runtime_error("cannot open: " + path.string());
+        m_addresses_offset = boost::filesystem::file_size(path);
+        m_addresses_first = sequence;
+
+        prune_postings(sequence);
+        return result + m_store.prune(sequence);
+    }
+
+private:
+    void load_addresses()
+    {
+        auto path = m_path / "addresses";
+        if (m_postings_store)
+            load_postings_position();
+        read_addresses();
+
+        if (m_read_only)
+            return;
+
+        //  the process stopped in prune() after the addresses file
+        //  was replaced
+        if (m_addresses_first > m_store.first())
+        {
+            prune_postings(m_addresses_first);
+            m_store.prune(m_addresses_first);
+        }
+
+        //  the process stopped between the two writes of push_back,
+        //  the actions without a line are fetched again
+        if (m_store.length() > m_addresses_length)
+            m_store.truncate(m_addresses_length);
+
+        //  lines past the stored actions are dropped from the file
+        if (m_addresses_length > m_store.length())
+            drop_lines(m_store.length());
+
+        m_addresses_file.open(path, std::ios_base::binary | std::ios_base::app);
+        if (!m_addresses_file)
+            throw std::runtime_error("cannot open: " + path.string());
+    }
+
+    //  the lines from length on are dropped from the addresses file,
+    //  and their postings from the store
+    void drop_lines(uint64_t length)
+    {
+        auto path = m_path / "addresses";
+        std::vector<std::string> lines;
+        kv_store::batch changes;
+        {
+            boost::filesystem::ifstream fl(path, std::ios_base::binary);
+            std::string line;
+            while (std::getline(fl, line))
+            {
+                if (m_addresses_first + lines.size() < length)
+                {
+                    lines.push_back(line);
+                    continue;
+                }
+
+                std::istringstream items(line);
+                uint64_t sequence = 0;
+                std::string address;
+                items >> sequence;
+                while (m_postings_store && items >> address)
+                    changes.erase(address + '\0' + sequence_key(sequence));
+            }
+        }
+        if (m_postings_store && false == changes.changes.empty())
+            m_postings_store->apply(changes);
+        boost::filesystem::ofstream fl(path, std::ios_base::binary | std::ios_base::trunc);
+        for (auto const& line : lines)
+            fl << line << "\n";
+        fl.close();
+        if (!fl)
+            throw std::runtime_error("cannot write: " + path.string());
+
+        reset_addresses();
+        read_addresses();
+    }
+
+    void reset_addresses()
+    {
+        m_postings.clear();
+        m_addresses_offset = 0;
+        m_addresses_length = 0;
+        m_addresses_first = 0;
+    }
+
+    //  reads the lines added since the last call, a partial last line
+    //  is left for later. the first line of the file sets the first
+    //  sequence. a read only index that finds the file replaced by the
+    //  writer's prune() reads it from the start
+    void read_addresses()
+    {
+        auto path = m_path / "addresses";
+        boost::filesystem::ifstream fl(path, std::ios_base::binary);
+        if (!fl)
+            return;
+
+        if (m_read_only && boost::filesystem::file_size(path) < m_addresses_offset)
+            reset_addresses();
+
+        fl.seekg(std::streamoff(m_addresses_offset));
+        kv_store::batch changes;
+        std::string line;
+        while (std::getline(fl, line))
+        {
+            if (fl.eof())
+                break;  //  no end of line yet
+
+            std::istringstream items(line);
+            uint64_t sequence;
+            bool valid = static_cast<bool>(items >> sequence);
+            if (valid && 0 == m_addresses_offset)
+                m_addresses_first = m_addresses_length = sequence;
+            if (false == valid || sequence != m_addresses_length)
+            {
+                if (false == m_read_only || 0 == m_addresses_offset)
+                    throw std::runtime_error("corrupt action index: " + path.string());
+                reset_addresses();
+                fl.clear();
+                fl.seekg(0);
+                continue;
+            }
+            m_addresses_offset += line.size() + 1;
+
+            std::vector<std::string> addresses;
+            std::string address;
+            while (items >> address)
+                addresses.push_back(address);
+            ++m_addresses_length;
+
+            add_postings(sequence, addresses, changes);
+            if (changes.changes.size() >= 64 * 1024)
+            {
+                apply_postings(changes);
+                changes.changes.clear();
+            }
+        }
+        apply_postings(changes);
+    }
+
+    void add_postings(uint64_t sequence,
+                      std::vector<std::string> const& addresses,
+                      kv_store::batch& changes)
+    {
+        for (auto const& address : addresses)
+        {
+            if (m_postings_store)
+            {
+                changes.put(address + '\0' + sequence_key(sequence), std::string());
+                continue;
+            }
+
+            auto& postings = m_postings[address];
+            if (postings.empty() || postings.back() != sequence)
+                postings.push_back(sequence);
+        }
+    }
+
+    //  with the lines read or written so far, so that the next open
+    //  starts after them
+    void apply_postings(kv_store::batch& changes)
+    {
+        if (nullptr == m_postings_store || changes.changes.empty())
+            return;
+        changes.put(position_key(), position_value());
+        m_postings_store->apply(changes);
+    }
+
+    std::string position_value() const
+    {
+        return std::to_string(m_addresses_length) + " " +
+               std::to_string(m_addresses_offset) + " " +
+               std::to_string(m_addresses_first);
+    }
+
+    //  the store may have lines the addresses file lost in a crash, or
+    //  the file may have been replaced by prune() since, then it is
+    //  filled again from the start of the file
+    void load_postings_position()
+    {
+        std::string value;
+        if (false == m_postings_store->get(position_key(), value))
+            return;
+
+        uint64_t length = 0;
+        uint64_t offset = 0;
+        uint64_t first = 0;
+        std::istringstream(value) >> length >> offset >> first;
+
+        auto path = m_path / "addresses";
+        boost::filesystem::ifstream fl(path, std::ios_base::binary);
+        uint64_t file_first = 0;
+        if (false == static_cast<bool>(fl >> file_first) || file_first != first)
+            return;
+
+        fl.clear();
+        char last = '\n';
+        if (offset > 0 && false == static_cast<bool>(fl.seekg(std::streamoff(offset - 1)).get(last)))
+            last = '\0';
+        if (last != '\n')
+            return;
+
+        m_addresses_length = length;
+        m_addresses_offset = offset;
+        m_addresses_first = first;
+    }
+
+    //  the postings of the actions before sequence, the kv_store is
+    //  walked whole for them
+    void prune_postings(uint64_t sequence)
+    {
+        if (nullptr == m_postings_store)
+        {
+            for (auto it = m_postings.begin(); it != m_postings.end();)
+            {
+                auto& postings = it->second;
+                postings.erase(postings.begin(), std::lower_bound(postings.begin(), postings.end(), sequence));
+                if (postings.empty())
+                    it = m_postings.erase(it);
+                else
+                    ++it;
+            }
+            return;
+        }
+
+        kv_store::batch changes;
+        m_postings_store->scan(std::string(), std::string(), [&changes, sequence](std::string const& key, std::string const&)
+        {
+            auto separator = key.find('\0');
+            if (separator != std::string::npos &&
+                sequence_from_key(key.substr(separator + 1)) < sequence)
+                changes.erase(key);
+            return true;
+        });
+        changes.put(position_key(), position_value());
+        m_postings_store->apply(changes);
+        m_postings_store->flush();
+    }
+
+    //  big endian, so that the keys of an address are in sequence order
+    static std::string sequence_key(uint64_t sequence)
+    {
+        std::string result(8, '\0');
+        for (size_t index = 0; index != 8; ++index)
+            result[7 - index] = char(uint8_t(sequence >> (index * 8)));
+        return result;
+    }
+
+    static uint64_t sequence_from_key(std::string const& key)
+    {
+        uint64_t result = 0;
+        for (char ch : key)
+            result = (result << 8) | uint8_t(ch);
+        return result;
+    }
+
+    //  no address is empty
+    static std::string position_key()
+    {
+        return std::string();
+    }
+
+    boost::filesystem::path m_path;
+    bool m_read_only;
+    mutable std::mutex m_mutex;
+    block_store m_store;
+    boost::filesystem::ofstream m_addresses_file;
+    uint64_t m_addresses_offset;    //  bytes of the file read
+    uint64_t m_addresses_length;    //  the sequence after the last line read or written
+    uint64_t m_addresses_first;     //  the sequence of the first line
+    std::unordered_map<std::string, std::vector<uint64_t>> m_postings;
+    std::unique_ptr<kv_store> m_postings_store;
+};
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <atomic>
+#include <thread>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace noahpp
+{
+//  heap allocations of the whole process, counted by the operator new
+//  and operator delete of allocation_hooks.hpp, all zero when the
+//  executable does not include it. each thread counts into its own
+//  thread_local block without a locked instruction, the totals add up
+//  the blocks of the running threads and what the ended ones left
+class allocation_counter
+{
+public:
+    static void allocated(size_t size) noexcept
+    {
+        add(&counts::allocations, 1);
+        add(&counts::bytes, size);
+    }
+
+    static void freed() noexcept
+    {
+        add(&counts::frees, 1);
+    }
+
+    static uint64_t allocations() noexcept
+    {
+        return sum(&counts::allocations);
+    }
+
+    static uint64_t frees() noexcept
+    {
+        return sum(&counts::frees);
+    }
+
+    //  requested by the allocations, the frees do not tell their size
+    static uint64_t bytes() noexcept
+    {
+        return sum(&counts::bytes);
+    }
+
+private:
+    class counts
+    {
+    public:
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> frees;
+        std::atomic<uint64_t> bytes;
+    };
+
+    using member = std::atomic<uint64_t> counts::*;
+
+    enum class thread_state { unlisted, listed, ended };
+
+    //  written only by its own thread
+    class thread_counts : public counts
+    {
+    public:
+        thread_state state;
+        thread_counts* previous;
+        thread_counts* next;
+    };
+
+    class registry
+    {
+    public:
+        std::atomic_flag busy;
+        thread_counts* first;
+        counts ended;   //  of the threads that are gone
+    };
+
+    class registry_lock
+    {
+    public:
+        registry_lock() noexcept
+        {
+            while (threads().busy.test_and_set(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+        registry_lock(registry_lock const&) = delete;
+        ~registry_lock()
+        {
+            threads().busy.clear(std::memory_order_release);
+        }
+    };
+
+    //  takes the thread's block out of the list when the thread ends
+    class thread_exit
+    {
+    public:
+        ~thread_exit()
+        {
+            auto& item = current();
+            registry_lock lock;
+            for (member field : {&counts::allocations, &counts::frees, &counts::bytes})
+                (threads().ended.*field).fetch_add((item.*field).load(std::memory_order_relaxed),
+                                                   std::memory_order_relaxed);
+            if (item.previous)
+                item.previous->next = item.next;
+            else
+                threads().first = item.next;
+            if (item.next)
+                item.next->previous = item.previous;
+            item.state = thread_state::ended;
+        }
+    };
+
+    //  zero initialized before anything runs, operator new may be called
+    //  before main
+    static registry& threads() noexcept
+    {
+        static registry value;
+        return value;
+    }
+
+    static thread_counts& current() noexcept
+    {
+        static thread_local thread_counts value;
+        return value;
+    }
+
+    static void add(member field, uint64_t value) noexcept
+    {
+        auto& item = current();
+        if (thread_state::listed == item.state)
+        {
+            auto& counter = item.*field;
+            counter.store(counter.load(std::memory_order_relaxed) + value,
+                          std::memory_order_relaxed);
+            return;
+        }
+        if (thread_state::unlisted == item.state)
+        {
+            {
+                registry_lock lock;
+                item.next = threads().first;
+                if (item.next)
+                    item.next->previous = &item;
+                threads().first = &item;
+                item.state = thread_state::listed;
+            }
+            static thread_local thread_exit on_exit;
+            (void)on_exit;
+            add(field, value);
+            return;
+        }
+        //  thread_local destructors still free memory after thread_exit
+        (threads().ended.*field).fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static uint64_t sum(member field) noexcept
+    {
+        registry_lock lock;
+        uint64_t result = (threads().ended.*field).load(std::memory_order_relaxed);
+        for (auto item = threads().first; item; item = item->next)
+            result += ((*item).*field).load(std::memory_order_relaxed);
+        return result;
+    }
+};
+}
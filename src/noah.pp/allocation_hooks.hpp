@@ -0,0 +1,106 @@
+#pragma once
+
+#include "allocation_counter.hpp"
+
+#include <new>
+
+#include <cstdlib>
+
+//  the global operator new and operator delete, counting into
+//  noahpp::allocation_counter. these are definitions, to be included
+//  from one source file of an executable
+
+namespace noahpp
+{
+namespace detail
+{
+//  nullptr when there is no new_handler to make room
+inline void* counted_allocate(size_t size)
+{
+    if (0 == size)
+        size = 1;
+    while (true)
+    {
+        void* result = std::malloc(size);
+        if (result)
+        {
+            allocation_counter::allocated(size);
+            return result;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (nullptr == handler)
+            return nullptr;
+        handler();
+    }
+}
+
+inline void counted_free(void* pointer) noexcept
+{
+    if (nullptr == pointer)
+        return;
+    allocation_counter::freed();
+    std::free(pointer);
+}
+}
+}
+
+void* operator new(size_t size)
+{
+    void* result = noahpp::detail::counted_allocate(size);
+    if (nullptr == result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void* operator new[](size_t size)
+{
+    void* result = noahpp::detail::counted_allocate(size);
+    if (nullptr == result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept
+{
+    try
+    {
+        return noahpp::detail::counted_allocate(size);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept
+{
+    try
+    {
+        return noahpp::detail::counted_allocate(size);
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void operator delete(void* pointer) noexcept
+{
+    noahpp::detail::counted_free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    noahpp::detail::counted_free(pointer);
+}
+
+void operator delete(void* pointer, std::nothrow_t const&) noexcept
+{
+    noahpp::detail::counted_free(pointer);
+}
+
+void operator delete[](void* pointer, std::nothrow_t const&) noexcept
+{
+    noahpp::detail::counted_free(pointer);
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+namespace noahpp
+{
+//  bump allocation for what lives as long as one request or one batch.
+//  nothing is freed on its own, reset() releases everything at once and
+//  keeps the last chunk, the largest, for the next round. memory given
+//  to the constructor is used first, a buffer on the stack serves small
+//  requests without touching the heap at all. one thread at a time
+class arena
+{
+public:
+    explicit arena(size_t chunk_size = 16 * 1024)
+        : m_initial(nullptr)
+        , m_initial_size(0)
+        , m_chunk_size(chunk_size)
+        , m_chunks(nullptr)
+        , m_position(nullptr)
+        , m_end(nullptr)
+        , m_allocated(0)
+    {}
+    arena(void* initial, size_t initial_size, size_t chunk_size = 16 * 1024)
+        : m_initial(static_cast<char*>(initial))
+        , m_initial_size(initial_size)
+        , m_chunk_size(chunk_size)
+        , m_chunks(nullptr)
+        , m_position(m_initial)
+        , m_end(m_initial + initial_size)
+        , m_allocated(0)
+    {}
+    arena(arena const&) = delete;
+    ~arena()
+    {
+        release(nullptr);
+    }
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        char* result = align(m_position, alignment);
+        //  the padding may already run past the end
+        if (nullptr == result || result > m_end || size_t(m_end - result) < size)
+        {
+            grow(size + alignment);
+            result = align(m_position, alignment);
+        }
+        m_position = result + size;
+        m_allocated += size;
+        return result;
+    }
+
+    void reset()
+    {
+        m_allocated = 0;
+        if (nullptr == m_chunks)
+        {
+            m_position = m_initial;
+            m_end = m_initial + m_initial_size;
+            return;
+        }
+
+        release(m_chunks);
+        m_chunks->next = nullptr;
+        m_position = reinterpret_cast<char*>(m_chunks + 1);
+        m_end = reinterpret_cast<char*>(m_chunks) + m_chunks->size;
+    }
+
+    //  bytes handed out since the last reset()
+    size_t allocated() const
+    {
+        return m_allocated;
+    }
+
+private:
+    class chunk
+    {
+    public:
+        chunk* next;
+        size_t size;
+        std::max_align_t alignment;
+    };
+
+    static char* align(char* position, size_t alignment)
+    {
+        if (nullptr == position)
+            return nullptr;
+        auto value = reinterpret_cast<std::uintptr_t>(position);
+        return position + ((alignment - value % alignment) % alignment);
+    }
+
+    //  chunks double, up to a limit, or fit the one large allocation.
+    //  sized in whole max_align_t units, so they end aligned too
+    void grow(size_t needed)
+    {
+        size_t size = m_chunks ? std::min<size_t>(m_chunks->size * 2, 1024 * 1024) : m_chunk_size;
+        size = std::max(size, needed + sizeof(chunk));
+        size_t const unit = alignof(std::max_align_t);
+        size = (size + unit - 1) / unit * unit;
+
+        auto item = static_cast<chunk*>(std::malloc(size));
+        if (nullptr == item)
+            throw std::bad_alloc();
+        item->next = m_chunks;
+        item->size = size;
+        m_chunks = item;
+        m_position = reinterpret_cast<char*>(item + 1);
+        m_end = reinterpret_cast<char*>(item) + size;
+    }
+
+    //  frees the chunks other than keep
+    void release(chunk* keep)
+    {
+        chunk* item = m_chunks;
+        while (item)
+        {
+            chunk* next = item->next;
+            if (item != keep)
+                std::free(item);
+            item = next;
+        }
+        m_chunks = keep;
+    }
+
+    char* m_initial;
+    size_t m_initial_size;
+    size_t m_chunk_size;
+    chunk* m_chunks;    //  the newest first
+    char* m_position;
+    char* m_end;
+    size_t m_allocated;
+};
+
+//  standard allocator over an arena, for containers that are destroyed
+//  before the arena's next reset()
+template <typename T>
+class arena_allocator
+{
+public:
+    using value_type = T;
+
+    arena_allocator(arena& owner) noexcept
+        : m_arena(&owner)
+    {}
+    template <typename U>
+    arena_allocator(arena_allocator<U> const& other) noexcept
+        : m_arena(other.owner())
+    {}
+
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(m_arena->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) noexcept
+    {}
+
+    arena* owner() const noexcept
+    {
+        return m_arena;
+    }
+
+private:
+    arena* m_arena;
+};
+
+template <typename T, typename U>
+bool operator == (arena_allocator<T> const& first, arena_allocator<U> const& second) noexcept
+{
+    return first.owner() == second.owner();
+}
+
+template <typename T, typename U>
+bool operator != (arena_allocator<T> const& first, arena_allocator<U> const& second) noexcept
+{
+    return first.owner() != second.owner();
+}
+}
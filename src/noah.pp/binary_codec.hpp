@@ -0,0 +1,426 @@
+#pragma once
+
+#include "global.hpp"
+#include "json.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  compact binary form of the JSON messages. the "rtt" type tag and the
+//  member names of BlockchainMessage types are written as small integers,
+//  integer numbers as varints, everything else keeps its JSON meaning,
+//  so any message converts to binary and back to equivalent JSON text.
+//  the first byte of the binary form can't start a JSON text
+namespace binary_codec
+{
+uint8_t const version = 1;
+
+enum tag : uint8_t
+{
+    tag_null = 0,
+    tag_false,
+    tag_true,
+    tag_unsigned,
+    tag_negative,
+    tag_number_text,
+    tag_string,
+    tag_array,
+    tag_object,
+    tag_typed_object,
+    tag_end
+};
+
+//  the order is part of the format, only append to the end
+inline std::vector<std::string> const& dictionary()
+{
+    static std::vector<std::string> const keys =
+    {
+        "rtt", "block_details", "header", "block_number", "delta", "c_sum",
+        "c_const", "prev_hash", "time_signed", "rewards", "to", "amount",
+        "whole", "fraction", "reward_type", "signed_transactions",
+        "authorization", "address", "signature", "transaction_details",
+        "authorizations", "creation", "expiry", "fee", "action", "from",
+        "message", "package", "echoes", "actions", "logging_type", "index",
+        "transaction_hash", "block_hash", "block_size", "transactions",
+        "authority", "transaction_size", "start_index", "max_count",
+        "public_key", "nodeid", "node_type", "origin", "channel_address",
+        "storage_address", "uri", "file_uri", "status", "count"
+    };
+    return keys;
+}
+
+inline std::unordered_map<std::string, size_t> const& dictionary_index()
+{
+    static std::unordered_map<std::string, size_t> const index = []
+    {
+        std::unordered_map<std::string, size_t> result;
+        auto const& keys = dictionary();
+        for (size_t position = 0; position != keys.size(); ++position)
+            result[keys[position]] = position;
+        return result;
+    }();
+    return index;
+}
+
+inline bool is_binary(std::string const& buffer)
+{
+    return false == buffer.empty() && uint8_t(buffer[0]) == version;
+}
+
+namespace detail
+{
+inline void write_varint(uint64_t number, std::string& out)
+{
+    while (number >= 0x80)
+    {
+        out += char(uint8_t(number) | 0x80);
+        number >>= 7;
+    }
+    out += char(uint8_t(number));
+}
+
+class reader
+{
+public:
+    reader(std::string const& buffer)
+        : m_it(buffer.data())
+        , m_end(buffer.data() + buffer.size())
+    {}
+
+    uint8_t peek() const
+    {
+        if (m_it == m_end)
+            throw std::runtime_error("binary_codec: truncated input");
+        return uint8_t(*m_it);
+    }
+
+    uint8_t byte()
+    {
+        if (m_it == m_end)
+            throw std::runtime_error("binary_codec: truncated input");
+        return uint8_t(*m_it++);
+    }
+
+    uint64_t varint()
+    {
+        uint64_t result = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t item = byte();
+            result |= uint64_t(item & 0x7f) << shift;
+            if (0 == (item & 0x80))
+                return result;
+        }
+        throw std::runtime_error("binary_codec: bad varint");
+    }
+
+    void bytes(std::string& out, bool append)
+    {
+        uint64_t length = varint();
+        if (uint64_t(m_end - m_it) < length)
+            throw std::runtime_error("binary_codec: truncated input");
+        if (append)
+            out.append(m_it, size_t(length));
+        else
+            out.assign(m_it, size_t(length));
+        m_it += length;
+    }
+
+    bool at_end() const
+    {
+        return m_it == m_end;
+    }
+
+private:
+    char const* m_it;
+    char const* m_end;
+};
+
+//  true when text is a plain decimal that fits 64 bits and prints back the same
+inline bool parse_integer(std::string const& text, bool& negative, uint64_t& magnitude)
+{
+    size_t start = 0;
+    negative = false;
+    if (false == text.empty() && '-' == text[0])
+    {
+        negative = true;
+        start = 1;
+    }
+
+    size_t length = text.size() - start;
+    if (0 == length || length > 19 ||
+        ('0' == text[start] && length > 1) ||
+        (negative && "0" == text.substr(start)))
+        return false;
+
+    magnitude = 0;
+    for (size_t index = start; index != text.size(); ++index)
+    {
+        if (text[index] < '0' || '9' < text[index])
+            return false;
+        magnitude = magnitude * 10 + uint64_t(text[index] - '0');
+    }
+    return true;
+}
+
+//  0 closes an object, 1 is followed by the key itself,
+//  the rest are dictionary entries
+inline void write_key(std::string const& key, std::string& out)
+{
+    auto const& index = dictionary_index();
+    auto it = index.find(key);
+    if (it != index.end())
+        write_varint(it->second + 2, out);
+    else
+    {
+        write_varint(1, out);
+        write_varint(key.size(), out);
+        out += key;
+    }
+}
+
+inline void write_number(std::string const& text, std::string& out)
+{
+    bool negative;
+    uint64_t magnitude;
+    if (parse_integer(text, negative, magnitude))
+    {
+        out += char(negative ? tag_negative : tag_unsigned);
+        write_varint(magnitude, out);
+    }
+    else
+    {
+        out += char(tag_number_text);
+        write_varint(text.size(), out);
+        out += text;
+    }
+}
+
+inline void encode(json::lexer& input, std::string& out, std::string& scratch, size_t depth)
+{
+    if (depth > json::max_depth)
+        input.fail("nesting is too deep");
+
+    char ch = input.peek();
+    if ('{' == ch)
+    {
+        input.expect('{');
+        if (input.accept('}'))
+        {
+            out += char(tag_object);
+            write_varint(0, out);
+            return;
+        }
+
+        std::string key;
+        input.read_string(key);
+        input.expect(':');
+
+        if ("rtt" == key && '0' <= input.peek() && input.peek() <= '9')
+        {
+            input.read_number(scratch);
+            bool negative;
+            uint64_t rtt;
+            if (parse_integer(scratch, negative, rtt))
+            {
+                out += char(tag_typed_object);
+                write_varint(rtt, out);
+            }
+            else
+            {
+                out += char(tag_object);
+                write_key(key, out);
+                write_number(scratch, out);
+            }
+        }
+        else
+        {
+            out += char(tag_object);
+            write_key(key, out);
+            encode(input, out, scratch, depth + 1);
+        }
+
+        while (input.accept(','))
+        {
+            input.read_string(key);
+            input.expect(':');
+            write_key(key, out);
+            encode(input, out, scratch, depth + 1);
+        }
+        input.expect('}');
+        write_varint(0, out);
+    }
+    else if ('[' == ch)
+    {
+        input.expect('[');
+        out += char(tag_array);
+        if (false == input.accept(']'))
+        {
+            do
+            {
+                encode(input, out, scratch, depth + 1);
+            }
+            while (input.accept(','));
+            input.expect(']');
+        }
+        out += char(tag_end);
+    }
+    else if ('"' == ch)
+    {
+        input.read_string(scratch);
+        out += char(tag_string);
+        write_varint(scratch.size(), out);
+        out += scratch;
+    }
+    else if ('t' == ch)
+    {
+        input.read_literal("true");
+        out += char(tag_true);
+    }
+    else if ('f' == ch)
+    {
+        input.read_literal("false");
+        out += char(tag_false);
+    }
+    else if ('n' == ch)
+    {
+        input.read_literal("null");
+        out += char(tag_null);
+    }
+    else
+    {
+        input.read_number(scratch);
+        write_number(scratch, out);
+    }
+}
+
+inline void decode(reader& input, std::string& out, std::string& scratch, size_t depth)
+{
+    if (depth > json::max_depth)
+        throw std::runtime_error("binary_codec: nesting is too deep");
+
+    uint8_t value_tag = input.byte();
+    switch (value_tag)
+    {
+    case tag_null: out += "null"; break;
+    case tag_false: out += "false"; break;
+    case tag_true: out += "true"; break;
+    case tag_unsigned:
+        out += std::to_string(input.varint());
+        break;
+    case tag_negative:
+        out += '-';
+        out += std::to_string(input.varint());
+        break;
+    case tag_number_text:
+        input.bytes(out, true);
+        break;
+    case tag_string:
+        input.bytes(scratch, false);
+        json::write_string(scratch, out);
+        break;
+    case tag_array:
+    {
+        out += '[';
+        bool first = true;
+        while (true)
+        {
+            if (input.peek() == tag_end)
+            {
+                input.byte();
+                break;
+            }
+            if (false == first)
+                out += ',';
+            first = false;
+            decode(input, out, scratch, depth + 1);
+        }
+        out += ']';
+        break;
+    }
+    case tag_object:
+    case tag_typed_object:
+    {
+        out += '{';
+        bool first = true;
+        if (tag_typed_object == value_tag)
+        {
+            out += "\"rtt\":";
+            out += std::to_string(input.varint());
+            first = false;
+        }
+
+        auto const& keys = dictionary();
+        while (true)
+        {
+            uint64_t key = input.varint();
+            if (0 == key)
+                break;
+
+            if (false == first)
+                out += ',';
+            first = false;
+
+            if (1 == key)
+            {
+                input.bytes(scratch, false);
+                json::write_string(scratch, out);
+            }
+            else if (key - 2 < keys.size())
+                json::write_string(keys[size_t(key - 2)], out);
+            else
+                throw std::runtime_error("binary_codec: unknown key " + std::to_string(key));
+
+            out += ':';
+            decode(input, out, scratch, depth + 1);
+        }
+        out += '}';
+        break;
+    }
+    default:
+        throw std::runtime_error("binary_codec: unknown tag " + std::to_string(value_tag));
+    }
+}
+}
+
+inline std::string encode(std::string const& json_text)
+{
+    std::string result;
+    result.reserve(json_text.size() / 2);
+    result += char(version);
+
+    std::string scratch;
+    json::lexer input(json_text.data(), json_text.data() + json_text.size());
+    detail::encode(input, result, scratch, 0);
+    if (false == input.at_end())
+        input.fail("unexpected data after the value");
+
+    return result;
+}
+
+//  compact JSON text, in the member order the message was encoded with
+inline std::string decode(std::string const& binary)
+{
+    if (false == is_binary(binary))
+        throw std::runtime_error("binary_codec: not binary encoded");
+
+    std::string result;
+    result.reserve(binary.size() * 2);
+
+    std::string scratch;
+    detail::reader input(binary);
+    input.byte();
+    detail::decode(input, result, scratch, 0);
+    if (false == input.at_end())
+        throw std::runtime_error("binary_codec: unexpected data after the value");
+
+    return result;
+}
+}
+}
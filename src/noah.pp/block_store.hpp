@@ -0,0 +1,331 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+namespace noahpp
+{
+//  append only block storage. block bytes go one after the other into
+//  fixed size segment files, the index file keeps one fixed size record
+//  per block number, so lookup by height is a single array access.
+//  both are memory mapped, reads return pointers into the mapping
+//
+//  the blocks before first() are pruned, the segments holding only
+//  those are removed. their index records stay, a few bytes a block
+class block_store
+{
+public:
+    class view
+    {
+    public:
+        char const* data = nullptr;
+        size_t size = 0;
+
+        std::string to_string() const
+        {
+            return std::string(data, size);
+        }
+    };
+
+    static uint64_t const default_segment_size = 64 * 1024 * 1024;
+
+    block_store(boost::filesystem::path const& path,
+                bool read_only = false,
+                uint64_t segment_size = default_segment_size)
+        : m_path(path)
+        , m_read_only(read_only)
+        , m_segment_size(segment_size)
+        , m_index_capacity(0)
+        , m_count(0)
+    {
+        if (false == m_read_only)
+            boost::filesystem::create_directories(m_path);
+
+        auto index_path = m_path / "index";
+        if (false == boost::filesystem::exists(index_path))
+        {
+            if (m_read_only)
+                throw std::runtime_error("block store not found: " + m_path.string());
+
+            header value;
+            std::memcpy(value.magic, "noahblk1", sizeof(value.magic));
+            value.segment_size = m_segment_size;
+            value.count = 0;
+            value.first = 0;
+
+            boost::filesystem::ofstream fl(index_path, std::ios_base::binary);
+            fl.write(reinterpret_cast<char const*>(&value), sizeof(value));
+            if (!fl)
+                throw std::runtime_error("cannot create: " + index_path.string());
+        }
+
+        map_index(0);
+        if (0 != std::memcmp(get_header().magic, "noahblk1", sizeof(get_header().magic)))
+            throw std::runtime_error("not a block store: " + m_path.string());
+        take_count();
+        m_segment_size = get_header().segment_size;
+
+        //  an append interrupted before the count was written
+        //  left the segment tail unused, it is simply overwritten
+        uint64_t count = length();
+        if (count > 0)
+            map_segment(get_record(count - 1).segment);
+    }
+    block_store(block_store const&) = delete;
+
+    //  a read only store keeps the count it saw on the last refresh(),
+    //  the writer may have grown the index and the segments since
+    uint64_t length() const
+    {
+        if (m_read_only)
+            return m_count;
+        return get_header().count;
+    }
+
+    //  the lowest block number kept, 0 unless pruned
+    uint64_t first() const
+    {
+        return get_header().first;
+    }
+
+    view at(uint64_t block_number) const
+    {
+        if (block_number >= length() || block_number < first())
+            throw std::out_of_range("block_store::at(" + std::to_string(block_number) + ")");
+
+        record const& item = get_record(block_number);
+        auto const& region = map_segment(item.segment, item.offset + item.size);
+        if (region.get_size() < item.offset + item.size)
+            throw std::runtime_error("block_store::at(" + std::to_string(block_number) +
+                                     ") past the end of its segment");
+
+        view result;
+        result.data = static_cast<char const*>(region.get_address()) + item.offset;
+        result.size = item.size;
+        return result;
+    }
+
+    //  a block that does not fit in a segment gets a segment of its own
+    void push_back(std::string const& block_bytes)
+    {
+        if (m_read_only)
+            throw std::logic_error("block_store::push_back on read only store");
+
+        uint64_t count = length();
+        record item;
+        item.segment = 0;
+        item.offset = 0;
+        item.size = block_bytes.size();
+
+        if (count > 0)
+        {
+            record const& last = get_record(count - 1);
+            item.segment = last.segment;
+            item.offset = last.offset + last.size;
+            if (item.offset + item.size > segment_capacity(item.segment))
+            {
+                ++item.segment;
+                item.offset = 0;
+            }
+        }
+
+        auto& region = map_segment(item.segment, item.size);
+        if (item.size > 0)
+            std::memcpy(static_cast<char*>(region.get_address()) + item.offset,
+                        block_bytes.data(),
+                        block_bytes.size());
+
+        if ((count + 1) * sizeof(record) + sizeof(header) > m_index_capacity)
+            map_index((count + 1) * 2);
+
+        get_record(count) = item;
+        get_header().count = count + 1;
+    }
+
+    //  drops the blocks starting from block_number, used on reorg
+    void truncate(uint64_t block_number)
+    {
+        if (m_read_only)
+            throw std::logic_error("block_store::truncate on read only store");
+        if (block_number < first())
+            throw std::runtime_error("block_store::truncate(" + std::to_string(block_number) +
+                                     ") below the pruned blocks");
+        if (block_number < length())
+            get_header().count = block_number;
+    }
+
+    //  drops the blocks before block_number, at most up to length().
+    //  first() goes to disk before any file is removed, segments left
+    //  by an interrupted call are removed by the next one. returns the
+    //  bytes of the removed files
+    uint64_t prune(uint64_t block_number)
+    {
+        if (m_read_only)
+            throw std::logic_error("block_store::prune on read only store");
+
+        block_number = std::min(block_number, length());
+        if (block_number > first())
+        {
+            get_header().first = block_number;
+            m_index->flush();
+        }
+
+        uint64_t result = 0;
+        for (uint64_t segment = 0; segment != first_segment(); ++segment)
+        {
+            auto path = segment_path(segment);
+            if (segment < m_segments.size())
+                m_segments[segment].reset();
+            if (false == boost::filesystem::exists(path))
+                continue;
+            result += boost::filesystem::file_size(path);
+            boost::filesystem::remove(path);
+        }
+        return result;
+    }
+
+    void flush()
+    {
+        if (m_read_only)
+            return;
+        for (auto& region : m_segments)
+        {
+            if (region)
+                region->flush();
+        }
+        if (m_index)
+            m_index->flush();
+    }
+
+    //  a read only store follows the writer, picks up what it has appended
+    //  and lets go of the segments it has pruned
+    void refresh()
+    {
+        map_index(0);
+        take_count();
+        for (uint64_t segment = 0; segment < std::min<uint64_t>(first_segment(), m_segments.size()); ++segment)
+            m_segments[segment].reset();
+    }
+
+private:
+    class header
+    {
+    public:
+        char magic[8];
+        uint64_t segment_size;
+        uint64_t count;
+        uint64_t first;     //  was always written 0 before pruning
+    };
+    class record
+    {
+    public:
+        uint64_t segment;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    boost::filesystem::path segment_path(uint64_t segment) const
+    {
+        return m_path / ("segment." + std::to_string(segment));
+    }
+
+    //  the segments before this one hold pruned blocks only. the last
+    //  segment is kept even if all is pruned, the next block goes there
+    uint64_t first_segment() const
+    {
+        if (0 == length())
+            return 0;
+        return get_record(std::min(first(), length() - 1)).segment;
+    }
+
+    uint64_t segment_capacity(uint64_t segment) const
+    {
+        return map_segment(segment).get_size();
+    }
+
+    //  no more than the records the index mapping holds
+    void take_count()
+    {
+        m_count = std::min<uint64_t>(get_header().count,
+                                     (m_index_capacity - sizeof(header)) / sizeof(record));
+    }
+
+    header& get_header() const
+    {
+        return *static_cast<header*>(m_index->get_address());
+    }
+    record& get_record(uint64_t block_number) const
+    {
+        char* address = static_cast<char*>(m_index->get_address());
+        return *reinterpret_cast<record*>(address + sizeof(header) + block_number * sizeof(record));
+    }
+
+    void map_index(uint64_t records)
+    {
+        auto path = m_path / "index";
+        uint64_t size = sizeof(header) + records * sizeof(record);
+
+        if (m_read_only)
+            size = boost::filesystem::file_size(path);
+        else if (size > boost::filesystem::file_size(path))
+            boost::filesystem::resize_file(path, size);
+        else
+            size = boost::filesystem::file_size(path);
+
+        auto mode = m_read_only ? boost::interprocess::read_only : boost::interprocess::read_write;
+        boost::interprocess::file_mapping mapping(path.string().c_str(), mode);
+        m_index.reset(new boost::interprocess::mapped_region(mapping, mode, 0, size));
+        m_index_capacity = size;
+    }
+
+    //  segments stay mapped once touched, so reads don't hit the file system
+    boost::interprocess::mapped_region& map_segment(uint64_t segment, uint64_t at_least = 0) const
+    {
+        if (m_segments.size() <= segment)
+            m_segments.resize(segment + 1);
+
+        auto& region = m_segments[segment];
+        if (region && region->get_size() >= at_least)
+            return *region;
+
+        auto path = segment_path(segment);
+        if (false == m_read_only)
+        {
+            uint64_t size = std::max(m_segment_size, at_least);
+            if (false == boost::filesystem::exists(path))
+                boost::filesystem::ofstream(path, std::ios_base::binary);
+            if (boost::filesystem::file_size(path) < size)
+                boost::filesystem::resize_file(path, size);
+        }
+
+        auto mode = m_read_only ? boost::interprocess::read_only : boost::interprocess::read_write;
+        boost::interprocess::file_mapping mapping(path.string().c_str(), mode);
+        region.reset(new boost::interprocess::mapped_region(mapping, mode));
+
+        return *region;
+    }
+
+    boost::filesystem::path m_path;
+    bool m_read_only;
+    uint64_t m_segment_size;
+    uint64_t m_index_capacity;
+    uint64_t m_count;   //  of a read only store, as of the last refresh()
+    std::unique_ptr<boost::interprocess::mapped_region> m_index;
+    mutable std::vector<std::unique_ptr<boost::interprocess::mapped_region>> m_segments;
+};
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  splits the heights [from, to) in ranges of window blocks and hands
+//  them to the peers that ask, one range per peer at a time, lowest
+//  heights first so that the blocks can be stored in order. a range is
+//  handed out at most max_ahead blocks past written().
+//
+//  each peer has a score, its blocks per second over the recent ranges.
+//  a range not completed in time, three times the peer's score would
+//  take but at least timeout, is given to the next peer that asks. a
+//  peer that fails three times in a row is left out for a while. when
+//  nothing is left to hand out, an idle peer gets a copy of the lowest
+//  range still held by a slower one, the first to complete it wins.
+//  all methods may be called from any thread
+class download_scheduler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    class range
+    {
+    public:
+        uint64_t from = 0;
+        uint64_t count = 0;
+    };
+
+    class peer_stats
+    {
+    public:
+        std::string peer;
+        uint64_t height = 0;
+        double blocks_per_second = 0;
+        uint64_t blocks = 0;
+        uint64_t bytes = 0;
+        uint64_t failures = 0;
+        uint64_t timeouts = 0;
+        size_t in_flight = 0;
+        bool benched = false;
+    };
+
+    download_scheduler(uint64_t from,
+                       uint64_t to,
+                       uint64_t window = 128,
+                       uint64_t max_ahead = 8192,
+                       std::chrono::milliseconds timeout = std::chrono::seconds(20))
+        : m_to(to)
+        , m_next(from)
+        , m_written(from)
+        , m_window(std::max<uint64_t>(window, 1))
+        , m_max_ahead(std::max(max_ahead, m_window))
+        , m_timeout(timeout)
+    {}
+    download_scheduler(download_scheduler const&) = delete;
+
+    //  the peer has the blocks below height
+    void add_peer(std::string const& peer, uint64_t height)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_peers[peer].height = height;
+    }
+
+    //  false when there is nothing for the peer now
+    bool assign(std::string const& peer, range& result, clock::time_point now = clock::now())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        expire(now);
+
+        auto peer_it = m_peers.find(peer);
+        if (peer_it == m_peers.end())
+            return false;
+        auto& state = peer_it->second;
+        if (state.in_flight > 0 || state.benched_until > now)
+            return false;
+
+        for (auto it = m_retry.begin(); it != m_retry.end(); ++it)
+        {
+            if (it->first + it->second > state.height)
+                continue;
+
+            result.from = it->first;
+            result.count = it->second;
+            m_retry.erase(it);
+            hold(peer, state, result, now);
+            return true;
+        }
+
+        if (m_next < m_to &&
+            m_next < m_written + m_max_ahead &&
+            m_next < state.height)
+        {
+            result.from = m_next;
+            result.count = std::min(std::min(m_window, m_to - m_next), state.height - m_next);
+            m_next += result.count;
+            hold(peer, state, result, now);
+            return true;
+        }
+
+        if (false == m_retry.empty() || m_next < m_to)
+            return false;
+
+        //  the end of the download, an idle peer helps a slower one
+        for (auto& item : m_in_flight)
+        {
+            auto& holders = item.second.holders;
+            if (holders.size() != 1 ||
+                holders.count(peer) ||
+                item.first + item.second.count > state.height)
+                continue;
+
+            auto const& holder = m_peers[holders.begin()->first];
+            if (holder.blocks_per_second >= state.blocks_per_second &&
+                now - holders.begin()->second.assigned < m_timeout / 2)
+                continue;
+
+            result.from = item.first;
+            result.count = item.second.count;
+            hold(peer, state, result, now);
+            return true;
+        }
+        return false;
+    }
+
+    //  false when the range has been completed already by another peer,
+    //  then the blocks should be dropped
+    bool complete(std::string const& peer,
+                  range const& item,
+                  uint64_t bytes,
+                  clock::time_point now = clock::now())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& state = m_peers[peer];
+
+        auto it = m_in_flight.find(item.from);
+        auto holder_it = (it == m_in_flight.end()) ? nullptr : &it->second.holders;
+        if (holder_it && holder_it->count(peer))
+        {
+            std::chrono::duration<double> seconds = now - (*holder_it)[peer].assigned;
+            double sample = double(item.count) / std::max(seconds.count(), 0.001);
+            state.blocks_per_second = (0 == state.blocks_per_second) ?
+                                          sample :
+                                          state.blocks_per_second * 0.7 + sample * 0.3;
+        }
+        state.consecutive_failures = 0;
+
+        bool accepted = false;
+        if (it != m_in_flight.end() && it->second.count == item.count)
+        {
+            for (auto const& holder : it->second.holders)
+                --m_peers[holder.first].in_flight;
+            m_in_flight.erase(it);
+            accepted = true;
+        }
+        else
+        {
+            auto retry_it = m_retry.find(item.from);
+            if (retry_it != m_retry.end() && retry_it->second == item.count)
+            {
+                m_retry.erase(retry_it);
+                accepted = true;
+            }
+        }
+
+        if (accepted)
+        {
+            state.blocks += item.count;
+            state.bytes += bytes;
+        }
+        return accepted;
+    }
+
+    //  the peer could not give the range or gave wrong blocks
+    void fail(std::string const& peer, range const& item, clock::time_point now = clock::now())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto& state = m_peers[peer];
+        release(peer, state, item.from);
+        penalize(state, now);
+        ++state.failures;
+    }
+
+    //  the blocks below height are stored
+    void written(uint64_t height)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_written = std::max(m_written, height);
+    }
+
+    bool done() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_next >= m_to && m_in_flight.empty() && m_retry.empty();
+    }
+
+    std::vector<peer_stats> peers(clock::time_point now = clock::now()) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<peer_stats> result;
+        for (auto const& item : m_peers)
+        {
+            peer_stats stats;
+            stats.peer = item.first;
+            stats.height = item.second.height;
+            stats.blocks_per_second = item.second.blocks_per_second;
+            stats.blocks = item.second.blocks;
+            stats.bytes = item.second.bytes;
+            stats.failures = item.second.failures;
+            stats.timeouts = item.second.timeouts;
+            stats.in_flight = item.second.in_flight;
+            stats.benched = item.second.benched_until > now;
+            result.push_back(stats);
+        }
+        return result;
+    }
+
+private:
+    class peer_state
+    {
+    public:
+        uint64_t height = 0;
+        double blocks_per_second = 0;
+        uint64_t blocks = 0;
+        uint64_t bytes = 0;
+        uint64_t failures = 0;
+        uint64_t timeouts = 0;
+        uint64_t consecutive_failures = 0;
+        size_t in_flight = 0;
+        clock::time_point benched_until;
+    };
+
+    class holder
+    {
+    public:
+        clock::time_point assigned;
+        clock::time_point deadline;
+    };
+
+    class flight
+    {
+    public:
+        uint64_t count = 0;
+        std::map<std::string, holder> holders;
+    };
+
+    void hold(std::string const& peer, peer_state& state, range const& item, clock::time_point now)
+    {
+        std::chrono::milliseconds expected(0);
+        if (state.blocks_per_second > 0)
+            expected = std::chrono::milliseconds(uint64_t(3000 * double(item.count) / state.blocks_per_second));
+
+        auto& value = m_in_flight[item.from];
+        value.count = item.count;
+        auto& entry = value.holders[peer];
+        entry.assigned = now;
+        entry.deadline = now + std::max(expected, m_timeout);
+        ++state.in_flight;
+    }
+
+    //  the range goes back to be handed out when no one else holds it
+    void release(std::string const& peer, peer_state& state, uint64_t from)
+    {
+        auto it = m_in_flight.find(from);
+        if (it == m_in_flight.end() || 0 == it->second.holders.erase(peer))
+            return;
+
+        --state.in_flight;
+        if (it->second.holders.empty())
+        {
+            m_retry[from] = it->second.count;
+            m_in_flight.erase(it);
+        }
+    }
+
+    void penalize(peer_state& state, clock::time_point now)
+    {
+        state.blocks_per_second /= 2;
+        if (++state.consecutive_failures >= 3)
+        {
+            state.benched_until = now + std::chrono::seconds(30);
+            state.consecutive_failures = 0;
+        }
+    }
+
+    void expire(clock::time_point now)
+    {
+        std::vector<std::pair<std::string, uint64_t>> late;
+        for (auto const& item : m_in_flight)
+        {
+            for (auto const& entry : item.second.holders)
+            {
+                if (entry.second.deadline <= now)
+                    late.push_back(std::make_pair(entry.first, item.first));
+            }
+        }
+
+        for (auto const& item : late)
+        {
+            auto& state = m_peers[item.first];
+            release(item.first, state, item.second);
+            penalize(state, now);
+            ++state.timeouts;
+        }
+    }
+
+    uint64_t m_to;
+    uint64_t m_next;
+    uint64_t m_written;
+    uint64_t m_window;
+    uint64_t m_max_ahead;
+    std::chrono::milliseconds m_timeout;
+    mutable std::mutex m_mutex;
+    std::map<std::string, peer_state> m_peers;
+    std::map<uint64_t, flight> m_in_flight;     //  by first height
+    std::map<uint64_t, uint64_t> m_retry;       //  first height to count
+};
+}
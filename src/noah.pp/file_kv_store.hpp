@@ -0,0 +1,164 @@
+#pragma once
+
+#include "global.hpp"
+#include "kv_store.hpp"
+#include "write_ahead_log.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace noahpp
+{
+//  a file per key, the way the state directory is laid out. the file
+//  name is the key in hex, under two levels of directories picked by
+//  the key's hash so that none of them gets too large. lookups are a
+//  file open, a scan walks every file. noahd_bench compares the other
+//  backends against it, noahd does not keep the action index in it
+class file_kv_store : public kv_store
+{
+public:
+    //  file names are limited to 255 bytes
+    static size_t const max_key_size = 120;
+
+    file_kv_store(boost::filesystem::path const& path)
+        : m_path(path)
+    {
+        boost::filesystem::create_directories(m_path);
+    }
+    file_kv_store(file_kv_store const&) = delete;
+
+    bool get(std::string const& key, std::string& value) const override
+    {
+        boost::filesystem::ifstream fl(key_path(key), std::ios_base::binary);
+        if (!fl)
+            return false;
+        value.assign(std::istreambuf_iterator<char>(fl), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    void apply(batch const& changes) override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto const& item : changes.changes)
+        {
+            auto path = key_path(item.key);
+            if (item.erased)
+            {
+                boost::filesystem::remove(path);
+                m_unsynced.erase(path.string());
+                continue;
+            }
+
+            boost::filesystem::create_directories(path.parent_path());
+            boost::filesystem::ofstream fl(path, std::ios_base::binary | std::ios_base::trunc);
+            fl.write(item.value.data(), std::streamsize(item.value.size()));
+            if (!fl)
+                throw std::runtime_error("cannot write: " + path.string());
+            m_unsynced.insert(path.string());
+        }
+    }
+
+    void scan(std::string const& prefix,
+              std::string const& from,
+              visitor const& visit) const override
+    {
+        std::vector<std::pair<std::string, boost::filesystem::path>> found;
+        for (boost::filesystem::recursive_directory_iterator it(m_path), end; it != end; ++it)
+        {
+            if (false == boost::filesystem::is_regular_file(it->path()))
+                continue;
+
+            std::string key;
+            if (false == from_hex(it->path().filename().string(), key))
+                continue;
+            if (0 == key.compare(0, prefix.size(), prefix) && key >= from)
+                found.push_back(std::make_pair(key, it->path()));
+        }
+        std::sort(found.begin(), found.end());
+
+        for (auto const& item : found)
+        {
+            std::string value;
+            if (get(item.first, value) && false == visit(item.first, value))
+                break;
+        }
+    }
+
+    void flush() override
+    {
+        std::set<std::string> unsynced;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            unsynced.swap(m_unsynced);
+        }
+        for (auto const& path : unsynced)
+            sync_file(path);
+    }
+
+private:
+    boost::filesystem::path key_path(std::string const& key) const
+    {
+        if (key.size() > max_key_size)
+            throw std::runtime_error("key is too long for file_kv_store: " + std::to_string(key.size()));
+
+        uint64_t hash = detail::stable_hash(key);
+        std::string name = to_hex(key);
+        std::string bucket = to_hex(std::string(1, char(hash)));
+        std::string sub_bucket = to_hex(std::string(1, char(hash >> 8)));
+        return m_path / bucket / sub_bucket / (name.empty() ? std::string("_") : name);
+    }
+
+    static std::string to_hex(std::string const& bytes)
+    {
+        static char const digits[] = "0123456789abcdef";
+        std::string result;
+        for (char ch : bytes)
+        {
+            result += digits[uint8_t(ch) >> 4];
+            result += digits[uint8_t(ch) & 0xf];
+        }
+        return result;
+    }
+
+    static bool from_hex(std::string const& text, std::string& bytes)
+    {
+        if ("_" == text)
+            return true;
+        if (text.size() % 2)
+            return false;
+
+        for (size_t index = 0; index != text.size(); index += 2)
+        {
+            int high = digit(text[index]);
+            int low = digit(text[index + 1]);
+            if (high < 0 || low < 0)
+                return false;
+            bytes += char(high * 16 + low);
+        }
+        return true;
+    }
+
+    static int digit(char ch)
+    {
+        if (ch >= '0' && ch <= '9')
+            return ch - '0';
+        if (ch >= 'a' && ch <= 'f')
+            return ch - 'a' + 10;
+        return -1;
+    }
+
+    boost::filesystem::path m_path;
+    std::mutex m_mutex;
+    std::set<std::string> m_unsynced;
+};
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <mesh.pp/cryptoutility.hpp>
+
+#include <publiq.pp/coin.hpp>
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <string>
+#include <vector>
+
+namespace noahpp
+{
+inline std::string genesis_signed_block(bool testnet)
+{
+#if 0
+    using namespace BlockchainMessage;
+
+    Block genesis_block_mainnet;
+    genesis_block_mainnet.header.block_number = 0;
+    genesis_block_mainnet.header.delta = 0;
+    genesis_block_mainnet.header.c_sum = 0;
+    genesis_block_mainnet.header.c_const = 1;
+    genesis_block_mainnet.header.prev_hash = meshpp::hash("NOAH blockchain. https://noahcoin.org/blog/how-far-can-your-cryptocurrency-go/");
+    beltpp::gm_string_to_gm_time_t("2019-06-01 00:00:00", genesis_block_mainnet.header.time_signed.tm);
+
+    std::string prefix = meshpp::config::public_key_prefix();
+    Reward reward_publiq1;
+    reward_publiq1.amount.whole = 212500000000;
+    reward_publiq1.reward_type = RewardType::initial;
+    reward_publiq1.to = prefix + "8ZzHz4NFvZzaHD2Sfv4DuRAJaNeG3Sg9q2WuSESvGSQrr9Ftcb";
+
+    genesis_block_mainnet.rewards =
+    {
+        reward_publiq1
+    };
+
+    Block genesis_block_testnet = genesis_block_mainnet;
+    genesis_block_testnet.rewards =
+    {
+        reward_publiq1
+    };
+
+    meshpp::random_seed seed;
+    meshpp::private_key pvk = seed.get_private_key(0);
+    meshpp::public_key pbk = pvk.get_public_key();
+
+    SignedBlock sb;
+    if (testnet)
+        sb.block_details = std::move(genesis_block_testnet);
+    else
+        sb.block_details = std::move(genesis_block_mainnet);
+
+    Authority authorization;
+    authorization.address = pbk.to_string();
+    authorization.signature = pvk.sign(sb.block_details.to_string()).base58;
+
+    sb.authorization = authorization;
+
+    std::cout << sb.to_string() << std::endl;
+#endif
+    std::string str_genesis_mainnet = R"genesis(
+                                      {
+                                         "rtt":8,
+                                         "block_details":{
+                                            "rtt":7,
+                                            "header":{
+                                               "rtt":5,
+                                               "block_number":0,
+                                               "delta":0,
+                                               "c_sum":0,
+                                               "c_const":1,
+                                               "prev_hash":"Fic61hPnMkuBGRnVwg6Jo7S3TRZPQrUo2LP2vuLTPpwR",
+                                               "time_signed":"2019-06-01 00:00:00"
+                                            },
+                                            "rewards":[
+                                               {
+                                                  "rtt":12,
+                                                  "to":"NOAH8ZzHz4NFvZzaHD2Sfv4DuRAJaNeG3Sg9q2WuSESvGSQrr9Ftcb",
+                                                  "amount":{
+                                                     "rtt":0,
+                                                     "whole":212500000000,
+                                                     "fraction":0
+                                                  },
+                                                  "reward_type":"initial"
+                                               }
+                                            ],
+                                            "signed_transactions":[
+
+                                            ]
+                                         },
+                                         "authorization":{
+                                            "rtt":3,
+                                            "address":"NOAH8UNYkeKE4as51snM9EptwNBbCX2FeAjMiJyaDZ2hXzph4kd2AL",
+                                            "signature":"AN1rKp3S6vnu5S6rtQWQFhqnyi4C7hdvCaLBnYdT4wx79ZBFFVYzUhLWNMNFgW8kHU1WuXCRnqJyMzDBYi8YPxBTzdyqrfLMf"
+                                         }
+                                      }
+                                      )genesis";
+
+    std::string str_genesis_testnet = R"genesis(
+                                      {
+                                         "rtt":8,
+                                         "block_details":{
+                                            "rtt":7,
+                                            "header":{
+                                               "rtt":5,
+                                               "block_number":0,
+                                               "delta":0,
+                                               "c_sum":0,
+                                               "c_const":1,
+                                               "prev_hash":"Fic61hPnMkuBGRnVwg6Jo7S3TRZPQrUo2LP2vuLTPpwR",
+                                               "time_signed":"2019-06-01 00:00:00"
+                                            },
+                                            "rewards":[
+                                               {
+                                                  "rtt":12,
+                                                  "to":"TNOAH8ZzHz4NFvZzaHD2Sfv4DuRAJaNeG3Sg9q2WuSESvGSQrr9Ftcb",
+                                                  "amount":{
+                                                     "rtt":0,
+                                                     "whole":212500000000,
+                                                     "fraction":0
+                                                  },
+                                                  "reward_type":"initial"
+                                               }
+                                            ],
+                                            "signed_transactions":[
+
+                                            ]
+                                         },
+                                         "authorization":{
+                                            "rtt":3,
+                                            "address":"TNOAH8D2N3bVtvd9Wnns2UNcFG3BJuvYCBJFgBoTMVepebrAEMUL9yv",
+                                            "signature":"AN1rKqXkD7LnKiV7ioeQKw6wbespSQsLmxxDQFSJpn1sLE4NMAd1Epbkdf1xj7TuQ6vPJL5KpjDzzxLPgNXury1rZZDFhtndf"
+                                         }
+                                      }
+                                      )genesis";
+
+    if (testnet)
+        return str_genesis_testnet;
+    else
+        return str_genesis_mainnet;
+}
+
+inline publiqpp::coin mine_amount_threshhold()
+{
+    return publiqpp::coin(1000000, 0);
+}
+
+inline std::vector<publiqpp::coin> block_reward_array()
+{
+    using coin = publiqpp::coin;
+    return std::vector<publiqpp::coin>
+    {
+        coin(75000,0), coin(75000,0), coin(75000,0), coin(75000,0), coin(75000,0),
+        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
+        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
+        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
+        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
+        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0)
+    };
+}
+}
@@ -0,0 +1,512 @@
+#pragma once
+
+#include "global.hpp"
+#include "arena.hpp"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+namespace noahpp
+{
+namespace json
+{
+//  arrays and objects nested deeper than this are refused, the text may
+//  come from anyone and each level takes a stack frame
+size_t const max_depth = 256;
+
+//  just enough JSON for the messages belt.pp generates. the lexer is
+//  shared by the document parser below and by the binary codec, which
+//  converts straight from text without building a document
+class lexer
+{
+public:
+    lexer(char const* begin, char const* end)
+        : m_begin(begin)
+        , m_it(begin)
+        , m_end(end)
+    {}
+
+    char peek()
+    {
+        skip_whitespace();
+        if (m_it == m_end)
+            return '\0';
+        return *m_it;
+    }
+
+    bool at_end()
+    {
+        skip_whitespace();
+        return m_it == m_end;
+    }
+
+    void expect(char ch)
+    {
+        if (peek() != ch)
+            fail(std::string("expected '") + ch + "'");
+        ++m_it;
+    }
+
+    //  consumes ch if it is the next character
+    bool accept(char ch)
+    {
+        if (peek() != ch)
+            return false;
+        ++m_it;
+        return true;
+    }
+
+    void read_literal(char const* literal)
+    {
+        size_t length = std::strlen(literal);
+        skip_whitespace();
+        if (size_t(m_end - m_it) < length ||
+            0 != std::memcmp(m_it, literal, length))
+            fail(std::string("expected ") + literal);
+        m_it += length;
+    }
+
+    //  the number is returned as text, exactly as it was written
+    template <typename STRING>
+    void read_number(STRING& text)
+    {
+        skip_whitespace();
+        char const* start = m_it;
+        if (m_it != m_end && '-' == *m_it)
+            ++m_it;
+        while (m_it != m_end &&
+               (('0' <= *m_it && *m_it <= '9') ||
+                '.' == *m_it || 'e' == *m_it || 'E' == *m_it ||
+                '+' == *m_it || '-' == *m_it))
+            ++m_it;
+
+        if (start == m_it || (m_it - start == 1 && '-' == *start))
+            fail("expected a number");
+        text.assign(start, m_it);
+    }
+
+    template <typename STRING>
+    void read_string(STRING& value)
+    {
+        expect('"');
+        value.clear();
+
+        while (true)
+        {
+            char const* start = m_it;
+            while (m_it != m_end && '"' != *m_it && '\\' != *m_it)
+                ++m_it;
+            value.append(start, m_it);
+
+            if (m_it == m_end)
+                fail("unterminated string");
+            if ('"' == *m_it)
+            {
+                ++m_it;
+                return;
+            }
+
+            ++m_it;  //  backslash
+            if (m_it == m_end)
+                fail("unterminated string");
+            char ch = *m_it++;
+            switch (ch)
+            {
+            case '"': value += '"'; break;
+            case '\\': value += '\\'; break;
+            case '/': value += '/'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'n': value += '\n'; break;
+            case 'r': value += '\r'; break;
+            case 't': value += '\t'; break;
+            case 'u':
+            {
+                uint32_t code = read_hex4();
+                if (0xd800 <= code && code < 0xdc00)
+                {
+                    if (m_end - m_it < 2 || '\\' != m_it[0] || 'u' != m_it[1])
+                        fail("bad surrogate pair");
+                    m_it += 2;
+                    uint32_t low = read_hex4();
+                    if (low < 0xdc00 || 0xe000 <= low)
+                        fail("bad surrogate pair");
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                append_utf8(code, value);
+                break;
+            }
+            default:
+                fail("bad escape");
+            }
+        }
+    }
+
+    //  skips a whole value, returns where it started
+    char const* skip_value(size_t depth = 0)
+    {
+        if (depth > max_depth)
+            fail("nesting is too deep");
+
+        char ch = peek();
+        char const* start = m_it;
+        std::string scratch;
+
+        if ('{' == ch)
+        {
+            expect('{');
+            if (false == accept('}'))
+            {
+                do
+                {
+                    read_string(scratch);
+                    expect(':');
+                    skip_value(depth + 1);
+                }
+                while (accept(','));
+                expect('}');
+            }
+        }
+        else if ('[' == ch)
+        {
+            expect('[');
+            if (false == accept(']'))
+            {
+                do
+                {
+                    skip_value(depth + 1);
+                }
+                while (accept(','));
+                expect(']');
+            }
+        }
+        else if ('"' == ch)
+            read_string(scratch);
+        else if ('t' == ch)
+            read_literal("true");
+        else if ('f' == ch)
+            read_literal("false");
+        else if ('n' == ch)
+            read_literal("null");
+        else
+            read_number(scratch);
+
+        return start;
+    }
+
+    char const* position() const
+    {
+        return m_it;
+    }
+
+    [[noreturn]] void fail(std::string const& message) const
+    {
+        throw std::runtime_error("json: " + message + " at offset " +
+                                 std::to_string(m_it - m_begin));
+    }
+
+private:
+    void skip_whitespace()
+    {
+        while (m_it != m_end &&
+               (' ' == *m_it || '\n' == *m_it || '\r' == *m_it || '\t' == *m_it))
+            ++m_it;
+    }
+
+    uint32_t read_hex4()
+    {
+        if (m_end - m_it < 4)
+            fail("bad \\u escape");
+
+        uint32_t code = 0;
+        for (size_t index = 0; index != 4; ++index)
+        {
+            char ch = *m_it++;
+            code <<= 4;
+            if ('0' <= ch && ch <= '9')
+                code += uint32_t(ch - '0');
+            else if ('a' <= ch && ch <= 'f')
+                code += uint32_t(ch - 'a' + 10);
+            else if ('A' <= ch && ch <= 'F')
+                code += uint32_t(ch - 'A' + 10);
+            else
+                fail("bad \\u escape");
+        }
+        return code;
+    }
+
+    template <typename STRING>
+    static void append_utf8(uint32_t code, STRING& value)
+    {
+        if (code < 0x80)
+            value += char(code);
+        else if (code < 0x800)
+        {
+            value += char(0xc0 | (code >> 6));
+            value += char(0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000)
+        {
+            value += char(0xe0 | (code >> 12));
+            value += char(0x80 | ((code >> 6) & 0x3f));
+            value += char(0x80 | (code & 0x3f));
+        }
+        else
+        {
+            value += char(0xf0 | (code >> 18));
+            value += char(0x80 | ((code >> 12) & 0x3f));
+            value += char(0x80 | ((code >> 6) & 0x3f));
+            value += char(0x80 | (code & 0x3f));
+        }
+    }
+
+    char const* m_begin;
+    char const* m_it;
+    char const* m_end;
+};
+
+inline void write_string(char const* data, size_t size, std::string& out)
+{
+    static char const hex[] = "0123456789abcdef";
+
+    out += '"';
+    for (char const* it = data; it != data + size; ++it)
+    {
+        char ch = *it;
+        switch (ch)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                out += "\\u00";
+                out += hex[(ch >> 4) & 0xf];
+                out += hex[ch & 0xf];
+            }
+            else
+                out += ch;
+        }
+    }
+    out += '"';
+}
+
+inline void write_string(std::string const& value, std::string& out)
+{
+    write_string(value.data(), value.size(), out);
+}
+
+//  a parsed document. with arena_allocator every string and array of
+//  the document is taken from the arena, so a whole document costs a few
+//  chunks of it at most instead of an allocation for each part
+template <typename ALLOCATOR>
+class basic_value
+{
+public:
+    enum class kind { null, boolean, number, string, array, object };
+
+    using allocator_type = ALLOCATOR;
+    using string_type = std::basic_string<char, std::char_traits<char>, ALLOCATOR>;
+    using items_type = std::vector<basic_value,
+                                   typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<basic_value>>;
+    using members_type = std::vector<std::pair<string_type, basic_value>,
+                                     typename std::allocator_traits<ALLOCATOR>::template rebind_alloc<std::pair<string_type, basic_value>>>;
+
+    explicit basic_value(ALLOCATOR const& allocator = ALLOCATOR())
+        : type(kind::null)
+        , flag(false)
+        , text(allocator)
+        , items(allocator)
+        , members(allocator)
+    {}
+
+    bool is_object() const { return kind::object == type; }
+    bool is_array() const { return kind::array == type; }
+    bool is_string() const { return kind::string == type; }
+    bool is_number() const { return kind::number == type; }
+
+    //  nullptr when this is not an object or there is no such member
+    basic_value const* find(std::string const& key) const
+    {
+        for (auto const& member : members)
+        {
+            if (member.first.size() == key.size() &&
+                0 == key.compare(0, key.size(), member.first.data(), member.first.size()))
+                return &member.second;
+        }
+        return nullptr;
+    }
+
+    //  text as a std::string, whatever the allocator
+    std::string string() const
+    {
+        return std::string(text.data(), text.size());
+    }
+
+    allocator_type get_allocator() const
+    {
+        return text.get_allocator();
+    }
+
+    kind type;
+    bool flag;
+    string_type text;   //  string value, or number as written
+    items_type items;
+    members_type members;
+};
+
+using value = basic_value<std::allocator<char>>;
+using arena_value = basic_value<arena_allocator<char>>;
+
+template <typename ALLOCATOR>
+void parse(lexer& input, basic_value<ALLOCATOR>& result, size_t depth = 0)
+{
+    if (depth > max_depth)
+        input.fail("nesting is too deep");
+
+    using value_type = basic_value<ALLOCATOR>;
+    auto allocator = result.get_allocator();
+
+    char ch = input.peek();
+    if ('{' == ch)
+    {
+        result.type = value_type::kind::object;
+        input.expect('{');
+        if (input.accept('}'))
+            return;
+        do
+        {
+            result.members.emplace_back(typename value_type::string_type(allocator), value_type(allocator));
+            input.read_string(result.members.back().first);
+            input.expect(':');
+            parse(input, result.members.back().second, depth + 1);
+        }
+        while (input.accept(','));
+        input.expect('}');
+    }
+    else if ('[' == ch)
+    {
+        result.type = value_type::kind::array;
+        input.expect('[');
+        if (input.accept(']'))
+            return;
+        do
+        {
+            result.items.emplace_back(allocator);
+            parse(input, result.items.back(), depth + 1);
+        }
+        while (input.accept(','));
+        input.expect(']');
+    }
+    else if ('"' == ch)
+    {
+        result.type = value_type::kind::string;
+        input.read_string(result.text);
+    }
+    else if ('t' == ch || 'f' == ch)
+    {
+        result.type = value_type::kind::boolean;
+        result.flag = ('t' == ch);
+        input.read_literal(result.flag ? "true" : "false");
+    }
+    else if ('n' == ch)
+    {
+        result.type = value_type::kind::null;
+        input.read_literal("null");
+    }
+    else
+    {
+        result.type = value_type::kind::number;
+        input.read_number(result.text);
+    }
+}
+
+template <typename ALLOCATOR>
+void parse(std::string const& text, basic_value<ALLOCATOR>& result)
+{
+    lexer input(text.data(), text.data() + text.size());
+    parse(input, result);
+    if (false == input.at_end())
+        input.fail("unexpected data after the value");
+}
+
+inline value parse(std::string const& text)
+{
+    value result;
+    parse(text, result);
+    return result;
+}
+
+//  the result and everything in it lives in memory, it has to be
+//  destroyed before memory's reset()
+inline arena_value parse(std::string const& text, arena& memory)
+{
+    arena_value result{arena_allocator<char>(memory)};
+    parse(text, result);
+    return result;
+}
+
+template <typename ALLOCATOR>
+void write(basic_value<ALLOCATOR> const& item, std::string& out)
+{
+    using value_type = basic_value<ALLOCATOR>;
+
+    switch (item.type)
+    {
+    case value_type::kind::null:
+        out += "null";
+        break;
+    case value_type::kind::boolean:
+        out += item.flag ? "true" : "false";
+        break;
+    case value_type::kind::number:
+        out.append(item.text.data(), item.text.size());
+        break;
+    case value_type::kind::string:
+        write_string(item.text.data(), item.text.size(), out);
+        break;
+    case value_type::kind::array:
+        out += '[';
+        for (size_t index = 0; index != item.items.size(); ++index)
+        {
+            if (index > 0)
+                out += ',';
+            write(item.items[index], out);
+        }
+        out += ']';
+        break;
+    case value_type::kind::object:
+        out += '{';
+        for (size_t index = 0; index != item.members.size(); ++index)
+        {
+            if (index > 0)
+                out += ',';
+            write_string(item.members[index].first.data(), item.members[index].first.size(), out);
+            out += ':';
+            write(item.members[index].second, out);
+        }
+        out += '}';
+        break;
+    }
+}
+
+template <typename ALLOCATOR>
+std::string to_string(basic_value<ALLOCATOR> const& item)
+{
+    std::string result;
+    write(item, result);
+    return result;
+}
+}
+}
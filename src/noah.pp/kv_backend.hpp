@@ -0,0 +1,33 @@
+#pragma once
+
+#include "global.hpp"
+#include "file_kv_store.hpp"
+#include "kv_store.hpp"
+#include "lsm_kv_store.hpp"
+
+#include <boost/filesystem/path.hpp>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace noahpp
+{
+inline std::vector<std::string> kv_backends()
+{
+    return {"files", "lsm"};
+}
+
+//  the store of the named backend in the directory, created if missing
+inline std::unique_ptr<kv_store> open_kv_store(std::string const& backend,
+                                               boost::filesystem::path const& path)
+{
+    if ("files" == backend)
+        return std::unique_ptr<kv_store>(new file_kv_store(path));
+    if ("lsm" == backend)
+        return std::unique_ptr<kv_store>(new lsm_kv_store(path));
+
+    throw std::runtime_error("unknown kv backend: " + backend);
+}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+namespace detail
+{
+//  FNV-1a, what is stored depends on it, so it has to stay the same
+//  across platforms and builds
+inline uint64_t stable_hash(std::string const& bytes, uint64_t seed = 0)
+{
+    uint64_t result = 14695981039346656037ULL ^ seed;
+    for (char ch : bytes)
+    {
+        result ^= uint8_t(ch);
+        result *= 1099511628211ULL;
+    }
+    return result;
+}
+}
+
+//  ordered string keys to string values, kept on local disk. the
+//  backends are in file_kv_store.hpp and lsm_kv_store.hpp, one is
+//  chosen by name with open_kv_store() from kv_backend.hpp
+class kv_store
+{
+public:
+    class batch
+    {
+    public:
+        class change
+        {
+        public:
+            std::string key;
+            std::string value;
+            bool erased = false;
+        };
+
+        void put(std::string const& key, std::string const& value)
+        {
+            change item;
+            item.key = key;
+            item.value = value;
+            changes.push_back(std::move(item));
+        }
+        void erase(std::string const& key)
+        {
+            change item;
+            item.key = key;
+            item.erased = true;
+            changes.push_back(std::move(item));
+        }
+
+        std::vector<change> changes;
+    };
+
+    //  false stops the scan
+    using visitor = std::function<bool(std::string const& key, std::string const& value)>;
+
+    virtual ~kv_store() {}
+
+    virtual bool get(std::string const& key, std::string& value) const = 0;
+
+    //  in order, a later change of the same key wins
+    virtual void apply(batch const& changes) = 0;
+
+    //  the keys starting with prefix, in order, from the first one that
+    //  is not less than from. visit must not call back into the store
+    virtual void scan(std::string const& prefix,
+                      std::string const& from,
+                      visitor const& visit) const = 0;
+
+    //  on return what was applied is on disk
+    virtual void flush() = 0;
+};
+}
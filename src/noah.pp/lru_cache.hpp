@@ -0,0 +1,237 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  string to string cache bounded by bytes, split in shards by key hash
+//  so that lookups on different keys rarely wait for each other. each
+//  shard evicts its least recently used entries.
+//
+//  entries may carry tags, invalidate(tag) drops all entries with the
+//  tag. a value computed before an invalidation must not be put after
+//  it, so put() takes the generation() read before computing the value
+//  and ignores the value if any invalidation happened in between.
+//  all methods may be called from any thread
+class lru_cache
+{
+public:
+    lru_cache(size_t max_bytes, size_t shard_count = 16)
+        : m_shards()
+        , m_generation(0)
+        , m_hits(0)
+        , m_misses(0)
+        , m_evictions(0)
+        , m_invalidations(0)
+    {
+        if (0 == shard_count)
+            shard_count = 1;
+        for (size_t index = 0; index != shard_count; ++index)
+            m_shards.emplace_back(new shard(max_bytes / shard_count));
+    }
+    lru_cache(lru_cache const&) = delete;
+
+    bool get(std::string const& key, std::string& value)
+    {
+        auto& item = shard_for(key);
+        std::lock_guard<std::mutex> lock(item.mutex);
+
+        auto it = item.index.find(key);
+        if (it == item.index.end())
+        {
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        item.entries.splice(item.entries.begin(), item.entries, it->second);
+        value = it->second->value;
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t generation() const
+    {
+        return m_generation.load();
+    }
+
+    void put(std::string const& key,
+             std::string const& value,
+             std::vector<std::string> const& tags,
+             uint64_t generation)
+    {
+        auto& item = shard_for(key);
+        size_t bytes = key.size() * 2 + value.size() + 128;
+        for (auto const& tag : tags)
+            bytes += tag.size() + key.size() + 64;
+        if (bytes > item.max_bytes)
+            return;
+
+        std::lock_guard<std::mutex> lock(item.mutex);
+        //  invalidate() increments it under every shard lock in turn,
+        //  so reading it here under this one is enough
+        if (generation != m_generation.load())
+            return;
+
+        auto it = item.index.find(key);
+        if (it != item.index.end())
+            erase(item, it->second);
+
+        while (item.bytes + bytes > item.max_bytes && false == item.entries.empty())
+        {
+            erase(item, std::prev(item.entries.end()));
+            m_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        entry value_entry;
+        value_entry.key = key;
+        value_entry.value = value;
+        value_entry.tags = tags;
+        value_entry.bytes = bytes;
+        item.entries.push_front(std::move(value_entry));
+        item.index[key] = item.entries.begin();
+        for (auto const& tag : tags)
+            item.tags[tag].insert(key);
+        item.bytes += bytes;
+    }
+
+    size_t invalidate(std::string const& tag)
+    {
+        return invalidate(std::vector<std::string>(1, tag));
+    }
+
+    size_t invalidate(std::vector<std::string> const& tags)
+    {
+        size_t count = 0;
+        for (auto& pshard : m_shards)
+        {
+            auto& item = *pshard;
+            std::lock_guard<std::mutex> lock(item.mutex);
+            if (pshard == m_shards.front())
+                ++m_generation;
+
+            for (auto const& tag : tags)
+            {
+                auto it = item.tags.find(tag);
+                if (it == item.tags.end())
+                    continue;
+
+                std::vector<std::string> keys(it->second.begin(), it->second.end());
+                for (auto const& key : keys)
+                {
+                    auto entry_it = item.index.find(key);
+                    if (entry_it != item.index.end())
+                    {
+                        erase(item, entry_it->second);
+                        ++count;
+                    }
+                }
+            }
+        }
+        m_invalidations.fetch_add(count, std::memory_order_relaxed);
+        return count;
+    }
+
+    size_t size() const
+    {
+        size_t result = 0;
+        for (auto const& pshard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(pshard->mutex);
+            result += pshard->index.size();
+        }
+        return result;
+    }
+    size_t bytes() const
+    {
+        size_t result = 0;
+        for (auto const& pshard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(pshard->mutex);
+            result += pshard->bytes;
+        }
+        return result;
+    }
+    uint64_t hits() const
+    {
+        return m_hits.load(std::memory_order_relaxed);
+    }
+    uint64_t misses() const
+    {
+        return m_misses.load(std::memory_order_relaxed);
+    }
+    uint64_t evictions() const
+    {
+        return m_evictions.load(std::memory_order_relaxed);
+    }
+    uint64_t invalidations() const
+    {
+        return m_invalidations.load(std::memory_order_relaxed);
+    }
+
+private:
+    class entry
+    {
+    public:
+        std::string key;
+        std::string value;
+        std::vector<std::string> tags;
+        size_t bytes = 0;
+    };
+
+    class shard
+    {
+    public:
+        explicit shard(size_t _max_bytes)
+            : max_bytes(_max_bytes)
+            , bytes(0)
+        {}
+
+        size_t const max_bytes;
+        size_t bytes;
+        mutable std::mutex mutex;
+        std::list<entry> entries;   //  most recently used first
+        std::unordered_map<std::string, std::list<entry>::iterator> index;
+        std::unordered_map<std::string, std::unordered_set<std::string>> tags;
+    };
+
+    shard& shard_for(std::string const& key)
+    {
+        return *m_shards[std::hash<std::string>()(key) % m_shards.size()];
+    }
+
+    static void erase(shard& item, std::list<entry>::iterator it)
+    {
+        for (auto const& tag : it->tags)
+        {
+            auto tag_it = item.tags.find(tag);
+            if (tag_it == item.tags.end())
+                continue;
+            tag_it->second.erase(it->key);
+            if (tag_it->second.empty())
+                item.tags.erase(tag_it);
+        }
+        item.bytes -= it->bytes;
+        item.index.erase(it->key);
+        item.entries.erase(it);
+    }
+
+    std::vector<std::unique_ptr<shard>> m_shards;
+    std::atomic<uint64_t> m_generation;
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+    std::atomic<uint64_t> m_evictions;
+    std::atomic<uint64_t> m_invalidations;
+};
+}
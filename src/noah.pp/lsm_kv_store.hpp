@@ -0,0 +1,708 @@
+#pragma once
+
+#include "global.hpp"
+#include "binary_codec.hpp"
+#include "kv_store.hpp"
+#include "write_ahead_log.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+#include <cstring>
+
+namespace noahpp
+{
+//  a log structured merge tree in a directory. changes are committed to
+//  a write_ahead_log without waiting for the sync and go to an ordered
+//  map in memory. when that grows past memtable_bytes it is written out
+//  as a sorted table file and the log is checkpointed. a lookup checks
+//  the map, then the tables newest first, each has a bloom filter and a
+//  sparse index of every 16th key in memory, the rest is read from the
+//  memory mapped file.
+//
+//  the tables are merged on a thread of their own, merge_width or more
+//  adjacent ones of about the same size at a time, so each key is
+//  rewritten once per size tier and not with every merge. the merged
+//  table is built without the lock held and swapped in for the ones it
+//  replaces. the erased keys are dropped when the oldest table is one
+//  of them. apply() waits for the merges only when there are more than
+//  max_tables
+//
+//  the manifest file lists the tables in use, a table that is not in it
+//  is a leftover of an interrupted write and is removed on open
+class lsm_kv_store : public kv_store
+{
+public:
+    static size_t const default_memtable_bytes = 32 * 1024 * 1024;
+    static size_t const merge_width = 4;
+    static size_t const max_tables = 32;
+
+    lsm_kv_store(boost::filesystem::path const& path,
+                 size_t memtable_bytes = default_memtable_bytes)
+        : m_path(path)
+        , m_memtable_limit(memtable_bytes)
+        , m_memtable_bytes(0)
+        , m_last_table(0)
+        , m_stopping(false)
+        , m_log(path / "log")
+    {
+        load();
+        m_merger = std::thread([this]
+        {
+            run_merges();
+        });
+    }
+    lsm_kv_store(lsm_kv_store const&) = delete;
+    ~lsm_kv_store()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+        m_merger.join();
+
+        //  the last changes may not have been synced yet
+        try
+        {
+            m_log.sync();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    bool get(std::string const& key, std::string& value) const override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_memtable.find(key);
+        if (it != m_memtable.end())
+        {
+            if (it->second.erased)
+                return false;
+            value = it->second.value;
+            return true;
+        }
+
+        for (auto table_it = m_tables.rbegin(); table_it != m_tables.rend(); ++table_it)
+        {
+            auto const& item = **table_it;
+            if (false == item.may_contain(key))
+                continue;
+
+            entry found;
+            uint64_t offset = item.seek(key);
+            if (offset < item.data_end && (item.read(offset, found), found.key == key))
+            {
+                if (found.erased)
+                    return false;
+                value = std::move(found.value);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void apply(batch const& changes) override
+    {
+        if (changes.changes.empty())
+            return;
+
+        std::string record;
+        for (auto const& item : changes.changes)
+            encode(item.key, item.value, item.erased, record);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (false == m_merge_error.empty())
+            throw std::runtime_error(m_merge_error);
+
+        //  in the log in the same order as in the memtable
+        m_log.commit(wal_stream(), std::vector<std::string>(1, record), false);
+        for (auto const& item : changes.changes)
+            insert(item.key, item.value, item.erased);
+
+        if (m_memtable_bytes >= m_memtable_limit)
+        {
+            write_memtable();
+            m_condition.notify_all();
+            m_condition.wait(lock, [this]
+            {
+                return m_tables.size() <= max_tables || false == m_merge_error.empty();
+            });
+        }
+    }
+
+    void scan(std::string const& prefix,
+              std::string const& from,
+              visitor const& visit) const override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        merger sources(&m_memtable, m_tables, std::max(prefix, from));
+
+        entry item;
+        while (sources.next(item))
+        {
+            if (0 != item.key.compare(0, prefix.size(), prefix))
+                break;
+            if (false == item.erased && false == visit(item.key, item.value))
+                break;
+        }
+    }
+
+    void flush() override
+    {
+        m_log.sync();
+    }
+
+    size_t tables() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_tables.size();
+    }
+
+private:
+    static uint64_t const index_interval = 16;
+    static uint64_t const bloom_bits_per_key = 10;
+    static uint64_t const bloom_hashes = 7;
+
+    class entry
+    {
+    public:
+        std::string key;
+        std::string value;
+        bool erased = false;
+    };
+
+    class memtable_value
+    {
+    public:
+        std::string value;
+        bool erased = false;
+    };
+
+    //  index offset, bloom offset, bloom bits, entries, magic
+    class footer
+    {
+    public:
+        uint64_t index_offset;
+        uint64_t bloom_offset;
+        uint64_t bloom_bits;
+        uint64_t entries;
+        char magic[8];
+    };
+
+    //  entries: key, erased flag, value, each string with a varint size
+    //  in front, then the sparse index: key and entry offset, then the
+    //  bloom filter and the footer
+    class table
+    {
+    public:
+        table(boost::filesystem::path const& _path, uint64_t _number)
+            : path(_path)
+            , number(_number)
+            , mapping(path.string().c_str(), boost::interprocess::read_only)
+            , region(mapping, boost::interprocess::read_only)
+            , data(static_cast<char const*>(region.get_address()))
+            , data_end(0)
+            , bloom(nullptr)
+            , bloom_bits(0)
+            , entries(0)
+        {
+            footer tail;
+            if (region.get_size() < sizeof(tail))
+                throw std::runtime_error("corrupt table: " + path.string());
+            std::memcpy(&tail, data + region.get_size() - sizeof(tail), sizeof(tail));
+            if (0 != std::memcmp(tail.magic, "noahlsm1", sizeof(tail.magic)) ||
+                tail.index_offset > tail.bloom_offset ||
+                tail.bloom_offset + tail.bloom_bits / 8 > region.get_size() - sizeof(tail))
+                throw std::runtime_error("corrupt table: " + path.string());
+
+            data_end = tail.index_offset;
+            entries = tail.entries;
+            bloom = reinterpret_cast<uint8_t const*>(data + tail.bloom_offset);
+            bloom_bits = tail.bloom_bits;
+
+            std::string index_bytes(data + tail.index_offset, size_t(tail.bloom_offset - tail.index_offset));
+            binary_codec::detail::reader input(index_bytes);
+            while (false == input.at_end())
+            {
+                std::string key;
+                input.bytes(key, false);
+                uint64_t offset = input.varint();
+                index.push_back(std::make_pair(std::move(key), offset));
+            }
+        }
+
+        bool may_contain(std::string const& key) const
+        {
+            uint64_t first = detail::stable_hash(key);
+            uint64_t second = detail::stable_hash(key, first) | 1;
+            for (uint64_t index = 0; index != bloom_hashes; ++index)
+            {
+                uint64_t bit = (first + index * second) % bloom_bits;
+                if (0 == (bloom[bit / 8] & (1 << (bit % 8))))
+                    return false;
+            }
+            return true;
+        }
+
+        //  as may_contain() checks them
+        static void add_to_bloom(std::string const& key, std::string& filter)
+        {
+            uint64_t bits = filter.size() * 8;
+            uint64_t first = detail::stable_hash(key);
+            uint64_t second = detail::stable_hash(key, first) | 1;
+            for (uint64_t index = 0; index != bloom_hashes; ++index)
+            {
+                uint64_t bit = (first + index * second) % bits;
+                filter[size_t(bit / 8)] = char(uint8_t(filter[size_t(bit / 8)]) | (1 << (bit % 8)));
+            }
+        }
+
+        //  the offset of the first entry with a key not less than key
+        uint64_t seek(std::string const& key) const
+        {
+            auto it = std::upper_bound(index.begin(), index.end(), key,
+                                       [](std::string const& value, std::pair<std::string, uint64_t> const& item)
+            {
+                return value < item.first;
+            });
+            if (it == index.begin())
+                return 0;
+
+            uint64_t offset = (--it)->second;
+            entry item;
+            while (offset < data_end)
+            {
+                uint64_t next = read(offset, item);
+                if (item.key >= key)
+                    break;
+                offset = next;
+            }
+            return offset;
+        }
+
+        //  the offset of the entry after it
+        uint64_t read(uint64_t offset, entry& item) const
+        {
+            char const* it = data + offset;
+            read_bytes(it, item.key);
+            item.erased = (0 != *it++);
+            read_bytes(it, item.value);
+            return uint64_t(it - data);
+        }
+
+        static void read_bytes(char const*& it, std::string& bytes)
+        {
+            uint64_t size = 0;
+            for (unsigned shift = 0; ; shift += 7)
+            {
+                uint8_t item = uint8_t(*it++);
+                size |= uint64_t(item & 0x7f) << shift;
+                if (0 == (item & 0x80))
+                    break;
+            }
+            bytes.assign(it, size_t(size));
+            it += size;
+        }
+
+        boost::filesystem::path path;
+        uint64_t number;
+        boost::interprocess::file_mapping mapping;
+        boost::interprocess::mapped_region region;
+        char const* data;
+        uint64_t data_end;
+        uint8_t const* bloom;
+        uint64_t bloom_bits;
+        uint64_t entries;
+        std::vector<std::pair<std::string, uint64_t>> index;
+    };
+
+    using table_list = std::vector<std::shared_ptr<table>>;
+
+    //  walks the memtable, if any, and the tables together in key order,
+    //  of the same key the newest one is taken
+    class merger
+    {
+    public:
+        merger(std::map<std::string, memtable_value> const* memtable,
+               table_list const& tables,
+               std::string const& from)
+            : m_memtable(memtable)
+        {
+            if (m_memtable)
+                m_memtable_it = m_memtable->lower_bound(from);
+            for (auto const& ptable : tables)
+            {
+                cursor item;
+                item.ptable = ptable.get();
+                item.offset = ptable->seek(from);
+                advance(item);
+                m_cursors.push_back(std::move(item));
+            }
+        }
+
+        bool next(entry& item)
+        {
+            //  the tables are oldest first, the memtable is newer than all
+            std::string const* key = nullptr;
+            cursor* newest = nullptr;
+            for (auto& table_cursor : m_cursors)
+            {
+                if (false == table_cursor.valid)
+                    continue;
+                if (nullptr == key || table_cursor.current.key <= *key)
+                {
+                    key = &table_cursor.current.key;
+                    newest = &table_cursor;
+                }
+            }
+            bool memtable = (m_memtable &&
+                             m_memtable_it != m_memtable->end() &&
+                             (nullptr == key || m_memtable_it->first <= *key));
+
+            if (memtable)
+            {
+                item.key = m_memtable_it->first;
+                item.value = m_memtable_it->second.value;
+                item.erased = m_memtable_it->second.erased;
+                ++m_memtable_it;
+            }
+            else if (newest)
+                item = newest->current;
+            else
+                return false;
+
+            for (auto& table_cursor : m_cursors)
+            {
+                if (table_cursor.valid && table_cursor.current.key == item.key)
+                    advance(table_cursor);
+            }
+            return true;
+        }
+
+    private:
+        class cursor
+        {
+        public:
+            table const* ptable = nullptr;
+            uint64_t offset = 0;
+            bool valid = false;
+            entry current;
+        };
+
+        static void advance(cursor& item)
+        {
+            item.valid = (item.offset < item.ptable->data_end);
+            if (item.valid)
+                item.offset = item.ptable->read(item.offset, item.current);
+        }
+
+        std::map<std::string, memtable_value> const* m_memtable;
+        std::map<std::string, memtable_value>::const_iterator m_memtable_it;
+        std::vector<cursor> m_cursors;
+    };
+
+    static std::string wal_stream()
+    {
+        return "lsm";
+    }
+
+    static void encode(std::string const& key, std::string const& value, bool erased, std::string& out)
+    {
+        binary_codec::detail::write_varint(key.size(), out);
+        out += key;
+        out += char(erased ? 1 : 0);
+        binary_codec::detail::write_varint(value.size(), out);
+        out += value;
+    }
+
+    void insert(std::string const& key, std::string const& value, bool erased)
+    {
+        auto it = m_memtable.find(key);
+        if (it == m_memtable.end())
+        {
+            it = m_memtable.insert(std::make_pair(key, memtable_value())).first;
+            m_memtable_bytes += key.size() + 64;    //  the node of the map
+        }
+        else
+            m_memtable_bytes -= it->second.value.size();
+
+        it->second.value = value;
+        it->second.erased = erased;
+        m_memtable_bytes += value.size();
+    }
+
+    boost::filesystem::path table_path(uint64_t number) const
+    {
+        return m_path / ("table." + std::to_string(number));
+    }
+
+    void load()
+    {
+        std::vector<uint64_t> numbers;
+        {
+            boost::filesystem::ifstream fl(m_path / "manifest");
+            std::string magic;
+            if (fl >> magic)
+            {
+                if (magic != "noahlsm1")
+                    throw std::runtime_error("not an lsm store: " + m_path.string());
+                uint64_t number;
+                while (fl >> number)
+                    numbers.push_back(number);
+            }
+        }
+
+        for (auto number : numbers)
+        {
+            m_tables.emplace_back(new table(table_path(number), number));
+            m_last_table = std::max(m_last_table, number);
+        }
+
+        std::vector<boost::filesystem::path> leftovers;
+        for (boost::filesystem::directory_iterator it(m_path), end; it != end; ++it)
+        {
+            std::string name = it->path().filename().string();
+            bool table_file = (0 == name.compare(0, 6, "table."));
+            if (false == table_file && 0 != name.compare(0, 9, "manifest."))
+                continue;
+
+            uint64_t number = 0;
+            std::istringstream(name.substr(name.find('.') + 1)) >> number;
+            m_last_table = std::max(m_last_table, number);
+            if (false == table_file ||
+                name != table_path(number).filename().string() ||
+                std::find(numbers.begin(), numbers.end(), number) == numbers.end())
+                leftovers.push_back(it->path());
+        }
+        for (auto const& leftover : leftovers)
+            boost::filesystem::remove(leftover);
+
+        for (auto const& record : m_log.recovered(wal_stream()))
+        {
+            binary_codec::detail::reader input(record);
+            while (false == input.at_end())
+            {
+                std::string key;
+                std::string value;
+                input.bytes(key, false);
+                bool erased = (0 != input.byte());
+                input.bytes(value, false);
+                insert(key, value, erased);
+            }
+        }
+    }
+
+    //  the memtable becomes the newest table
+    void write_memtable()
+    {
+        if (m_memtable.empty())
+            return;
+
+        uint64_t number = ++m_last_table;
+        merger sources(&m_memtable, table_list(), std::string());
+        write_table(number, sources, false, m_memtable.size());
+        m_tables.emplace_back(new table(table_path(number), number));
+        write_manifest();
+
+        m_memtable.clear();
+        m_memtable_bytes = 0;
+        m_log.checkpoint(wal_stream(), m_log.lsn());
+    }
+
+    //  a table merged from merge_width of one tier lands in the next
+    size_t tier(table const& item) const
+    {
+        size_t result = 0;
+        for (uint64_t size = item.region.get_size() / std::max<size_t>(m_memtable_limit, 1);
+             size >= merge_width;
+             size /= merge_width)
+            ++result;
+        return result;
+    }
+
+    //  called with m_mutex locked. the newest run of merge_width or more
+    //  adjacent tables of one tier, or the newest merge_width tables when
+    //  there are too many anyway
+    bool pick_merge(size_t& begin, size_t& end) const
+    {
+        end = m_tables.size();
+        while (end > 0)
+        {
+            begin = end - 1;
+            while (begin > 0 && tier(*m_tables[begin - 1]) == tier(*m_tables[end - 1]))
+                --begin;
+            if (end - begin >= merge_width)
+                return true;
+            end = begin;
+        }
+
+        end = m_tables.size();
+        begin = end > merge_width ? end - merge_width : 0;
+        return m_tables.size() > max_tables;
+    }
+
+    //  the merge thread. the tables picked are read without the lock,
+    //  apply() only adds newer tables after them meanwhile
+    void run_merges()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            size_t begin = 0;
+            size_t end = 0;
+            m_condition.wait(lock, [this, &begin, &end]
+            {
+                return m_stopping || pick_merge(begin, end);
+            });
+            if (m_stopping)
+                return;
+
+            table_list sources(m_tables.begin() + std::ptrdiff_t(begin),
+                               m_tables.begin() + std::ptrdiff_t(end));
+            //  nothing older is left to hide, so the erased keys go
+            bool drop_erased = (0 == begin);
+            uint64_t number = ++m_last_table;
+            lock.unlock();
+
+            try
+            {
+                uint64_t entries = 0;
+                for (auto const& item : sources)
+                    entries += item->entries;
+                merger input(nullptr, sources, std::string());
+                write_table(number, input, drop_erased, entries);
+                std::shared_ptr<table> merged(new table(table_path(number), number));
+
+                lock.lock();
+                auto first = std::find(m_tables.begin(), m_tables.end(), sources.front());
+                first = m_tables.erase(first, first + std::ptrdiff_t(sources.size()));
+                m_tables.insert(first, merged);
+                write_manifest();
+                lock.unlock();
+                m_condition.notify_all();
+            }
+            catch (std::exception const& ex)
+            {
+                if (false == lock.owns_lock())
+                    lock.lock();
+                m_merge_error = std::string("lsm merge: ") + ex.what();
+                m_condition.notify_all();
+                return;
+            }
+
+            for (auto& item : sources)
+            {
+                auto path = item->path;
+                item.reset();
+                boost::filesystem::remove(path);
+            }
+            lock.lock();
+        }
+    }
+
+    //  the bloom filter is sized for at most entries keys
+    void write_table(uint64_t number, merger& sources, bool drop_erased, uint64_t entries)
+    {
+        auto path = table_path(number);
+        auto temp_path = path;
+        temp_path += ".tmp";
+
+        std::string bloom(size_t(std::max<uint64_t>(64, entries * bloom_bits_per_key) / 8), '\0');
+        std::string index;
+        uint64_t offset = 0;
+        uint64_t count = 0;
+        {
+            boost::filesystem::ofstream fl(temp_path, std::ios_base::binary | std::ios_base::trunc);
+            std::string buffer;
+            entry item;
+            while (sources.next(item))
+            {
+                if (drop_erased && item.erased)
+                    continue;
+
+                if (0 == count % index_interval)
+                {
+                    binary_codec::detail::write_varint(item.key.size(), index);
+                    index += item.key;
+                    binary_codec::detail::write_varint(offset + buffer.size(), index);
+                }
+                table::add_to_bloom(item.key, bloom);
+                encode(item.key, item.value, item.erased, buffer);
+                ++count;
+
+                if (buffer.size() >= 1024 * 1024)
+                {
+                    fl.write(buffer.data(), std::streamsize(buffer.size()));
+                    offset += buffer.size();
+                    buffer.clear();
+                }
+            }
+
+            footer tail;
+            tail.index_offset = offset + buffer.size();
+            buffer += index;
+            tail.bloom_offset = offset + buffer.size();
+            tail.bloom_bits = bloom.size() * 8;
+            tail.entries = count;
+            std::memcpy(tail.magic, "noahlsm1", sizeof(tail.magic));
+            fl.write(buffer.data(), std::streamsize(buffer.size()));
+            fl.write(bloom.data(), std::streamsize(bloom.size()));
+            fl.write(reinterpret_cast<char const*>(&tail), sizeof(tail));
+            if (!fl)
+                throw std::runtime_error("cannot write: " + temp_path.string());
+        }
+        sync_file(temp_path);
+        sync_rename(temp_path, path);
+    }
+
+    void write_manifest()
+    {
+        std::string content = "noahlsm1\n";
+        for (auto const& item : m_tables)
+            content += std::to_string(item->number) + "\n";
+
+        auto path = m_path / "manifest";
+        auto temp_path = m_path / ("manifest." + std::to_string(m_last_table));
+        {
+            boost::filesystem::ofstream fl(temp_path, std::ios_base::binary | std::ios_base::trunc);
+            fl << content;
+            if (!fl)
+                throw std::runtime_error("cannot write: " + temp_path.string());
+        }
+        sync_file(temp_path);
+        sync_rename(temp_path, path);
+    }
+
+    boost::filesystem::path m_path;
+    size_t m_memtable_limit;
+    size_t m_memtable_bytes;
+    uint64_t m_last_table;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+    std::string m_merge_error;      //  no more merges after one failed
+    std::map<std::string, memtable_value> m_memtable;
+    table_list m_tables;            //  oldest first
+    write_ahead_log m_log;
+    std::thread m_merger;
+};
+}
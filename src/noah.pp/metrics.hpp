@@ -0,0 +1,278 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  counters and histograms are plain relaxed atomics, updating them never
+//  takes a lock. the registry lock is taken only to add a metric and to
+//  render them all, in prometheus text exposition format
+namespace metrics
+{
+class counter
+{
+public:
+    counter()
+        : m_value(0)
+    {}
+
+    void increment(uint64_t amount = 1)
+    {
+        m_value.fetch_add(amount, std::memory_order_relaxed);
+    }
+    uint64_t value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_value;
+};
+
+class gauge
+{
+public:
+    gauge()
+        : m_value(0)
+    {}
+
+    void set(int64_t value)
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+    void add(int64_t amount)
+    {
+        m_value.fetch_add(amount, std::memory_order_relaxed);
+    }
+    int64_t value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> m_value;
+};
+
+//  durations in seconds, the buckets double from 50us up to about 105s
+class histogram
+{
+public:
+    static size_t const bucket_count = 22;
+
+    histogram()
+        : m_count(0)
+        , m_sum_nanoseconds(0)
+    {
+        for (auto& bucket : m_buckets)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+
+    static double bound(size_t index)
+    {
+        return 0.00005 * double(uint64_t(1) << index);
+    }
+
+    template <typename DURATION>
+    void observe(DURATION const& duration)
+    {
+        uint64_t nanoseconds = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+        uint64_t limit = 50000;
+        size_t index = 0;
+        while (index != bucket_count && nanoseconds > limit)
+        {
+            limit *= 2;
+            ++index;
+        }
+
+        if (index != bucket_count)
+            m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum_nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+    double sum() const
+    {
+        return double(m_sum_nanoseconds.load(std::memory_order_relaxed)) / 1e9;
+    }
+    uint64_t bucket(size_t index) const
+    {
+        return m_buckets[index].load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_buckets[bucket_count];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum_nanoseconds;
+};
+
+//  observes the time from construction to destruction
+class scoped_timer
+{
+public:
+    explicit scoped_timer(histogram& target)
+        : m_target(target)
+        , m_start(std::chrono::steady_clock::now())
+    {}
+    scoped_timer(scoped_timer const&) = delete;
+    ~scoped_timer()
+    {
+        m_target.observe(std::chrono::steady_clock::now() - m_start);
+    }
+
+private:
+    histogram& m_target;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+class registry
+{
+public:
+    //  name may carry labels, as in rpc_seconds{type="Broadcast"}.
+    //  the returned objects live as long as the registry
+    counter& add_counter(std::string const& name, std::string const& help)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.emplace_back(new item(name, help, item::kind::counter));
+        return m_items.back()->count_value;
+    }
+    gauge& add_gauge(std::string const& name, std::string const& help)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.emplace_back(new item(name, help, item::kind::gauge));
+        return m_items.back()->gauge_value;
+    }
+    histogram& add_histogram(std::string const& name, std::string const& help)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.emplace_back(new item(name, help, item::kind::histogram));
+        return m_items.back()->histogram_value;
+    }
+    //  for values that already are counted somewhere else,
+    //  the callback is called only when rendering
+    void add_callback(std::string const& name,
+                      std::string const& help,
+                      std::function<double()> callback,
+                      bool is_counter = false)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_items.emplace_back(new item(name, help, is_counter ? item::kind::counter : item::kind::gauge));
+        m_items.back()->callback = callback;
+    }
+
+    std::string render() const
+    {
+        std::ostringstream out;
+        out.precision(12);
+        std::string last_family;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        //  samples of a family have to come together
+        std::vector<item const*> items;
+        for (auto const& pitem : m_items)
+            items.push_back(pitem.get());
+        std::stable_sort(items.begin(), items.end(), [](item const* first, item const* second)
+        {
+            return first->family() < second->family();
+        });
+
+        for (auto pitem : items)
+        {
+            auto const& value = *pitem;
+            std::string family = value.family();
+            std::string labels;
+            if (family.size() != value.name.size())
+                labels = value.name.substr(family.size() + 1, value.name.size() - family.size() - 2);
+
+            if (family != last_family)
+            {
+                out << "# HELP " << family << " " << value.help << "\n";
+                out << "# TYPE " << family << " " << type_name(value.type) << "\n";
+                last_family = family;
+            }
+
+            if (value.callback)
+                out << value.name << " " << value.callback() << "\n";
+            else if (item::kind::counter == value.type)
+                out << value.name << " " << value.count_value.value() << "\n";
+            else if (item::kind::gauge == value.type)
+                out << value.name << " " << value.gauge_value.value() << "\n";
+            else
+            {
+                std::string separator = labels.empty() ? "" : ",";
+                uint64_t cumulative = 0;
+                for (size_t index = 0; index != histogram::bucket_count; ++index)
+                {
+                    cumulative += value.histogram_value.bucket(index);
+                    out << family << "_bucket{" << labels << separator
+                        << "le=\"" << histogram::bound(index) << "\"} " << cumulative << "\n";
+                }
+                uint64_t count = value.histogram_value.count();
+                std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+                out << family << "_bucket{" << labels << separator << "le=\"+Inf\"} " << count << "\n";
+                out << family << "_sum" << suffix << " " << value.histogram_value.sum() << "\n";
+                out << family << "_count" << suffix << " " << count << "\n";
+            }
+        }
+
+        return out.str();
+    }
+
+private:
+    class item
+    {
+    public:
+        enum class kind { counter, gauge, histogram };
+
+        item(std::string const& _name, std::string const& _help, kind _type)
+            : name(_name)
+            , help(_help)
+            , type(_type)
+        {}
+
+        std::string family() const
+        {
+            return name.substr(0, name.find('{'));
+        }
+
+        std::string name;
+        std::string help;
+        kind type;
+        counter count_value;
+        gauge gauge_value;
+        histogram histogram_value;
+        std::function<double()> callback;
+    };
+
+    static char const* type_name(item::kind type)
+    {
+        switch (type)
+        {
+        case item::kind::counter: return "counter";
+        case item::kind::gauge: return "gauge";
+        case item::kind::histogram: return "histogram";
+        }
+        return "untyped";
+    }
+
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<item>> m_items;
+};
+}
+}
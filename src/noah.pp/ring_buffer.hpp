@@ -0,0 +1,124 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace noahpp
+{
+//  bounded lock-free queue, any thread may push and pop. every cell
+//  carries a sequence number telling whether it is free for the push
+//  with that position or filled for the pop with that position, so a
+//  full buffer is detected without a shared counter
+template <typename T>
+class ring_buffer
+{
+public:
+    //  capacity is rounded up to a power of two
+    explicit ring_buffer(size_t capacity)
+        : m_mask(0)
+        , m_cells()
+        , m_push_position(0)
+        , m_pop_position(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+
+        m_mask = size - 1;
+        m_cells.reset(new cell[size]);
+        for (size_t index = 0; index != size; ++index)
+            m_cells[index].sequence.store(index, std::memory_order_relaxed);
+    }
+    ring_buffer(ring_buffer const&) = delete;
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    //  approximate while other threads work on it
+    size_t size() const
+    {
+        size_t push_position = m_push_position.load(std::memory_order_relaxed);
+        size_t pop_position = m_pop_position.load(std::memory_order_relaxed);
+        return push_position > pop_position ? push_position - pop_position : 0;
+    }
+
+    //  false when full, value is left untouched then
+    bool try_push(T&& value)
+    {
+        cell* pcell;
+        size_t position = m_push_position.load(std::memory_order_relaxed);
+        while (true)
+        {
+            pcell = &m_cells[position & m_mask];
+            size_t sequence = pcell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = intptr_t(sequence) - intptr_t(position);
+
+            if (0 == difference)
+            {
+                if (m_push_position.compare_exchange_weak(position, position + 1,
+                                                          std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = m_push_position.load(std::memory_order_relaxed);
+        }
+
+        pcell->value = std::move(value);
+        pcell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    //  false when empty
+    bool try_pop(T& value)
+    {
+        cell* pcell;
+        size_t position = m_pop_position.load(std::memory_order_relaxed);
+        while (true)
+        {
+            pcell = &m_cells[position & m_mask];
+            size_t sequence = pcell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+
+            if (0 == difference)
+            {
+                if (m_pop_position.compare_exchange_weak(position, position + 1,
+                                                         std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = m_pop_position.load(std::memory_order_relaxed);
+        }
+
+        value = std::move(pcell->value);
+        pcell->value = T();
+        pcell->sequence.store(position + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    class cell
+    {
+    public:
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    size_t m_mask;
+    std::unique_ptr<cell[]> m_cells;
+    //  producers and the consumer should not share a cache line
+    alignas(64) std::atomic<size_t> m_push_position;
+    alignas(64) std::atomic<size_t> m_pop_position;
+};
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "global.hpp"
+#include "worker_pool.hpp"
+
+#include <mesh.pp/cryptoutility.hpp>
+
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  batched signature check, collects every Authority of a block
+//  or of a set of transactions and verifies them on the worker pool
+class signature_verifier
+{
+public:
+    class item
+    {
+    public:
+        std::string address;
+        std::string message;
+        std::string signature;
+    };
+
+    explicit signature_verifier(worker_pool* pool = nullptr)
+        : m_pool(pool)
+        , m_verified(0)
+        , m_failed(0)
+        , m_nanoseconds(0)
+    {}
+
+    static void collect(BlockchainMessage::SignedTransaction const& signed_transaction,
+                        std::vector<item>& items)
+    {
+        std::string message = signed_transaction.transaction_details.to_string();
+        for (auto const& authority : signed_transaction.authorizations)
+            items.push_back(item{authority.address, message, authority.signature});
+    }
+
+    static void collect(BlockchainMessage::SignedBlock const& signed_block,
+                        std::vector<item>& items)
+    {
+        items.push_back(item{signed_block.authorization.address,
+                             signed_block.block_details.to_string(),
+                             signed_block.authorization.signature});
+
+        for (auto const& signed_transaction : signed_block.block_details.signed_transactions)
+            collect(signed_transaction, items);
+    }
+
+    //  result[i] tells whether items[i] holds a valid signature
+    std::vector<bool> verify(std::vector<item> const& items)
+    {
+        //  std::vector<bool> packs bits, which can't be written concurrently
+        std::vector<char> valid(items.size(), 0);
+
+        auto start = std::chrono::steady_clock::now();
+        parallel_for(m_pool, items.size(), [&items, &valid](size_t begin, size_t end)
+        {
+            for (size_t index = begin; index != end; ++index)
+                valid[index] = check(items[index]) ? 1 : 0;
+        });
+        auto duration = std::chrono::steady_clock::now() - start;
+
+        std::vector<bool> result(valid.begin(), valid.end());
+        size_t failed = 0;
+        for (auto flag : valid)
+        {
+            if (0 == flag)
+                ++failed;
+        }
+
+        m_verified += items.size() - failed;
+        m_failed += failed;
+        m_nanoseconds += uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+
+        return result;
+    }
+
+    bool verify(BlockchainMessage::SignedBlock const& signed_block)
+    {
+        std::vector<item> items;
+        collect(signed_block, items);
+
+        for (bool valid : verify(items))
+        {
+            if (false == valid)
+                return false;
+        }
+        return true;
+    }
+
+    //  keeps only the transactions with all signatures valid,
+    //  the relative order of the rest is not changed
+    std::vector<BlockchainMessage::SignedTransaction>
+    filter(std::vector<BlockchainMessage::SignedTransaction>&& signed_transactions)
+    {
+        std::vector<item> items;
+        std::vector<size_t> owners;
+        std::vector<bool> accepted(signed_transactions.size(), true);
+        for (size_t index = 0; index != signed_transactions.size(); ++index)
+        {
+            auto const& signed_transaction = signed_transactions[index];
+            if (signed_transaction.authorizations.empty())
+                accepted[index] = false;
+
+            collect(signed_transaction, items);
+            owners.resize(items.size(), index);
+        }
+
+        auto valid = verify(items);
+        for (size_t index = 0; index != valid.size(); ++index)
+        {
+            if (false == valid[index])
+                accepted[owners[index]] = false;
+        }
+
+        std::vector<BlockchainMessage::SignedTransaction> result;
+        for (size_t index = 0; index != signed_transactions.size(); ++index)
+        {
+            if (accepted[index])
+                result.push_back(std::move(signed_transactions[index]));
+        }
+
+        return result;
+    }
+
+    uint64_t verified() const
+    {
+        return m_verified.load();
+    }
+    uint64_t failed() const
+    {
+        return m_failed.load();
+    }
+    //  verifications per second of time spent inside verify()
+    double rate() const
+    {
+        uint64_t nanoseconds = m_nanoseconds.load();
+        if (0 == nanoseconds)
+            return 0;
+        return double(m_verified.load() + m_failed.load()) * 1e9 / double(nanoseconds);
+    }
+
+    static bool check(item const& value)
+    {
+        try
+        {
+            return meshpp::verify_signature(meshpp::public_key(value.address),
+                                            value.message,
+                                            value.signature);
+        }
+        catch (...)
+        {
+            return false;   //  malformed address or signature
+        }
+    }
+
+private:
+    worker_pool* m_pool;
+    std::atomic<uint64_t> m_verified;
+    std::atomic<uint64_t> m_failed;
+    std::atomic<uint64_t> m_nanoseconds;
+};
+}
@@ -0,0 +1,298 @@
+#pragma once
+
+#include "global.hpp"
+#include "kv_store.hpp"
+#include "worker_pool.hpp"
+
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  applies the transactions of a block to a kv_store state, the ones
+//  that share no key side by side on the worker pool. the changes come
+//  out in the block's order and leave the same state as running the
+//  transactions one after another. the verify mode does both and throws
+//  if the states differ
+class transaction_executor
+{
+public:
+    enum class mode {serial, parallel, verify};
+
+    //  the keys a transaction reads and writes. an exclusive one runs
+    //  alone, after everything before it and before everything after it
+    class access
+    {
+    public:
+        std::vector<std::string> reads;
+        std::vector<std::string> writes;
+        bool exclusive = false;
+    };
+
+    using changes_map = std::unordered_map<std::string, kv_store::batch::change>;
+
+    //  the state as one transaction sees it, the store under the changes
+    //  of the transactions that ran before
+    class view
+    {
+    public:
+        bool get(std::string const& key, std::string& value) const
+        {
+            auto it = m_changes->find(key);
+            if (it == m_changes->end())
+                return m_store->get(key, value);
+            if (it->second.erased)
+                return false;
+            value = it->second.value;
+            return true;
+        }
+
+    private:
+        friend class transaction_executor;
+        view(kv_store const& store, changes_map const& changes)
+            : m_store(&store)
+            , m_changes(&changes)
+        {}
+
+        kv_store const* m_store;
+        changes_map const* m_changes;
+    };
+
+    //  puts the changes of transaction index. it must read only the keys
+    //  of its access and give the same changes for the same state, the
+    //  writes outside of its access are caught, the reads are not
+    using function = std::function<void(size_t index, view const& state, kv_store::batch& changes)>;
+
+    explicit transaction_executor(worker_pool* pool = nullptr, mode run_mode = mode::parallel)
+        : m_pool(pool)
+        , m_mode(run_mode)
+        , m_transactions(0)
+        , m_groups(0)
+        , m_mismatches(0)
+    {}
+
+    //  the accounts of a signed transaction, as key_prefix + address. the
+    //  authorities pay the fee, a transfer moves coins between its two
+    //  sides and any other action is not known here, so it runs exclusive.
+    //  the fees reach the block's signer after all transactions, adding
+    //  them up does not depend on the order
+    static access access_of(BlockchainMessage::SignedTransaction const& signed_transaction,
+                            std::string const& key_prefix = std::string())
+    {
+        access result;
+        for (auto const& authority : signed_transaction.authorizations)
+            result.writes.push_back(key_prefix + authority.address);
+
+        auto const& action = signed_transaction.transaction_details.action;
+        if (action.type() == BlockchainMessage::Transfer::rvalue)
+        {
+            BlockchainMessage::Transfer const* ptransfer = nullptr;
+            action.get(ptransfer);
+            result.writes.push_back(key_prefix + ptransfer->from);
+            result.writes.push_back(key_prefix + ptransfer->to);
+        }
+        else
+            result.exclusive = true;
+
+        std::sort(result.writes.begin(), result.writes.end());
+        result.writes.erase(std::unique(result.writes.begin(), result.writes.end()), result.writes.end());
+        return result;
+    }
+
+    //  the groups that run one after another, the transactions of a group
+    //  in the block's order and in conflict with none of the same group.
+    //  each transaction goes to the first group after the last one it
+    //  conflicts with, so conflicting pairs keep their order
+    static std::vector<std::vector<size_t>> schedule(std::vector<access> const& accesses)
+    {
+        //  the first group that may take a writer or a reader of the key
+        std::unordered_map<std::string, size_t> after_writes;
+        std::unordered_map<std::string, size_t> after_reads;
+        size_t barrier = 0;
+
+        auto at_least = [](std::unordered_map<std::string, size_t> const& groups,
+                           std::string const& key,
+                           size_t& group)
+        {
+            auto it = groups.find(key);
+            if (it != groups.end())
+                group = std::max(group, it->second);
+        };
+
+        std::vector<std::vector<size_t>> result;
+        for (size_t index = 0; index != accesses.size(); ++index)
+        {
+            auto const& item = accesses[index];
+
+            size_t group = barrier;
+            if (item.exclusive)
+                group = result.size();
+            else
+            {
+                for (auto const& key : item.writes)
+                {
+                    at_least(after_writes, key, group);
+                    at_least(after_reads, key, group);
+                }
+                for (auto const& key : item.reads)
+                    at_least(after_writes, key, group);
+            }
+
+            if (group == result.size())
+                result.push_back(std::vector<size_t>());
+            result[group].push_back(index);
+
+            for (auto const& key : item.writes)
+                after_writes[key] = group + 1;
+            for (auto const& key : item.reads)
+            {
+                size_t& value = after_reads[key];
+                value = std::max(value, group + 1);
+            }
+            if (item.exclusive)
+                barrier = group + 1;
+        }
+
+        return result;
+    }
+
+    //  the changes of all transactions in the block's order, the store
+    //  itself is not touched
+    kv_store::batch execute(kv_store const& store,
+                            std::vector<access> const& accesses,
+                            function const& fn)
+    {
+        kv_store::batch result;
+        if (mode::serial == m_mode)
+            result = run_serial(store, accesses, fn);
+        else
+            result = run_parallel(store, accesses, fn);
+
+        if (mode::verify == m_mode &&
+            final_state(result) != final_state(run_serial(store, accesses, fn)))
+        {
+            ++m_mismatches;
+            throw std::runtime_error("parallel transaction execution does not match the serial one");
+        }
+
+        m_transactions += accesses.size();
+        return result;
+    }
+
+    uint64_t transactions() const
+    {
+        return m_transactions.load();
+    }
+    //  the transactions per group tell how much ran side by side
+    uint64_t groups() const
+    {
+        return m_groups.load();
+    }
+    uint64_t mismatches() const
+    {
+        return m_mismatches.load();
+    }
+
+private:
+    static void check(size_t index, access const& item, kv_store::batch const& changes)
+    {
+        if (item.exclusive)
+            return;
+        for (auto const& change : changes.changes)
+        {
+            if (std::find(item.writes.begin(), item.writes.end(), change.key) == item.writes.end())
+                throw std::runtime_error("transaction " + std::to_string(index) +
+                                         " changes " + change.key + " outside of its access");
+        }
+    }
+
+    static void merge(kv_store::batch const& changes, changes_map& state)
+    {
+        for (auto const& change : changes.changes)
+            state[change.key] = change;
+    }
+
+    static std::map<std::string, std::string> final_state(kv_store::batch const& changes)
+    {
+        std::map<std::string, std::string> result;
+        for (auto const& change : changes.changes)
+        {
+            if (change.erased)
+                result[change.key] = std::string(1, '\0');
+            else
+                result[change.key] = "=" + change.value;
+        }
+        return result;
+    }
+
+    kv_store::batch run_serial(kv_store const& store,
+                               std::vector<access> const& accesses,
+                               function const& fn)
+    {
+        changes_map state;
+        view current(store, state);
+        kv_store::batch result;
+        for (size_t index = 0; index != accesses.size(); ++index)
+        {
+            kv_store::batch changes;
+            fn(index, current, changes);
+            check(index, accesses[index], changes);
+            merge(changes, state);
+            result.changes.insert(result.changes.end(), changes.changes.begin(), changes.changes.end());
+        }
+        return result;
+    }
+
+    //  the groups see the changes of the groups before them, nothing of
+    //  their own is visible inside a group as its transactions don't
+    //  share keys
+    kv_store::batch run_parallel(kv_store const& store,
+                                 std::vector<access> const& accesses,
+                                 function const& fn)
+    {
+        auto groups = schedule(accesses);
+        m_groups += groups.size();
+
+        changes_map state;
+        view current(store, state);
+        std::vector<kv_store::batch> changes(accesses.size());
+        for (auto const& group : groups)
+        {
+            parallel_for(m_pool, group.size(), [&group, &current, &changes, &accesses, &fn](size_t begin, size_t end)
+            {
+                for (size_t item = begin; item != end; ++item)
+                {
+                    size_t index = group[item];
+                    fn(index, current, changes[index]);
+                    check(index, accesses[index], changes[index]);
+                }
+            });
+
+            for (size_t index : group)
+                merge(changes[index], state);
+        }
+
+        kv_store::batch result;
+        for (auto& item : changes)
+            std::move(item.changes.begin(), item.changes.end(), std::back_inserter(result.changes));
+        return result;
+    }
+
+    worker_pool* m_pool;
+    mode m_mode;
+    std::atomic<uint64_t> m_transactions;
+    std::atomic<uint64_t> m_groups;
+    std::atomic<uint64_t> m_mismatches;
+};
+}
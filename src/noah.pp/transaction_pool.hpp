@@ -0,0 +1,444 @@
+#pragma once
+
+#include "global.hpp"
+#include "write_ahead_log.hpp"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  pending transactions in memory, bounded by size. a sender's
+//  transactions leave the pool in the order they were created, among
+//  senders the one with the higher fee per byte goes first, then the
+//  older one. when full, the lowest fee per byte is evicted
+//
+//  changes are journaled behind, save() writes what has accumulated
+//  since the last call and rewrites the journal when it has grown
+//  much larger than the pool. with a write_ahead_log, save() commits
+//  to it instead and the journal file is only written by the rewrite,
+//  synced, which checkpoints the log. all methods may be called from
+//  any thread
+class transaction_pool
+{
+public:
+    class entry
+    {
+    public:
+        std::string hash;
+        std::string sender;
+        std::string payload;    //  as it is sent on, without newlines
+        uint64_t fee = 0;
+        int64_t creation = 0;
+        int64_t expiry = 0;
+
+        size_t bytes() const
+        {
+            //  a rough cost of the indexes on top of the strings
+            return payload.size() + hash.size() * 2 + sender.size() + 256;
+        }
+    };
+
+    enum class result { added, duplicate, expired, rejected };
+
+    transaction_pool(size_t max_bytes,
+                     boost::filesystem::path const& journal_path,
+                     write_ahead_log* wal = nullptr)
+        : m_max_bytes(max_bytes)
+        , m_journal_path(journal_path)
+        , m_wal(wal)
+        , m_journal_bytes(0)
+        , m_bytes(0)
+        , m_sequence(0)
+        , m_added(0)
+        , m_evicted(0)
+        , m_rejected(0)
+        , m_expired(0)
+    {
+        if (false == m_journal_path.empty())
+            load();
+    }
+    transaction_pool(transaction_pool const&) = delete;
+
+    result add(entry&& item, int64_t now)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return insert(std::move(item), now, true);
+    }
+
+    bool contains(std::string const& hash) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.count(hash) > 0;
+    }
+
+    //  a copy of the transaction to send next, it stays in the pool
+    //  until it is removed
+    bool best(entry& item) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_ready.empty())
+            return false;
+        item = (*m_ready.begin())->value;
+        return true;
+    }
+
+    bool remove(std::string const& hash)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return erase(hash, true);
+    }
+
+    size_t remove_expired(int64_t now)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::string> expired;
+        for (auto const& item : m_entries)
+        {
+            if (item.second->value.expiry <= now)
+                expired.push_back(item.first);
+        }
+        for (auto const& hash : expired)
+            erase(hash, true);
+        m_expired += expired.size();
+        return expired.size();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.size();
+    }
+    size_t bytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_bytes;
+    }
+    uint64_t added() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_added;
+    }
+    uint64_t evicted() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_evicted;
+    }
+    uint64_t rejected() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_rejected;
+    }
+    uint64_t expired() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_expired;
+    }
+
+    void save()
+    {
+        if (m_journal_path.empty())
+            return;
+
+        //  taken first, so that what is taken from m_journal is written
+        //  in the same order
+        std::lock_guard<std::mutex> file_lock(m_file_mutex);
+
+        std::string pending;
+        bool compact = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            pending.swap(m_journal);
+            m_journal_bytes += pending.size();
+            compact = (m_journal_bytes > 2 * m_bytes + 1024 * 1024);
+        }
+
+        if (compact)
+            return rewrite_locked();
+
+        if (pending.empty())
+            return;
+
+        if (m_wal)
+        {
+            m_wal->commit(wal_stream(), std::vector<std::string>(1, pending));
+            return;
+        }
+
+        boost::filesystem::ofstream fl(m_journal_path, std::ios_base::binary | std::ios_base::app);
+        fl.write(pending.data(), std::streamsize(pending.size()));
+        if (!fl)
+            throw std::runtime_error("cannot write: " + m_journal_path.string());
+    }
+
+private:
+    static std::string wal_stream()
+    {
+        return "transaction_pool";
+    }
+
+    class node
+    {
+    public:
+        entry value;
+        uint64_t sequence;
+    };
+
+    //  true if first goes out before second
+    class before
+    {
+    public:
+        bool operator()(node const* first, node const* second) const
+        {
+            //  fee per byte, compared without division
+            long double first_rate = static_cast<long double>(first->value.fee) * second->value.payload.size();
+            long double second_rate = static_cast<long double>(second->value.fee) * first->value.payload.size();
+            if (first_rate != second_rate)
+                return first_rate > second_rate;
+            return first->sequence < second->sequence;
+        }
+    };
+
+    class created_before
+    {
+    public:
+        bool operator()(node const* first, node const* second) const
+        {
+            if (first->value.creation != second->value.creation)
+                return first->value.creation < second->value.creation;
+            return first->sequence < second->sequence;
+        }
+    };
+
+    using sender_queue = std::set<node const*, created_before>;
+
+    result insert(entry&& item, int64_t now, bool journal)
+    {
+        if (m_entries.count(item.hash))
+            return result::duplicate;
+        if (item.expiry <= now)
+        {
+            ++m_expired;
+            return result::expired;
+        }
+
+        std::unique_ptr<node> pnode(new node());
+        pnode->value = std::move(item);
+        pnode->sequence = m_sequence++;
+        size_t size = pnode->value.bytes();
+
+        //  the ones that would go out last make room, if they are
+        //  worse than the newcomer. nothing is evicted unless enough of
+        //  them free enough room
+        std::vector<std::string> evicted;
+        size_t freed = 0;
+        for (auto it = m_by_priority.rbegin();
+             m_bytes - freed + size > m_max_bytes;
+             ++it)
+        {
+            if (size > m_max_bytes ||
+                it == m_by_priority.rend() ||
+                before()(*it, pnode.get()))
+            {
+                ++m_rejected;
+                return result::rejected;
+            }
+            evicted.push_back((*it)->value.hash);
+            freed += (*it)->value.bytes();
+        }
+        for (auto const& hash : evicted)
+            erase(hash, true);
+        m_evicted += evicted.size();
+
+        node const* pitem = pnode.get();
+        auto& queue = m_senders[pitem->value.sender];
+        node const* head = queue.empty() ? nullptr : *queue.begin();
+        queue.insert(pitem);
+        if (*queue.begin() == pitem)
+        {
+            if (head)
+                m_ready.erase(head);
+            m_ready.insert(pitem);
+        }
+        m_by_priority.insert(pitem);
+        m_bytes += size;
+        ++m_added;
+
+        if (journal && false == m_journal_path.empty())
+            append_add(pitem->value, m_journal);
+
+        m_entries.insert(std::make_pair(pitem->value.hash, std::move(pnode)));
+        return result::added;
+    }
+
+    bool erase(std::string const& hash, bool journal)
+    {
+        auto it = m_entries.find(hash);
+        if (it == m_entries.end())
+            return false;
+
+        node const* pitem = it->second.get();
+        auto sender_it = m_senders.find(pitem->value.sender);
+        auto& queue = sender_it->second;
+        if (*queue.begin() == pitem)
+        {
+            m_ready.erase(pitem);
+            queue.erase(queue.begin());
+            if (false == queue.empty())
+                m_ready.insert(*queue.begin());
+        }
+        else
+            queue.erase(pitem);
+        if (queue.empty())
+            m_senders.erase(sender_it);
+
+        m_by_priority.erase(pitem);
+        m_bytes -= pitem->value.bytes();
+
+        if (journal && false == m_journal_path.empty())
+            m_journal += "r " + hash + "\n";
+
+        m_entries.erase(it);
+        return true;
+    }
+
+    static void append_add(entry const& item, std::string& out)
+    {
+        out += "a " + std::to_string(item.fee) +
+               " " + std::to_string(item.creation) +
+               " " + std::to_string(item.expiry) +
+               " " + item.hash +
+               " " + item.sender +
+               " " + item.payload + "\n";
+    }
+
+    void load()
+    {
+        if (m_journal_path.has_parent_path())
+            boost::filesystem::create_directories(m_journal_path.parent_path());
+
+        boost::filesystem::ifstream fl(m_journal_path, std::ios_base::binary);
+        std::string line;
+        while (std::getline(fl, line))
+        {
+            if (fl.eof())
+                break;  //  the last write did not make it whole
+            replay(line);
+        }
+        fl.close();
+
+        //  adding again what is there or removing what is not is
+        //  harmless, so what the journal already had can be replayed
+        if (m_wal)
+        {
+            for (auto const& record : m_wal->recovered(wal_stream()))
+            {
+                std::istringstream lines(record);
+                while (std::getline(lines, line))
+                    replay(line);
+            }
+        }
+
+        m_added = 0;
+        m_evicted = 0;
+        m_rejected = 0;
+        rewrite();
+    }
+
+    void replay(std::string const& line)
+    {
+        std::istringstream items(line);
+        std::string type;
+        items >> type;
+        if ("a" == type)
+        {
+            entry item;
+            items >> item.fee >> item.creation >> item.expiry >> item.hash >> item.sender;
+            items.get();
+            std::getline(items, item.payload);
+            if (!items && false == items.eof())
+                throw std::runtime_error("corrupt transaction pool journal: " + m_journal_path.string());
+            //  expired ones are dropped by the owner, with its clock
+            insert(std::move(item), std::numeric_limits<int64_t>::min(), false);
+        }
+        else if ("r" == type)
+        {
+            std::string hash;
+            items >> hash;
+            erase(hash, false);
+        }
+        else
+            throw std::runtime_error("corrupt transaction pool journal: " + m_journal_path.string());
+    }
+
+    void rewrite()
+    {
+        std::lock_guard<std::mutex> file_lock(m_file_mutex);
+        rewrite_locked();
+    }
+
+    //  the journal becomes one "a" line per transaction in the pool.
+    //  all that was committed to the log is in it, saves wait for
+    //  m_file_mutex
+    void rewrite_locked()
+    {
+        std::string content;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto const& item : m_entries)
+                append_add(item.second->value, content);
+            m_journal.clear();
+            m_journal_bytes = content.size();
+        }
+
+        auto temp_path = m_journal_path;
+        temp_path += ".tmp";
+        {
+            boost::filesystem::ofstream fl(temp_path, std::ios_base::binary | std::ios_base::trunc);
+            fl.write(content.data(), std::streamsize(content.size()));
+            if (!fl)
+                throw std::runtime_error("cannot write: " + temp_path.string());
+        }
+        if (m_wal)
+        {
+            sync_file(temp_path);
+            sync_rename(temp_path, m_journal_path);
+            m_wal->checkpoint(wal_stream(), m_wal->lsn());
+        }
+        else
+            boost::filesystem::rename(temp_path, m_journal_path);
+    }
+
+    size_t m_max_bytes;
+    boost::filesystem::path m_journal_path;
+    write_ahead_log* m_wal;
+    mutable std::mutex m_mutex;
+    std::mutex m_file_mutex;
+    std::string m_journal;          //  not yet written
+    uint64_t m_journal_bytes;       //  the size of the file
+    size_t m_bytes;
+    uint64_t m_sequence;
+    uint64_t m_added;
+    uint64_t m_evicted;
+    uint64_t m_rejected;
+    uint64_t m_expired;
+    std::unordered_map<std::string, std::unique_ptr<node>> m_entries;
+    std::unordered_map<std::string, sender_queue> m_senders;
+    std::set<node const*, before> m_ready;          //  the first of each sender
+    std::set<node const*, before> m_by_priority;    //  all, the last is evicted first
+};
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+namespace noahpp
+{
+//  fixed size thread pool, every worker owns a task queue
+//  and steals from the others when its own queue is empty
+class worker_pool
+{
+public:
+    using task = std::function<void()>;
+
+    explicit worker_pool(size_t count)
+        : m_stopping(false)
+        , m_next(0)
+        , m_pending(0)
+        , m_executed(0)
+        , m_stolen(0)
+    {
+        if (0 == count)
+            count = default_size();
+
+        for (size_t index = 0; index != count; ++index)
+            m_queues.emplace_back(new queue());
+
+        for (size_t index = 0; index != count; ++index)
+            m_threads.emplace_back([this, index]{ worker(index); });
+    }
+    worker_pool(worker_pool const&) = delete;
+    worker_pool(worker_pool&&) = delete;
+    ~worker_pool()
+    {
+        stop();
+    }
+
+    static size_t default_size()
+    {
+        size_t result = std::thread::hardware_concurrency();
+        if (0 == result)
+            result = 1;
+        return result;
+    }
+
+    size_t size() const
+    {
+        return m_queues.size();
+    }
+
+    void post(task&& item)
+    {
+        size_t index = m_next.fetch_add(1) % m_queues.size();
+        //  tasks posted from a worker stay on that worker's queue
+        if (tls_owner() == this)
+            index = tls_index();
+
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(item));
+        }
+        notify();
+    }
+
+    //  runs the remaining tasks and joins the workers
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stopping)
+                return;
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+
+        for (auto& thread : m_threads)
+        {
+            if (thread.joinable())
+                thread.join();
+        }
+    }
+
+    uint64_t pending() const
+    {
+        return m_pending.load();
+    }
+    uint64_t executed() const
+    {
+        return m_executed.load();
+    }
+    uint64_t stolen() const
+    {
+        return m_stolen.load();
+    }
+
+private:
+    class queue
+    {
+    public:
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    static worker_pool*& tls_owner()
+    {
+        static thread_local worker_pool* owner = nullptr;
+        return owner;
+    }
+    static size_t& tls_index()
+    {
+        static thread_local size_t index = 0;
+        return index;
+    }
+
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_pending;
+        }
+        m_cv.notify_one();
+    }
+
+    bool take(size_t index, task& item)
+    {
+        {
+            auto& own = *m_queues[index];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (false == own.tasks.empty())
+            {
+                item = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t step = 1; step != m_queues.size(); ++step)
+        {
+            auto& other = *m_queues[(index + step) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (false == other.tasks.empty())
+            {
+                item = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                ++m_stolen;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void worker(size_t index)
+    {
+        tls_owner() = this;
+        tls_index() = index;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this]{ return m_stopping || m_pending > 0; });
+                if (0 == m_pending)
+                    break;  //  stopping and nothing is left
+                --m_pending;
+            }
+
+            //  the scan is not atomic, another worker may take the task
+            //  reserved above while a newer one lands in a queue scanned
+            //  already. the queues hold at least one task per reservation,
+            //  so the scan is repeated until it finds one
+            task item;
+            while (false == take(index, item))
+                std::this_thread::yield();
+
+            try
+            {
+                item();
+            }
+            catch (...)
+            {}  //  tasks report their own errors
+
+            ++m_executed;
+        }
+
+        tls_owner() = nullptr;
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stopping;
+    std::atomic<size_t> m_next;
+    std::atomic<uint64_t> m_pending;
+    std::atomic<uint64_t> m_executed;
+    std::atomic<uint64_t> m_stolen;
+    std::vector<std::unique_ptr<queue>> m_queues;
+    std::vector<std::thread> m_threads;
+};
+
+//  splits [0, count) into chunks and runs fn(begin, end) for each of them
+//  on the pool, the calling thread takes chunks too and returns when
+//  all of them are done. works without a pool, or from a pool worker
+template <typename FUNCTION>
+void parallel_for(worker_pool* pool, size_t count, FUNCTION fn, size_t chunk = 0)
+{
+    if (0 == count)
+        return;
+
+    size_t workers = pool ? pool->size() : 0;
+    if (0 == chunk)
+        chunk = std::max<size_t>(1, count / (4 * (workers + 1)));
+
+    if (0 == workers || count <= chunk)
+    {
+        fn(size_t(0), count);
+        return;
+    }
+
+    class state
+    {
+    public:
+        state(size_t _count, size_t _chunk, FUNCTION const& _fn)
+            : count(_count), chunk(_chunk), next(0), done(0), fn(_fn)
+        {}
+
+        //  returns false when there was nothing left to take
+        bool run_one()
+        {
+            size_t begin = next.fetch_add(chunk);
+            if (begin >= count)
+                return false;
+            size_t end = std::min(count, begin + chunk);
+
+            std::exception_ptr eptr;
+            try
+            {
+                fn(begin, end);
+            }
+            catch (...)
+            {
+                eptr = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (eptr && nullptr == error)
+                error = eptr;
+            done += end - begin;
+            if (done == count)
+                cv.notify_all();
+            return true;
+        }
+
+        size_t const count;
+        size_t const chunk;
+        std::atomic<size_t> next;
+        size_t done;
+        FUNCTION fn;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::exception_ptr error;
+    };
+
+    auto pstate = std::make_shared<state>(count, chunk, fn);
+    size_t helpers = std::min(workers, (count + chunk - 1) / chunk - 1);
+    for (size_t index = 0; index != helpers; ++index)
+        pool->post([pstate]{ while (pstate->run_one()) {} });
+
+    while (pstate->run_one())
+    {}
+
+    std::unique_lock<std::mutex> lock(pstate->mutex);
+    pstate->cv.wait(lock, [&pstate]{ return pstate->done == pstate->count; });
+    if (pstate->error)
+        std::rethrow_exception(pstate->error);
+}
+}
@@ -0,0 +1,514 @@
+#pragma once
+
+#include "global.hpp"
+#include "binary_codec.hpp"
+#include "metrics.hpp"
+
+#include <boost/crc.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#ifdef B_OS_WINDOWS
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace noahpp
+{
+namespace detail
+{
+class sync_file_handle
+{
+public:
+    //  not append opens only to sync, a directory too except on windows
+    sync_file_handle(boost::filesystem::path const& path, bool append)
+        : m_path(path)
+    {
+#ifdef B_OS_WINDOWS
+        m_fd = ::_wopen(path.wstring().c_str(),
+                        append ? (_O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY) : (_O_RDWR | _O_BINARY),
+                        _S_IREAD | _S_IWRITE);
+#else
+        m_fd = ::open(path.string().c_str(), append ? (O_WRONLY | O_CREAT | O_APPEND) : O_RDONLY, 0644);
+#endif
+        if (m_fd < 0)
+            throw std::runtime_error("cannot open: " + path.string() + ": " + std::strerror(errno));
+    }
+    sync_file_handle(sync_file_handle const&) = delete;
+    ~sync_file_handle()
+    {
+#ifdef B_OS_WINDOWS
+        ::_close(m_fd);
+#else
+        ::close(m_fd);
+#endif
+    }
+
+    void write(std::string const& buffer)
+    {
+        char const* data = buffer.data();
+        size_t size = buffer.size();
+        while (size > 0)
+        {
+#ifdef B_OS_WINDOWS
+            int written = ::_write(m_fd, data, unsigned(std::min<size_t>(size, 1 << 30)));
+#else
+            ssize_t written = ::write(m_fd, data, size);
+#endif
+            if (written < 0 && EINTR == errno)
+                continue;
+            if (written <= 0)
+                throw std::runtime_error("cannot write: " + m_path.string() + ": " + std::strerror(errno));
+            data += written;
+            size -= size_t(written);
+        }
+    }
+
+    void sync()
+    {
+#if defined(B_OS_WINDOWS)
+        int result = ::_commit(m_fd);
+#elif defined(B_OS_LINUX)
+        int result = ::fdatasync(m_fd);
+#else
+        int result = ::fsync(m_fd);
+#endif
+        if (0 != result)
+            throw std::runtime_error("cannot sync: " + m_path.string() + ": " + std::strerror(errno));
+    }
+
+private:
+    boost::filesystem::path m_path;
+    int m_fd;
+};
+}
+
+//  waits until what was written to the file is on disk
+inline void sync_file(boost::filesystem::path const& path)
+{
+    detail::sync_file_handle(path, false).sync();
+}
+
+//  replaces to with from, which has been synced, and waits until the
+//  directory entry is on disk as well
+inline void sync_rename(boost::filesystem::path const& from, boost::filesystem::path const& to)
+{
+    boost::filesystem::rename(from, to);
+#ifndef B_OS_WINDOWS
+    sync_file(to.has_parent_path() ? to.parent_path() : boost::filesystem::path("."));
+#endif
+}
+
+//  one log for the files noahd keeps itself, so that the changes that
+//  belong together go to disk at once, with a single sync. a store
+//  commits them as a batch of records under its stream name, commit()
+//  returns when the batch is on disk. the batches committed from
+//  different threads meanwhile go with the same write and sync
+//
+//  after commit the store changes its own files, without syncing them.
+//  once it has synced them, it calls checkpoint() and the log does not
+//  need the stream's batches up to there. on open, the batches that
+//  were not checkpointed are given back by recovered() for the store to
+//  apply again, so applying a batch twice has to give the same result.
+//  a batch that was not written whole is dropped. all methods may be
+//  called from any thread
+class write_ahead_log
+{
+public:
+    //  write_seconds, if given, observes each write and sync
+    write_ahead_log(boost::filesystem::path const& path,
+                    metrics::histogram* write_seconds = nullptr)
+        : m_path(path)
+        , m_write_seconds(write_seconds)
+        , m_lsn(0)
+        , m_durable(0)
+        , m_writing(false)
+        , m_failed()
+        , m_file_bytes(0)
+        , m_recovered_batches(0)
+        , m_commits(0)
+        , m_syncs(0)
+        , m_bytes_written(0)
+    {
+        if (m_path.has_parent_path())
+            boost::filesystem::create_directories(m_path.parent_path());
+        load();
+        m_durable = m_lsn;
+        m_file.reset(new detail::sync_file_handle(m_path, true));
+#ifndef B_OS_WINDOWS
+        //  the file itself may have just been created
+        sync_file(m_path.has_parent_path() ? m_path.parent_path() : boost::filesystem::path("."));
+#endif
+    }
+    write_ahead_log(write_ahead_log const&) = delete;
+
+    //  the records of the stream's batches that were not checkpointed
+    //  before the last stop, in the order they were committed
+    std::vector<std::string> recovered(std::string const& stream) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<std::string> result;
+        auto it = m_recovered.find(stream);
+        if (it != m_recovered.end())
+            result = it->second;
+        return result;
+    }
+
+    //  the sequence number of the batch. without wait it returns right
+    //  away, and the batch goes to disk with the next sync
+    uint64_t commit(std::string const& stream,
+                    std::vector<std::string> const& records,
+                    bool wait = true)
+    {
+        std::string body;
+        binary_codec::detail::write_varint(records.size(), body);
+        for (auto const& record : records)
+        {
+            binary_codec::detail::write_varint(record.size(), body);
+            body += record;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        uint64_t lsn = ++m_lsn;
+        std::string frame = make_frame(frame_batch, lsn, stream, body);
+        m_pending += frame;
+        m_live[stream].push_back(std::make_pair(lsn, std::move(frame)));
+
+        ++m_commits;
+        if (wait)
+            wait_durable(lock, lsn);
+        return lsn;
+    }
+
+    //  waits until all batches committed so far are on disk
+    void sync()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        wait_durable(lock, m_lsn);
+    }
+
+    //  the last sequence number given by commit()
+    uint64_t lsn() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_lsn;
+    }
+
+    //  the stream's batches up to lsn are on disk elsewhere
+    void checkpoint(std::string const& stream, uint64_t lsn)
+    {
+        std::string body;
+        binary_codec::detail::write_varint(lsn, body);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        uint64_t ticket = ++m_lsn;
+        m_pending += make_frame(frame_checkpoint, ticket, stream, body);
+        wait_durable(lock, ticket);
+
+        m_recovered.erase(stream);
+        auto& live = m_live[stream];
+        while (false == live.empty() && live.front().first <= lsn)
+            live.pop_front();
+
+        compact(lock);
+    }
+
+    uint64_t recovered_batches() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_recovered_batches;
+    }
+    uint64_t commits() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_commits;
+    }
+    uint64_t syncs() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_syncs;
+    }
+    uint64_t bytes_written() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_bytes_written;
+    }
+    uint64_t file_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_file_bytes;
+    }
+
+private:
+    static uint8_t const frame_batch = 1;
+    static uint8_t const frame_checkpoint = 2;
+    static size_t const frame_header = 8;
+    //  the log is rewritten with the batches still needed when it grows
+    //  past this much more than twice their size
+    static uint64_t const compact_bytes = 64 * 1024 * 1024;
+
+    static uint32_t checksum(char const* data, size_t size)
+    {
+        boost::crc_32_type result;
+        result.process_bytes(data, size);
+        return result.checksum();
+    }
+
+    static void write_uint32(uint32_t number, char* out)
+    {
+        for (size_t index = 0; index != 4; ++index)
+            out[index] = char(uint8_t(number >> (8 * index)));
+    }
+
+    static uint32_t read_uint32(char const* in)
+    {
+        uint32_t result = 0;
+        for (size_t index = 0; index != 4; ++index)
+            result |= uint32_t(uint8_t(in[index])) << (8 * index);
+        return result;
+    }
+
+    //  size and crc32 of the payload, then the payload:
+    //  type, lsn, stream and the body
+    static std::string make_frame(uint8_t type,
+                                  uint64_t lsn,
+                                  std::string const& stream,
+                                  std::string const& body)
+    {
+        std::string frame(frame_header, '\0');
+        frame += char(type);
+        binary_codec::detail::write_varint(lsn, frame);
+        binary_codec::detail::write_varint(stream.size(), frame);
+        frame += stream;
+        frame += body;
+
+        size_t size = frame.size() - frame_header;
+        write_uint32(uint32_t(size), &frame[0]);
+        write_uint32(checksum(frame.data() + frame_header, size), &frame[4]);
+        return frame;
+    }
+
+    void load()
+    {
+        std::string content;
+        {
+            boost::filesystem::ifstream fl(m_path, std::ios_base::binary);
+            content.assign(std::istreambuf_iterator<char>(fl), std::istreambuf_iterator<char>());
+        }
+
+        class batch
+        {
+        public:
+            uint64_t lsn;
+            std::string stream;
+            std::string frame;
+            std::vector<std::string> records;
+        };
+        std::vector<batch> batches;
+        std::map<std::string, uint64_t> checkpoints;
+
+        size_t offset = 0;
+        while (content.size() - offset >= frame_header)
+        {
+            size_t size = read_uint32(content.data() + offset);
+            if (content.size() - offset - frame_header < size ||
+                checksum(content.data() + offset + frame_header, size) != read_uint32(content.data() + offset + 4))
+                break;  //  the end of the last write that made it
+
+            std::string frame = content.substr(offset, frame_header + size);
+            std::string payload = frame.substr(frame_header);
+            binary_codec::detail::reader input(payload);
+
+            uint8_t type = input.byte();
+            uint64_t lsn = input.varint();
+            std::string stream;
+            input.bytes(stream, false);
+
+            if (frame_batch == type)
+            {
+                batch item;
+                item.lsn = lsn;
+                item.stream = stream;
+                uint64_t count = input.varint();
+                for (uint64_t index = 0; index != count; ++index)
+                {
+                    item.records.push_back(std::string());
+                    input.bytes(item.records.back(), false);
+                }
+                item.frame = std::move(frame);
+                batches.push_back(std::move(item));
+            }
+            else if (frame_checkpoint == type)
+            {
+                auto& value = checkpoints[stream];
+                value = std::max(value, input.varint());
+            }
+            else
+                throw std::runtime_error("corrupt write ahead log: " + m_path.string());
+
+            m_lsn = std::max(m_lsn, lsn);
+            offset += frame_header + size;
+        }
+
+        for (auto& item : batches)
+        {
+            if (item.lsn <= checkpoints[item.stream])
+                continue;
+
+            auto& records = m_recovered[item.stream];
+            std::move(item.records.begin(), item.records.end(), std::back_inserter(records));
+            m_live[item.stream].push_back(std::make_pair(item.lsn, std::move(item.frame)));
+            ++m_recovered_batches;
+        }
+
+        if (offset < content.size())
+            boost::filesystem::resize_file(m_path, offset);
+        m_file_bytes = offset;
+    }
+
+    //  the caller has put its frame in m_pending. one of the waiting
+    //  callers writes everything pending and syncs, the others wait
+    void wait_durable(std::unique_lock<std::mutex>& lock, uint64_t lsn)
+    {
+        while (m_durable < lsn)
+        {
+            if (false == m_failed.empty())
+                throw std::runtime_error(m_failed);
+            if (m_writing)
+            {
+                m_condition.wait(lock);
+                continue;
+            }
+
+            m_writing = true;
+            std::string buffer;
+            buffer.swap(m_pending);
+            uint64_t last = m_lsn;
+            lock.unlock();
+
+            std::string error;
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                m_file->write(buffer);
+                m_file->sync();
+            }
+            catch (std::exception const& ex)
+            {
+                error = ex.what();
+            }
+
+            if (m_write_seconds)
+                m_write_seconds->observe(std::chrono::steady_clock::now() - start);
+
+            lock.lock();
+            m_writing = false;
+            //  what is on disk is unknown now, nothing can be
+            //  committed after that
+            if (false == error.empty())
+                m_failed = error;
+            else
+            {
+                m_durable = last;
+                m_file_bytes += buffer.size();
+                m_bytes_written += buffer.size();
+                ++m_syncs;
+            }
+            m_condition.notify_all();
+        }
+    }
+
+    //  keeps only the batches not checkpointed, those that are on disk
+    void compact(std::unique_lock<std::mutex>& lock)
+    {
+        size_t live_bytes = 0;
+        for (auto const& stream : m_live)
+        {
+            for (auto const& item : stream.second)
+                live_bytes += item.second.size();
+        }
+        if (m_file_bytes < live_bytes * 2 + compact_bytes || m_writing || false == m_failed.empty())
+            return;
+
+        m_writing = true;
+        std::string content;
+        for (auto const& stream : m_live)
+        {
+            for (auto const& item : stream.second)
+            {
+                if (item.first <= m_durable)
+                    content += item.second;
+            }
+        }
+        lock.unlock();
+
+        std::string error;
+        auto temp_path = m_path;
+        temp_path += ".tmp";
+        try
+        {
+            m_file.reset();
+            {
+                boost::filesystem::ofstream fl(temp_path, std::ios_base::binary | std::ios_base::trunc);
+                fl.write(content.data(), std::streamsize(content.size()));
+                if (!fl)
+                    throw std::runtime_error("cannot write: " + temp_path.string());
+            }
+            sync_file(temp_path);
+            sync_rename(temp_path, m_path);
+            m_file.reset(new detail::sync_file_handle(m_path, true));
+        }
+        catch (std::exception const& ex)
+        {
+            error = ex.what();
+        }
+
+        lock.lock();
+        m_writing = false;
+        if (false == error.empty())
+            m_failed = error;
+        else
+            m_file_bytes = content.size();
+        m_condition.notify_all();
+    }
+
+    boost::filesystem::path m_path;
+    metrics::histogram* m_write_seconds;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::unique_ptr<detail::sync_file_handle> m_file;
+    uint64_t m_lsn;
+    uint64_t m_durable;
+    bool m_writing;                 //  a thread is writing the file
+    std::string m_failed;
+    std::string m_pending;          //  frames not yet written
+    uint64_t m_file_bytes;
+    //  the frames of the batches not checkpointed, by stream
+    std::map<std::string, std::list<std::pair<uint64_t, std::string>>> m_live;
+    std::map<std::string, std::vector<std::string>> m_recovered;
+    uint64_t m_recovered_batches;
+    uint64_t m_commits;
+    uint64_t m_syncs;
+    uint64_t m_bytes_written;
+};
+}
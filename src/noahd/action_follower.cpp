@@ -0,0 +1,758 @@
+#include "action_follower.hpp"
+#include "rpc_client.hpp"
+
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <noah.pp/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace BlockchainMessage;
+using std::string;
+using std::vector;
+using steady_clock = std::chrono::steady_clock;
+
+namespace
+{
+size_t const fetch_count = 5000;            //  actions asked from the node at once
+size_t const default_batch = 1000;          //  actions in one response or chunk
+size_t const max_batch = 10000;
+size_t const max_stream_backlog = 4 * 1024 * 1024;
+std::chrono::milliseconds const poll_interval(250);
+std::chrono::seconds const error_interval(2);
+std::chrono::seconds const heartbeat_interval(15);
+std::chrono::seconds const checkpoint_interval(10);
+std::chrono::minutes const prune_interval(10);
+uint64_t const max_wait_seconds = 60;
+
+bool is_address(char const* text, size_t size, string const& prefix)
+{
+    static string const base58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
+
+    if (size < prefix.size() + 40 ||
+        size > prefix.size() + 60 ||
+        0 != prefix.compare(0, prefix.size(), text, prefix.size()))
+        return false;
+
+    for (size_t index = prefix.size(); index != size; ++index)
+    {
+        if (base58.find(text[index]) == string::npos)
+            return false;
+    }
+    return true;
+}
+
+//  any string in the action that looks like a public key, so new
+//  action types are indexed without knowing about them
+void collect_addresses(noahpp::json::arena_value const& item,
+                       string const& prefix,
+                       vector<string>& addresses)
+{
+    if (item.is_string())
+    {
+        if (is_address(item.text.data(), item.text.size(), prefix))
+            addresses.push_back(item.string());
+    }
+    else if (item.is_array())
+    {
+        for (auto const& child : item.items)
+            collect_addresses(child, prefix, addresses);
+    }
+    else if (item.is_object())
+    {
+        for (auto const& member : item.members)
+            collect_addresses(member.second, prefix, addresses);
+    }
+}
+
+uint64_t number_parameter(http_request const& request, string const& name, uint64_t default_value)
+{
+    string value = request.parameter(name);
+    if (value.empty())
+        return default_value;
+    if (value.find_first_not_of("0123456789") != string::npos)
+        throw std::runtime_error("invalid " + name + ": " + value);
+    return std::stoull(value);
+}
+
+class subscription
+{
+public:
+    std::shared_ptr<http_stream> stream;
+    uint64_t cursor;
+    string address;
+    steady_clock::time_point last_write;
+};
+
+class waiter
+{
+public:
+    uint64_t cursor;
+    size_t limit;
+    string address;
+    steady_clock::time_point deadline;
+    http_server::responder respond;
+};
+}
+
+class action_follower::impl
+{
+public:
+    impl(boost::filesystem::path const& path,
+         bool _read_only,
+         uint64_t _prune_depth,
+         string const& rpc_address,
+         unsigned short rpc_port,
+         string const& _address_prefix,
+         string const& postings_backend,
+         noahpp::lru_cache* _cache,
+         noahpp::write_ahead_log* _wal,
+         noahpp::metrics::histogram* _flush_seconds,
+         beltpp::ilog* _plogger)
+        : read_only(_read_only)
+        , prune_depth(_prune_depth)
+        , index(path, read_only, read_only ? string() : postings_backend)
+        , client(rpc_address, rpc_port)
+        , address_prefix(_address_prefix)
+        , cache(_cache)
+        , wal(read_only ? nullptr : _wal)
+        , wal_lsn(0)
+        , checkpoint_lsn(0)
+        , last_checkpoint(steady_clock::now())
+        , last_prune()
+        , reclaimed(0)
+        , flush_seconds(_flush_seconds)
+        , plogger(_plogger)
+        , mutex()
+        , condition()
+        , stopped(false)
+        , new_subscriptions()
+        , new_waiters()
+        , subscriptions()
+        , waiters()
+        , worker()
+    {
+        recover();
+    }
+
+    static string wal_stream()
+    {
+        return "action_index";
+    }
+
+    //  a record is the addresses line, "sequence address...", and the
+    //  action after it. the index files past the last checkpoint may
+    //  have reached the disk only in part, the count before the actions
+    //  it covers, so the index is cut back to the first recovered action
+    //  and all of them are pushed again
+    void recover()
+    {
+        if (nullptr == wal)
+            return;
+
+        bool first_record = true;
+        for (auto const& record : wal->recovered(wal_stream()))
+        {
+            auto separator = record.find('\n');
+            std::istringstream items(record.substr(0, separator));
+            uint64_t sequence = 0;
+            items >> sequence;
+            vector<string> addresses;
+            string address;
+            while (items >> address)
+                addresses.push_back(address);
+
+            if (first_record)
+            {
+                first_record = false;
+                index.truncate(sequence);
+            }
+            //  pruned since
+            if (sequence < index.first())
+                continue;
+            if (separator == string::npos || sequence != index.length())
+                throw std::runtime_error("action index write ahead log has " + std::to_string(sequence) +
+                                         " while expecting " + std::to_string(index.length()));
+            index.push_back(record.substr(separator + 1), addresses);
+        }
+
+        flush_index();
+        wal->checkpoint(wal_stream(), wal->lsn());
+    }
+
+    void flush_index()
+    {
+        if (nullptr == flush_seconds)
+        {
+            index.flush();
+            return;
+        }
+        noahpp::metrics::scoped_timer timer(*flush_seconds);
+        index.flush();
+    }
+
+    //  the index files are synced once in a while, until then the
+    //  actions appended are in the write ahead log
+    void checkpoint(bool force)
+    {
+        auto now = steady_clock::now();
+        if (nullptr == wal ||
+            checkpoint_lsn == wal_lsn ||
+            (false == force && now - last_checkpoint < checkpoint_interval))
+            return;
+
+        flush_index();
+        wal->checkpoint(wal_stream(), wal_lsn);
+        checkpoint_lsn = wal_lsn;
+        last_checkpoint = now;
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            bool more = false;
+            bool failed = false;
+            try
+            {
+                more = read_only ? follow() : fetch();
+            }
+            catch (std::exception const& ex)
+            {
+                failed = true;
+                if (plogger)
+                    plogger->message(string("action follower: ") + ex.what());
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (false == more && false == stopped)
+                    condition.wait_for(lock,
+                                       failed ? std::chrono::milliseconds(error_interval) : poll_interval,
+                                       [this]
+                    {
+                        return stopped || false == new_subscriptions.empty() || false == new_waiters.empty();
+                    });
+                if (stopped)
+                    break;
+
+                std::move(new_subscriptions.begin(), new_subscriptions.end(), std::back_inserter(subscriptions));
+                new_subscriptions.clear();
+                std::move(new_waiters.begin(), new_waiters.end(), std::back_inserter(waiters));
+                new_waiters.clear();
+            }
+
+            pump();
+            serve_waiters(false);
+        }
+
+        try
+        {
+            checkpoint(true);
+        }
+        catch (std::exception const& ex)
+        {
+            if (plogger)
+                plogger->message(string("action follower: ") + ex.what());
+        }
+
+        for (auto& item : subscriptions)
+            item.stream->close();
+        subscriptions.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::move(new_waiters.begin(), new_waiters.end(), std::back_inserter(waiters));
+            new_waiters.clear();
+        }
+        serve_waiters(true);
+    }
+
+    //  true when the node may have more right away
+    bool fetch()
+    {
+        LoggedTransactionsRequest request;
+        request.start_index = index.length();
+        request.max_count = fetch_count;
+
+        LoggedTransactions response;
+        client.call(request, response);
+
+        if (response.actions.empty())
+        {
+            checkpoint(false);
+            prune();
+            return false;
+        }
+
+        vector<string> texts;
+        vector<vector<string>> addresses;
+        vector<string> records;
+        vector<string> touched;
+        uint64_t sequence = index.length();
+        for (auto const& item : response.actions)
+        {
+            if (item.index != sequence)
+                throw std::runtime_error("action log index " + std::to_string(item.index) +
+                                         " while expecting " + std::to_string(sequence));
+
+            texts.push_back(item.to_string());
+            addresses.push_back(vector<string>());
+            auto& item_addresses = addresses.back();
+            addresses_of(texts.back(), item_addresses);
+            std::sort(item_addresses.begin(), item_addresses.end());
+            item_addresses.erase(std::unique(item_addresses.begin(), item_addresses.end()), item_addresses.end());
+            touched.insert(touched.end(), item_addresses.begin(), item_addresses.end());
+
+            if (wal)
+            {
+                string record = std::to_string(sequence);
+                for (auto const& address : item_addresses)
+                    record += " " + address;
+                records.push_back(record + "\n" + texts.back());
+            }
+            ++sequence;
+        }
+
+        //  the whole batch goes to disk with one sync, before the index
+        //  files are touched
+        if (wal)
+            wal_lsn = wal->commit(wal_stream(), records);
+
+        for (size_t item = 0; item != texts.size(); ++item)
+            index.push_back(texts[item], addresses[item]);
+
+        if (wal)
+            checkpoint(false);
+        else
+            flush_index();
+
+        invalidate(touched);
+        return true;
+    }
+
+    //  keeps the actions from the one applying the block prune_depth
+    //  before the last applied block, found by walking back from the end
+    //  of the log. runs when the node has nothing new, once in a while
+    void prune()
+    {
+        auto now = steady_clock::now();
+        if (0 == prune_depth || now - last_prune < prune_interval)
+            return;
+        last_prune = now;
+
+        bool found = false;
+        uint64_t last_block = 0;
+        for (uint64_t sequence = index.length(); sequence > index.first(); --sequence)
+        {
+            uint64_t block_number = 0;
+            if (false == applied_block(index.at(sequence - 1), block_number))
+                continue;
+            if (false == found)
+            {
+                found = true;
+                last_block = block_number;
+            }
+            else if (block_number + prune_depth <= last_block)
+            {
+                //  what is pruned must be in the index files first
+                checkpoint(true);
+                uint64_t bytes = index.prune(sequence - 1);
+                if (plogger && bytes > 0)
+                    plogger->message("action follower: pruned the actions before " + std::to_string(sequence - 1) +
+                                     ", " + std::to_string(bytes) + " bytes reclaimed");
+                reclaimed += bytes;
+                return;
+            }
+        }
+    }
+
+    //  the node logs a BlockLog for each block it applies and reverts
+    bool applied_block(string const& action, uint64_t& block_number)
+    {
+        bool result = false;
+        {
+            auto document = noahpp::json::parse(action, memory);
+            auto logging_type = document.find("logging_type");
+            auto item = document.find("action");
+            auto number = item ? item->find("block_number") : nullptr;
+            if (logging_type && "apply" == logging_type->string() &&
+                number && number->is_number())
+            {
+                block_number = std::stoull(number->string());
+                result = true;
+            }
+        }
+        memory.reset();
+        return result;
+    }
+
+    //  picks up what the writer has flushed to the index since the
+    //  last time, false as the writer is not waited for
+    bool follow()
+    {
+        uint64_t length = index.length();
+        index.refresh();
+
+        vector<string> touched;
+        for (uint64_t sequence = length; sequence < index.length(); ++sequence)
+            addresses_of(index.at(sequence), touched);
+
+        if (length < index.length())
+            invalidate(touched);
+        return false;
+    }
+
+    //  the action's document lives in the arena only while its addresses
+    //  are collected, so the arena stays at one chunk however long the
+    //  batch is
+    void addresses_of(string const& action, vector<string>& addresses)
+    {
+        collect_addresses(noahpp::json::parse(action, memory), address_prefix, addresses);
+        memory.reset();
+    }
+
+    void invalidate(vector<string>& touched)
+    {
+        if (nullptr == cache)
+            return;
+
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+        vector<string> tags;
+        tags.push_back(action_follower::log_tail_tag());
+        for (auto const& address : touched)
+            tags.push_back(action_follower::address_tag(address));
+        cache->invalidate(tags);
+    }
+
+    //  the actions from cursor on, one per line, and moves the cursor
+    //  past what was looked at
+    string batch(uint64_t& cursor, string const& address, size_t limit) const
+    {
+        cursor = std::max(cursor, index.first());
+        vector<string> actions;
+        if (address.empty())
+        {
+            index.range(cursor, limit, actions);
+            cursor += actions.size();
+        }
+        else
+        {
+            uint64_t length = index.length();
+            auto sequences = index.by_address(address, cursor, limit);
+            while (false == sequences.empty() && sequences.back() >= length)
+                sequences.pop_back();
+
+            for (auto sequence : sequences)
+                actions.push_back(index.at(sequence));
+
+            if (sequences.size() < limit)
+                cursor = std::max(cursor, length);
+            else
+                cursor = sequences.back() + 1;
+        }
+
+        string result;
+        for (auto const& action : actions)
+        {
+            result += action;
+            result += "\n";
+        }
+        return result;
+    }
+
+    void pump()
+    {
+        auto now = steady_clock::now();
+        for (auto& item : subscriptions)
+        {
+            while (item.stream && item.stream->backlog() < max_stream_backlog)
+            {
+                string chunk = batch(item.cursor, item.address, default_batch);
+                if (chunk.empty())
+                    break;
+                if (false == item.stream->write(std::move(chunk)))
+                    item.stream.reset();
+                else
+                    item.last_write = now;
+            }
+
+            //  this is how a client that went away is noticed
+            if (item.stream && now - item.last_write > heartbeat_interval)
+            {
+                if (false == item.stream->write("\n"))
+                    item.stream.reset();
+                else
+                    item.last_write = now;
+            }
+        }
+
+        subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(),
+                                           [](subscription const& item)
+        {
+            return nullptr == item.stream;
+        }), subscriptions.end());
+    }
+
+    void serve_waiters(bool all)
+    {
+        auto now = steady_clock::now();
+        for (auto& item : waiters)
+        {
+            uint64_t cursor = item.cursor;
+            string body = batch(cursor, item.address, item.limit);
+            if (body.empty() && false == all && now < item.deadline)
+                continue;
+
+            respond(item.respond, body, cursor);
+            item.respond = nullptr;
+        }
+
+        waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                                     [](waiter const& item)
+        {
+            return nullptr == item.respond;
+        }), waiters.end());
+    }
+
+    //  batch() through the cache, a batch that is not full can change
+    //  with the next actions
+    string cached_batch(uint64_t& cursor, string const& address, size_t limit) const
+    {
+        if (nullptr == cache)
+            return batch(cursor, address, limit);
+
+        string key = "actions " + std::to_string(cursor) +
+                     " " + std::to_string(limit) +
+                     " " + address;
+        string value;
+        if (cache->get(key, value))
+        {
+            auto separator = value.find('\n');
+            cursor = std::stoull(value.substr(0, separator));
+            return value.substr(separator + 1);
+        }
+
+        uint64_t generation = cache->generation();
+        string result = batch(cursor, address, limit);
+
+        vector<string> tags;
+        if (size_t(std::count(result.begin(), result.end(), '\n')) < limit)
+            tags.push_back(address.empty() ?
+                               action_follower::log_tail_tag() :
+                               action_follower::address_tag(address));
+        cache->put(key, std::to_string(cursor) + "\n" + result, tags, generation);
+        return result;
+    }
+
+    static void respond(http_server::responder const& responder, string const& body, uint64_t cursor)
+    {
+        http_response response;
+        response.content_type = "application/x-ndjson";
+        response.headers.push_back(std::make_pair("X-Next-Cursor", std::to_string(cursor)));
+        response.body = body;
+        responder(std::move(response));
+    }
+
+    bool read_only;
+    uint64_t prune_depth;               //  in blocks, 0 keeps all actions
+    noahpp::action_index index;
+    rpc_client client;
+    string address_prefix;
+    noahpp::lru_cache* cache;
+    noahpp::write_ahead_log* wal;
+    uint64_t wal_lsn;                   //  the last batch committed
+    uint64_t checkpoint_lsn;
+    steady_clock::time_point last_checkpoint;
+    steady_clock::time_point last_prune;
+    std::atomic<uint64_t> reclaimed;    //  bytes of pruned actions removed
+    noahpp::metrics::histogram* flush_seconds;
+    beltpp::ilog* plogger;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopped;
+    vector<subscription> new_subscriptions;
+    vector<waiter> new_waiters;
+
+    //  used by the worker thread only
+    vector<subscription> subscriptions;
+    vector<waiter> waiters;
+    noahpp::arena memory;               //  one action's document at a time
+
+    std::thread worker;
+};
+
+action_follower::action_follower(boost::filesystem::path const& path,
+                                 bool read_only,
+                                 uint64_t prune_depth,
+                                 string const& rpc_address,
+                                 unsigned short rpc_port,
+                                 string const& address_prefix,
+                                 string const& postings_backend,
+                                 noahpp::lru_cache* cache,
+                                 noahpp::write_ahead_log* wal,
+                                 noahpp::metrics::histogram* flush_seconds,
+                                 beltpp::ilog* plogger)
+    : m_pimpl(new impl(path,
+                       read_only,
+                       prune_depth,
+                       rpc_address,
+                       rpc_port,
+                       address_prefix,
+                       postings_backend,
+                       cache,
+                       wal,
+                       flush_seconds,
+                       plogger))
+{
+    m_pimpl->worker = std::thread([this]
+    {
+        m_pimpl->run();
+    });
+}
+
+action_follower::~action_follower()
+{
+    stop();
+}
+
+noahpp::action_index const& action_follower::index() const
+{
+    return m_pimpl->index;
+}
+
+uint64_t action_follower::reclaimed_bytes() const
+{
+    return m_pimpl->reclaimed;
+}
+
+string action_follower::logged_transactions(uint64_t start_index, size_t max_count) const
+{
+    vector<string> actions;
+    m_pimpl->index.range(start_index, std::min(max_count, max_batch), actions);
+
+    LoggedTransactions response;
+    for (auto const& action : actions)
+    {
+        LoggedTransaction item;
+        item.from_string(action, nullptr);
+        response.actions.push_back(std::move(item));
+    }
+    return response.to_string();
+}
+
+string action_follower::log_tail_tag()
+{
+    return "actions";
+}
+
+string action_follower::address_tag(string const& address)
+{
+    return "address " + address;
+}
+
+bool action_follower::handle(http_request const& request, http_server::responder const& respond)
+{
+    if (request.path != "/actions" && request.path != "/actions/subscribe")
+        return false;
+
+    http_response response;
+    if (request.method != "GET")
+    {
+        response.status = 405;
+        response.body = "method not allowed";
+        respond(std::move(response));
+        return true;
+    }
+
+    uint64_t cursor = 0;
+    uint64_t limit = 0;
+    uint64_t wait = 0;
+    try
+    {
+        cursor = number_parameter(request, "from", 0);
+        limit = std::min<uint64_t>(number_parameter(request, "limit", default_batch), max_batch);
+        wait = std::min(number_parameter(request, "wait", 0), max_wait_seconds);
+    }
+    catch (std::exception const& ex)
+    {
+        response.status = 400;
+        response.body = ex.what();
+        respond(std::move(response));
+        return true;
+    }
+    string address = request.parameter("address");
+
+    if (request.path == "/actions/subscribe")
+    {
+        auto pimpl = m_pimpl.get();
+        response.content_type = "application/x-ndjson";
+        response.on_stream = [pimpl, cursor, address](std::shared_ptr<http_stream> const& stream)
+        {
+            subscription item;
+            item.stream = stream;
+            item.cursor = cursor;
+            item.address = address;
+            item.last_write = steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(pimpl->mutex);
+                if (pimpl->stopped)
+                    return stream->close();
+                pimpl->new_subscriptions.push_back(item);
+            }
+            pimpl->condition.notify_one();
+        };
+        respond(std::move(response));
+        return true;
+    }
+
+    if (0 == limit)
+        limit = default_batch;
+
+    uint64_t next = cursor;
+    string body = m_pimpl->cached_batch(next, address, size_t(limit));
+    if (false == body.empty() || 0 == wait)
+    {
+        impl::respond(respond, body, next);
+        return true;
+    }
+
+    waiter item;
+    item.cursor = cursor;
+    item.limit = size_t(limit);
+    item.address = address;
+    item.deadline = steady_clock::now() + std::chrono::seconds(wait);
+    item.respond = respond;
+    {
+        std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+        if (false == m_pimpl->stopped)
+        {
+            m_pimpl->new_waiters.push_back(item);
+            item.respond = nullptr;
+        }
+    }
+    if (item.respond)
+        impl::respond(respond, body, next);
+    else
+        m_pimpl->condition.notify_one();
+    return true;
+}
+
+void action_follower::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+        m_pimpl->stopped = true;
+    }
+    m_pimpl->condition.notify_one();
+    if (m_pimpl->worker.joinable())
+        m_pimpl->worker.join();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "http_server.hpp"
+
+#include <belt.pp/global.hpp>
+#include <belt.pp/log.hpp>
+
+#include <noah.pp/action_index.hpp>
+#include <noah.pp/lru_cache.hpp>
+#include <noah.pp/metrics.hpp>
+#include <noah.pp/write_ahead_log.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+//  keeps action_index up to date with the node's action log, which it
+//  reads through the node's RPC, and hands the new actions to the
+//  subscribers. everything runs on one thread of its own
+//
+//  served over HTTP, the actions are LoggedTransaction objects one per
+//  line, their "index" is the sequence:
+//      GET /actions?from=N&limit=M[&address=A][&wait=S]
+//          one batch, X-Next-Cursor has the sequence to continue from.
+//          with wait the request is held up to S seconds until there
+//          is something to return
+//      GET /actions/subscribe?from=N[&address=A]
+//          a chunked response that never ends, each chunk is a batch
+//
+//  with a cache, the /actions answers are kept in it. after each batch
+//  of actions appended to the index, the cached answers that could
+//  change are invalidated: the ones tagged log_tail_tag() and the ones
+//  tagged address_tag() of an address in the new actions. a block apply
+//  and a block revert both come in as new actions
+//
+//  with a write ahead log, each batch of actions read from the node is
+//  committed to it with one sync, and the index files are synced only
+//  every few seconds. on start the batches the index may have lost
+//  are applied again
+//
+//  with prune_depth, the actions of the blocks applied before the last
+//  prune_depth ones are dropped from the index every few minutes,
+//  /actions starts from the first action kept
+//
+//  postings_backend is passed on to action_index, empty keeps the
+//  sequences by address in memory
+//
+//  a read only follower opens the action_index another noahd writes
+//  to, and follows it instead of the node. it sees the actions once
+//  the writer has flushed them, with a write ahead log that is every
+//  few seconds. rpc_address, postings_backend, wal and prune_depth are
+//  not used, the writer prunes
+class action_follower
+{
+public:
+    action_follower(boost::filesystem::path const& path,
+                    bool read_only,
+                    uint64_t prune_depth,
+                    std::string const& rpc_address,
+                    unsigned short rpc_port,
+                    std::string const& address_prefix,
+                    std::string const& postings_backend,
+                    noahpp::lru_cache* cache,
+                    noahpp::write_ahead_log* wal,
+                    //  observes each flush of the index files, may be nullptr
+                    noahpp::metrics::histogram* flush_seconds,
+                    beltpp::ilog* plogger);
+    action_follower(action_follower const&) = delete;
+    ~action_follower();
+
+    noahpp::action_index const& index() const;
+    //  bytes removed by pruning since start
+    uint64_t reclaimed_bytes() const;
+
+    //  a LoggedTransactions message with the actions from start_index
+    //  on, at most max_count and no more than a batch
+    std::string logged_transactions(uint64_t start_index, size_t max_count) const;
+
+    static std::string log_tail_tag();
+    static std::string address_tag(std::string const& address);
+
+    //  true if the request was for this
+    bool handle(http_request const& request, http_server::responder const& respond);
+
+    void stop();
+
+    class impl;
+private:
+    std::unique_ptr<impl> m_pimpl;
+};
@@ -0,0 +1,517 @@
+#include "async_logger.hpp"
+
+#include <noah.pp/ring_buffer.hpp>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::string;
+namespace filesystem = boost::filesystem;
+using system_clock = std::chrono::system_clock;
+
+namespace
+{
+enum class log_level : uint8_t { message, warning, error };
+
+class log_entry
+{
+public:
+    log_entry()
+        : time()
+        , level(log_level::message)
+        , eol(true)
+        , text()
+    {}
+
+    system_clock::time_point time;
+    log_level level;
+    bool eol;
+    string text;
+};
+
+class log_destination
+{
+public:
+    virtual ~log_destination() {}
+    //  called with mutex locked
+    virtual void write(string const& batch) = 0;
+
+    std::mutex mutex;
+};
+
+class console_destination : public log_destination
+{
+public:
+    void write(string const& batch) override
+    {
+        std::cout.write(batch.data(), std::streamsize(batch.size()));
+        std::cout.flush();
+    }
+};
+
+class file_destination : public log_destination
+{
+public:
+    file_destination(filesystem::path const& path, uint64_t max_file_size, size_t keep_files)
+        : m_path(path)
+        , m_max_file_size(max_file_size)
+        , m_keep_files(keep_files)
+        , m_file()
+        , m_size(0)
+    {
+        if (m_path.has_parent_path())
+            filesystem::create_directories(m_path.parent_path());
+        open();
+    }
+
+    void write(string const& batch) override
+    {
+        if (m_size > 0 && m_size + batch.size() > m_max_file_size)
+            rotate();
+
+        m_file.write(batch.data(), std::streamsize(batch.size()));
+        m_file.flush();
+        m_size += batch.size();
+    }
+
+private:
+    void open()
+    {
+        m_file.open(m_path, std::ios_base::binary | std::ios_base::app);
+        if (!m_file)
+            throw std::runtime_error("cannot open log file: " + m_path.string());
+
+        boost::system::error_code ec;
+        m_size = filesystem::file_size(m_path, ec);
+        if (ec)
+            m_size = 0;
+    }
+
+    filesystem::path numbered(size_t number) const
+    {
+        filesystem::path result = m_path.parent_path() / m_path.stem();
+        result += "." + std::to_string(number);
+        result += m_path.extension();
+        return result;
+    }
+
+    //  errors are ignored here, at worst the file keeps growing
+    void rotate()
+    {
+        m_file.close();
+
+        boost::system::error_code ec;
+        if (m_keep_files > 0)
+        {
+            filesystem::remove(numbered(m_keep_files), ec);
+            for (size_t number = m_keep_files - 1; number > 0; --number)
+            {
+                if (filesystem::exists(numbered(number), ec))
+                    filesystem::rename(numbered(number), numbered(number + 1), ec);
+            }
+            filesystem::rename(m_path, numbered(1), ec);
+        }
+        else
+            filesystem::remove(m_path, ec);
+
+        m_file.clear();
+        open();
+    }
+
+    filesystem::path m_path;
+    uint64_t m_max_file_size;
+    size_t m_keep_files;
+    filesystem::ofstream m_file;
+    uint64_t m_size;
+};
+
+//  one per logger, the logger is the only producer in the common case
+class log_channel
+{
+public:
+    log_channel(string const& _name,
+                bool _timestamp,
+                std::shared_ptr<log_destination> const& _destination,
+                size_t buffer_lines)
+        : name(_name)
+        , timestamp(_timestamp)
+        , destination(_destination)
+        , ring(buffer_lines)
+        , closed(false)
+        , dropped(0)
+        , at_line_start(true)
+    {}
+
+    string const name;
+    bool const timestamp;
+    std::shared_ptr<log_destination> const destination;
+    noahpp::ring_buffer<log_entry> ring;
+    std::atomic<bool> closed;
+    std::atomic<uint64_t> dropped;  //  not yet reported in the log itself
+    bool at_line_start;             //  used under destination->mutex
+};
+
+void format_time(system_clock::time_point const& time, string& output)
+{
+    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+    time_t seconds = system_clock::to_time_t(time);
+    std::tm parts;
+#ifdef B_OS_WINDOWS
+    gmtime_s(&parts, &seconds);
+#else
+    gmtime_r(&seconds, &parts);
+#endif
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &parts);
+    output += buffer;
+    char fraction[8];
+    std::snprintf(fraction, sizeof(fraction), ".%03d ", int(milliseconds));
+    output += fraction;
+}
+
+void format_entry(log_channel& channel, log_entry const& entry, string& output)
+{
+    if (channel.at_line_start)
+    {
+        if (channel.timestamp)
+            format_time(entry.time, output);
+        if (log_level::warning == entry.level)
+            output += "warning: ";
+        else if (log_level::error == entry.level)
+            output += "error: ";
+    }
+    output += entry.text;
+    if (entry.eol)
+        output += "\n";
+    channel.at_line_start = entry.eol;
+}
+}
+
+class async_log_service::impl
+{
+public:
+    impl(log_overflow _overflow, size_t _buffer_lines, std::chrono::milliseconds _flush_interval)
+        : overflow(_overflow)
+        , buffer_lines(_buffer_lines)
+        , flush_interval(_flush_interval)
+        , mutex()
+        , condition()
+        , channels()
+        , wake_up(false)
+        , stopped(false)
+        , written(0)
+        , dropped(0)
+        , flusher()
+    {}
+
+    void start()
+    {
+        flusher = std::thread([this]
+        {
+            while (false == stopped.load())
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait_for(lock, flush_interval, [this]
+                    {
+                        return wake_up || stopped.load();
+                    });
+                    wake_up = false;
+                }
+                drain();
+            }
+        });
+    }
+
+    void stop()
+    {
+        if (false == flusher.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        condition.notify_one();
+        flusher.join();
+        //  whatever was pushed while the flusher was exiting
+        drain();
+    }
+
+    //  producers get here only when a buffer is half full or full,
+    //  otherwise the flusher just runs once per flush interval
+    void wake()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            wake_up = true;
+        }
+        condition.notify_one();
+    }
+
+    void push(std::shared_ptr<log_channel> const& pchannel, log_entry&& entry)
+    {
+        auto& channel = *pchannel;
+        if (stopped.load())
+            return write_now(channel, entry);
+
+        size_t size = channel.ring.size();
+        if (channel.ring.try_push(std::move(entry)))
+        {
+            if (size == channel.ring.capacity() / 2)
+                wake();
+            return;
+        }
+
+        if (log_overflow::drop == overflow)
+        {
+            channel.dropped.fetch_add(1);
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        while (false == channel.ring.try_push(std::move(entry)))
+        {
+            if (stopped.load())
+                return write_now(channel, entry);
+            wake();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    void write_now(log_channel& channel, log_entry const& entry)
+    {
+        std::lock_guard<std::mutex> lock(channel.destination->mutex);
+        string output;
+        format_entry(channel, entry, output);
+        channel.destination->write(output);
+        written.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void drain()
+    {
+        std::vector<std::shared_ptr<log_channel>> current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = channels;
+        }
+
+        //  the lines of the channels sharing a destination are joined
+        //  into one write, the order within a channel is kept
+        std::map<log_destination*, string> batches;
+        log_entry entry;
+        uint64_t count = 0;
+        for (auto const& pchannel : current)
+        {
+            std::lock_guard<std::mutex> lock(pchannel->destination->mutex);
+            string& batch = batches[pchannel->destination.get()];
+
+            size_t limit = pchannel->ring.capacity();
+            while (limit-- && pchannel->ring.try_pop(entry))
+            {
+                format_entry(*pchannel, entry, batch);
+                ++count;
+            }
+
+            uint64_t lost = pchannel->dropped.exchange(0);
+            if (lost)
+            {
+                if (false == pchannel->at_line_start)
+                    batch += "\n";
+                batch += pchannel->name + ": " + std::to_string(lost) + " log lines dropped\n";
+                pchannel->at_line_start = true;
+            }
+        }
+
+        for (auto& item : batches)
+        {
+            if (item.second.empty())
+                continue;
+            std::lock_guard<std::mutex> lock(item.first->mutex);
+            try
+            {
+                item.first->write(item.second);
+            }
+            catch (...)
+            {}  //  nowhere to report it
+        }
+        written.fetch_add(count, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = channels.begin(); it != channels.end();)
+        {
+            if ((*it)->closed.load() && 0 == (*it)->ring.size())
+                it = channels.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    uint64_t pending()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t result = 0;
+        for (auto const& pchannel : channels)
+            result += pchannel->ring.size();
+        return result;
+    }
+
+    log_overflow const overflow;
+    size_t const buffer_lines;
+    std::chrono::milliseconds const flush_interval;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<std::shared_ptr<log_channel>> channels;
+    bool wake_up;
+    std::atomic<bool> stopped;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+    std::thread flusher;
+};
+
+namespace
+{
+class async_logger : public beltpp::ilog
+{
+public:
+    async_logger(std::shared_ptr<async_log_service::impl> const& pservice,
+                 std::shared_ptr<log_channel> const& pchannel)
+        : m_enabled(true)
+        , m_pservice(pservice)
+        , m_pchannel(pchannel)
+    {}
+    ~async_logger() override
+    {
+        m_pchannel->closed = true;
+    }
+
+    string name() const noexcept override
+    {
+        return m_pchannel->name;
+    }
+    void enable() noexcept override
+    {
+        m_enabled = true;
+    }
+    void disable() noexcept override
+    {
+        m_enabled = false;
+    }
+
+    void message(string const& value) override
+    {
+        push(log_level::message, value, true);
+    }
+    void warning(string const& value) override
+    {
+        push(log_level::warning, value, true);
+    }
+    void error(string const& value) override
+    {
+        push(log_level::error, value, true);
+    }
+    void message_no_eol(string const& value) override
+    {
+        push(log_level::message, value, false);
+    }
+    void warning_no_eol(string const& value) override
+    {
+        push(log_level::warning, value, false);
+    }
+    void error_no_eol(string const& value) override
+    {
+        push(log_level::error, value, false);
+    }
+
+private:
+    void push(log_level level, string const& value, bool eol)
+    {
+        if (false == m_enabled.load(std::memory_order_relaxed))
+            return;
+
+        log_entry entry;
+        entry.time = system_clock::now();
+        entry.level = level;
+        entry.eol = eol;
+        entry.text = value;
+        m_pservice->push(m_pchannel, std::move(entry));
+    }
+
+    std::atomic<bool> m_enabled;
+    std::shared_ptr<async_log_service::impl> m_pservice;
+    std::shared_ptr<log_channel> m_pchannel;
+};
+
+beltpp::ilog_ptr make_logger(std::shared_ptr<async_log_service::impl> const& pservice,
+                             string const& name,
+                             bool timestamp,
+                             std::shared_ptr<log_destination> const& pdestination)
+{
+    auto pchannel = std::make_shared<log_channel>(name, timestamp, pdestination, pservice->buffer_lines);
+    {
+        std::lock_guard<std::mutex> lock(pservice->mutex);
+        pservice->channels.push_back(pchannel);
+    }
+
+    return beltpp::ilog_ptr(new async_logger(pservice, pchannel),
+                            [](beltpp::ilog* plogger) { delete plogger; });
+}
+}
+
+async_log_service::async_log_service(log_overflow overflow,
+                                     size_t buffer_lines,
+                                     std::chrono::milliseconds flush_interval)
+    : m_pimpl(new impl(overflow, buffer_lines, flush_interval))
+{
+    m_pimpl->start();
+}
+
+async_log_service::~async_log_service()
+{
+    stop();
+}
+
+beltpp::ilog_ptr async_log_service::console_logger(string const& name, bool timestamp)
+{
+    //  all console loggers share stdout and with it the batches
+    static std::shared_ptr<log_destination> pconsole = std::make_shared<console_destination>();
+    return make_logger(m_pimpl, name, timestamp, pconsole);
+}
+
+beltpp::ilog_ptr async_log_service::file_logger(string const& name,
+                                                filesystem::path const& file,
+                                                uint64_t max_file_size,
+                                                size_t keep_files)
+{
+    auto pfile = std::make_shared<file_destination>(file, max_file_size, keep_files);
+    return make_logger(m_pimpl, name, true, pfile);
+}
+
+uint64_t async_log_service::written() const
+{
+    return m_pimpl->written.load(std::memory_order_relaxed);
+}
+
+uint64_t async_log_service::dropped() const
+{
+    return m_pimpl->dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t async_log_service::pending() const
+{
+    return m_pimpl->pending();
+}
+
+void async_log_service::stop()
+{
+    m_pimpl->stop();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <belt.pp/global.hpp>
+#include <belt.pp/log.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+//  what a logger does when its buffer is full
+enum class log_overflow
+{
+    drop,   //  the line is counted and thrown away, the caller never waits
+    block   //  the caller waits for the flusher to make room
+};
+
+//  loggers created here only put the line into their own ring buffer,
+//  a single flusher thread takes the lines out in batches and writes
+//  them with one call per destination. the files rotate by size
+class async_log_service
+{
+public:
+    async_log_service(log_overflow overflow,
+                      size_t buffer_lines = 64 * 1024,
+                      std::chrono::milliseconds flush_interval = std::chrono::milliseconds(100));
+    async_log_service(async_log_service const&) = delete;
+    ~async_log_service();
+
+    beltpp::ilog_ptr console_logger(std::string const& name, bool timestamp);
+    //  file.txt is moved to file.1.txt when it grows over max_file_size,
+    //  file.1.txt to file.2.txt and so on, keeping keep_files of them
+    beltpp::ilog_ptr file_logger(std::string const& name,
+                                 boost::filesystem::path const& file,
+                                 uint64_t max_file_size = 64 * 1024 * 1024,
+                                 size_t keep_files = 5);
+
+    uint64_t written() const;
+    uint64_t dropped() const;
+    uint64_t pending() const;
+
+    //  writes out what is buffered and joins the flusher, loggers that
+    //  are still alive after that write synchronously
+    void stop();
+
+    class impl;
+private:
+    std::shared_ptr<impl> m_pimpl;
+};
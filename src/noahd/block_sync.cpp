@@ -0,0 +1,1283 @@
+#include "block_sync.hpp"
+#include "rpc_client.hpp"
+
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <mesh.pp/cryptoutility.hpp>
+
+#include <noah.pp/binary_codec.hpp>
+#include <noah.pp/block_store.hpp>
+#include <noah.pp/download_scheduler.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace BlockchainMessage;
+using std::string;
+using std::vector;
+using std::unique_ptr;
+using steady_clock = std::chrono::steady_clock;
+
+namespace
+{
+uint64_t const max_headers = 2000;          //  headers in one response
+uint64_t const max_blocks = 256;            //  blocks in one response
+size_t const max_blocks_bytes = 16 * 1024 * 1024;
+uint64_t const max_round_headers = 100000;  //  headers read from a peer in one round
+uint64_t const window = 128;                //  blocks asked from a peer at once
+uint64_t const max_ahead = 8192;            //  blocks downloaded past the stored ones
+size_t const short_id_length = 12;        //  characters of the transaction hash
+std::chrono::seconds const peer_timeout(30);
+std::chrono::seconds const follow_interval(10);
+std::chrono::seconds const stall_interval(60);
+std::chrono::seconds const flush_interval(5);
+std::chrono::milliseconds const idle_interval(100);
+uint64_t const check_batch = 1000;          //  blocks checked under one lock
+uint64_t const node_blocks = 100;           //  blocks asked from the node at once
+std::chrono::seconds const refresh_interval(1);
+
+class header_line
+{
+public:
+    uint64_t number = 0;
+    string hash;
+    string prev_hash;
+};
+
+class peer_link
+{
+public:
+    string name;
+    unique_ptr<rpc_client> client;
+    vector<header_line> headers;    //  read this round
+    uint64_t agreed = 0;            //  has the target chain below this
+    bool forked = false;            //  has a different last stored block
+    bool confirmed = false;         //  has the same one
+};
+
+uint64_t number_parameter(http_request const& request, string const& name, uint64_t default_value)
+{
+    string value = request.parameter(name);
+    if (value.empty())
+        return default_value;
+    if (value.find_first_not_of("0123456789") != string::npos)
+        throw std::runtime_error("invalid " + name + ": " + value);
+    return std::stoull(value);
+}
+
+//  the answer of a pruned noahd asked for blocks it no longer has
+string pruned_line(uint64_t first)
+{
+    return "pruned " + std::to_string(first) + "\n";
+}
+
+bool is_pruned_line(string const& body, uint64_t& first)
+{
+    string const prefix = "pruned ";
+    if (0 != body.compare(0, prefix.size(), prefix))
+        return false;
+    std::istringstream(body.substr(prefix.size())) >> first;
+    return true;
+}
+
+string block_hash(SignedBlock const& signed_block)
+{
+    return meshpp::hash(signed_block.block_details.to_string());
+}
+
+//  the /blocks line of a block with compact=1
+string compact_block(string const& block)
+{
+    SignedBlock signed_block;
+    signed_block.from_string(block, nullptr);
+    auto& transactions = signed_block.block_details.signed_transactions;
+    if (transactions.empty())
+        return block;
+
+    string result;
+    for (auto const& transaction : transactions)
+    {
+        if (false == result.empty())
+            result += " ";
+        result += block_sync::short_transaction_id(transaction.to_string());
+    }
+    transactions.clear();
+    return result + "\t" + signed_block.to_string();
+}
+}
+
+class block_sync::impl
+{
+public:
+    impl(boost::filesystem::path const& path,
+         bool _read_only,
+         uint64_t _prune_depth,
+         string const& genesis_block,
+         vector<std::pair<string, unsigned short>> const& peers,
+         string const& node_address,
+         unsigned short node_port,
+         noahpp::lru_cache* _known_transactions,
+         noahpp::signature_verifier& _verifier,
+         noahpp::metrics::histogram* _flush_seconds,
+         beltpp::ilog* _plogger)
+        : read_only(_read_only)
+        , prune_depth(_prune_depth)
+        , store(path, read_only)
+        , reclaimed(0)
+        , known_transactions(_known_transactions)
+        , compact_blocks(0)
+        , transactions_known(0)
+        , transactions_fetched(0)
+        , full_blocks_fetched(0)
+        , verifier(_verifier)
+        , flush_seconds(_flush_seconds)
+        , plogger(_plogger)
+        , stopped(false)
+        , phase("checking")
+        , checked(0)
+        , target(0)
+        , blocks_per_second(0)
+        , pscheduler(nullptr)
+    {
+        SignedBlock genesis;
+        genesis.from_string(genesis_block, nullptr);
+        genesis_hash = block_hash(genesis);
+
+        if (store.length() > store.first())
+        {
+            SignedBlock last;
+            last.from_string(stored_block(store.length() - 1), nullptr);
+            tip_hash = block_hash(last);
+        }
+        target = store.length();
+
+        if (read_only && (false == peers.empty() || 0 != node_port))
+            throw std::runtime_error("block sync: a read only store is not downloaded to");
+        if (0 != node_port)
+            node.reset(new rpc_client(node_address, node_port, peer_timeout));
+
+        for (auto const& item : peers)
+        {
+            links.emplace_back(new peer_link());
+            links.back()->name = item.first + ":" + std::to_string(item.second);
+            links.back()->client.reset(new rpc_client(item.first, item.second, peer_timeout));
+        }
+    }
+
+    //  the caller holds store_mutex
+    string stored_block(uint64_t number) const
+    {
+        string block = store.at(number).to_string();
+        if (noahpp::binary_codec::is_binary(block))
+            block = noahpp::binary_codec::decode(block);
+        return block;
+    }
+
+    //  the caller holds store_mutex
+    string stored_hash(uint64_t number) const
+    {
+        SignedBlock signed_block;
+        signed_block.from_string(stored_block(number), nullptr);
+        return block_hash(signed_block);
+    }
+
+    uint64_t height() const
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        return store.length();
+    }
+
+    //  the caller holds store_mutex
+    void flush_store()
+    {
+        if (nullptr == flush_seconds)
+        {
+            store.flush();
+            return;
+        }
+        noahpp::metrics::scoped_timer timer(*flush_seconds);
+        store.flush();
+    }
+
+    void log(string const& message) const
+    {
+        if (plogger)
+            plogger->message("block sync: " + message);
+    }
+
+    bool wait(std::chrono::milliseconds duration)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait_for(lock, duration, [this] { return stopped; });
+        return false == stopped;
+    }
+
+    void run()
+    {
+        try
+        {
+            check();
+        }
+        catch (std::exception const& ex)
+        {
+            log(ex.what());
+        }
+        if (read_only)
+        {
+            set_phase("following");
+            while (wait(refresh_interval))
+            {
+                try
+                {
+                    refresh();
+                }
+                catch (std::exception const& ex)
+                {
+                    log(ex.what());
+                }
+            }
+            return;
+        }
+        try
+        {
+            prune();
+        }
+        catch (std::exception const& ex)
+        {
+            log(ex.what());
+        }
+        if (links.empty() && nullptr == node)
+        {
+            set_phase("serving");
+            return;
+        }
+
+        while (true)
+        {
+            bool more = false;
+            try
+            {
+                if (node)
+                    more = follow_node();
+                if (false == links.empty())
+                    more = round() || more;
+                prune();
+            }
+            catch (std::exception const& ex)
+            {
+                log(ex.what());
+            }
+
+            if (false == more && false == wait(follow_interval))
+                break;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopped)
+                break;
+        }
+
+        try
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            flush_store();
+        }
+        catch (std::exception const& ex)
+        {
+            log(ex.what());
+        }
+    }
+
+    //  a read only store picks up the blocks the writer has appended
+    void refresh()
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        uint64_t length = store.length();
+        store.refresh();
+        if (store.length() == length)
+            return;
+
+        SignedBlock last;
+        last.from_string(stored_block(store.length() - 1), nullptr);
+        tip_hash = block_hash(last);
+
+        std::lock_guard<std::mutex> target_lock(mutex);
+        target = store.length();
+    }
+
+    //  keeps the last prune_depth blocks
+    void prune()
+    {
+        if (0 == prune_depth)
+            return;
+
+        std::lock_guard<std::mutex> lock(store_mutex);
+        if (store.length() <= prune_depth)
+            return;
+        uint64_t first = store.length() - prune_depth;
+        uint64_t bytes = store.prune(first);
+        if (0 == bytes)
+            return;
+        reclaimed += bytes;
+        log("pruned the blocks before " + std::to_string(first) + ", " +
+            std::to_string(bytes) + " bytes reclaimed");
+    }
+
+    //  on open only the last block is read, the whole chain is checked
+    //  here while the store is served already. a block that does not link
+    //  to the one before is dropped with the rest after it, the peers
+    //  give them again. a read only store is left as it is, the writer
+    //  drops them. a pruned store is checked from its first block, that
+    //  one's link is not known
+    void check()
+    {
+        string prev_hash;
+        uint64_t number = 0;
+        uint64_t first = 0;
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            number = first = store.first();
+        }
+        while (true)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopped)
+                    return;
+                checked = number;
+            }
+
+            std::lock_guard<std::mutex> lock(store_mutex);
+            uint64_t end = std::min(store.length(), number + check_batch);
+            if (number == end)
+                break;
+
+            for (; number != end; ++number)
+            {
+                SignedBlock signed_block;
+                string hash;
+                try
+                {
+                    signed_block.from_string(stored_block(number), nullptr);
+                    hash = block_hash(signed_block);
+                }
+                catch (std::exception const&)
+                {}
+
+                if (hash.empty() ||
+                    signed_block.block_details.header.block_number != number ||
+                    (0 == number && hash != genesis_hash) ||
+                    (first != number && signed_block.block_details.header.prev_hash != prev_hash))
+                {
+                    if (read_only)
+                    {
+                        log("stored block " + std::to_string(number) + " does not link to the chain");
+                        return;
+                    }
+                    log("stored block " + std::to_string(number) + " does not link to the chain, " +
+                        std::to_string(store.length() - number) + " blocks are dropped");
+                    store.truncate(number);
+                    flush_store();
+                    tip_hash = prev_hash;
+
+                    std::lock_guard<std::mutex> target_lock(mutex);
+                    target = number;
+                    break;
+                }
+                prev_hash = hash;
+            }
+        }
+    }
+
+    //  the blocks the node has applied past the stored ones, true when
+    //  it may have more right away. the node's block at the stored tip is
+    //  asked along, when it differs the node has reverted blocks and the
+    //  store goes back to where they agree. a node behind the store, still
+    //  syncing, is waited for
+    bool follow_node()
+    {
+        set_phase("node");
+        uint64_t base = 0;
+        string base_hash;
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            base = store.length();
+            base_hash = tip_hash;
+        }
+        bool with_base = (false == base_hash.empty());
+        uint64_t from = with_base ? base - 1 : base;
+
+        vector<SignedBlock> blocks = node_blocks_from(from, node_blocks + (with_base ? 1 : 0));
+        if (blocks.empty())
+        {
+            set_phase("synced");
+            return false;
+        }
+
+        string prev_hash = base_hash;
+        size_t index = 0;
+        if (with_base)
+        {
+            if (block_hash(blocks.front()) != base_hash)
+            {
+                return rewind([this](uint64_t start, uint64_t count)
+                {
+                    vector<string> result;
+                    for (auto const& item : node_blocks_from(start, count))
+                        result.push_back(block_hash(item));
+                    return result;
+                });
+            }
+            index = 1;
+        }
+
+        vector<noahpp::signature_verifier::item> items;
+        vector<string> hashes;
+        for (size_t item = index; item != blocks.size(); ++item)
+        {
+            auto const& header = blocks[item].block_details.header;
+            if (0 == header.block_number)
+            {
+                if (block_hash(blocks[item]) != genesis_hash)
+                    throw std::runtime_error("the node has a different genesis block");
+            }
+            else if (header.prev_hash != prev_hash)
+                throw std::runtime_error("the node's block " + std::to_string(header.block_number) +
+                                         " does not link to the previous one");
+            noahpp::signature_verifier::collect(blocks[item], items);
+            hashes.push_back(block_hash(blocks[item]));
+            prev_hash = hashes.back();
+        }
+        for (bool valid : verifier.verify(items))
+        {
+            if (false == valid)
+                throw std::runtime_error("a block from the node has a bad signature");
+        }
+        if (hashes.empty())
+        {
+            set_phase("synced");
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            for (size_t item = index; item != blocks.size(); ++item)
+                store.push_back(blocks[item].to_string());
+            flush_store();
+            tip_hash = hashes.back();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            target = std::max(target, base + hashes.size());
+        }
+        return hashes.size() >= node_blocks;
+    }
+
+    //  the node's blocks from..from + count - 1 in order, fewer when it
+    //  has fewer
+    vector<SignedBlock> node_blocks_from(uint64_t from, uint64_t count)
+    {
+        BlockchainRequest request;
+        request.blocks_from = from;
+        request.blocks_to = from + count - 1;
+
+        BlockchainResponse response;
+        node->call(request, response);
+
+        vector<SignedBlock> result;
+        for (auto& item : response.signed_blocks)
+        {
+            if (result.size() == count)
+                break;
+            if (item.block_details.header.block_number != from + result.size())
+                throw std::runtime_error("the node sent block " +
+                                         std::to_string(item.block_details.header.block_number) +
+                                         " while expecting " + std::to_string(from + result.size()));
+            result.push_back(std::move(item));
+        }
+        return result;
+    }
+
+    //  true when the peers may have more right away
+    bool round()
+    {
+        set_phase("headers");
+        uint64_t base = height();
+        string base_hash;
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            base_hash = tip_hash;
+        }
+
+        {
+            vector<std::thread> readers;
+            for (auto& plink : links)
+            {
+                auto& link = *plink;
+                readers.emplace_back([this, &link, base, &base_hash]
+                {
+                    link.headers.clear();
+                    link.forked = false;
+                    link.confirmed = false;
+                    try
+                    {
+                        read_headers(link, base, base_hash);
+                    }
+                    catch (std::exception const& ex)
+                    {
+                        link.headers.clear();
+                        log(link.name + ": " + ex.what());
+                    }
+                });
+            }
+            for (auto& reader : readers)
+                reader.join();
+        }
+
+        peer_link const* best = nullptr;
+        for (auto const& plink : links)
+        {
+            if (nullptr == best || plink->headers.size() > best->headers.size())
+                best = plink.get();
+        }
+
+        //  no peer has the last stored block and some have a different
+        //  one, the store goes back to where the first of those agrees
+        //  and the round is run again
+        peer_link* forked = nullptr;
+        bool confirmed = false;
+        for (auto const& plink : links)
+        {
+            if (plink->forked && nullptr == forked)
+                forked = plink.get();
+            confirmed = confirmed || plink->confirmed;
+        }
+        //  with a node the node decides
+        if (forked && false == confirmed && nullptr == node)
+        {
+            peer_link& link = *forked;
+            return rewind([this, &link](uint64_t from, uint64_t count)
+            {
+                return peer_hashes(link, from, count);
+            });
+        }
+
+        if (nullptr == best || best->headers.empty())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            phase = "synced";
+            target = base;
+            return false;
+        }
+
+        vector<header_line> target_headers = best->headers;
+        for (auto& plink : links)
+        {
+            auto& link = *plink;
+            size_t count = 0;
+            while (count < link.headers.size() &&
+                   link.headers[count].hash == target_headers[count].hash)
+                ++count;
+            link.agreed = base + count;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            phase = "blocks";
+            target = base + target_headers.size();
+        }
+
+        uint64_t next = download(base, target_headers);
+        if (next < base + target_headers.size())
+            return false;
+
+        set_phase("synced");
+        return target_headers.size() >= max_round_headers;
+    }
+
+    //  the last stored block's header is read along, a peer that has a
+    //  different one is marked forked
+    void read_headers(peer_link& link, uint64_t base, string const& base_hash)
+    {
+        string prev_hash = base_hash;
+        bool with_base = (false == base_hash.empty());
+        while (link.headers.size() < max_round_headers)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopped)
+                    return;
+            }
+
+            uint64_t from = base + link.headers.size() - (with_base ? 1 : 0);
+            string body = link.client->get("/headers?from=" + std::to_string(from) +
+                                           "&limit=" + std::to_string(max_headers));
+
+            uint64_t first = 0;
+            if (is_pruned_line(body, first))
+            {
+                log(link.name + " has pruned the blocks before " + std::to_string(first));
+                return;
+            }
+
+            std::istringstream lines(body);
+            string line;
+            uint64_t count = 0;
+            while (std::getline(lines, line))
+            {
+                header_line item;
+                std::istringstream fields(line);
+                if (false == static_cast<bool>(fields >> item.number >> item.hash) ||
+                    item.number != from + count)
+                    throw std::runtime_error("bad header line: " + line.substr(0, 256));
+                fields >> item.prev_hash;
+                ++count;
+
+                if (with_base)
+                {
+                    with_base = false;
+                    if (item.hash != base_hash)
+                    {
+                        link.forked = true;
+                        return;
+                    }
+                    link.confirmed = true;
+                    continue;
+                }
+
+                if (0 == item.number)
+                {
+                    if (item.hash != genesis_hash)
+                        throw std::runtime_error("a different genesis block");
+                }
+                else if (item.prev_hash != prev_hash)
+                    throw std::runtime_error("header " + std::to_string(item.number) +
+                                             " does not link to the previous one");
+
+                prev_hash = item.hash;
+                link.headers.push_back(std::move(item));
+            }
+
+            if (count < max_headers)
+                break;
+        }
+    }
+
+    //  the hashes a peer has for the blocks from..from + count - 1,
+    //  fewer when it has fewer
+    vector<string> peer_hashes(peer_link& link, uint64_t from, uint64_t count)
+    {
+        string body = link.client->get("/headers?from=" + std::to_string(from) +
+                                       "&limit=" + std::to_string(count));
+        vector<string> result;
+        uint64_t first = 0;
+        if (is_pruned_line(body, first))
+            return result;
+
+        std::istringstream lines(body);
+        string line;
+        while (result.size() < count && std::getline(lines, line))
+        {
+            header_line item;
+            std::istringstream fields(line);
+            if (false == static_cast<bool>(fields >> item.number >> item.hash) ||
+                item.number != from + result.size())
+                throw std::runtime_error("bad header line: " + line.substr(0, 256));
+            result.push_back(std::move(item.hash));
+        }
+        return result;
+    }
+
+    //  on a reorg, drops the stored blocks after the last one the other
+    //  side agrees on. hashes(from, count) are its hashes of those blocks.
+    //  false when the chains part before the first kept block, the store
+    //  is left as it is then
+    bool rewind(std::function<vector<string>(uint64_t, uint64_t)> const& hashes)
+    {
+        uint64_t end = 0;
+        uint64_t first = 0;
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            end = store.length();
+            first = store.first();
+        }
+
+        while (end > first)
+        {
+            uint64_t from = std::max(first, end > max_headers ? end - max_headers : 0);
+            vector<string> other = hashes(from, end - from);
+
+            std::lock_guard<std::mutex> lock(store_mutex);
+            for (uint64_t number = end; number-- > from;)
+            {
+                if (number - from >= other.size() || other[number - from] != stored_hash(number))
+                    continue;
+
+                log("reorg, " + std::to_string(store.length() - number - 1) +
+                    " blocks after " + std::to_string(number) + " are dropped");
+                store.truncate(number + 1);
+                flush_store();
+                tip_hash = other[number - from];
+
+                std::lock_guard<std::mutex> target_lock(mutex);
+                target = number + 1;
+                return true;
+            }
+            end = from;
+        }
+
+        log("reorg past the first kept block " + std::to_string(first) + ", the store is left as it is");
+        return false;
+    }
+
+    //  the height reached
+    uint64_t download(uint64_t base, vector<header_line> const& target_headers)
+    {
+        uint64_t end = base + target_headers.size();
+        noahpp::download_scheduler scheduler(base, end, window, max_ahead);
+        for (auto const& plink : links)
+        {
+            if (plink->agreed > base)
+                scheduler.add_peer(plink->name, plink->agreed);
+        }
+
+        std::atomic<bool> round_done(false);
+        std::map<uint64_t, vector<string>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pscheduler = &scheduler;
+        }
+
+        vector<std::thread> workers;
+        for (auto& plink : links)
+        {
+            auto& link = *plink;
+            if (link.agreed <= base)
+                continue;
+
+            workers.emplace_back([this, &link, &scheduler, &round_done, &ready, &target_headers, base]
+            {
+                noahpp::download_scheduler::range item;
+                while (false == round_done)
+                {
+                    if (false == scheduler.assign(link.name, item))
+                    {
+                        std::this_thread::sleep_for(idle_interval);
+                        continue;
+                    }
+
+                    vector<string> blocks;
+                    uint64_t bytes = 0;
+                    try
+                    {
+                        fetch_blocks(link, item, target_headers, base, blocks, bytes);
+                    }
+                    catch (std::exception const& ex)
+                    {
+                        scheduler.fail(link.name, item);
+                        log(link.name + ": " + ex.what());
+                        continue;
+                    }
+
+                    if (scheduler.complete(link.name, item, bytes))
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            ready[item.from] = std::move(blocks);
+                        }
+                        condition.notify_all();
+                    }
+                }
+            });
+        }
+
+        uint64_t next = base;
+        auto now = steady_clock::now();
+        auto last_progress = now;
+        auto last_flush = now;
+        auto rate_start = now;
+        uint64_t rate_blocks = 0;
+        while (next < end)
+        {
+            vector<string> blocks;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait_for(lock, std::chrono::seconds(1), [this, &ready, next]
+                {
+                    return stopped || ready.count(next);
+                });
+                if (stopped)
+                    break;
+
+                auto it = ready.find(next);
+                if (it != ready.end())
+                {
+                    blocks = std::move(it->second);
+                    ready.erase(it);
+                }
+            }
+
+            now = steady_clock::now();
+            if (false == blocks.empty())
+            {
+                {
+                    std::lock_guard<std::mutex> lock(store_mutex);
+                    for (auto const& block : blocks)
+                        store.push_back(block);
+                    tip_hash = target_headers[next + blocks.size() - 1 - base].hash;
+                }
+                next += blocks.size();
+                rate_blocks += blocks.size();
+                scheduler.written(next);
+                last_progress = now;
+            }
+
+            std::chrono::duration<double> rate_seconds = now - rate_start;
+            if (rate_seconds.count() >= 1)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                blocks_per_second = double(rate_blocks) / rate_seconds.count();
+                rate_start = now;
+                rate_blocks = 0;
+            }
+            if (now - last_flush > flush_interval)
+            {
+                std::lock_guard<std::mutex> lock(store_mutex);
+                flush_store();
+                last_flush = now;
+            }
+            if (now - last_progress > stall_interval)
+            {
+                log("no progress from the peers at " + std::to_string(next) + ", reading the headers again");
+                break;
+            }
+        }
+
+        round_done = true;
+        for (auto& worker : workers)
+            worker.join();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            last_peers = scheduler.peers();
+            pscheduler = nullptr;
+            blocks_per_second = 0;
+        }
+        {
+            std::lock_guard<std::mutex> lock(store_mutex);
+            flush_store();
+        }
+        return next;
+    }
+
+    //  the blocks of the range, checked against the target headers and
+    //  their signatures
+    void fetch_blocks(peer_link& link,
+                      noahpp::download_scheduler::range const& item,
+                      vector<header_line> const& target_headers,
+                      uint64_t base,
+                      vector<string>& blocks,
+                      uint64_t& bytes)
+    {
+        vector<noahpp::signature_verifier::item> items;
+        while (blocks.size() < item.count)
+        {
+            uint64_t from = item.from + blocks.size();
+            string body = link.client->get("/blocks?from=" + std::to_string(from) +
+                                           "&limit=" + std::to_string(item.count - blocks.size()) +
+                                           (known_transactions ? "&compact=1" : ""));
+            bytes += body.size();
+
+            uint64_t first = 0;
+            if (is_pruned_line(body, first))
+                throw std::runtime_error("pruned the blocks before " + std::to_string(first));
+
+            std::istringstream lines(body);
+            string line;
+            size_t count = 0;
+            while (blocks.size() < item.count && std::getline(lines, line))
+            {
+                uint64_t number = item.from + blocks.size();
+                string const& hash = target_headers[number - base].hash;
+                SignedBlock signed_block;
+                size_t tab = line.find('\t');
+                if (tab == string::npos)
+                    signed_block.from_string(line, nullptr);
+                else
+                {
+                    expand_block(link, line, tab, signed_block, bytes);
+                    if (block_hash(signed_block) != hash)
+                    {
+                        //  a short id matched a different transaction
+                        string full = link.client->get("/blocks?from=" + std::to_string(number) + "&limit=1");
+                        bytes += full.size();
+                        signed_block.from_string(full.substr(0, full.find('\n')), nullptr);
+                        ++full_blocks_fetched;
+                    }
+                }
+
+                if (signed_block.block_details.header.block_number != number ||
+                    block_hash(signed_block) != hash)
+                    throw std::runtime_error("block " + std::to_string(number) + " does not match its header");
+
+                noahpp::signature_verifier::collect(signed_block, items);
+                blocks.push_back(signed_block.to_string());
+                ++count;
+            }
+            if (0 == count)
+                throw std::runtime_error("no blocks from " + std::to_string(from));
+        }
+
+        for (bool valid : verifier.verify(items))
+        {
+            if (false == valid)
+                throw std::runtime_error("a block from " + std::to_string(item.from) + " has a bad signature");
+        }
+    }
+
+    //  a compact /blocks line, the transactions not known are asked by
+    //  index
+    void expand_block(peer_link& link,
+                      string const& line,
+                      size_t tab,
+                      SignedBlock& signed_block,
+                      uint64_t& bytes)
+    {
+        signed_block.from_string(line.substr(tab + 1), nullptr);
+        auto& transactions = signed_block.block_details.signed_transactions;
+        uint64_t number = signed_block.block_details.header.block_number;
+
+        std::istringstream ids(line.substr(0, tab));
+        string id;
+        vector<size_t> missing;
+        transactions.clear();
+        while (ids >> id)
+        {
+            transactions.emplace_back();
+            string value;
+            if (known_transactions && known_transactions->get(id, value))
+            {
+                transactions.back().from_string(value, nullptr);
+                ++transactions_known;
+            }
+            else
+                missing.push_back(transactions.size() - 1);
+        }
+        ++compact_blocks;
+        if (missing.empty())
+            return;
+
+        string indexes;
+        for (size_t index : missing)
+        {
+            if (false == indexes.empty())
+                indexes += ",";
+            indexes += std::to_string(index);
+        }
+        string body = link.client->get("/transactions?block=" + std::to_string(number) +
+                                       "&index=" + indexes);
+        bytes += body.size();
+
+        std::istringstream lines(body);
+        string transaction_line;
+        for (size_t index : missing)
+        {
+            if (false == static_cast<bool>(std::getline(lines, transaction_line)))
+                throw std::runtime_error("missing transactions of block " + std::to_string(number));
+            transactions[index].from_string(transaction_line, nullptr);
+            ++transactions_fetched;
+        }
+    }
+
+    void set_phase(string const& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        phase = value;
+    }
+
+    bool read_only;
+    uint64_t prune_depth;           //  0 keeps all blocks
+    mutable std::mutex store_mutex;
+    noahpp::block_store store;
+    std::atomic<uint64_t> reclaimed;    //  bytes of pruned blocks removed
+    string tip_hash;                //  of the last stored block
+    string genesis_hash;
+    vector<unique_ptr<peer_link>> links;
+    unique_ptr<rpc_client> node;    //  the blocks it applies are stored
+    noahpp::lru_cache* known_transactions;
+    std::atomic<uint64_t> compact_blocks;
+    std::atomic<uint64_t> transactions_known;
+    std::atomic<uint64_t> transactions_fetched;
+    std::atomic<uint64_t> full_blocks_fetched;     //  after a compact one did not match
+    noahpp::signature_verifier& verifier;
+    noahpp::metrics::histogram* flush_seconds;
+    beltpp::ilog* plogger;
+
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    bool stopped;
+    string phase;
+    uint64_t checked;               //  stored blocks checked so far
+    uint64_t target;
+    double blocks_per_second;
+    noahpp::download_scheduler* pscheduler;     //  while downloading blocks
+    vector<noahpp::download_scheduler::peer_stats> last_peers;
+
+    std::thread worker;
+};
+
+block_sync::block_sync(boost::filesystem::path const& path,
+                       bool read_only,
+                       uint64_t prune_depth,
+                       string const& genesis_block,
+                       vector<std::pair<string, unsigned short>> const& peers,
+                       string const& node_address,
+                       unsigned short node_port,
+                       noahpp::lru_cache* known_transactions,
+                       noahpp::signature_verifier& verifier,
+                       noahpp::metrics::histogram* flush_seconds,
+                       beltpp::ilog* plogger)
+    : m_pimpl(new impl(path,
+                       read_only,
+                       prune_depth,
+                       genesis_block,
+                       peers,
+                       node_address,
+                       node_port,
+                       known_transactions,
+                       verifier,
+                       flush_seconds,
+                       plogger))
+{
+    m_pimpl->worker = std::thread([this]
+    {
+        m_pimpl->run();
+    });
+}
+
+block_sync::~block_sync()
+{
+    stop();
+}
+
+uint64_t block_sync::height() const
+{
+    return m_pimpl->height();
+}
+
+uint64_t block_sync::first() const
+{
+    std::lock_guard<std::mutex> lock(m_pimpl->store_mutex);
+    return m_pimpl->store.first();
+}
+
+uint64_t block_sync::reclaimed_bytes() const
+{
+    return m_pimpl->reclaimed;
+}
+
+uint64_t block_sync::target() const
+{
+    uint64_t result = height();
+    std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+    return std::max(result, m_pimpl->target);
+}
+
+double block_sync::blocks_per_second() const
+{
+    std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+    return m_pimpl->blocks_per_second;
+}
+
+uint64_t block_sync::transactions_known() const
+{
+    return m_pimpl->transactions_known;
+}
+
+uint64_t block_sync::transactions_fetched() const
+{
+    return m_pimpl->transactions_fetched;
+}
+
+string block_sync::progress() const
+{
+    uint64_t height_value = height();
+    uint64_t first_value = first();
+
+    std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+    auto peers = m_pimpl->pscheduler ? m_pimpl->pscheduler->peers() : m_pimpl->last_peers;
+
+    std::ostringstream result;
+    result << "{\"phase\":\"" << m_pimpl->phase << "\""
+           << ",\"checked\":" << m_pimpl->checked
+           << ",\"first\":" << first_value
+           << ",\"height\":" << height_value
+           << ",\"target\":" << std::max(height_value, m_pimpl->target)
+           << ",\"blocks_per_second\":" << m_pimpl->blocks_per_second
+           << ",\"reclaimed_bytes\":" << m_pimpl->reclaimed
+           << ",\"compact\":{\"blocks\":" << m_pimpl->compact_blocks
+           << ",\"transactions_known\":" << m_pimpl->transactions_known
+           << ",\"transactions_fetched\":" << m_pimpl->transactions_fetched
+           << ",\"full_blocks_fetched\":" << m_pimpl->full_blocks_fetched << "}"
+           << ",\"peers\":[";
+    for (size_t index = 0; index != peers.size(); ++index)
+    {
+        auto const& item = peers[index];
+        if (index > 0)
+            result << ",";
+        result << "{\"peer\":\"" << item.peer << "\""
+               << ",\"height\":" << item.height
+               << ",\"blocks_per_second\":" << item.blocks_per_second
+               << ",\"blocks\":" << item.blocks
+               << ",\"bytes\":" << item.bytes
+               << ",\"failures\":" << item.failures
+               << ",\"timeouts\":" << item.timeouts
+               << ",\"in_flight\":" << item.in_flight
+               << ",\"benched\":" << (item.benched ? "true" : "false") << "}";
+    }
+    result << "]}";
+    return result.str();
+}
+
+bool block_sync::handle(http_request const& request, http_server::responder const& respond)
+{
+    if (request.path != "/headers" &&
+        request.path != "/blocks" &&
+        request.path != "/transactions" &&
+        request.path != "/sync")
+        return false;
+
+    http_response response;
+    if (request.method != "GET")
+    {
+        response.status = 405;
+        response.body = "method not allowed";
+        respond(std::move(response));
+        return true;
+    }
+
+    if (request.path == "/sync")
+    {
+        response.content_type = "application/json";
+        response.body = progress();
+        respond(std::move(response));
+        return true;
+    }
+
+    if (request.path == "/transactions")
+    {
+        try
+        {
+            uint64_t number = number_parameter(request, "block", 0);
+            string block;
+            {
+                std::lock_guard<std::mutex> lock(m_pimpl->store_mutex);
+                if (number >= m_pimpl->store.length() || number < m_pimpl->store.first())
+                    throw std::runtime_error("no block " + std::to_string(number));
+                block = m_pimpl->stored_block(number);
+            }
+
+            SignedBlock signed_block;
+            signed_block.from_string(block, nullptr);
+            auto const& transactions = signed_block.block_details.signed_transactions;
+
+            std::istringstream indexes(request.parameter("index"));
+            string index;
+            while (std::getline(indexes, index, ','))
+            {
+                if (index.empty() ||
+                    index.find_first_not_of("0123456789") != string::npos ||
+                    std::stoull(index) >= transactions.size())
+                    throw std::runtime_error("invalid index: " + index);
+                response.body += transactions[std::stoull(index)].to_string() + "\n";
+            }
+            response.content_type = "application/x-ndjson";
+        }
+        catch (std::exception const& ex)
+        {
+            response.status = 400;
+            response.body = ex.what();
+        }
+        respond(std::move(response));
+        return true;
+    }
+
+    uint64_t from = 0;
+    uint64_t limit = 0;
+    bool compact = (request.parameter("compact") == "1");
+    uint64_t max_limit = (request.path == "/headers") ? max_headers : max_blocks;
+    try
+    {
+        from = number_parameter(request, "from", 0);
+        limit = std::min(number_parameter(request, "limit", max_limit), max_limit);
+    }
+    catch (std::exception const& ex)
+    {
+        response.status = 400;
+        response.body = ex.what();
+        respond(std::move(response));
+        return true;
+    }
+
+    //  copied out under the lock, a push_back may remap the store
+    vector<string> blocks;
+    {
+        std::lock_guard<std::mutex> lock(m_pimpl->store_mutex);
+        if (from < m_pimpl->store.first())
+        {
+            response.body = pruned_line(m_pimpl->store.first());
+            respond(std::move(response));
+            return true;
+        }
+        size_t bytes = 0;
+        for (uint64_t number = from;
+             number < m_pimpl->store.length() && blocks.size() < limit;
+             ++number)
+        {
+            blocks.push_back(m_pimpl->stored_block(number));
+            bytes += blocks.back().size();
+            if (request.path == "/blocks" && bytes >= max_blocks_bytes)
+                break;
+        }
+    }
+
+    response.content_type = (request.path == "/blocks") ? "application/x-ndjson" : "text/plain; charset=utf-8";
+    for (auto const& block : blocks)
+    {
+        if (request.path == "/blocks")
+        {
+            response.body += compact ? compact_block(block) : block;
+            response.body += "\n";
+            continue;
+        }
+
+        SignedBlock signed_block;
+        signed_block.from_string(block, nullptr);
+        response.body += std::to_string(signed_block.block_details.header.block_number) + " " +
+                         block_hash(signed_block) + " " +
+                         signed_block.block_details.header.prev_hash + "\n";
+    }
+    respond(std::move(response));
+    return true;
+}
+
+string block_sync::short_transaction_id(string const& signed_transaction)
+{
+    return meshpp::hash(signed_transaction).substr(0, short_id_length);
+}
+
+void block_sync::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+        m_pimpl->stopped = true;
+    }
+    m_pimpl->condition.notify_all();
+    if (m_pimpl->worker.joinable())
+        m_pimpl->worker.join();
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "http_server.hpp"
+
+#include <belt.pp/global.hpp>
+#include <belt.pp/log.hpp>
+
+#include <noah.pp/lru_cache.hpp>
+#include <noah.pp/metrics.hpp>
+#include <noah.pp/signature_verifier.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+//  a copy of the blockchain in a block_store, taken from the node the
+//  blocks as it applies them, or downloaded from the noahd instances
+//  given as peers, and served to others in turn
+//
+//  served over HTTP:
+//      GET /headers?from=N&limit=M
+//          one line per block, "number hash prev_hash", where hash is
+//          the hash of the block details, as the next block's prev_hash.
+//          a pruned noahd answers "pruned F" for N before its first
+//          block F, the same for /blocks
+//      GET /blocks?from=N&limit=M[&compact=1]
+//          SignedBlock objects one per line, fewer than asked when they
+//          would not fit in one response. with compact=1 a block with
+//          transactions is sent as the short ids of its transactions,
+//          separated by spaces, a tab, and the block without them
+//      GET /transactions?block=N&index=I,J,...
+//          the block's transactions at those indexes, one per line
+//      GET /sync
+//          the download progress, a JSON object
+//
+//  the download is headers first. the headers past the stored blocks
+//  are read from every peer at once and each peer's have to link to
+//  each other and to the last stored block, or the genesis block. the
+//  longest such chain is the target. then the blocks are asked in
+//  ranges from all the peers that agree with the target, as
+//  download_scheduler hands them out, and each range is checked
+//  against the target headers and the signatures before the blocks are
+//  stored in order. once at the target the headers are read again
+//  every few seconds. everything runs on threads of its own
+//
+//  the headers are read from the last stored block on. when no peer has
+//  that block and some have a different one, the chain was reorganized,
+//  the store is truncated to the last block the first of those peers
+//  agrees on and the download goes on from there
+//
+//  with a node, every few seconds, and right away while it has more,
+//  its blocks past the stored ones are asked through its rpc with
+//  BlockchainRequest, checked to link and for their signatures and
+//  stored. the node's block at the stored tip is asked along, when the
+//  node has reverted it the store is truncated to the last block the
+//  node agrees on. the node decides reorgs then, not the peers, and a
+//  node behind the store is waited for
+//
+//  on open only the last stored block is read. the whole stored chain
+//  is checked on the worker thread while it is served already, before
+//  any download, a block that does not link is dropped with the ones
+//  after it
+//
+//  with prune_depth, only the last prune_depth blocks are kept. after
+//  each round the segments of the older ones are removed from the
+//  block_store. a peer that answers "pruned" sits out the round
+//
+//  a read only block_sync serves the block_store another noahd writes
+//  to, it has no peers and picks up the writer's blocks every second.
+//  a block that does not link is not dropped, only logged
+//
+//  with known_transactions, the transactions this noahd has seen by
+//  short_transaction_id, see rpc_gateway.hpp, the blocks are asked
+//  compact. a block is put together from the known transactions and
+//  the rest are asked by index, if the result does not match the header
+//  the block is asked in full. a peer that does not know compact=1
+//  sends full blocks, those are taken as they are
+class block_sync
+{
+public:
+    block_sync(boost::filesystem::path const& path,
+               bool read_only,
+               uint64_t prune_depth,
+               std::string const& genesis_block,
+               std::vector<std::pair<std::string, unsigned short>> const& peers,
+               //  0 port for no node
+               std::string const& node_address,
+               unsigned short node_port,
+               noahpp::lru_cache* known_transactions,
+               noahpp::signature_verifier& verifier,
+               //  observes each flush of the block store, may be nullptr
+               noahpp::metrics::histogram* flush_seconds,
+               beltpp::ilog* plogger);
+    block_sync(block_sync const&) = delete;
+    ~block_sync();
+
+    //  blocks stored
+    uint64_t height() const;
+    //  the first block kept, 0 unless pruned
+    uint64_t first() const;
+    //  bytes removed by pruning since start
+    uint64_t reclaimed_bytes() const;
+    //  blocks in the target chain, the same as height() when there
+    //  is nothing to download
+    uint64_t target() const;
+    double blocks_per_second() const;
+    //  transactions of compact blocks found in known_transactions and
+    //  asked from the peers
+    uint64_t transactions_known() const;
+    uint64_t transactions_fetched() const;
+    //  the /sync object
+    std::string progress() const;
+
+    //  true if the request was for this
+    bool handle(http_request const& request, http_server::responder const& respond);
+
+    void stop();
+
+    //  of a SignedTransaction's string, the start of its hash
+    static std::string short_transaction_id(std::string const& signed_transaction);
+
+    class impl;
+private:
+    std::unique_ptr<impl> m_pimpl;
+};
@@ -0,0 +1,74 @@
+#include "compression.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using std::string;
+
+namespace
+{
+//  windowBits above 15 ask zlib for the gzip header and trailer
+int const gzip_window_bits = 15 + 16;
+size_t const chunk_size = 64 * 1024;
+}
+
+string gzip_compress(string const& data)
+{
+    if (data.size() > std::numeric_limits<uInt>::max())
+        throw std::runtime_error("gzip: too much to compress at once");
+
+    z_stream stream = z_stream();
+    if (Z_OK != deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, gzip_window_bits, 8, Z_DEFAULT_STRATEGY))
+        throw std::runtime_error("gzip: deflateInit2 failed");
+
+    string result(deflateBound(&stream, uLong(data.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&result[0]);
+    stream.avail_out = uInt(result.size());
+
+    int code = deflate(&stream, Z_FINISH);
+    result.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (Z_STREAM_END != code)
+        throw std::runtime_error("gzip: deflate failed");
+    return result;
+}
+
+string gzip_decompress(string const& data, size_t max_size)
+{
+    if (data.size() > std::numeric_limits<uInt>::max())
+        throw std::runtime_error("gzip: too much to decompress at once");
+
+    z_stream stream = z_stream();
+    if (Z_OK != inflateInit2(&stream, gzip_window_bits))
+        throw std::runtime_error("gzip: inflateInit2 failed");
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = uInt(data.size());
+
+    string result;
+    int code = Z_OK;
+    while (Z_OK == code)
+    {
+        size_t used = result.size();
+        if (used >= max_size)
+            break;
+        result.resize(std::min(used + chunk_size, max_size));
+        stream.next_out = reinterpret_cast<Bytef*>(&result[used]);
+        stream.avail_out = uInt(result.size() - used);
+
+        code = inflate(&stream, Z_NO_FLUSH);
+        result.resize(stream.total_out);
+    }
+    inflateEnd(&stream);
+
+    if (Z_STREAM_END != code)
+        throw std::runtime_error(result.size() >= max_size ? "gzip: decompressed data is too large" :
+                                                             "gzip: the data is not valid");
+    return result;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+//  the gzip format of HTTP's Content-Encoding: gzip
+std::string gzip_compress(std::string const& data);
+
+//  throws on what is not gzip, or would grow beyond max_size
+std::string gzip_decompress(std::string const& data,
+                            size_t max_size = 256 * 1024 * 1024);
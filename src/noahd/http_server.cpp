@@ -0,0 +1,691 @@
+#include "http_server.hpp"
+#include "compression.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using std::string;
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+namespace
+{
+size_t const max_header_size = 64 * 1024;
+//  the body is read this much at a time, it grows with what arrives
+size_t const body_piece_size = 64 * 1024;
+//  smaller bodies are not worth the time to compress
+size_t const min_compressed_size = 1024;
+//  for a kept alive connection to start its next request, and for each
+//  piece of a body to arrive
+std::chrono::seconds const idle_timeout(60);
+
+char const* status_text(int status)
+{
+    switch (status)
+    {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+bool parse_header(string const& text, http_request& request)
+{
+    std::istringstream stream(text);
+    string line;
+    if (false == static_cast<bool>(std::getline(stream, line)))
+        return false;
+    boost::algorithm::trim_right_if(line, boost::algorithm::is_any_of("\r"));
+
+    std::istringstream request_line(line);
+    string target;
+    request_line >> request.method >> target >> request.version;
+    if (request.method.empty() || target.empty() ||
+        0 != request.version.compare(0, 5, "HTTP/"))
+        return false;
+
+    auto question = target.find('?');
+    request.path = target.substr(0, question);
+    if (question != string::npos)
+        request.query = target.substr(question + 1);
+
+    while (std::getline(stream, line))
+    {
+        boost::algorithm::trim_right_if(line, boost::algorithm::is_any_of("\r"));
+        if (line.empty())
+            break;
+
+        auto colon = line.find(':');
+        if (colon == string::npos)
+            return false;
+        string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+        string value = boost::algorithm::trim_copy(line.substr(colon + 1));
+        request.headers[name] = value;
+    }
+
+    return true;
+}
+
+string url_decode(string const& text)
+{
+    string result;
+    for (size_t index = 0; index < text.size(); ++index)
+    {
+        char ch = text[index];
+        if ('+' == ch)
+            result += ' ';
+        else if ('%' == ch && index + 2 < text.size() &&
+                 std::isxdigit(static_cast<unsigned char>(text[index + 1])) &&
+                 std::isxdigit(static_cast<unsigned char>(text[index + 2])))
+        {
+            result += char(std::stoi(text.substr(index + 1, 2), nullptr, 16));
+            index += 2;
+        }
+        else
+            result += ch;
+    }
+    return result;
+}
+}
+
+string http_request::parameter(string const& name) const
+{
+    size_t position = 0;
+    while (position <= query.size())
+    {
+        size_t end = query.find('&', position);
+        if (end == string::npos)
+            end = query.size();
+
+        string item = query.substr(position, end - position);
+        size_t equal = item.find('=');
+        if (url_decode(item.substr(0, equal)) == name)
+            return equal == string::npos ? string() : url_decode(item.substr(equal + 1));
+
+        position = end + 1;
+    }
+    return string();
+}
+
+//  a connection that is not HTTP, passed on to another address as it is
+//  in both directions, until either side closes it
+class raw_pipe : public std::enable_shared_from_this<raw_pipe>
+{
+public:
+    raw_pipe(tcp::socket&& client, asio::streambuf& received)
+        : m_client(std::move(client))
+        , m_target(m_client.get_executor())
+        , m_pending(received.size())
+        , m_closed(false)
+    {
+        asio::buffer_copy(asio::buffer(m_to_target), received.data());
+        received.consume(m_pending);
+    }
+
+    void start(string const& address, unsigned short port)
+    {
+        auto self = shared_from_this();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        boost::system::error_code ec;
+        tcp::endpoint endpoint(asio::ip::make_address(address, ec), port);
+        if (ec)
+            return close();
+
+        m_target.async_connect(endpoint, [self](boost::system::error_code const& ec)
+        {
+            std::lock_guard<std::mutex> lock(self->m_mutex);
+            if (ec || self->m_closed)
+                return self->close();
+
+            boost::system::error_code ignored;
+            self->m_target.set_option(tcp::no_delay(true), ignored);
+            self->transfer(self->m_client, self->m_target, self->m_to_target, self->m_pending);
+            self->transfer(self->m_target, self->m_client, self->m_to_client, 0);
+        });
+    }
+
+private:
+    using buffer_type = std::array<char, max_header_size>;
+
+    //  called with m_mutex locked. writes size bytes of the buffer to
+    //  to, then reads from from into it again
+    void transfer(tcp::socket& from, tcp::socket& to, buffer_type& buffer, size_t size)
+    {
+        auto self = shared_from_this();
+        if (0 == size)
+        {
+            from.async_read_some(asio::buffer(buffer),
+                                 [self, &from, &to, &buffer](boost::system::error_code const& ec, size_t read)
+            {
+                std::lock_guard<std::mutex> lock(self->m_mutex);
+                if (ec || self->m_closed)
+                    return self->close();
+                self->transfer(from, to, buffer, read);
+            });
+            return;
+        }
+
+        asio::async_write(to, asio::buffer(buffer.data(), size),
+                          [self, &from, &to, &buffer](boost::system::error_code const& ec, size_t)
+        {
+            std::lock_guard<std::mutex> lock(self->m_mutex);
+            if (ec || self->m_closed)
+                return self->close();
+            self->transfer(from, to, buffer, 0);
+        });
+    }
+
+    //  called with m_mutex locked
+    void close()
+    {
+        m_closed = true;
+        boost::system::error_code ec;
+        m_client.shutdown(tcp::socket::shutdown_both, ec);
+        m_client.close(ec);
+        m_target.shutdown(tcp::socket::shutdown_both, ec);
+        m_target.close(ec);
+    }
+
+    //  the sockets are touched with this locked only
+    std::mutex m_mutex;
+    tcp::socket m_client;
+    tcp::socket m_target;
+    buffer_type m_to_target;
+    buffer_type m_to_client;
+    size_t m_pending;   //  read before the connection was known not to be HTTP
+    bool m_closed;
+};
+
+class connection : public http_stream
+                 , public std::enable_shared_from_this<connection>
+{
+public:
+    connection(tcp::socket&& socket,
+               http_server::handler const& request_handler,
+               size_t max_body_size,
+               string const& raw_address,
+               unsigned short raw_port)
+        : m_socket(std::move(socket))
+        , m_buffer(max_header_size)
+        , m_handler(request_handler)
+        , m_max_body_size(max_body_size)
+        , m_raw_address(raw_address)
+        , m_raw_port(raw_port)
+        , m_keep_alive(false)
+        , m_gzip(false)
+        , m_mutex()
+        , m_idle(m_socket.get_executor())
+        , m_queue()
+        , m_backlog(0)
+        , m_reads(0)
+        , m_reading(false)
+        , m_read_next(false)
+        , m_writing(false)
+        , m_closing(false)
+        , m_closed(false)
+    {}
+
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (0 == m_raw_port)
+            return read_header();
+
+        //  a JSON client of the node starts with its first message, an
+        //  HTTP one with the request line
+        auto self = shared_from_this();
+        start_read();
+        asio::async_read(m_socket, m_buffer, asio::transfer_at_least(1),
+                         [self](boost::system::error_code const& ec, size_t)
+        {
+            std::lock_guard<std::mutex> lock(self->m_mutex);
+            self->m_reading = false;
+            self->m_idle.cancel();
+            if (ec || self->m_closed)
+                return;
+
+            char first = *asio::buffers_begin(self->m_buffer.data());
+            if ('{' != first && '[' != first)
+                return self->read_header();
+
+            self->m_closed = true;
+            std::make_shared<raw_pipe>(std::move(self->m_socket), self->m_buffer)->start(self->m_raw_address,
+                                                                                         self->m_raw_port);
+        });
+    }
+
+    bool write(string&& chunk) override
+    {
+        if (chunk.empty())
+            return true;    //  an empty chunk would end the body
+
+        std::ostringstream size;
+        size << std::hex << chunk.size() << "\r\n";
+        return enqueue(size.str() + chunk + "\r\n", false);
+    }
+
+    size_t backlog() const override
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_backlog;
+    }
+
+    void close() override
+    {
+        enqueue("0\r\n\r\n", true);
+    }
+
+private:
+    //  called with m_mutex locked. requests on one connection are taken
+    //  one at a time, the next one is read once the answer to the last
+    //  one is written, so the answers of pipelined requests keep their
+    //  order. a connection that does not start a request within the
+    //  idle timeout is closed
+    void read_header()
+    {
+        auto self = shared_from_this();
+        start_read();
+
+        asio::async_read_until(m_socket, m_buffer, "\r\n\r\n",
+                               [self](boost::system::error_code const& ec, size_t size)
+        {
+            {
+                std::lock_guard<std::mutex> lock(self->m_mutex);
+                self->m_reading = false;
+                self->m_idle.cancel();
+            }
+
+            if (ec)
+            {
+                if (ec == asio::error::not_found)
+                    self->reply_error(413);
+                return;
+            }
+            self->on_header(size);
+        });
+    }
+
+    //  called with m_mutex locked. the connection is closed unless the
+    //  read started here ends within the idle timeout
+    void start_read()
+    {
+        auto self = shared_from_this();
+        uint64_t read = ++m_reads;
+        m_reading = true;
+
+        m_idle.expires_after(idle_timeout);
+        m_idle.async_wait([self, read](boost::system::error_code const& ec)
+        {
+            std::lock_guard<std::mutex> lock(self->m_mutex);
+            if (false == static_cast<bool>(ec) &&
+                read == self->m_reads &&
+                self->m_reading &&
+                false == self->m_closed)
+                self->shutdown();
+        });
+    }
+
+    //  called with m_mutex locked. the body is taken a piece at a time
+    //  and grows as the bytes arrive, Content-Length alone does not
+    //  reserve the memory
+    void read_body(size_t remaining)
+    {
+        auto self = shared_from_this();
+        start_read();
+
+        size_t offset = m_request.body.size();
+        size_t piece = std::min(remaining, body_piece_size);
+        m_request.body.resize(offset + piece);
+        asio::async_read(m_socket,
+                         asio::buffer(&m_request.body[offset], piece),
+                         [self, remaining, piece](boost::system::error_code const& ec, size_t)
+        {
+            {
+                std::lock_guard<std::mutex> lock(self->m_mutex);
+                self->m_reading = false;
+                self->m_idle.cancel();
+
+                if (ec)
+                    return;
+                if (remaining > piece)
+                    return self->read_body(remaining - piece);
+            }
+            self->dispatch();
+        });
+    }
+
+    void on_header(size_t size)
+    {
+        string text(asio::buffers_begin(m_buffer.data()),
+                    asio::buffers_begin(m_buffer.data()) + std::ptrdiff_t(size));
+        m_buffer.consume(size);
+
+        m_request = http_request();
+        if (false == parse_header(text, m_request))
+            return reply_error(400);
+
+        string connection_header = boost::algorithm::to_lower_copy(m_request.header("connection"));
+        if ("HTTP/1.1" == m_request.version)
+            m_keep_alive = (connection_header.find("close") == string::npos);
+        else
+            m_keep_alive = (connection_header.find("keep-alive") != string::npos);
+        m_gzip = (boost::algorithm::to_lower_copy(m_request.header("accept-encoding")).find("gzip") != string::npos);
+
+        size_t content_length = 0;
+        string str_length = m_request.header("content-length");
+        if (false == str_length.empty())
+        {
+            try
+            {
+                content_length = std::stoull(str_length);
+            }
+            catch (...)
+            {
+                return reply_error(400);
+            }
+        }
+        if (content_length > m_max_body_size)
+            return reply_error(413);
+
+        size_t buffered = std::min(content_length, m_buffer.size());
+        m_request.body.assign(asio::buffers_begin(m_buffer.data()),
+                              asio::buffers_begin(m_buffer.data()) + std::ptrdiff_t(buffered));
+        m_buffer.consume(buffered);
+
+        if (buffered == content_length)
+            return dispatch();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        read_body(content_length - buffered);
+    }
+
+    void dispatch()
+    {
+        auto self = shared_from_this();
+        http_server::responder respond = [self](http_response&& response)
+        {
+            self->send(std::move(response));
+        };
+
+        try
+        {
+            m_handler(std::move(m_request), respond);
+        }
+        catch (std::exception const& ex)
+        {
+            http_response response;
+            response.status = 500;
+            response.body = ex.what();
+            respond(std::move(response));
+        }
+    }
+
+    //  the request could not be read, so the connection can't go on
+    void reply_error(int status)
+    {
+        m_keep_alive = false;
+        http_response response;
+        response.status = status;
+        response.body = status_text(status);
+        send(std::move(response));
+    }
+
+    //  a stream ends with the connection, other answers keep it open
+    //  when the client asked for that
+    void send(http_response&& response)
+    {
+        bool streaming = static_cast<bool>(response.on_stream);
+        bool keep_alive = m_keep_alive && false == streaming;
+
+        std::ostringstream header;
+        header << "HTTP/1.1 " << response.status << " " << status_text(response.status) << "\r\n"
+               << "Content-Type: " << response.content_type << "\r\n";
+        if (streaming)
+            header << "Transfer-Encoding: chunked\r\n";
+        else
+        {
+            if (m_gzip && response.body.size() >= min_compressed_size)
+            {
+                response.body = gzip_compress(response.body);
+                header << "Content-Encoding: gzip\r\n"
+                       << "Vary: Accept-Encoding\r\n";
+            }
+            header << "Content-Length: " << response.body.size() << "\r\n";
+        }
+        header << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n";
+        for (auto const& item : response.headers)
+            header << item.first << ": " << item.second << "\r\n";
+        header << "\r\n";
+
+        if (false == streaming)
+        {
+            enqueue(header.str() + response.body, false == keep_alive, keep_alive);
+            return;
+        }
+
+        enqueue(header.str(), false);
+        response.on_stream(shared_from_this());
+    }
+
+    //  one write at a time is in flight, the rest waits in the queue.
+    //  read_next starts reading the next request once all is written
+    bool enqueue(string&& data, bool last, bool read_next = false)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_closed || m_closing)
+                return false;
+
+            m_backlog += data.size();
+            m_queue.push_back(std::move(data));
+            m_closing = last;
+            m_read_next = read_next;
+            if (m_writing)
+                return true;
+            m_writing = true;
+        }
+
+        auto self = shared_from_this();
+        asio::post(m_socket.get_executor(), [self]
+        {
+            self->write_next();
+        });
+        return true;
+    }
+
+    void write_next()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty())
+        {
+            m_writing = false;
+            if (m_closing)
+                shutdown();
+            else if (m_read_next && false == m_closed)
+            {
+                m_read_next = false;
+                read_header();
+            }
+            return;
+        }
+
+        auto self = shared_from_this();
+        asio::async_write(m_socket, asio::buffer(m_queue.front()),
+                          [self](boost::system::error_code const& ec, size_t)
+        {
+            {
+                std::lock_guard<std::mutex> lock(self->m_mutex);
+                self->m_backlog -= self->m_queue.front().size();
+                self->m_queue.pop_front();
+
+                if (ec)
+                {
+                    self->m_queue.clear();
+                    self->m_backlog = 0;
+                    self->m_writing = false;
+                    self->shutdown();
+                    return;
+                }
+            }
+            self->write_next();
+        });
+    }
+
+    //  called with m_mutex locked
+    void shutdown()
+    {
+        m_closed = true;
+        m_idle.cancel();
+        boost::system::error_code ec;
+        m_socket.shutdown(tcp::socket::shutdown_both, ec);
+        m_socket.close(ec);
+    }
+
+    tcp::socket m_socket;
+    asio::streambuf m_buffer;
+    http_server::handler const& m_handler;
+    size_t m_max_body_size;
+    string m_raw_address;
+    unsigned short m_raw_port;      //  0 when every connection is HTTP
+    http_request m_request;
+    bool m_keep_alive;
+    bool m_gzip;
+
+    //  the socket and the timer are touched with this locked only
+    mutable std::mutex m_mutex;
+    asio::steady_timer m_idle;
+    std::deque<string> m_queue;
+    size_t m_backlog;
+    uint64_t m_reads;
+    bool m_reading;
+    bool m_read_next;
+    bool m_writing;
+    bool m_closing;
+    bool m_closed;
+};
+
+class http_server::impl
+{
+public:
+    impl(string const& address,
+         unsigned short port,
+         handler const& request_handler,
+         size_t max_body_size,
+         string const& raw_address,
+         unsigned short raw_port)
+        : m_context()
+        , m_acceptor(m_context)
+        , m_handler(request_handler)
+        , m_max_body_size(max_body_size)
+        , m_raw_address(raw_address)
+        , m_raw_port(raw_port)
+    {
+        tcp::endpoint endpoint(asio::ip::make_address(address), port);
+        m_acceptor.open(endpoint.protocol());
+        m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+        m_acceptor.bind(endpoint);
+        m_acceptor.listen();
+    }
+
+    void accept()
+    {
+        m_acceptor.async_accept([this](boost::system::error_code const& ec, tcp::socket socket)
+        {
+            if (false == m_acceptor.is_open())
+                return;
+            if (false == static_cast<bool>(ec))
+            {
+                //  the answers to pipelined requests are small writes one
+                //  after another, they should not wait for acks
+                boost::system::error_code ignored;
+                socket.set_option(tcp::no_delay(true), ignored);
+                std::make_shared<connection>(std::move(socket),
+                                             m_handler,
+                                             m_max_body_size,
+                                             m_raw_address,
+                                             m_raw_port)->start();
+            }
+            accept();
+        });
+    }
+
+    asio::io_context m_context;
+    tcp::acceptor m_acceptor;
+    handler m_handler;
+    size_t m_max_body_size;
+    string m_raw_address;
+    unsigned short m_raw_port;
+    std::vector<std::thread> m_threads;
+};
+
+http_server::http_server(string const& address,
+                         unsigned short port,
+                         handler const& request_handler,
+                         size_t threads,
+                         size_t max_body_size,
+                         string const& raw_address,
+                         unsigned short raw_port)
+    : m_pimpl(new impl(address, port, request_handler, max_body_size, raw_address, raw_port))
+{
+    m_pimpl->accept();
+
+    if (0 == threads)
+        threads = 1;
+    for (size_t index = 0; index != threads; ++index)
+        m_pimpl->m_threads.emplace_back([this]
+        {
+            while (true)
+            {
+                try
+                {
+                    m_pimpl->m_context.run();
+                    break;
+                }
+                catch (std::exception const& ex)
+                {
+                    std::cout << "http server: " << ex.what() << std::endl;
+                }
+            }
+        });
+}
+
+http_server::~http_server()
+{
+    stop();
+}
+
+void http_server::stop()
+{
+    if (m_pimpl->m_threads.empty())
+        return;
+
+    asio::post(m_pimpl->m_context, [this]
+    {
+        boost::system::error_code ec;
+        m_pimpl->m_acceptor.close(ec);
+    });
+    m_pimpl->m_context.stop();
+
+    for (auto& thread : m_pimpl->m_threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    m_pimpl->m_threads.clear();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <belt.pp/global.hpp>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class http_request
+{
+public:
+    std::string method;
+    std::string path;       //  without the query
+    std::string query;
+    std::string version;
+    std::map<std::string, std::string> headers;    //  names in lower case
+    std::string body;
+
+    std::string header(std::string const& name) const
+    {
+        auto it = headers.find(name);
+        if (it == headers.end())
+            return std::string();
+        return it->second;
+    }
+
+    //  the decoded value from the query, empty if it is not there
+    std::string parameter(std::string const& name) const;
+};
+
+//  the body of a response that goes on after the header, sent in
+//  HTTP chunks. any thread may write, the chunks go out in order
+class http_stream
+{
+public:
+    virtual ~http_stream() {}
+
+    //  false once the client has gone away, the chunk is dropped then
+    virtual bool write(std::string&& chunk) = 0;
+    //  bytes written and not yet sent, the writer should slow down
+    //  when this grows
+    virtual size_t backlog() const = 0;
+    //  ends the body and the connection after what is already queued
+    virtual void close() = 0;
+};
+
+class http_response
+{
+public:
+    int status = 200;
+    std::string content_type = "text/plain; charset=utf-8";
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    //  when set the body is not sent, instead this gets the stream
+    //  right after the header went out
+    std::function<void(std::shared_ptr<http_stream> const&)> on_stream;
+};
+
+//  small HTTP/1.1 listener for noahd's own endpoints, served by
+//  its own threads. the handler gets a responder, which may be
+//  called later and from any thread. a request with a body larger
+//  than max_body_size is answered 413, the endpoints that only take
+//  GET need max_get_body_size
+//
+//  with raw_port, a connection that starts with '{' or '[' is not HTTP
+//  but a JSON client, it is passed as it is to raw_address:raw_port
+class http_server
+{
+public:
+    using responder = std::function<void(http_response&&)>;
+    using handler = std::function<void(http_request&&, responder)>;
+
+    static size_t const default_max_body_size = 64 * 1024 * 1024;
+    static size_t const max_get_body_size = 64 * 1024;
+
+    http_server(std::string const& address,
+                unsigned short port,
+                handler const& request_handler,
+                size_t threads = 1,
+                size_t max_body_size = default_max_body_size,
+                std::string const& raw_address = std::string(),
+                unsigned short raw_port = 0);
+    http_server(http_server const&) = delete;
+    ~http_server();
+
+    void stop();
+
+    class impl;
+private:
+    std::unique_ptr<impl> m_pimpl;
+};
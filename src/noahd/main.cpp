@@ -12,18 +12,44 @@
 #include <publiq.pp/coin.hpp>
 #include <publiq.pp/message.tmpl.hpp>
 
+#include <noah.pp/worker_pool.hpp>
+#include <noah.pp/signature_verifier.hpp>
+#include <noah.pp/genesis.hpp>
+#include <noah.pp/kv_backend.hpp>
+#include <noah.pp/lru_cache.hpp>
+#include <noah.pp/metrics.hpp>
+#include <noah.pp/write_ahead_log.hpp>
+
+#include "action_follower.hpp"
+#include "async_logger.hpp"
+#include "block_sync.hpp"
+#include "http_server.hpp"
+#include "rpc_gateway.hpp"
+#include "snapshot.hpp"
+#include "startup.hpp"
+
+#ifdef NOAHD_ALLOCATION_COUNTERS
+#include <noah.pp/allocation_hooks.hpp>
+#endif
+
 #include <boost/program_options.hpp>
 #include <boost/locale.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <iostream>
 #include <vector>
 #include <sstream>
 #include <exception>
 #include <thread>
+#include <set>
 #include <functional>
+#include <chrono>
+#include <future>
 
 #include <csignal>
 
@@ -37,27 +63,106 @@ using std::endl;
 using std::vector;
 using std::runtime_error;
 
+//  one node with noahd's stores and interfaces around it. noahd runs the
+//  one given on the command line and one more for each --instance file,
+//  every one with its own data directory and ports
+class instance_options
+{
+public:
+    //  empty for the command line one, the file name for the others
+    string name;
+    beltpp::ip_address p2p_bind_to_address;
+    vector<beltpp::ip_address> p2p_connect_to_addresses;
+    beltpp::ip_address rpc_bind_to_address;
+    beltpp::ip_address node_rpc_bind_to_address;
+    beltpp::ip_address metrics_bind_to_address;
+    beltpp::ip_address actions_bind_to_address;
+    beltpp::ip_address blocks_bind_to_address;
+    vector<beltpp::ip_address> block_sync_peers;
+    beltpp::ip_address public_address;
+    boost::filesystem::path data_directory;
+    //  another noahd's data directory, its action index and block store
+    //  are served read only and there is no node
+    boost::filesystem::path read_only_replica;
+    string private_key;
+    bool log_enabled = false;
+    bool action_index = false;
+    string action_index_backend;
+    bool testnet = false;
+    uint64_t tx_pool_memory = 0;
+    uint64_t rpc_cache_memory = 0;
+    //  blocks kept in the block store and the action index, 0 keeps all
+    uint64_t prune_depth = 0;
+
+    //  as meshpp::data_directory_path and meshpp::data_file_path, in
+    //  this instance's data directory
+    boost::filesystem::path directory_path(string const& directory) const
+    {
+        auto result = data_directory / directory;
+        boost::filesystem::create_directories(result);
+        return result;
+    }
+    boost::filesystem::path file_path(string const& file) const
+    {
+        return data_directory / file;
+    }
+
+    //  every port the instance listens on
+    std::set<unsigned short> ports() const
+    {
+        std::set<unsigned short> result;
+        for (auto const* address : {&p2p_bind_to_address,
+                                    &rpc_bind_to_address,
+                                    &node_rpc_bind_to_address,
+                                    &metrics_bind_to_address,
+                                    &actions_bind_to_address,
+                                    &blocks_bind_to_address})
+        {
+            if (false == address->local.empty())
+                result.insert(address->local.port);
+        }
+        return result;
+    }
+};
+
+//  what the instances share
+class shared_services
+{
+public:
+    async_log_service* log_service = nullptr;
+    uint64_t log_file_size = 0;
+    noahpp::worker_pool* pool = nullptr;
+    noahpp::signature_verifier* verifier = nullptr;
+    bool fast_start = false;
+};
+
 bool process_command_line(int argc, char** argv,
-                          beltpp::ip_address& p2p_bind_to_address,
-                          vector<beltpp::ip_address>& p2p_connect_to_addresses,
-                          beltpp::ip_address& rpc_bind_to_address,
-                          beltpp::ip_address& public_address,
-                          string& data_directory,
-                          meshpp::private_key& pv_key,
-                          bool& log_enabled,
-                          bool& testnet);
-
-string genesis_signed_block(bool testnet);
-publiqpp::coin mine_amount_threshhold();
-vector<publiqpp::coin> block_reward_array();
-
-static bool g_termination_handled = false;
-static publiqpp::node* g_pnode = nullptr;
+                          vector<instance_options>& instances,
+                          bool& fast_start,
+                          size_t& worker_threads,
+                          string& export_snapshot_path,
+                          string& bootstrap_snapshot_path,
+                          string& snapshot_signer,
+                          string& async_log,
+                          uint64_t& log_file_size);
+
+//  publiqpp::node has no way to share its threads with another one, each
+//  instance runs its own on a thread of its own
+size_t const max_instances = 64;
+//  a reorg deeper than this is not expected, the blocks it reverts
+//  have to be there
+uint64_t const min_prune_depth = 100;
+static std::atomic<bool> g_termination_handled(false);
+static std::atomic<publiqpp::node*> g_pnodes[max_instances];
 void termination_handler(int /*signum*/)
 {
     g_termination_handled = true;
-    if (g_pnode)
-        g_pnode->wake();
+    for (auto& item : g_pnodes)
+    {
+        auto pnode = item.load();
+        if (pnode)
+            pnode->wake();
+    }
 }
 
 class port2pid_helper
@@ -131,7 +236,18 @@ private:
 };
 
 template <typename NODE>
-void loop(NODE& node, beltpp::ilog_ptr& plogger_exceptions, bool& termination_handled);
+void loop(NODE& node,
+          beltpp::ilog_ptr& plogger_exceptions,
+          std::atomic<bool>& termination_handled,
+          noahpp::metrics::histogram& run_seconds,
+          noahpp::metrics::counter& run_errors);
+
+void run_instance(instance_options const& options,
+                  size_t slot,
+                  shared_services const& services,
+                  string const& export_snapshot_path,
+                  string const& bootstrap_snapshot_path,
+                  string const& snapshot_signer);
 
 int main(int argc, char** argv)
 {
@@ -147,35 +263,33 @@ int main(int argc, char** argv)
     meshpp::settings::set_application_name("noahd");
     meshpp::settings::set_data_directory(meshpp::config_directory_path().string());
 
-    beltpp::ip_address p2p_bind_to_address;
-    beltpp::ip_address rpc_bind_to_address;
-    beltpp::ip_address public_address;
-    vector<beltpp::ip_address> p2p_connect_to_addresses;
-    string data_directory;
-    NodeType n_type = NodeType::blockchain;
-    bool log_enabled;
-    bool testnet;
-    meshpp::random_seed seed;
-    meshpp::private_key pv_key = seed.get_private_key(0);
+    vector<instance_options> instances;
+    bool fast_start;
+    size_t worker_threads = 0;
+    string export_snapshot_path;
+    string bootstrap_snapshot_path;
+    string snapshot_signer;
+    string async_log;
+    uint64_t log_file_size = 64;
 
     if (false == process_command_line(argc, argv,
-                                      p2p_bind_to_address,
-                                      p2p_connect_to_addresses,
-                                      rpc_bind_to_address,
-                                      public_address,
-                                      data_directory,
-                                      pv_key,
-                                      log_enabled,
-                                      testnet))
+                                      instances,
+                                      fast_start,
+                                      worker_threads,
+                                      export_snapshot_path,
+                                      bootstrap_snapshot_path,
+                                      snapshot_signer,
+                                      async_log,
+                                      log_file_size))
         return 1;
 
-    if (testnet)
+    //  the key prefix is process wide, all instances are on one network
+    if (instances.front().testnet)
         meshpp::config::set_public_key_prefix("TNOAH");
     else
         meshpp::config::set_public_key_prefix("NOAH");
 
-    if (false == data_directory.empty())
-        meshpp::settings::set_data_directory(data_directory);
+    meshpp::settings::set_data_directory(instances.front().data_directory.string());
 
 #ifdef B_OS_WINDOWS
     signal(SIGINT, termination_handler);
@@ -186,19 +300,168 @@ int main(int argc, char** argv)
     ::sigaction(SIGTERM, &signal_handler, nullptr);
 #endif
 
+    //  declared before the instances, so that it outlives their loggers
+    unique_ptr<async_log_service> log_service;
+    try
+    {
+        meshpp::create_config_directory();
+
+        //  the pid file is not safe to change from several threads, every
+        //  port of every instance is taken here before any of them starts
+        vector<unique_ptr<port2pid_helper>> port2pid;
+        if (export_snapshot_path.empty())
+        {
+            for (auto const& options : instances)
+            {
+                for (auto port : options.ports())
+                    port2pid.emplace_back(new port2pid_helper(meshpp::config_file_path("pid"), port));
+            }
+        }
+
+        if (false == async_log.empty())
+            log_service.reset(new async_log_service("block" == async_log ?
+                                                        log_overflow::block :
+                                                        log_overflow::drop));
+
+        //  node.run() stays the ordered lane on each instance's thread,
+        //  the pool takes the work that does not touch the blockchain state
+        unique_ptr<noahpp::worker_pool> pool;
+        if (worker_threads > 0)
+        {
+            pool.reset(new noahpp::worker_pool(worker_threads));
+            cout << "worker threads: " << pool->size() << endl;
+        }
+        noahpp::signature_verifier verifier(pool.get());
+
+        shared_services services;
+        services.log_service = log_service.get();
+        services.log_file_size = log_file_size;
+        services.pool = pool.get();
+        services.verifier = &verifier;
+        services.fast_start = fast_start;
+
+        //  the command line one keeps the main thread
+        vector<std::thread> threads;
+        for (size_t index = 1; index < instances.size(); ++index)
+        {
+            auto const& options = instances[index];
+            threads.emplace_back([&options, index, &services]
+            {
+                run_instance(options, index, services, string(), string(), string());
+            });
+        }
+        run_instance(instances.front(), 0, services, export_snapshot_path, bootstrap_snapshot_path, snapshot_signer);
+        for (auto& thread : threads)
+            thread.join();
+
+        //  termination_handler has stopped the loops, let the pool
+        //  finish what is already queued
+        if (pool)
+            pool->stop();
+
+        cout << "signatures verified: " << verifier.verified()
+             << ", rejected: " << verifier.failed()
+             << ", " << uint64_t(verifier.rate()) << "/s" << endl;
+        if (log_service)
+        {
+            log_service->stop();
+            cout << "log lines written: " << log_service->written()
+                 << ", dropped: " << log_service->dropped() << endl;
+        }
+
+        for (auto& item : port2pid)
+            item->commit();
+    }
+    catch (std::exception const& ex)
+    {
+        cout << "exception cought: " << ex.what() << endl;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+    }
+    return 0;
+}
+
+void run_instance(instance_options const& options,
+                  size_t slot,
+                  shared_services const& services,
+                  string const& export_snapshot_path,
+                  string const& bootstrap_snapshot_path,
+                  string const& snapshot_signer)
+{
+    NodeType n_type = NodeType::blockchain;
     beltpp::ilog_ptr plogger_exceptions = beltpp::t_unique_nullptr<beltpp::ilog>();
+    string label = options.name.empty() ? string() : options.name + ": ";
+    //  the writer's running.txt is left to the writer, the replica locks
+    //  its own data directory and only reads the writer's files
+    bool replica = false == options.read_only_replica.empty();
 
     try
     {
-        meshpp::create_config_directory();
-        meshpp::create_data_directory();
+        //  prints how long each phase takes
+        startup_timer startup(options.name);
+        auto data_directory_start = startup_timer::clock::now();
 
-        unique_ptr<port2pid_helper> port2pid(new port2pid_helper(meshpp::config_file_path("pid"), p2p_bind_to_address.local.port));
+        boost::filesystem::create_directories(options.data_directory);
+
+        meshpp::random_seed seed;
+        meshpp::private_key pv_key = seed.get_private_key(0);
+        if (false == options.private_key.empty())
+            pv_key = meshpp::private_key(options.private_key);
 
         using DataDirAttributeLoader = meshpp::file_locker<meshpp::file_loader<PidConfig::DataDirAttribute,
                                                                                 &PidConfig::DataDirAttribute::from_string,
                                                                                 &PidConfig::DataDirAttribute::to_string>>;
-        DataDirAttributeLoader dda(meshpp::data_file_path("running.txt"));
+
+        //  blockchain and state have to match each other, action_log is
+        //  kept along for the nodes that maintain it
+        snapshot_directories snapshot_content =
+        {
+            std::make_pair(string("blockchain"), options.directory_path("blockchain")),
+            std::make_pair(string("state"), options.directory_path("state")),
+            std::make_pair(string("action_log"), options.directory_path("action_log"))
+        };
+
+        if (false == export_snapshot_path.empty())
+        {
+            //  running.txt lock keeps a node away from the data directory
+            //  while the snapshot is being written
+            DataDirAttributeLoader dda(options.file_path("running.txt"));
+
+            auto info = export_snapshot(snapshot_content, export_snapshot_path, pv_key);
+            cout << label << "snapshot exported: " << export_snapshot_path << endl;
+            cout << label << "files: " << info.files << ", bytes: " << info.bytes << endl;
+            cout << label << "signed by: " << info.signer << endl;
+            return;
+        }
+
+        DataDirAttributeLoader dda(options.file_path("running.txt"));
+
+        noahpp::metrics::registry metrics;
+        //  the write ahead log and the store flushes, by file
+        auto disk_write_seconds = [&metrics](string const& file) -> noahpp::metrics::histogram&
+        {
+            return metrics.add_histogram("noahd_disk_write_seconds{file=\"" + file + "\"}",
+                                         "Time spent writing and syncing noahd's own files");
+        };
+#ifdef NOAHD_ALLOCATION_COUNTERS
+        //  of the whole process, every instance reports the same numbers
+        metrics.add_callback("noahd_heap_allocations_total", "Heap allocations made by the process",
+                             [] { return double(noahpp::allocation_counter::allocations()); }, true);
+        metrics.add_callback("noahd_heap_frees_total", "Heap allocations freed by the process",
+                             [] { return double(noahpp::allocation_counter::frees()); }, true);
+        metrics.add_callback("noahd_heap_allocated_bytes_total", "Bytes requested by the heap allocations",
+                             [] { return double(noahpp::allocation_counter::bytes()); }, true);
+#endif
+
+        if (false == bootstrap_snapshot_path.empty())
+        {
+            auto info = import_snapshot(bootstrap_snapshot_path, snapshot_content, snapshot_signer);
+            cout << label << "snapshot loaded: " << bootstrap_snapshot_path << endl;
+            cout << label << "files: " << info.files << ", bytes: " << info.bytes << endl;
+            cout << label << "signed by: " << info.signer << endl;
+        }
         {
             PidConfig::RunningDuration item;
             item.start.tm = item.end.tm = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
@@ -207,78 +470,454 @@ int main(int argc, char** argv)
             dda.save();
         }
 
-        auto fs_blockchain = meshpp::data_directory_path("blockchain");
-        auto fs_action_log = meshpp::data_directory_path("action_log");
-        auto fs_transaction_pool = meshpp::data_directory_path("transaction_pool");
-        auto fs_state = meshpp::data_directory_path("state");
-        auto fs_log = meshpp::data_directory_path("log");
+        //  checked and written while running.txt is locked. a full data
+        //  directory may be pruned from now on, a pruned one can't give
+        //  back the blocks it has dropped
+        if (false == replica)
+        {
+            auto pruned_path = options.file_path("pruned.txt");
+            if (options.prune_depth > 0)
+            {
+                boost::filesystem::ofstream fl(pruned_path);
+                fl << options.prune_depth << "\n";
+            }
+            else if (boost::filesystem::exists(pruned_path))
+                throw std::runtime_error("the data directory has been pruned, it needs prune_depth or "
+                                         "another data_directory to keep all blocks: " +
+                                         options.data_directory.string());
+        }
+
+        startup.phase("data directory", data_directory_start);
+        auto loggers_start = startup_timer::clock::now();
 
-        cout << "p2p local address: " << p2p_bind_to_address.to_string() << endl;
-        for (auto const& item : p2p_connect_to_addresses)
-            cout << "p2p host: " << item.to_string() << endl;
-        if (false == rpc_bind_to_address.local.empty())
-            cout << "rpc interface: " << rpc_bind_to_address.to_string() << endl;
+        auto fs_blockchain = options.directory_path("blockchain");
+        auto fs_action_log = options.directory_path("action_log");
+        auto fs_transaction_pool = options.directory_path("transaction_pool");
+        auto fs_state = options.directory_path("state");
+        auto fs_log = options.directory_path("log");
 
-        beltpp::ilog_ptr plogger_p2p = beltpp::console_logger("noahd_p2p", false);
+        if (replica)
+            cout << label << "read only replica of: " << options.read_only_replica.string() << endl;
+        else
+        {
+            cout << label << "p2p local address: " << options.p2p_bind_to_address.to_string() << endl;
+            for (auto const& item : options.p2p_connect_to_addresses)
+                cout << label << "p2p host: " << item.to_string() << endl;
+        }
+        if (false == options.rpc_bind_to_address.local.empty())
+            cout << label << "rpc interface: " << options.rpc_bind_to_address.to_string() << endl;
+        if ((options.tx_pool_memory > 0 || options.rpc_cache_memory > 0) && false == replica)
+            cout << label << "node rpc interface: " << options.node_rpc_bind_to_address.to_string() << endl;
+        if (false == options.metrics_bind_to_address.local.empty())
+            cout << label << "metrics interface: " << options.metrics_bind_to_address.to_string() << endl;
+        if (false == options.actions_bind_to_address.local.empty())
+            cout << label << "actions interface: " << options.actions_bind_to_address.to_string() << endl;
+        if (options.prune_depth > 0)
+            cout << label << "prune depth: " << options.prune_depth << " blocks" << endl;
+
+        beltpp::ilog_ptr plogger_p2p = beltpp::t_unique_nullptr<beltpp::ilog>();
+        beltpp::ilog_ptr plogger_rpc = beltpp::t_unique_nullptr<beltpp::ilog>();
+        if (services.log_service)
+        {
+            //  the node thread only queues the lines, see async_logger.hpp
+            auto plog_service = services.log_service;
+            plogger_p2p = plog_service->console_logger("noahd_p2p", false);
+            plogger_rpc = plog_service->console_logger("noahd_rpc", true);
+            plogger_exceptions = plog_service->file_logger("noahd_exceptions",
+                                                           fs_log / "exceptions.txt",
+                                                           services.log_file_size * 1024 * 1024);
+
+            metrics.add_callback("noahd_log_lines_total{result=\"written\"}", "Log lines taken by the async logger",
+                                 [plog_service] { return double(plog_service->written()); }, true);
+            metrics.add_callback("noahd_log_lines_total{result=\"dropped\"}", "Log lines taken by the async logger",
+                                 [plog_service] { return double(plog_service->dropped()); }, true);
+            metrics.add_callback("noahd_log_lines_pending", "Log lines waiting for the flusher",
+                                 [plog_service] { return double(plog_service->pending()); });
+        }
+        else
+        {
+            plogger_p2p = beltpp::console_logger("noahd_p2p", false);
+            plogger_rpc = beltpp::console_logger("noahd_rpc", true);
+            plogger_exceptions = meshpp::file_logger("noahd_exceptions",
+                                                     fs_log / "exceptions.txt");
+        }
         plogger_p2p->disable();
-        beltpp::ilog_ptr plogger_rpc = beltpp::console_logger("noahd_rpc", true);
+        startup.phase("loggers", loggers_start);
         //plogger_rpc->disable();
-        plogger_exceptions = meshpp::file_logger("noahd_exceptions",
-                                                 fs_log / "exceptions.txt");
-
-        
-        publiqpp::node node(genesis_signed_block(testnet),
-                            public_address,
-                            rpc_bind_to_address,
-                            p2p_bind_to_address,
-                            p2p_connect_to_addresses,
-                            fs_blockchain,
-                            fs_action_log,
-                            fs_transaction_pool,
-                            fs_state,
-                            boost::filesystem::path(),
-                            boost::filesystem::path(),
-                            plogger_p2p.get(),
-                            plogger_rpc.get(),
-                            pv_key,
-                            n_type,
-                            log_enabled,
-                            true,
-                            testnet,
-                            mine_amount_threshhold(),
-                            block_reward_array(),
-                            std::chrono::seconds(0));
-
-        g_pnode = &node;
-
-        cout << endl;
-        cout << "Node: " << node.name() << endl;
-        cout << "Type: " << static_cast<int>(n_type) << endl;
-        cout << endl;
-
-        loop(node, plogger_exceptions, g_termination_handled);
+
+        auto pool = services.pool;
+        auto& verifier = *services.verifier;
+        {
+            SignedBlock genesis;
+            genesis.from_string(noahpp::genesis_signed_block(options.testnet), nullptr);
+            if (false == verifier.verify(genesis))
+                throw runtime_error("genesis block signature is not valid");
+        }
+
+        //  noahd's own stores and interfaces, none of them needs the node.
+        //  with fast_start they are opened on a thread of their own while
+        //  the node opens its data directories, and serve from there on
+        unique_ptr<noahpp::write_ahead_log> wal;
+        unique_ptr<noahpp::lru_cache> cache;
+        unique_ptr<action_follower> follower;
+        unique_ptr<noahpp::lru_cache> known_transactions;
+        unique_ptr<rpc_gateway> gateway;
+        unique_ptr<block_sync> blocks;
+        unique_ptr<http_server> blocks_server;
+        unique_ptr<http_server> actions_server;
+        unique_ptr<http_server> metrics_server;
+        auto open_noahd = [&]
+        {
+            auto noahd_start = startup_timer::clock::now();
+
+            //  the action index and the transaction pool commit their
+            //  changes here, one sync covers both
+            if (options.action_index || options.tx_pool_memory > 0)
+            {
+                wal.reset(new noahpp::write_ahead_log(options.file_path("noahd.wal"), &disk_write_seconds("wal")));
+                if (wal->recovered_batches() > 0)
+                    cout << label << "write ahead log batches to recover: " << wal->recovered_batches() << endl;
+
+                auto pwal = wal.get();
+                metrics.add_callback("noahd_wal_commits_total", "Batches committed to the write ahead log",
+                                     [pwal] { return double(pwal->commits()); }, true);
+                metrics.add_callback("noahd_wal_syncs_total", "Syncs of the write ahead log, one covers all batches committed meanwhile",
+                                     [pwal] { return double(pwal->syncs()); }, true);
+                metrics.add_callback("noahd_wal_written_bytes_total", "Bytes written to the write ahead log",
+                                     [pwal] { return double(pwal->bytes_written()); }, true);
+                metrics.add_callback("noahd_wal_bytes", "Size of the write ahead log file",
+                                     [pwal] { return double(pwal->file_bytes()); });
+            }
+
+            if (options.rpc_cache_memory > 0)
+            {
+                cache.reset(new noahpp::lru_cache(options.rpc_cache_memory * 1024 * 1024));
+
+                auto pcache = cache.get();
+                metrics.add_callback("noahd_rpc_cache_lookups_total{result=\"hit\"}", "Lookups in the rpc cache",
+                                     [pcache] { return double(pcache->hits()); }, true);
+                metrics.add_callback("noahd_rpc_cache_lookups_total{result=\"miss\"}", "Lookups in the rpc cache",
+                                     [pcache] { return double(pcache->misses()); }, true);
+                metrics.add_callback("noahd_rpc_cache_evictions_total", "Entries evicted from the rpc cache to make room",
+                                     [pcache] { return double(pcache->evictions()); }, true);
+                metrics.add_callback("noahd_rpc_cache_invalidations_total", "Entries dropped from the rpc cache by new actions",
+                                     [pcache] { return double(pcache->invalidations()); }, true);
+                metrics.add_callback("noahd_rpc_cache_entries", "Entries in the rpc cache",
+                                     [pcache] { return double(pcache->size()); });
+                metrics.add_callback("noahd_rpc_cache_bytes", "Approximate memory taken by the rpc cache",
+                                     [pcache] { return double(pcache->bytes()); });
+            }
+
+            //  reads the action log back through rpc, which node.run()
+            //  below serves on this thread. a replica follows the writer's
+            //  index files instead
+            if (options.action_index ||
+                (replica && (false == options.rpc_bind_to_address.local.empty() ||
+                             false == options.actions_bind_to_address.local.empty())))
+            {
+                auto index_start = startup_timer::clock::now();
+                follower.reset(new action_follower(replica ?
+                                                       options.read_only_replica / "action_index" :
+                                                       options.directory_path("action_index"),
+                                                   replica,
+                                                   options.prune_depth,
+                                                   options.node_rpc_bind_to_address.local.address,
+                                                   options.node_rpc_bind_to_address.local.port,
+                                                   options.testnet ? "TNOAH" : "NOAH",
+                                                   options.action_index_backend,
+                                                   cache.get(),
+                                                   wal.get(),
+                                                   replica ? nullptr : &disk_write_seconds("action_index"),
+                                                   plogger_exceptions.get()));
+
+                auto pfollower = follower.get();
+                metrics.add_callback("noahd_action_index_length", "Actions in the action index",
+                                     [pfollower] { return double(pfollower->index().length()); });
+                metrics.add_callback("noahd_action_index_first", "The first action kept in the action index, 0 unless pruned",
+                                     [pfollower] { return double(pfollower->index().first()); });
+                metrics.add_callback("noahd_prune_reclaimed_bytes_total{store=\"action_index\"}",
+                                     "Bytes of disk freed by dropping old blocks and actions",
+                                     [pfollower] { return double(pfollower->reclaimed_bytes()); }, true);
+                startup.phase("action index", index_start);
+            }
+
+            //  the transactions broadcast through the pool, a block downloaded
+            //  compact takes them from here instead of asking the peer
+            if (options.tx_pool_memory > 0 && false == options.block_sync_peers.empty())
+                known_transactions.reset(new noahpp::lru_cache(options.tx_pool_memory * 1024 * 1024));
+
+            //  takes the rpc interface, the node is reached on its internal one.
+            //  a replica answers from the follower
+            if (options.tx_pool_memory > 0 || cache ||
+                (replica && false == options.rpc_bind_to_address.local.empty()))
+            {
+                auto gateway_start = startup_timer::clock::now();
+                gateway.reset(new rpc_gateway(options.rpc_bind_to_address.local.address,
+                                              options.rpc_bind_to_address.local.port,
+                                              options.node_rpc_bind_to_address.local.address,
+                                              options.node_rpc_bind_to_address.local.port,
+                                              options.tx_pool_memory * 1024 * 1024,
+                                              fs_transaction_pool / "noahd",
+                                              wal.get(),
+                                              known_transactions.get(),
+                                              cache.get(),
+                                              follower != nullptr,
+                                              replica ? follower.get() : nullptr,
+                                              verifier,
+                                              metrics,
+                                              plogger_exceptions.get()));
+                startup.phase("rpc gateway", gateway_start);
+            }
+
+            //  a copy of the blockchain kept by noahd, taken from the node
+            //  through rpc, which node.run() below serves on this thread,
+            //  or downloaded from other noahd instances, and served to
+            //  them, see block_sync.hpp
+            if (false == options.blocks_bind_to_address.local.empty() || false == options.block_sync_peers.empty())
+            {
+                vector<std::pair<string, unsigned short>> peers;
+                for (auto const& item : options.block_sync_peers)
+                    peers.push_back(std::make_pair(item.local.address, item.local.port));
+                bool from_node = (false == replica && false == options.rpc_bind_to_address.local.empty());
+                auto block_store_start = startup_timer::clock::now();
+                blocks.reset(new block_sync(replica ?
+                                                options.read_only_replica / "block_store" :
+                                                options.directory_path("block_store"),
+                                            replica,
+                                            options.prune_depth,
+                                            noahpp::genesis_signed_block(options.testnet),
+                                            peers,
+                                            options.node_rpc_bind_to_address.local.address,
+                                            from_node ? options.node_rpc_bind_to_address.local.port : 0,
+                                            known_transactions.get(),
+                                            verifier,
+                                            replica ? nullptr : &disk_write_seconds("block_store"),
+                                            plogger_exceptions.get()));
+                startup.phase("block store", block_store_start);
+
+                auto pblocks = blocks.get();
+                metrics.add_callback("noahd_block_sync_height", "Blocks in noahd's block store",
+                                     [pblocks] { return double(pblocks->height()); });
+                metrics.add_callback("noahd_block_sync_target", "Blocks in the chain the block store is downloading",
+                                     [pblocks] { return double(pblocks->target()); });
+                metrics.add_callback("noahd_block_sync_first_block", "The first block kept in noahd's block store, 0 unless pruned",
+                                     [pblocks] { return double(pblocks->first()); });
+                metrics.add_callback("noahd_prune_reclaimed_bytes_total{store=\"block_store\"}",
+                                     "Bytes of disk freed by dropping old blocks and actions",
+                                     [pblocks] { return double(pblocks->reclaimed_bytes()); }, true);
+                metrics.add_callback("noahd_block_sync_blocks_per_second", "Blocks stored per second while downloading",
+                                     [pblocks] { return pblocks->blocks_per_second(); });
+                metrics.add_callback("noahd_block_sync_compact_transactions_total{source=\"known\"}",
+                                     "Transactions of compact blocks, found among the broadcast ones or asked from the peer",
+                                     [pblocks] { return double(pblocks->transactions_known()); }, true);
+                metrics.add_callback("noahd_block_sync_compact_transactions_total{source=\"fetched\"}",
+                                     "Transactions of compact blocks, found among the broadcast ones or asked from the peer",
+                                     [pblocks] { return double(pblocks->transactions_fetched()); }, true);
+            }
+
+            if (blocks && false == options.blocks_bind_to_address.local.empty())
+            {
+                auto pblocks = blocks.get();
+                blocks_server.reset(new http_server(options.blocks_bind_to_address.local.address,
+                                                    options.blocks_bind_to_address.local.port,
+                                                    [pblocks](http_request&& request, http_server::responder respond)
+                {
+                    if (pblocks->handle(request, respond))
+                        return;
+
+                    http_response response;
+                    response.status = 404;
+                    response.body = "not found";
+                    respond(std::move(response));
+                }, 4, http_server::max_get_body_size));
+            }
+
+            if (follower && false == options.actions_bind_to_address.local.empty())
+            {
+                auto pfollower = follower.get();
+                actions_server.reset(new http_server(options.actions_bind_to_address.local.address,
+                                                     options.actions_bind_to_address.local.port,
+                                                     [pfollower](http_request&& request, http_server::responder respond)
+                {
+                    if (pfollower->handle(request, respond))
+                        return;
+
+                    http_response response;
+                    response.status = 404;
+                    response.body = "not found";
+                    respond(std::move(response));
+                }, 1, http_server::max_get_body_size));
+            }
+
+            //  the registry is read from the listener threads, the node
+            //  thread only ever touches the atomics behind it
+            if (false == options.metrics_bind_to_address.local.empty())
+                metrics_server.reset(new http_server(options.metrics_bind_to_address.local.address,
+                                                     options.metrics_bind_to_address.local.port,
+                                                     [&metrics](http_request&& request, http_server::responder respond)
+                {
+                    http_response response;
+                    if (request.path != "/metrics")
+                    {
+                        response.status = 404;
+                        response.body = "not found";
+                    }
+                    else if (request.method != "GET" && request.method != "HEAD")
+                    {
+                        response.status = 405;
+                        response.body = "method not allowed";
+                    }
+                    else
+                    {
+                        response.content_type = "text/plain; version=0.0.4";
+                        response.body = metrics.render();
+                    }
+                    respond(std::move(response));
+                }, 1, http_server::max_get_body_size));
+
+            startup.phase("noahd", noahd_start);
+        };
+        std::future<void> noahd_opened;
+        if (services.fast_start)
+            noahd_opened = std::async(std::launch::async, open_noahd);
+
+        unique_ptr<publiqpp::node> node;
+        if (false == replica)
+        {
+            auto node_start = startup_timer::clock::now();
+            node.reset(new publiqpp::node(noahpp::genesis_signed_block(options.testnet),
+                                          options.public_address,
+                                          options.node_rpc_bind_to_address,
+                                          options.p2p_bind_to_address,
+                                          options.p2p_connect_to_addresses,
+                                          fs_blockchain,
+                                          fs_action_log,
+                                          fs_transaction_pool,
+                                          fs_state,
+                                          boost::filesystem::path(),
+                                          boost::filesystem::path(),
+                                          plogger_p2p.get(),
+                                          plogger_rpc.get(),
+                                          pv_key,
+                                          n_type,
+                                          options.log_enabled,
+                                          true,
+                                          options.testnet,
+                                          noahpp::mine_amount_threshhold(),
+                                          noahpp::block_reward_array(),
+                                          std::chrono::seconds(0)));
+            startup.phase("node", node_start);
+        }
+
+        g_pnodes[slot] = node.get();
+
+        auto& run_seconds = metrics.add_histogram("noahd_node_run_seconds",
+                                                  "Duration of one node event loop iteration");
+        auto& run_errors = metrics.add_counter("noahd_node_run_errors_total",
+                                               "Exceptions thrown out of the node event loop");
+        auto start_time = std::chrono::steady_clock::now();
+        metrics.add_callback("noahd_uptime_seconds", "Seconds since the node has started", [start_time]
+        {
+            std::chrono::duration<double> uptime = std::chrono::steady_clock::now() - start_time;
+            return uptime.count();
+        });
+        metrics.add_callback("noahd_signatures_total{result=\"valid\"}", "Signatures checked by noahd",
+                             [&verifier] { return double(verifier.verified()); }, true);
+        metrics.add_callback("noahd_signatures_total{result=\"invalid\"}", "Signatures checked by noahd",
+                             [&verifier] { return double(verifier.failed()); }, true);
+        metrics.add_callback("noahd_transaction_pool_files", "Files in the transaction pool directory",
+                             [fs_transaction_pool]
+        {
+            boost::system::error_code ec;
+            size_t count = 0;
+            for (boost::filesystem::directory_iterator it(fs_transaction_pool, ec), end;
+                 false == static_cast<bool>(ec) && it != end; it.increment(ec))
+                ++count;
+            return double(count);
+        });
+        if (pool)
+        {
+            auto ppool = pool;
+            metrics.add_callback("noahd_worker_threads", "Worker pool threads",
+                                 [ppool] { return double(ppool->size()); });
+            metrics.add_callback("noahd_worker_tasks_pending", "Tasks waiting in the worker pool",
+                                 [ppool] { return double(ppool->pending()); });
+            metrics.add_callback("noahd_worker_tasks_executed_total", "Tasks run by the worker pool",
+                                 [ppool] { return double(ppool->executed()); }, true);
+            metrics.add_callback("noahd_worker_tasks_stolen_total", "Tasks a worker took from another one's queue",
+                                 [ppool] { return double(ppool->stolen()); }, true);
+        }
+
+        if (services.fast_start)
+            noahd_opened.get();
+        else
+            open_noahd();
+
+        startup.ready();
+        for (auto const& item : startup.phases())
+        {
+            double seconds = item.second;
+            metrics.add_callback("noahd_startup_seconds{phase=\"" + item.first + "\"}",
+                                 "Time noahd took in each phase of its startup",
+                                 [seconds] { return seconds; });
+        }
+
+        if (node)
+        {
+            cout << endl;
+            cout << label << "Node: " << node->name() << endl;
+            cout << label << "Type: " << static_cast<int>(n_type) << endl;
+            cout << endl;
+
+            loop(*node, plogger_exceptions, g_termination_handled, run_seconds, run_errors);
+        }
+        else
+        {
+            //  the replica's components run on threads of their own,
+            //  termination_handler has no node to wake here
+            while (false == g_termination_handled)
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        g_pnodes[slot] = nullptr;
+
+        if (metrics_server)
+            metrics_server->stop();
+        if (actions_server)
+            actions_server->stop();
+        if (blocks_server)
+            blocks_server->stop();
+        if (blocks)
+            blocks->stop();
+        if (gateway)
+            gateway->stop();
+        if (follower)
+            follower->stop();
 
         dda->history.back().end.tm = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
         dda.save();
-        port2pid->commit();
     }
     catch (std::exception const& ex)
     {
         if (plogger_exceptions)
             plogger_exceptions->message(ex.what());
-        cout << "exception cought: " << ex.what() << endl;
+        cout << label << "exception cought: " << ex.what() << endl;
+        termination_handler(0);
     }
     catch (...)
     {
         if (plogger_exceptions)
             plogger_exceptions->message("always throw std::exceptions");
-        cout << "always throw std::exceptions" << endl;
+        cout << label << "always throw std::exceptions" << endl;
+        termination_handler(0);
     }
-    return 0;
 }
 
 template <typename NODE>
-void loop(NODE& node, beltpp::ilog_ptr& plogger_exceptions, bool& termination_handled)
+void loop(NODE& node,
+          beltpp::ilog_ptr& plogger_exceptions,
+          std::atomic<bool>& termination_handled,
+          noahpp::metrics::histogram& run_seconds,
+          noahpp::metrics::counter& run_errors)
 {
     while (true)
     {
@@ -286,11 +925,14 @@ void loop(NODE& node, beltpp::ilog_ptr& plogger_exceptions, bool& termination_ha
         {
             if (termination_handled)
                 break;
+
+            noahpp::metrics::scoped_timer timer(run_seconds);
             if (false == node.run())
                 break;
         }
         catch (std::bad_alloc const& ex)
         {
+            run_errors.increment();
             if (plogger_exceptions)
                 plogger_exceptions->message(ex.what());
             cout << "exception cought: " << ex.what() << endl;
@@ -300,6 +942,7 @@ void loop(NODE& node, beltpp::ilog_ptr& plogger_exceptions, bool& termination_ha
         }
         catch (std::logic_error const& ex)
         {
+            run_errors.increment();
             if (plogger_exceptions)
                 plogger_exceptions->message(ex.what());
             cout << "logic error cought: " << ex.what() << endl;
@@ -309,12 +952,14 @@ void loop(NODE& node, beltpp::ilog_ptr& plogger_exceptions, bool& termination_ha
         }
         catch (std::exception const& ex)
         {
+            run_errors.increment();
             if (plogger_exceptions)
                 plogger_exceptions->message(ex.what());
             cout << "exception cought: " << ex.what() << endl;
         }
         catch (...)
         {
+            run_errors.increment();
             if (plogger_exceptions)
                 plogger_exceptions->message("always throw std::exceptions, will exit now");
             cout << "always throw std::exceptions, will exit now" << endl;
@@ -324,41 +969,247 @@ void loop(NODE& node, beltpp::ilog_ptr& plogger_exceptions, bool& termination_ha
     }
 }
 
-bool process_command_line(int argc, char** argv,
-                          beltpp::ip_address& p2p_bind_to_address,
-                          vector<beltpp::ip_address>& p2p_connect_to_addresses,
-                          beltpp::ip_address& rpc_bind_to_address,
-                          beltpp::ip_address& public_address,
-                          string& data_directory,
-                          meshpp::private_key& pv_key,
-                          bool& log_enabled,
-                          bool& testnet)
+//  the options of one instance as given, on the command line or in an
+//  --instance file
+class instance_arguments
 {
+public:
     string p2p_local_interface;
+    vector<string> hosts;
     string rpc_local_interface;
+    string node_rpc_local_interface;
+    string metrics_local_interface;
+    string actions_local_interface;
+    string blocks_local_interface;
+    vector<string> block_sync_hosts;
     string str_public_address;
+    string data_directory;
+    string read_only_replica;
     string str_pv_key;
-    vector<string> hosts;
+    string action_index_backend;
+    uint64_t tx_pool_memory = 0;
+    uint64_t rpc_cache_memory = 0;
+    uint64_t prune_depth = 0;
+};
+
+void describe_instance(program_options::options_description& options_description,
+                       instance_arguments& arguments)
+{
+    auto desc_init = options_description.add_options()
+        ("action_log,g", "Keep track of blockchain actions.")
+        ("p2p_local_interface,i", program_options::value<string>(&arguments.p2p_local_interface),
+                        "(p2p) The local network interface and port to bind to")
+        ("p2p_remote_host,p", program_options::value<vector<string>>(&arguments.hosts),
+                        "Remote nodes addresss with port")
+        ("rpc_local_interface,r", program_options::value<string>(&arguments.rpc_local_interface),
+                        "(rpc) The local network interface and port to bind to. With tx_pool_memory or rpc_cache_memory "
+                        "noahd's gateway listens here, it answers HTTP and passes plain TCP JSON clients on to the node")
+        ("metrics_local_interface,m", program_options::value<string>(&arguments.metrics_local_interface),
+                        "The local network interface and port to serve /metrics on")
+        ("action_index", "Keep an index of the action log, by sequence and by address")
+        ("action_index_backend", program_options::value<string>(&arguments.action_index_backend),
+                        "Keep the action index by address on disk, \"lsm\", instead of in memory")
+        ("actions_local_interface", program_options::value<string>(&arguments.actions_local_interface),
+                        "The local network interface and port to serve /actions and /actions/subscribe on")
+        ("blocks_local_interface", program_options::value<string>(&arguments.blocks_local_interface),
+                        "The local network interface and port to serve /headers, /blocks, /transactions and /sync on, from noahd's block store. "
+                        "The store takes the node's blocks through rpc_local_interface")
+        ("block_sync_peer", program_options::value<vector<string>>(&arguments.block_sync_hosts),
+                        "Another noahd's blocks interface, the block store is downloaded from all of them, headers first")
+        ("tx_pool_memory", program_options::value<uint64_t>(&arguments.tx_pool_memory),
+                        "(rpc) Keep broadcast transactions in a fee ordered pool of this many MB in front of the node")
+        ("rpc_cache_memory", program_options::value<uint64_t>(&arguments.rpc_cache_memory),
+                        "(rpc) Cache action log reads of this many MB in front of the node, and /actions answers with action_index")
+        ("node_rpc_local_interface", program_options::value<string>(&arguments.node_rpc_local_interface),
+                        "(rpc) The node's internal rpc interface with tx_pool_memory or rpc_cache_memory, rpc port + 1 on loopback by default")
+        ("prune_depth", program_options::value<uint64_t>(&arguments.prune_depth),
+                        "Keep only the last this many blocks in the block store and their actions in the action index, "
+                        "at least 100. A pruned data directory can't go back to keeping all blocks")
+        ("public_address,a", program_options::value<string>(&arguments.str_public_address),
+                        "(rpc) The public IP address that will be broadcasted")
+        ("data_directory,d", program_options::value<string>(&arguments.data_directory),
+                        "Data directory path")
+        ("read_only_replica", program_options::value<string>(&arguments.read_only_replica),
+                        "Another noahd's data directory, serve its action index and block store read only as it writes them, "
+                        "on rpc_local_interface, actions_local_interface and blocks_local_interface, without a node")
+        ("node_private_key,k", program_options::value<string>(&arguments.str_pv_key),
+                        "Node private key to start with")
+        ("testnet", "Work in testnet blockchain");
+    (void)(desc_init);
+}
+
+//  throws when the options do not go together
+void parse_instance(instance_arguments const& arguments,
+                    program_options::variables_map const& options,
+                    bool exporting,
+                    instance_options& result)
+{
+    result.testnet = options.count("testnet");
+    if (false == arguments.read_only_replica.empty())
+        result.read_only_replica = arguments.read_only_replica;
+    bool replica = false == result.read_only_replica.empty();
+
+    //  exporting a snapshot does not start the node, nor does a replica
+    if (arguments.p2p_local_interface.empty() && false == exporting && false == replica)
+        throw std::runtime_error("the option '--p2p_local_interface' is required but missing");
+    if (replica)
+    {
+        if (exporting)
+            throw std::runtime_error("export_snapshot and read_only_replica can't be used together");
+        if (false == arguments.p2p_local_interface.empty() ||
+            false == arguments.hosts.empty() ||
+            false == arguments.node_rpc_local_interface.empty() ||
+            false == arguments.block_sync_hosts.empty() ||
+            arguments.tx_pool_memory > 0 ||
+            arguments.prune_depth > 0 ||
+            options.count("action_log") ||
+            options.count("action_index"))
+            throw std::runtime_error("read_only_replica has no node, nor a pool, an action index or a block store of its own");
+    }
+
+    if (false == arguments.p2p_local_interface.empty())
+        result.p2p_bind_to_address.from_string(arguments.p2p_local_interface);
+    if (false == arguments.rpc_local_interface.empty())
+        result.rpc_bind_to_address.from_string(arguments.rpc_local_interface);
+    result.node_rpc_bind_to_address = result.rpc_bind_to_address;
+    result.tx_pool_memory = arguments.tx_pool_memory;
+    result.rpc_cache_memory = arguments.rpc_cache_memory;
+    if ((result.tx_pool_memory > 0 || result.rpc_cache_memory > 0) && false == replica)
+    {
+        if (arguments.rpc_local_interface.empty())
+            throw std::runtime_error("tx_pool_memory and rpc_cache_memory need rpc_local_interface");
+        string node_rpc_local_interface = arguments.node_rpc_local_interface;
+        if (node_rpc_local_interface.empty())
+            node_rpc_local_interface = "127.0.0.1:" + std::to_string(result.rpc_bind_to_address.local.port + 1);
+        result.node_rpc_bind_to_address.from_string(node_rpc_local_interface);
+    }
+    if (false == arguments.metrics_local_interface.empty())
+        result.metrics_bind_to_address.from_string(arguments.metrics_local_interface);
+    if (false == arguments.actions_local_interface.empty())
+        result.actions_bind_to_address.from_string(arguments.actions_local_interface);
+    if (false == arguments.blocks_local_interface.empty())
+        result.blocks_bind_to_address.from_string(arguments.blocks_local_interface);
+    for (auto const& item : arguments.block_sync_hosts)
+    {
+        beltpp::ip_address address_item;
+        address_item.from_string(item);
+        result.block_sync_peers.push_back(address_item);
+    }
+    if (false == arguments.str_public_address.empty())
+        result.public_address.from_string(arguments.str_public_address);
+
+    for (auto const& item : arguments.hosts)
+    {
+        beltpp::ip_address address_item;
+        address_item.from_string(item);
+        result.p2p_connect_to_addresses.push_back(address_item);
+    }
+
+    if (result.p2p_connect_to_addresses.empty())
+    {
+        if (result.testnet)
+        {
+            beltpp::ip_address address_item;
+            address_item.from_string("88.99.146.31:48811");
+            result.p2p_connect_to_addresses.push_back(address_item);
+        }
+        else
+        {
+            beltpp::ip_address address_item;
+            address_item.from_string("88.99.146.31:44300");
+            result.p2p_connect_to_addresses.push_back(address_item);
+            address_item.from_string("88.99.146.31:44310");
+            result.p2p_connect_to_addresses.push_back(address_item);
+        }
+    }
+
+    if (false == arguments.str_pv_key.empty())
+        meshpp::private_key check(arguments.str_pv_key);
+    result.private_key = arguments.str_pv_key;
+
+    result.data_directory = arguments.data_directory.empty() ?
+                                meshpp::config_directory_path() :
+                                boost::filesystem::path(arguments.data_directory);
+
+    result.log_enabled = options.count("action_log");
+    result.action_index = options.count("action_index");
+    result.action_index_backend = arguments.action_index_backend;
+    if (result.action_index && (false == result.log_enabled || arguments.rpc_local_interface.empty()))
+        throw std::runtime_error("action_index needs action_log and rpc_local_interface");
+    if (false == arguments.actions_local_interface.empty() && false == result.action_index && false == replica)
+        throw std::runtime_error("actions_local_interface needs action_index");
+    if (false == result.action_index_backend.empty())
+    {
+        if (false == result.action_index)
+            throw std::runtime_error("action_index_backend needs action_index");
+        //  "files" keeps a file per posting and walks all of them on
+        //  every prune, it is there for noahd_bench to compare against
+        if ("lsm" != result.action_index_backend)
+            throw std::runtime_error("action_index_backend can be \"lsm\"");
+    }
+    result.prune_depth = arguments.prune_depth;
+    if (result.prune_depth > 0)
+    {
+        if (result.prune_depth < min_prune_depth)
+            throw std::runtime_error("prune_depth is at least " + std::to_string(min_prune_depth));
+        if (false == result.action_index &&
+            arguments.blocks_local_interface.empty() &&
+            arguments.block_sync_hosts.empty())
+            throw std::runtime_error("prune_depth needs action_index, blocks_local_interface or block_sync_peer");
+    }
+    if (false == arguments.str_public_address.empty() &&
+        arguments.rpc_local_interface.empty())
+        throw std::runtime_error("rpc_local_interface is not specified");
+    //  the block store takes the node's blocks through its rpc
+    if (false == replica &&
+        false == arguments.blocks_local_interface.empty() &&
+        arguments.block_sync_hosts.empty() &&
+        arguments.rpc_local_interface.empty())
+        throw std::runtime_error("blocks_local_interface needs rpc_local_interface or block_sync_peer");
+    if (replica)
+    {
+        if (false == boost::filesystem::is_directory(result.read_only_replica))
+            throw std::runtime_error("read_only_replica is not a directory: " + result.read_only_replica.string());
+        if (boost::filesystem::equivalent(result.read_only_replica, result.data_directory))
+            throw std::runtime_error("read_only_replica needs a data_directory of its own");
+    }
+}
+
+bool process_command_line(int argc, char** argv,
+                          vector<instance_options>& instances,
+                          bool& fast_start,
+                          size_t& worker_threads,
+                          string& export_snapshot_path,
+                          string& bootstrap_snapshot_path,
+                          string& snapshot_signer,
+                          string& async_log,
+                          uint64_t& log_file_size)
+{
+    instance_arguments arguments;
+    vector<string> instance_files;
     program_options::options_description options_description;
     try
     {
         auto desc_init = options_description.add_options()
             ("help,h", "Print this help message and exit.")
-            ("action_log,g", "Keep track of blockchain actions.")
-            ("p2p_local_interface,i", program_options::value<string>(&p2p_local_interface)->required(),
-                            "(p2p) The local network interface and port to bind to")
-            ("p2p_remote_host,p", program_options::value<vector<string>>(&hosts),
-                            "Remote nodes addresss with port")
-            ("rpc_local_interface,r", program_options::value<string>(&rpc_local_interface),
-                            "(rpc) The local network interface and port to bind to")
-            ("public_address,a", program_options::value<string>(&str_public_address),
-                            "(rpc) The public IP address that will be broadcasted")
-            ("data_directory,d", program_options::value<string>(&data_directory),
-                            "Data directory path")
-            ("node_private_key,k", program_options::value<string>(&str_pv_key),
-                            "Node private key to start with")
-            ("testnet", "Work in testnet blockchain");
+            ("instance", program_options::value<vector<string>>(&instance_files),
+                            "One more node in this process, from a file with the same options as here, one \"name = value\" per line. "
+                            "It needs its own data_directory and ports, and the same network")
+            ("fast_start", "Open noahd's own stores and interfaces while the node opens its data directories, and serve them from then on")
+            ("worker_threads,w", program_options::value<size_t>(&worker_threads),
+                            "Number of worker threads, 0 keeps everything on the node threads")
+            ("export_snapshot", program_options::value<string>(&export_snapshot_path),
+                            "Write a signed snapshot of the data directory to the file and exit")
+            ("bootstrap_snapshot", program_options::value<string>(&bootstrap_snapshot_path),
+                            "Start from the snapshot file, the data directory has to be empty")
+            ("snapshot_signer", program_options::value<string>(&snapshot_signer),
+                            "The public key of the node that exported the bootstrap snapshot, any other signer is refused")
+            ("async_log", program_options::value<string>(&async_log),
+                            "Write the logs from a background thread, \"drop\" or \"block\" when its buffer is full")
+            ("log_file_size", program_options::value<uint64_t>(&log_file_size),
+                            "Log files under data_directory/log rotate at this size in MB, with async_log");
         (void)(desc_init);
+        describe_instance(options_description, arguments);
 
         program_options::variables_map options;
 
@@ -372,46 +1223,76 @@ bool process_command_line(int argc, char** argv,
         {
             throw std::runtime_error("");
         }
-        testnet = options.count("testnet");
-
-        p2p_bind_to_address.from_string(p2p_local_interface);
-        if (false == rpc_local_interface.empty())
-            rpc_bind_to_address.from_string(rpc_local_interface);
-        if (false == str_public_address.empty())
-            public_address.from_string(str_public_address);
-
-        for (auto const& item : hosts)
-        {
-            beltpp::ip_address address_item;
-            address_item.from_string(item);
-            p2p_connect_to_addresses.push_back(address_item);
-        }
-
-        if (p2p_connect_to_addresses.empty())
+        fast_start = options.count("fast_start");
+
+        if (false == export_snapshot_path.empty() &&
+            false == bootstrap_snapshot_path.empty())
+            throw std::runtime_error("export_snapshot and bootstrap_snapshot can't be used together");
+        if (false == export_snapshot_path.empty() &&
+            false == instance_files.empty())
+            throw std::runtime_error("export_snapshot and instance can't be used together");
+        if (bootstrap_snapshot_path.empty() != snapshot_signer.empty())
+            throw std::runtime_error("bootstrap_snapshot needs snapshot_signer, and the other way round");
+        if (false == bootstrap_snapshot_path.empty() &&
+            false == arguments.read_only_replica.empty())
+            throw std::runtime_error("bootstrap_snapshot and read_only_replica can't be used together");
+        if (false == async_log.empty() &&
+            async_log != "drop" &&
+            async_log != "block")
+            throw std::runtime_error("async_log can be \"drop\" or \"block\"");
+        if (0 == log_file_size)
+            throw std::runtime_error("log_file_size can't be 0");
+        if (instance_files.size() + 1 > max_instances)
+            throw std::runtime_error("at most " + std::to_string(max_instances) + " instances");
+
+        instances.emplace_back();
+        parse_instance(arguments, options, false == export_snapshot_path.empty(), instances.back());
+
+        for (auto const& file : instance_files)
         {
-            if (testnet)
+            try
             {
-                beltpp::ip_address address_item;
-                address_item.from_string("88.99.146.31:48811");
-                p2p_connect_to_addresses.push_back(address_item);
+                instance_arguments file_arguments;
+                program_options::options_description file_description;
+                describe_instance(file_description, file_arguments);
+
+                program_options::variables_map file_options;
+                program_options::store(
+                            program_options::parse_config_file<char>(file.c_str(), file_description),
+                            file_options);
+                program_options::notify(file_options);
+
+                if (file_arguments.data_directory.empty())
+                    throw std::runtime_error("data_directory is required");
+
+                instances.emplace_back();
+                instances.back().name = boost::filesystem::path(file).stem().string();
+                parse_instance(file_arguments, file_options, false, instances.back());
             }
-            else
+            catch (std::exception const& ex)
             {
-                beltpp::ip_address address_item;
-                address_item.from_string("88.99.146.31:44300");
-                p2p_connect_to_addresses.push_back(address_item);
-                address_item.from_string("88.99.146.31:44310");
-                p2p_connect_to_addresses.push_back(address_item);
+                throw std::runtime_error("instance " + file + ": " + ex.what());
             }
         }
 
-        if (false == str_pv_key.empty())
-            pv_key = meshpp::private_key(str_pv_key);
-
-        log_enabled = options.count("action_log");
-        if (false == str_public_address.empty() &&
-            rpc_local_interface.empty())
-            throw std::runtime_error("rpc_local_interface is not specified");
+        std::set<string> names;
+        std::set<boost::filesystem::path> data_directories;
+        std::set<unsigned short> ports;
+        for (auto const& item : instances)
+        {
+            //  one key prefix for the whole process, see main()
+            if (item.testnet != instances.front().testnet)
+                throw std::runtime_error("instance " + item.name + ": all instances have to be on the same network");
+            if (false == names.insert(item.name).second)
+                throw std::runtime_error("instance " + item.name + ": two instance files with the same name");
+            if (false == data_directories.insert(boost::filesystem::absolute(item.data_directory)).second)
+                throw std::runtime_error("instance " + item.name + ": the data directory is used by another instance");
+            for (auto port : item.ports())
+            {
+                if (false == ports.insert(port).second)
+                    throw std::runtime_error("instance " + item.name + ": port " + std::to_string(port) + " is used by another instance");
+            }
+        }
     }
     catch (std::exception const& ex)
     {
@@ -432,151 +1313,3 @@ bool process_command_line(int argc, char** argv,
 
     return true;
 }
-
-
-string genesis_signed_block(bool testnet)
-{
-#if 0
-    Block genesis_block_mainnet;
-    genesis_block_mainnet.header.block_number = 0;
-    genesis_block_mainnet.header.delta = 0;
-    genesis_block_mainnet.header.c_sum = 0;
-    genesis_block_mainnet.header.c_const = 1;
-    genesis_block_mainnet.header.prev_hash = meshpp::hash("NOAH blockchain. https://noahcoin.org/blog/how-far-can-your-cryptocurrency-go/");
-    beltpp::gm_string_to_gm_time_t("2019-06-01 00:00:00", genesis_block_mainnet.header.time_signed.tm);
-
-    string prefix = meshpp::config::public_key_prefix();
-    Reward reward_publiq1;
-    reward_publiq1.amount.whole = 212500000000;
-    reward_publiq1.reward_type = RewardType::initial;
-    reward_publiq1.to = prefix + "8ZzHz4NFvZzaHD2Sfv4DuRAJaNeG3Sg9q2WuSESvGSQrr9Ftcb";
-
-    genesis_block_mainnet.rewards =
-    {
-        reward_publiq1
-    };
-
-    Block genesis_block_testnet = genesis_block_mainnet;
-    genesis_block_testnet.rewards =
-    {
-        reward_publiq1
-    };
-
-    meshpp::random_seed seed;
-    meshpp::private_key pvk = seed.get_private_key(0);
-    meshpp::public_key pbk = pvk.get_public_key();
-
-    SignedBlock sb;
-    if (testnet)
-        sb.block_details = std::move(genesis_block_testnet);
-    else
-        sb.block_details = std::move(genesis_block_mainnet);
-
-    Authority authorization;
-    authorization.address = pbk.to_string();
-    authorization.signature = pvk.sign(sb.block_details.to_string()).base58;
-
-    sb.authorization = authorization;
-
-    std::cout << sb.to_string() << std::endl;
-#endif
-    std::string str_genesis_mainnet = R"genesis(
-                                      {
-                                         "rtt":8,
-                                         "block_details":{
-                                            "rtt":7,
-                                            "header":{
-                                               "rtt":5,
-                                               "block_number":0,
-                                               "delta":0,
-                                               "c_sum":0,
-                                               "c_const":1,
-                                               "prev_hash":"Fic61hPnMkuBGRnVwg6Jo7S3TRZPQrUo2LP2vuLTPpwR",
-                                               "time_signed":"2019-06-01 00:00:00"
-                                            },
-                                            "rewards":[
-                                               {
-                                                  "rtt":12,
-                                                  "to":"NOAH8ZzHz4NFvZzaHD2Sfv4DuRAJaNeG3Sg9q2WuSESvGSQrr9Ftcb",
-                                                  "amount":{
-                                                     "rtt":0,
-                                                     "whole":212500000000,
-                                                     "fraction":0
-                                                  },
-                                                  "reward_type":"initial"
-                                               }
-                                            ],
-                                            "signed_transactions":[
-
-                                            ]
-                                         },
-                                         "authorization":{
-                                            "rtt":3,
-                                            "address":"NOAH8UNYkeKE4as51snM9EptwNBbCX2FeAjMiJyaDZ2hXzph4kd2AL",
-                                            "signature":"AN1rKp3S6vnu5S6rtQWQFhqnyi4C7hdvCaLBnYdT4wx79ZBFFVYzUhLWNMNFgW8kHU1WuXCRnqJyMzDBYi8YPxBTzdyqrfLMf"
-                                         }
-                                      }
-                                      )genesis";
-
-    std::string str_genesis_testnet = R"genesis(
-                                      {
-                                         "rtt":8,
-                                         "block_details":{
-                                            "rtt":7,
-                                            "header":{
-                                               "rtt":5,
-                                               "block_number":0,
-                                               "delta":0,
-                                               "c_sum":0,
-                                               "c_const":1,
-                                               "prev_hash":"Fic61hPnMkuBGRnVwg6Jo7S3TRZPQrUo2LP2vuLTPpwR",
-                                               "time_signed":"2019-06-01 00:00:00"
-                                            },
-                                            "rewards":[
-                                               {
-                                                  "rtt":12,
-                                                  "to":"TNOAH8ZzHz4NFvZzaHD2Sfv4DuRAJaNeG3Sg9q2WuSESvGSQrr9Ftcb",
-                                                  "amount":{
-                                                     "rtt":0,
-                                                     "whole":212500000000,
-                                                     "fraction":0
-                                                  },
-                                                  "reward_type":"initial"
-                                               }
-                                            ],
-                                            "signed_transactions":[
-
-                                            ]
-                                         },
-                                         "authorization":{
-                                            "rtt":3,
-                                            "address":"TNOAH8D2N3bVtvd9Wnns2UNcFG3BJuvYCBJFgBoTMVepebrAEMUL9yv",
-                                            "signature":"AN1rKqXkD7LnKiV7ioeQKw6wbespSQsLmxxDQFSJpn1sLE4NMAd1Epbkdf1xj7TuQ6vPJL5KpjDzzxLPgNXury1rZZDFhtndf"
-                                         }
-                                      }
-                                      )genesis";
-
-    if (testnet)
-        return str_genesis_testnet;
-    else
-        return str_genesis_mainnet;
-}
-
-publiqpp::coin mine_amount_threshhold()
-{
-    return publiqpp::coin(1000000, 0);
-}
-
-vector<publiqpp::coin> block_reward_array()
-{
-    using coin = publiqpp::coin;
-    return vector<publiqpp::coin>
-    {
-        coin(75000,0), coin(75000,0), coin(75000,0), coin(75000,0), coin(75000,0),
-        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
-        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
-        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
-        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0),
-        coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0), coin(15000,0)
-    };
-}
@@ -0,0 +1,132 @@
+#include "rpc_batch.hpp"
+
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <noah.pp/json.hpp>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace BlockchainMessage;
+
+using std::string;
+using std::vector;
+
+namespace
+{
+string remote_error(string const& message)
+{
+    RemoteError error;
+    error.message = message;
+    return error.to_string();
+}
+
+class batch_answers
+{
+public:
+    std::mutex mutex;
+    vector<string> answers;
+    size_t remaining = 0;
+    http_server::responder respond;
+};
+
+//  the last answer sends the whole array
+void answer(std::shared_ptr<batch_answers> const& state, size_t index, string&& body)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->answers[index] = body.empty() ? string("null") : std::move(body);
+        if (0 != --state->remaining)
+            return;
+    }
+
+    http_response response;
+    response.content_type = "application/json";
+    response.body = "[";
+    for (size_t item = 0; item != state->answers.size(); ++item)
+    {
+        if (item > 0)
+            response.body += ",";
+        response.body += state->answers[item];
+    }
+    response.body += "]";
+    state->respond(std::move(response));
+}
+}
+
+bool is_rpc_batch(string const& body)
+{
+    auto position = body.find_first_not_of(" \t\r\n");
+    return position != string::npos && '[' == body[position];
+}
+
+void handle_rpc_batch(http_request&& request,
+                      http_server::responder const& respond,
+                      http_server::handler const& item_handler)
+{
+    vector<string> items;
+    vector<bool> nested;
+    try
+    {
+        auto parsed = noahpp::json::parse(request.body);
+        if (parsed.items.empty())
+            throw std::runtime_error("an empty batch");
+        if (parsed.items.size() > max_rpc_batch_size)
+            throw std::runtime_error("a batch takes up to " + std::to_string(max_rpc_batch_size) + " messages");
+
+        for (auto const& item : parsed.items)
+        {
+            items.push_back(noahpp::json::to_string(item));
+            nested.push_back(item.is_array());
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        http_response response;
+        response.status = 400;
+        response.content_type = "application/json";
+        response.body = remote_error(ex.what());
+        return respond(std::move(response));
+    }
+
+    auto state = std::make_shared<batch_answers>();
+    state->answers.resize(items.size());
+    state->remaining = items.size();
+    state->respond = respond;
+
+    request.headers.erase("content-length");
+    for (size_t index = 0; index != items.size(); ++index)
+    {
+        if (nested[index])
+        {
+            answer(state, index, remote_error("batches inside a batch are not taken"));
+            continue;
+        }
+
+        http_request item;
+        item.method = request.method;
+        item.path = request.path;
+        item.query = request.query;
+        item.version = request.version;
+        item.headers = request.headers;
+        item.body = std::move(items[index]);
+
+        http_server::responder item_respond = [state, index](http_response&& item_response)
+        {
+            if (item_response.on_stream)
+                answer(state, index, remote_error("a stream can't be part of a batch"));
+            else
+                answer(state, index, std::move(item_response.body));
+        };
+
+        try
+        {
+            item_handler(std::move(item), item_respond);
+        }
+        catch (std::exception const& ex)
+        {
+            answer(state, index, remote_error(ex.what()));
+        }
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "http_server.hpp"
+
+#include <string>
+
+//  a JSON array of messages in one request, answered with the array of
+//  the answers in the same order. every message goes to the handler as
+//  a request of its own, batches inside a batch are not taken
+size_t const max_rpc_batch_size = 1000;
+
+//  the first character other than white space opens an array
+bool is_rpc_batch(std::string const& body);
+
+//  the answer goes out when the handler has answered every message, it
+//  may do so later and from any thread
+void handle_rpc_batch(http_request&& request,
+                      http_server::responder const& respond,
+                      http_server::handler const& item_handler);
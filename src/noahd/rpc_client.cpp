@@ -0,0 +1,341 @@
+#include "rpc_client.hpp"
+#include "compression.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <sstream>
+
+using std::string;
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+class rpc_client::impl
+{
+public:
+    impl(string const& _address, unsigned short _port, std::chrono::milliseconds _timeout)
+        : address(_address)
+        , port(_port)
+        , timeout(_timeout)
+        , context()
+        , socket(context)
+        , buffer()
+        , connected(false)
+    {
+        //  a node listening on all interfaces is reached through loopback
+        if (address.empty() || "0.0.0.0" == address)
+            address = "127.0.0.1";
+        else if ("::" == address)
+            address = "::1";
+    }
+
+    //  runs the started operation, gives up on it after the timeout
+    void run(bool const& done)
+    {
+        context.restart();
+        context.run_for(timeout);
+        if (false == done)
+        {
+            disconnect();
+            context.restart();
+            context.run();
+            throw std::runtime_error("rpc: no answer from " + address + ":" + std::to_string(port));
+        }
+    }
+
+    void connect()
+    {
+        if (connected)
+            return;
+
+        boost::system::error_code result;
+        bool done = false;
+        tcp::endpoint endpoint(asio::ip::make_address(address), port);
+        socket.async_connect(endpoint, [&result, &done](boost::system::error_code const& ec)
+        {
+            result = ec;
+            done = true;
+        });
+        run(done);
+        if (result)
+        {
+            disconnect();
+            throw std::runtime_error("rpc: cannot connect to " + address + ":" + std::to_string(port) +
+                                     ", " + result.message());
+        }
+
+        socket.set_option(tcp::no_delay(true));
+        buffer.consume(buffer.size());
+        connected = true;
+    }
+
+    void disconnect()
+    {
+        boost::system::error_code ec;
+        socket.close(ec);
+        connected = false;
+    }
+
+    void write(string const& data)
+    {
+        boost::system::error_code result;
+        bool done = false;
+        asio::async_write(socket, asio::buffer(data),
+                          [&result, &done](boost::system::error_code const& ec, size_t)
+        {
+            result = ec;
+            done = true;
+        });
+        run(done);
+        if (result)
+            throw boost::system::system_error(result);
+    }
+
+    size_t read_until(string const& delimiter)
+    {
+        boost::system::error_code result;
+        size_t size = 0;
+        bool done = false;
+        asio::async_read_until(socket, buffer, delimiter,
+                               [&result, &size, &done](boost::system::error_code const& ec, size_t count)
+        {
+            result = ec;
+            size = count;
+            done = true;
+        });
+        run(done);
+        if (result)
+            throw boost::system::system_error(result);
+        return size;
+    }
+
+    //  reads until there are at least count bytes in the buffer,
+    //  or until the node closes the connection
+    void read_body(size_t count, bool to_end)
+    {
+        boost::system::error_code result;
+        bool done = false;
+        if (buffer.size() >= count && false == to_end)
+            return;
+
+        if (to_end)
+            asio::async_read(socket, buffer, asio::transfer_all(),
+                             [&result, &done](boost::system::error_code const& ec, size_t)
+            {
+                result = ec;
+                done = true;
+            });
+        else
+            asio::async_read(socket, buffer, asio::transfer_exactly(count - buffer.size()),
+                             [&result, &done](boost::system::error_code const& ec, size_t)
+            {
+                result = ec;
+                done = true;
+            });
+        run(done);
+        if (result && false == (to_end && result == asio::error::eof))
+            throw boost::system::system_error(result);
+    }
+
+    string take(size_t count)
+    {
+        string result(asio::buffers_begin(buffer.data()),
+                      asio::buffers_begin(buffer.data()) + std::ptrdiff_t(count));
+        buffer.consume(count);
+        return result;
+    }
+
+    string request_text(string const& method, string const& target, string const& body) const
+    {
+        std::ostringstream header;
+        header << method << " " << target << " HTTP/1.1\r\n"
+               << "Host: " << address << ":" << port << "\r\n";
+        if ("POST" == method)
+            header << "Content-Type: application/json\r\n"
+                   << "Content-Length: " << body.size() << "\r\n";
+        header << "Accept-Encoding: gzip\r\n"
+               << "Connection: keep-alive\r\n\r\n";
+        return header.str() + body;
+    }
+
+    //  the body of the next response on the connection, keep_alive is
+    //  false when the other side closes after it
+    string read_response(int& status, bool& keep_alive)
+    {
+        string response_header = take(read_until("\r\n\r\n"));
+        std::istringstream lines(response_header);
+        string line;
+        std::getline(lines, line);
+
+        std::istringstream status_line(line);
+        string version;
+        status = 0;
+        status_line >> version >> status;
+
+        keep_alive = ("HTTP/1.1" == version);
+        size_t content_length = 0;
+        bool has_length = false;
+        bool gzip = false;
+        while (std::getline(lines, line))
+        {
+            boost::algorithm::trim(line);
+            auto colon = line.find(':');
+            if (colon == string::npos)
+                continue;
+            string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+            string value = boost::algorithm::trim_copy(line.substr(colon + 1));
+            if ("content-length" == name)
+            {
+                content_length = std::stoull(value);
+                has_length = true;
+            }
+            else if ("connection" == name)
+                keep_alive = (false == boost::algorithm::iequals(value, "close"));
+            else if ("content-encoding" == name)
+                gzip = boost::algorithm::iequals(value, "gzip");
+        }
+
+        string result;
+        if (has_length)
+        {
+            read_body(content_length, false);
+            result = take(content_length);
+        }
+        else
+        {
+            read_body(0, true);
+            result = take(buffer.size());
+            keep_alive = false;
+        }
+
+        if (gzip)
+            result = gzip_decompress(result);
+        return result;
+    }
+
+    string exchange(string const& method, string const& target, string const& body)
+    {
+        connect();
+        write(request_text(method, target, body));
+
+        int status = 0;
+        bool keep_alive = false;
+        string result = read_response(status, keep_alive);
+
+        if (false == keep_alive)
+            disconnect();
+
+        if (status != 200)
+            throw std::runtime_error("rpc: http status " + std::to_string(status) + ", " + result.substr(0, 512));
+
+        return result;
+    }
+
+    string call(string const& method, string const& target, string const& body)
+    {
+        try
+        {
+            return exchange(method, target, body);
+        }
+        catch (boost::system::system_error const&)
+        {
+            //  the node may have closed a kept alive connection in between,
+            //  one more try on a fresh one
+            disconnect();
+        }
+
+        try
+        {
+            return exchange(method, target, body);
+        }
+        catch (boost::system::system_error const& ex)
+        {
+            disconnect();
+            throw std::runtime_error(string("rpc: ") + ex.what());
+        }
+    }
+
+    //  all requests go out in one write, then the responses are read in
+    //  their order. tried once more on a fresh connection only when not
+    //  a single response came back
+    std::vector<string> call_all(std::vector<string> const& bodies)
+    {
+        string data;
+        for (auto const& body : bodies)
+            data += request_text("POST", "/", body);
+
+        std::vector<string> result;
+        for (size_t attempt = 0; true; ++attempt)
+        {
+            try
+            {
+                connect();
+                write(data);
+
+                while (result.size() != bodies.size())
+                {
+                    int status = 0;
+                    bool keep_alive = false;
+                    result.push_back(read_response(status, keep_alive));
+
+                    if (status != 200)
+                    {
+                        disconnect();
+                        throw std::runtime_error("rpc: http status " + std::to_string(status) + ", " +
+                                                 result.back().substr(0, 512));
+                    }
+                    if (false == keep_alive)
+                    {
+                        disconnect();
+                        if (result.size() != bodies.size())
+                            throw std::runtime_error("rpc: connection closed after " + std::to_string(result.size()) +
+                                                     " of " + std::to_string(bodies.size()) + " pipelined requests");
+                    }
+                }
+                return result;
+            }
+            catch (boost::system::system_error const& ex)
+            {
+                disconnect();
+                if (attempt > 0 || false == result.empty())
+                    throw std::runtime_error(string("rpc: ") + ex.what());
+            }
+        }
+    }
+
+    string address;
+    unsigned short port;
+    std::chrono::milliseconds timeout;
+    asio::io_context context;
+    tcp::socket socket;
+    asio::streambuf buffer;
+    bool connected;
+};
+
+rpc_client::rpc_client(string const& address,
+                       unsigned short port,
+                       std::chrono::milliseconds timeout)
+    : m_pimpl(new impl(address, port, timeout))
+{}
+
+rpc_client::~rpc_client()
+{
+    m_pimpl->disconnect();
+}
+
+string rpc_client::request(string const& body)
+{
+    return m_pimpl->call("POST", "/", body);
+}
+
+std::vector<string> rpc_client::request_all(std::vector<string> const& bodies)
+{
+    if (bodies.empty())
+        return std::vector<string>();
+    return m_pimpl->call_all(bodies);
+}
+
+string rpc_client::get(string const& target)
+{
+    return m_pimpl->call("GET", target, string());
+}
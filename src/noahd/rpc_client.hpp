@@ -0,0 +1,56 @@
+#pragma once
+
+#include <belt.pp/global.hpp>
+
+#include <noah.pp/json.hpp>
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//  blocking client for the node's RPC interface, keeps the connection
+//  open between requests when the node allows it. one thread at a time
+class rpc_client
+{
+public:
+    rpc_client(std::string const& address,
+               unsigned short port,
+               std::chrono::milliseconds timeout = std::chrono::seconds(30));
+    rpc_client(rpc_client const&) = delete;
+    ~rpc_client();
+
+    //  posts the message and returns the response body
+    std::string request(std::string const& body);
+
+    //  posts the messages one after another on the connection without
+    //  waiting for the answers, and returns the response bodies in the
+    //  same order
+    std::vector<std::string> request_all(std::vector<std::string> const& bodies);
+
+    //  gets the target, a path with its query, from one of noahd's
+    //  HTTP interfaces and returns the response body
+    std::string get(std::string const& target);
+
+    //  throws if the node answers with anything other than T_RESPONSE
+    template <typename T_RESPONSE, typename T_REQUEST>
+    void call(T_REQUEST const& request_message, T_RESPONSE& response_message)
+    {
+        std::string body = request(request_message.to_string());
+
+        //  the document is only looked at for its type, from an arena that
+        //  goes away with it
+        noahpp::arena memory;
+        auto parsed = noahpp::json::parse(body, memory);
+        auto rtt = parsed.find("rtt");
+        if (nullptr == rtt || rtt->string() != std::to_string(T_RESPONSE::rvalue))
+            throw std::runtime_error("rpc: unexpected response: " + body.substr(0, 512));
+
+        response_message.from_string(body, nullptr);
+    }
+
+    class impl;
+private:
+    std::unique_ptr<impl> m_pimpl;
+};
@@ -0,0 +1,511 @@
+#include "rpc_gateway.hpp"
+#include "action_follower.hpp"
+#include "block_sync.hpp"
+#include "http_server.hpp"
+#include "rpc_batch.hpp"
+#include "rpc_client.hpp"
+
+#include <mesh.pp/cryptoutility.hpp>
+
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <noah.pp/json.hpp>
+#include <noah.pp/transaction_pool.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace BlockchainMessage;
+using std::string;
+using std::unique_ptr;
+using system_clock = std::chrono::system_clock;
+
+namespace
+{
+size_t const gateway_threads = 4;
+//  a batch of max_rpc_batch_size broadcasts fits many times over
+size_t const max_rpc_body_size = 8 * 1024 * 1024;
+//  a whole coin is 10^8 fractions, fees are compared in fractions
+uint64_t const coin_fractions = 100000000;
+std::chrono::milliseconds const feed_idle_interval(50);
+std::chrono::seconds const node_retry_interval(1);
+std::chrono::seconds const save_interval(1);
+
+int64_t now_seconds()
+{
+    return int64_t(system_clock::to_time_t(system_clock::now()));
+}
+
+bool is_unsigned(noahpp::json::arena_value const* item)
+{
+    return item && item->is_number() &&
+           false == item->text.empty() &&
+           std::all_of(item->text.begin(), item->text.end(), [](char c) { return c >= '0' && c <= '9'; });
+}
+
+string remote_error(string const& message)
+{
+    RemoteError error;
+    error.message = message;
+    return error.to_string();
+}
+}
+
+class rpc_gateway::impl
+{
+public:
+    impl(string const& _node_address,
+         unsigned short _node_port,
+         size_t pool_bytes,
+         boost::filesystem::path const& pool_path,
+         noahpp::write_ahead_log* wal,
+         noahpp::lru_cache* _known_transactions,
+         noahpp::lru_cache* _cache,
+         bool _log_followed,
+         action_follower const* _replica,
+         noahpp::signature_verifier& _verifier,
+         noahpp::metrics::registry& _metrics,
+         beltpp::ilog* _plogger)
+        : node_address(_node_address)
+        , node_port(_node_port)
+        , pool()
+        , known_transactions(_known_transactions)
+        , cache(_cache)
+        , log_followed(_log_followed)
+        , replica(_replica)
+        , verifier(_verifier)
+        , metrics(_metrics)
+        , plogger(_plogger)
+        , mutex()
+        , condition()
+        , stopped(false)
+        , idle_clients()
+        , rpc_seconds()
+        , admitted(metrics.add_counter("noahd_tx_pool_admissions_total{result=\"added\"}",
+                                       "Transactions broadcast to the pool"))
+        , duplicates(metrics.add_counter("noahd_tx_pool_admissions_total{result=\"duplicate\"}",
+                                         "Transactions broadcast to the pool"))
+        , expired(metrics.add_counter("noahd_tx_pool_admissions_total{result=\"expired\"}",
+                                      "Transactions broadcast to the pool"))
+        , rejected(metrics.add_counter("noahd_tx_pool_admissions_total{result=\"rejected\"}",
+                                       "Transactions broadcast to the pool"))
+        , invalid(metrics.add_counter("noahd_tx_pool_admissions_total{result=\"invalid\"}",
+                                      "Transactions broadcast to the pool"))
+        , node_accepted(metrics.add_counter("noahd_tx_pool_submissions_total{result=\"accepted\"}",
+                                            "Transactions passed from the pool to the node"))
+        , node_rejected(metrics.add_counter("noahd_tx_pool_submissions_total{result=\"rejected\"}",
+                                            "Transactions passed from the pool to the node"))
+        , save_seconds(nullptr)
+        , feeder()
+        , server()
+    {
+        if (replica && pool_bytes > 0)
+            throw std::runtime_error("rpc gateway: a read only replica has no transaction pool");
+        if (0 == pool_bytes)
+            return;
+
+        pool.reset(new noahpp::transaction_pool(pool_bytes, pool_path / "pool.journal", wal));
+        auto ppool = pool.get();
+        metrics.add_callback("noahd_tx_pool_transactions", "Transactions in the pool",
+                             [ppool] { return double(ppool->size()); });
+        metrics.add_callback("noahd_tx_pool_bytes", "Approximate memory taken by the pool",
+                             [ppool] { return double(ppool->bytes()); });
+        metrics.add_callback("noahd_tx_pool_evictions_total", "Transactions evicted to make room for better paying ones",
+                             [ppool] { return double(ppool->evicted()); }, true);
+        metrics.add_callback("noahd_tx_pool_expirations_total", "Transactions that expired in the pool",
+                             [ppool] { return double(ppool->expired()); }, true);
+        save_seconds = &metrics.add_histogram("noahd_disk_write_seconds{file=\"tx_pool\"}",
+                                              "Time spent writing and syncing noahd's own files");
+    }
+
+    void save_pool()
+    {
+        noahpp::metrics::scoped_timer timer(*save_seconds);
+        pool->save();
+    }
+
+    unique_ptr<rpc_client> take_client()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (false == idle_clients.empty())
+            {
+                unique_ptr<rpc_client> result = std::move(idle_clients.back());
+                idle_clients.pop_back();
+                return result;
+            }
+        }
+        return unique_ptr<rpc_client>(new rpc_client(node_address, node_port));
+    }
+
+    void give_back(unique_ptr<rpc_client>&& client)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle_clients.push_back(std::move(client));
+    }
+
+    noahpp::metrics::histogram& histogram_for(string const& type)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = rpc_seconds.find(type);
+        if (it != rpc_seconds.end())
+            return *it->second;
+
+        auto& result = metrics.add_histogram("noahd_rpc_seconds{type=\"" + type + "\"}",
+                                             "RPC request latency by message type");
+        rpc_seconds.insert(std::make_pair(type, &result));
+        return result;
+    }
+
+    void handle(http_request&& request, http_server::responder const& respond)
+    {
+        http_response response;
+        response.content_type = "application/json";
+
+        if (request.method != "POST")
+        {
+            response.status = 405;
+            response.body = remote_error("rpc expects POST");
+            return respond(std::move(response));
+        }
+
+        if (is_rpc_batch(request.body))
+            return handle_rpc_batch(std::move(request), respond,
+                                    [this](http_request&& item, http_server::responder const& item_respond)
+            {
+                handle(std::move(item), item_respond);
+            });
+
+        //  the node does its own validation, whatever is not understood
+        //  here is passed on as it is
+        string type = "unknown";
+        string package_type;
+        string cache_key;
+        bool actions_request = false;
+        uint64_t start = 0;
+        uint64_t max_count = 0;
+        //  the request is only looked at, its document comes from a buffer
+        //  on the stack and does not reach the heap for the usual sizes
+        alignas(std::max_align_t) char buffer[4 * 1024];
+        noahpp::arena memory(buffer, sizeof(buffer));
+        try
+        {
+            auto parsed = noahpp::json::parse(request.body, memory);
+            auto rtt = parsed.find("rtt");
+            //  the label set has to stay bounded whatever the clients send
+            if (is_unsigned(rtt) && rtt->text.size() <= 4)
+                type = rtt->string();
+            auto package = parsed.find("package");
+            if (package && package->find("rtt"))
+                package_type = package->find("rtt")->string();
+
+            auto start_index = parsed.find("start_index");
+            auto count = parsed.find("max_count");
+            if (type == std::to_string(LoggedTransactionsRequest::rvalue) &&
+                is_unsigned(start_index) &&
+                is_unsigned(count))
+            {
+                start = std::stoull(start_index->string());
+                max_count = std::stoull(count->string());
+                actions_request = true;
+                if (cache)
+                    cache_key = "rpc actions " + start_index->string() + " " + count->string();
+            }
+        }
+        catch (std::exception const&)
+        {}
+
+        noahpp::metrics::scoped_timer timer(histogram_for(type));
+
+        if (pool &&
+            type == std::to_string(Broadcast::rvalue) &&
+            package_type == std::to_string(SignedTransaction::rvalue))
+            response.body = admit(request.body);
+        else if (false == cache_key.empty() &&
+                 cache->get(cache_key, response.body))
+        {}
+        else
+        {
+            try
+            {
+                uint64_t generation = cache ? cache->generation() : 0;
+                if (replica)
+                    response.body = actions_request ?
+                                        replica->logged_transactions(start, size_t(max_count)) :
+                                        remote_error("a read only replica answers LoggedTransactionsRequest only");
+                else
+                {
+                    auto client = take_client();
+                    response.body = client->request(request.body);
+                    give_back(std::move(client));
+                }
+
+                if (false == cache_key.empty())
+                    keep(cache_key, response.body, max_count, generation);
+            }
+            catch (std::exception const& ex)
+            {
+                response.status = 502;
+                response.body = remote_error(ex.what());
+            }
+        }
+
+        respond(std::move(response));
+    }
+
+    void keep(string const& key, string const& body, uint64_t max_count, uint64_t generation)
+    {
+        size_t count = 0;
+        noahpp::arena memory;
+        try
+        {
+            auto parsed = noahpp::json::parse(body, memory);
+            auto rtt = parsed.find("rtt");
+            auto actions = parsed.find("actions");
+            if (nullptr == rtt ||
+                rtt->string() != std::to_string(LoggedTransactions::rvalue) ||
+                nullptr == actions)
+                return;
+            count = actions->items.size();
+        }
+        catch (std::exception const&)
+        {
+            return;
+        }
+
+        if (count >= max_count)
+            cache->put(key, body, {}, generation);
+        else if (log_followed)
+            cache->put(key, body, {action_follower::log_tail_tag()}, generation);
+    }
+
+    string admit(string const& body)
+    {
+        Broadcast broadcast;
+        SignedTransaction signed_transaction;
+        try
+        {
+            broadcast.from_string(body, nullptr);
+            broadcast.package.get(signed_transaction);
+        }
+        catch (std::exception const& ex)
+        {
+            invalid.increment();
+            return remote_error(ex.what());
+        }
+
+        if (signed_transaction.authorizations.empty())
+        {
+            invalid.increment();
+            return remote_error("transaction has no authorizations");
+        }
+
+        std::vector<noahpp::signature_verifier::item> items;
+        noahpp::signature_verifier::collect(signed_transaction, items);
+        for (bool valid : verifier.verify(items))
+        {
+            if (false == valid)
+            {
+                invalid.increment();
+                return remote_error("invalid signature");
+            }
+        }
+
+        auto const& transaction = signed_transaction.transaction_details;
+        string signed_transaction_string = signed_transaction.to_string();
+        noahpp::transaction_pool::entry item;
+        item.hash = meshpp::hash(signed_transaction_string);
+        item.sender = signed_transaction.authorizations.front().address;
+        item.payload = broadcast.to_string();
+        item.fee = transaction.fee.whole * coin_fractions + transaction.fee.fraction;
+        item.creation = int64_t(transaction.creation.tm);
+        item.expiry = int64_t(transaction.expiry.tm);
+
+        switch (pool->add(std::move(item), now_seconds()))
+        {
+        case noahpp::transaction_pool::result::added:
+            admitted.increment();
+            condition.notify_one();
+            if (known_transactions)
+                known_transactions->put(block_sync::short_transaction_id(signed_transaction_string),
+                                        signed_transaction_string,
+                                        {},
+                                        known_transactions->generation());
+            break;
+        case noahpp::transaction_pool::result::duplicate:
+            duplicates.increment();
+            break;
+        case noahpp::transaction_pool::result::expired:
+            expired.increment();
+            return remote_error("transaction is expired");
+        case noahpp::transaction_pool::result::rejected:
+            rejected.increment();
+            return remote_error("transaction pool is full, the fee is too low");
+        }
+
+        return Done().to_string();
+    }
+
+    void feed()
+    {
+        rpc_client client(node_address, node_port);
+        auto last_save = system_clock::now();
+
+        while (true)
+        {
+            std::chrono::milliseconds wait(0);
+            noahpp::transaction_pool::entry item;
+            if (pool->best(item))
+            {
+                try
+                {
+                    string result = client.request(item.payload);
+                    auto parsed = noahpp::json::parse(result);
+                    auto rtt = parsed.find("rtt");
+                    if (rtt && rtt->text == std::to_string(Done::rvalue))
+                        node_accepted.increment();
+                    else
+                    {
+                        node_rejected.increment();
+                        if (plogger)
+                            plogger->message("tx pool: node did not take " + item.hash + ": " + result.substr(0, 512));
+                    }
+                    pool->remove(item.hash);
+                }
+                catch (std::exception const& ex)
+                {
+                    if (plogger)
+                        plogger->message(string("tx pool: ") + ex.what());
+                    wait = node_retry_interval;
+                }
+            }
+            else
+                wait = feed_idle_interval;
+
+            auto now = system_clock::now();
+            if (now - last_save >= save_interval)
+            {
+                last_save = now;
+                try
+                {
+                    pool->remove_expired(now_seconds());
+                    save_pool();
+                }
+                catch (std::exception const& ex)
+                {
+                    if (plogger)
+                        plogger->message(string("tx pool: ") + ex.what());
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (false == stopped && wait.count() > 0)
+                condition.wait_for(lock, wait, [this] { return stopped; });
+            if (stopped)
+                break;
+        }
+
+        try
+        {
+            save_pool();
+        }
+        catch (std::exception const& ex)
+        {
+            if (plogger)
+                plogger->message(string("tx pool: ") + ex.what());
+        }
+    }
+
+    string node_address;
+    unsigned short node_port;
+    unique_ptr<noahpp::transaction_pool> pool;
+    noahpp::lru_cache* known_transactions;
+    noahpp::lru_cache* cache;
+    bool log_followed;
+    action_follower const* replica;
+    noahpp::signature_verifier& verifier;
+    noahpp::metrics::registry& metrics;
+    beltpp::ilog* plogger;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopped;
+    std::vector<unique_ptr<rpc_client>> idle_clients;
+    std::map<string, noahpp::metrics::histogram*> rpc_seconds;
+
+    noahpp::metrics::counter& admitted;
+    noahpp::metrics::counter& duplicates;
+    noahpp::metrics::counter& expired;
+    noahpp::metrics::counter& rejected;
+    noahpp::metrics::counter& invalid;
+    noahpp::metrics::counter& node_accepted;
+    noahpp::metrics::counter& node_rejected;
+    noahpp::metrics::histogram* save_seconds;   //  with a pool
+
+    std::thread feeder;
+    unique_ptr<http_server> server;
+};
+
+rpc_gateway::rpc_gateway(string const& address,
+                         unsigned short port,
+                         string const& node_address,
+                         unsigned short node_port,
+                         size_t pool_bytes,
+                         boost::filesystem::path const& pool_path,
+                         noahpp::write_ahead_log* wal,
+                         noahpp::lru_cache* known_transactions,
+                         noahpp::lru_cache* cache,
+                         bool log_followed,
+                         action_follower const* replica,
+                         noahpp::signature_verifier& verifier,
+                         noahpp::metrics::registry& metrics,
+                         beltpp::ilog* plogger)
+    : m_pimpl(new impl(node_address, node_port,
+                       pool_bytes, pool_path, wal,
+                       known_transactions, cache, log_followed, replica,
+                       verifier, metrics, plogger))
+{
+    auto pimpl = m_pimpl.get();
+    if (m_pimpl->pool)
+        m_pimpl->feeder = std::thread([pimpl]
+        {
+            pimpl->feed();
+        });
+    m_pimpl->server.reset(new http_server(address, port,
+                                          [pimpl](http_request&& request, http_server::responder respond)
+    {
+        pimpl->handle(std::move(request), respond);
+    },
+                                          gateway_threads,
+                                          max_rpc_body_size,
+                                          node_address,
+                                          replica ? 0 : node_port));
+}
+
+rpc_gateway::~rpc_gateway()
+{
+    try
+    {
+        stop();
+    }
+    catch (...)
+    {}
+}
+
+void rpc_gateway::stop()
+{
+    if (m_pimpl->server)
+        m_pimpl->server->stop();
+    {
+        std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+        m_pimpl->stopped = true;
+    }
+    m_pimpl->condition.notify_one();
+    if (m_pimpl->feeder.joinable())
+        m_pimpl->feeder.join();
+}
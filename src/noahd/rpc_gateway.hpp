@@ -0,0 +1,64 @@
+#pragma once
+
+#include <belt.pp/global.hpp>
+#include <belt.pp/log.hpp>
+
+#include <noah.pp/lru_cache.hpp>
+#include <noah.pp/metrics.hpp>
+#include <noah.pp/signature_verifier.hpp>
+#include <noah.pp/write_ahead_log.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <memory>
+#include <string>
+
+//  listens on the rpc interface in place of the node, the node's own rpc
+//  moves to an internal address. the JSON clients that speak plain TCP
+//  instead of HTTP are passed to the node's address as they are, byte
+//  for byte. the HTTP requests are passed to the node as they are, except
+//      with pool_bytes the broadcast of a signed transaction: that is
+//      checked and kept in noahpp::transaction_pool, and the pool feeds
+//      the node one transaction at a time, best fee per byte first. the
+//      pool journals through wal when given. the transactions added are
+//      kept in known_transactions too when given, by
+//      block_sync::short_transaction_id, for the compact blocks
+//      with a cache the LoggedTransactionsRequest reads: the action log
+//      only grows, a response with max_count actions stays valid and is
+//      kept as it is. a shorter one reached the end of the log, it is
+//      kept only if the log is followed, tagged with
+//      action_follower::log_tail_tag, see action_follower.hpp
+//
+//  with a replica there is no node behind, node_address is not used and
+//  plain TCP clients are not served.
+//  the LoggedTransactionsRequest reads are answered from the replica's
+//  action_index, anything else gets a RemoteError
+class action_follower;
+
+class rpc_gateway
+{
+public:
+    rpc_gateway(std::string const& address,
+                unsigned short port,
+                std::string const& node_address,
+                unsigned short node_port,
+                size_t pool_bytes,
+                boost::filesystem::path const& pool_path,
+                noahpp::write_ahead_log* wal,
+                noahpp::lru_cache* known_transactions,
+                noahpp::lru_cache* cache,
+                bool log_followed,
+                action_follower const* replica,
+                noahpp::signature_verifier& verifier,
+                noahpp::metrics::registry& metrics,
+                beltpp::ilog* plogger);
+    rpc_gateway(rpc_gateway const&) = delete;
+    ~rpc_gateway();
+
+    //  stops listening, the transactions still in the pool are saved
+    void stop();
+
+    class impl;
+private:
+    std::unique_ptr<impl> m_pimpl;
+};
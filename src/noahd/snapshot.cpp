@@ -0,0 +1,286 @@
+#include "snapshot.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+using std::runtime_error;
+namespace filesystem = boost::filesystem;
+
+namespace
+{
+string const snapshot_magic = "noah.snapshot 1";
+
+class manifest_item
+{
+public:
+    uint64_t size;
+    string hash;
+    string path;    //  generic path, starting with the directory name
+};
+
+string read_file(filesystem::path const& path)
+{
+    filesystem::ifstream fl;
+    fl.open(path, std::ios_base::binary);
+    if (!fl)
+        throw runtime_error("cannot open: " + path.string());
+
+    return string(std::istreambuf_iterator<char>(fl),
+                  std::istreambuf_iterator<char>());
+}
+
+string read_line(filesystem::ifstream& fl, string const& key)
+{
+    string line;
+    if (!std::getline(fl, line) ||
+        0 != line.compare(0, key.length() + 1, key + " "))
+        throw runtime_error("snapshot: expected " + key);
+
+    return line.substr(key.length() + 1);
+}
+
+//  the sizes in the snapshot are not trusted before they are checked
+//  against what is left of the file
+void check_remaining(filesystem::ifstream& fl, uint64_t file_size, uint64_t size, string const& what)
+{
+    auto position = fl.tellg();
+    if (position < 0 || size > file_size - uint64_t(position))
+        throw runtime_error("snapshot: truncated at: " + what);
+}
+
+bool is_empty_directory(filesystem::path const& path)
+{
+    if (false == filesystem::exists(path))
+        return true;
+    return filesystem::is_directory(path) &&
+           filesystem::directory_iterator(path) == filesystem::directory_iterator();
+}
+}
+
+snapshot_info export_snapshot(snapshot_directories const& directories,
+                              filesystem::path const& snapshot_path,
+                              meshpp::private_key const& pv_key)
+{
+    snapshot_info info;
+    vector<std::pair<manifest_item, filesystem::path>> items;
+
+    for (auto const& directory : directories)
+    {
+        if (false == filesystem::exists(directory.second))
+            continue;
+
+        for (filesystem::recursive_directory_iterator it(directory.second), end;
+             it != end; ++it)
+        {
+            if (false == filesystem::is_regular_file(it->path()))
+                continue;
+
+            filesystem::path relative = directory.first;
+            relative /= filesystem::relative(it->path(), directory.second);
+
+            manifest_item item;
+            item.path = relative.generic_string();
+            items.push_back(std::make_pair(item, it->path()));
+        }
+    }
+
+    //  hashing needs the content anyway, so it is read twice: here
+    //  for the manifest and once more while writing the snapshot
+    std::ostringstream manifest;
+    for (auto& item : items)
+    {
+        string content = read_file(item.second);
+        item.first.size = content.size();
+        item.first.hash = meshpp::hash(content);
+
+        manifest << "file " << item.first.size << " "
+                 << item.first.hash << " "
+                 << item.first.path << "\n";
+
+        ++info.files;
+        info.bytes += content.size();
+    }
+
+    string str_manifest = manifest.str();
+    info.signer = pv_key.get_public_key().to_string();
+
+    filesystem::path temp_path = snapshot_path;
+    temp_path += ".tmp";
+    {
+        filesystem::ofstream fl;
+        fl.open(temp_path, std::ios_base::binary | std::ios_base::trunc);
+        if (!fl)
+            throw runtime_error("cannot create: " + temp_path.string());
+
+        fl << snapshot_magic << "\n"
+           << "signer " << info.signer << "\n"
+           << "signature " << pv_key.sign(str_manifest).base58 << "\n"
+           << "manifest " << str_manifest.size() << "\n"
+           << str_manifest;
+
+        for (auto const& item : items)
+        {
+            string content = read_file(item.second);
+            if (content.size() != item.first.size ||
+                meshpp::hash(content) != item.first.hash)
+                throw runtime_error("changed while exporting: " + item.second.string());
+
+            fl.write(content.data(), std::streamsize(content.size()));
+        }
+
+        fl.flush();
+        if (!fl)
+            throw runtime_error("cannot write: " + temp_path.string());
+    }
+    filesystem::rename(temp_path, snapshot_path);
+
+    return info;
+}
+
+snapshot_info import_snapshot(filesystem::path const& snapshot_path,
+                              snapshot_directories const& directories,
+                              string const& expected_signer)
+{
+    std::map<string, filesystem::path> targets;
+    for (auto const& directory : directories)
+    {
+        if (false == is_empty_directory(directory.second))
+            throw runtime_error("snapshot can be loaded only into an empty directory: " +
+                                directory.second.string());
+        targets[directory.first] = directory.second;
+    }
+
+    filesystem::ifstream fl;
+    fl.open(snapshot_path, std::ios_base::binary);
+    if (!fl)
+        throw runtime_error("cannot open: " + snapshot_path.string());
+
+    string magic;
+    std::getline(fl, magic);
+    if (magic != snapshot_magic)
+        throw runtime_error("not a noah snapshot: " + snapshot_path.string());
+
+    uint64_t file_size = filesystem::file_size(snapshot_path);
+    snapshot_info info;
+    info.signer = read_line(fl, "signer");
+    string signature = read_line(fl, "signature");
+    size_t manifest_size = std::stoull(read_line(fl, "manifest"));
+
+    //  anyone can sign a snapshot, only the expected key makes it trusted
+    if (info.signer != expected_signer)
+        throw runtime_error("snapshot: signed by " + info.signer + " instead of " + expected_signer);
+
+    check_remaining(fl, file_size, manifest_size, "manifest");
+    string str_manifest(manifest_size, '\0');
+    if (false == str_manifest.empty())
+        fl.read(&str_manifest[0], std::streamsize(manifest_size));
+    if (!fl)
+        throw runtime_error("snapshot: truncated manifest");
+
+    bool signature_valid = false;
+    try
+    {
+        signature_valid = meshpp::verify_signature(meshpp::public_key(expected_signer),
+                                                   str_manifest,
+                                                   signature);
+    }
+    catch (...)
+    {}
+    if (false == signature_valid)
+        throw runtime_error("snapshot: manifest signature is not valid");
+
+    vector<manifest_item> items;
+    std::istringstream manifest(str_manifest);
+    string line;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream line_stream(line);
+        string key;
+        manifest_item item;
+        line_stream >> key >> item.size >> item.hash;
+        line_stream.get();
+        std::getline(line_stream, item.path);
+
+        if (key != "file" || item.path.empty() || !line_stream.eof())
+            throw runtime_error("snapshot: bad manifest line: " + line);
+        items.push_back(item);
+    }
+
+    //  everything is unpacked next to the targets first,
+    //  and moved in place only after all hashes did match
+    auto staging = [](filesystem::path const& target)
+    {
+        filesystem::path result = target;
+        result += ".snapshot";
+        return result;
+    };
+
+    try
+    {
+        for (auto const& target : targets)
+        {
+            filesystem::remove_all(staging(target.second));
+            filesystem::create_directories(staging(target.second));
+        }
+
+        for (auto const& item : items)
+        {
+            filesystem::path relative(item.path);
+            auto it_target = targets.find(relative.begin()->string());
+            if (it_target == targets.end())
+                throw runtime_error("snapshot: unexpected directory: " + item.path);
+
+            filesystem::path path = staging(it_target->second);
+            for (auto it = ++relative.begin(); it != relative.end(); ++it)
+            {
+                if (*it == ".." || *it == ".")
+                    throw runtime_error("snapshot: bad path: " + item.path);
+                path /= *it;
+            }
+
+            check_remaining(fl, file_size, item.size, item.path);
+            string content(item.size, '\0');
+            if (false == content.empty())
+                fl.read(&content[0], std::streamsize(item.size));
+            if (!fl)
+                throw runtime_error("snapshot: truncated at: " + item.path);
+            if (meshpp::hash(content) != item.hash)
+                throw runtime_error("snapshot: hash mismatch at: " + item.path);
+
+            filesystem::create_directories(path.parent_path());
+            filesystem::ofstream out;
+            out.open(path, std::ios_base::binary | std::ios_base::trunc);
+            out.write(content.data(), std::streamsize(content.size()));
+            out.flush();
+            if (!out)
+                throw runtime_error("cannot write: " + path.string());
+
+            ++info.files;
+            info.bytes += content.size();
+        }
+
+        for (auto const& target : targets)
+        {
+            filesystem::remove_all(target.second);
+            filesystem::rename(staging(target.second), target.second);
+        }
+    }
+    catch (...)
+    {
+        for (auto const& target : targets)
+        {
+            boost::system::error_code ec;
+            filesystem::remove_all(staging(target.second), ec);
+        }
+        throw;
+    }
+
+    return info;
+}
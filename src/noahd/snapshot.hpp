@@ -0,0 +1,35 @@
+#pragma once
+
+#include <mesh.pp/cryptoutility.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+//  a snapshot is a single file carrying the content of the named data
+//  directories, a manifest with size and hash of every file in them and
+//  the signature of the manifest by the exporting node key
+class snapshot_info
+{
+public:
+    std::string signer;
+    size_t files = 0;
+    uint64_t bytes = 0;
+};
+
+using snapshot_directories = std::vector<std::pair<std::string, boost::filesystem::path>>;
+
+snapshot_info export_snapshot(snapshot_directories const& directories,
+                              boost::filesystem::path const& snapshot_path,
+                              meshpp::private_key const& pv_key);
+
+//  every target directory has to be empty, nothing is touched
+//  unless the whole snapshot has been verified. the manifest has to be
+//  signed by expected_signer, the public key of the exporting node
+snapshot_info import_snapshot(boost::filesystem::path const& snapshot_path,
+                              snapshot_directories const& directories,
+                              std::string const& expected_signer);
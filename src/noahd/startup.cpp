@@ -0,0 +1,54 @@
+#include "startup.hpp"
+
+#include <iostream>
+#include <mutex>
+
+using std::string;
+
+class startup_timer::impl
+{
+public:
+    impl(string const& _name)
+        : name(_name)
+        , start(clock::now())
+    {}
+
+    void add(string const& phase, clock::time_point from)
+    {
+        std::chrono::duration<double> seconds = clock::now() - from;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        phases.push_back(std::make_pair(phase, seconds.count()));
+        std::cout << "startup" << (name.empty() ? string() : " " + name) << ": "
+                  << phase << " "
+                  << uint64_t(seconds.count() * 1000) << " ms" << std::endl;
+    }
+
+    string name;
+    clock::time_point start;
+    mutable std::mutex mutex;
+    std::vector<std::pair<string, double>> phases;
+};
+
+startup_timer::startup_timer(string const& name)
+    : m_pimpl(new impl(name))
+{}
+
+startup_timer::~startup_timer()
+{}
+
+void startup_timer::phase(string const& name, clock::time_point start)
+{
+    m_pimpl->add(name, start);
+}
+
+void startup_timer::ready()
+{
+    m_pimpl->add("total", m_pimpl->start);
+}
+
+std::vector<std::pair<string, double>> startup_timer::phases() const
+{
+    std::lock_guard<std::mutex> lock(m_pimpl->mutex);
+    return m_pimpl->phases;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+//  the time noahd spends in each phase of its startup, printed to the
+//  console as each phase ends. phases may run in parallel, each one is
+//  timed from its own start. the lines carry the name when there is one,
+//  to tell apart the instances starting at once. all methods may be
+//  called from any thread
+class startup_timer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    startup_timer(std::string const& name = std::string());
+    startup_timer(startup_timer const&) = delete;
+    ~startup_timer();
+
+    //  the phase took from start till now
+    void phase(std::string const& name, clock::time_point start);
+    //  the whole startup took since the construction
+    void ready();
+
+    //  seconds, in the order the phases ended, "total" last after ready()
+    std::vector<std::pair<std::string, double>> phases() const;
+
+    class impl;
+private:
+    std::unique_ptr<impl> m_pimpl;
+};
@@ -0,0 +1,650 @@
+#include <belt.pp/global.hpp>
+
+#include <mesh.pp/cryptoutility.hpp>
+
+#include <publiq.pp/coin.hpp>
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <noah.pp/allocation_hooks.hpp>
+#include <noah.pp/arena.hpp>
+#include <noah.pp/block_store.hpp>
+#include <noah.pp/binary_codec.hpp>
+#include <noah.pp/genesis.hpp>
+#include <noah.pp/json.hpp>
+#include <noah.pp/kv_backend.hpp>
+#include <noah.pp/signature_verifier.hpp>
+#include <noah.pp/transaction_executor.hpp>
+#include <noah.pp/worker_pool.hpp>
+
+#include "http_server.hpp"
+#include "rpc_batch.hpp"
+#include "rpc_client.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <vector>
+
+using namespace BlockchainMessage;
+namespace program_options = boost::program_options;
+namespace filesystem = boost::filesystem;
+
+using std::string;
+using std::cout;
+using std::endl;
+using std::vector;
+using std::unique_ptr;
+
+bool process_command_line(int argc, char** argv,
+                          string& block_store_directory,
+                          string& format,
+                          size_t& iterations,
+                          size_t& transactions,
+                          size_t& threads,
+                          size_t& accounts,
+                          unsigned short& rpc_port);
+
+class benchmark_result
+{
+public:
+    string name;
+    uint64_t iterations;
+    double seconds;
+    uint64_t allocations;   //  heap allocations during the whole run
+};
+
+//  a run can be too short for the clock, it reports 0 rather than inf
+double per_second(benchmark_result const& result)
+{
+    if (result.seconds <= 0)
+        return 0;
+    return double(result.iterations) / result.seconds;
+}
+
+double allocations_per_iteration(benchmark_result const& result)
+{
+    if (0 == result.iterations)
+        return 0;
+    return double(result.allocations) / double(result.iterations);
+}
+
+//  fn(index) is called iterations times, the result is
+//  reported per iteration, so one call has to be one operation
+template <typename FUNCTION>
+benchmark_result run(string const& name, uint64_t iterations, FUNCTION fn)
+{
+    uint64_t allocations = noahpp::allocation_counter::allocations();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t index = 0; index != iterations; ++index)
+        fn(index);
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    benchmark_result result;
+    result.name = name;
+    result.iterations = iterations;
+    result.seconds = duration.count();
+    result.allocations = noahpp::allocation_counter::allocations() - allocations;
+    return result;
+}
+
+class synthetic_transfer
+{
+public:
+    string from;
+    string to;
+    uint64_t amount;
+};
+
+//  the keys come from a fixed brain key, so every run signs the same block
+void make_synthetic_block(size_t count,
+                          vector<SignedTransaction>& signed_transactions,
+                          vector<synthetic_transfer>& transfers)
+{
+    size_t const account_count = 100;
+    meshpp::random_seed seed("noahd_bench synthetic accounts");
+    vector<meshpp::private_key> keys;
+    for (size_t index = 0; index != account_count; ++index)
+        keys.push_back(seed.get_private_key(uint32_t(index)));
+
+    for (size_t index = 0; index != count; ++index)
+    {
+        auto const& from_key = keys[index % account_count];
+        auto const& to_key = keys[(index * 7 + 1) % account_count];
+
+        Transfer transfer;
+        transfer.from = from_key.get_public_key().to_string();
+        transfer.to = to_key.get_public_key().to_string();
+        transfer.amount = publiqpp::coin(1, 0).to_Coin();
+        transfer.message = "noahd_bench " + std::to_string(index);
+
+        Transaction transaction;
+        transaction.creation.tm = 1559347200 + time_t(index);
+        transaction.expiry.tm = transaction.creation.tm + 3600;
+        transaction.fee = publiqpp::coin(0, 1).to_Coin();
+        transaction.action = transfer;
+
+        Authority authority;
+        authority.address = transfer.from;
+        authority.signature = from_key.sign(transaction.to_string()).base58;
+
+        SignedTransaction signed_transaction;
+        signed_transaction.transaction_details = transaction;
+        signed_transaction.authorizations.push_back(authority);
+        signed_transactions.push_back(signed_transaction);
+
+        synthetic_transfer item;
+        item.from = transfer.from;
+        item.to = transfer.to;
+        item.amount = 1;
+        transfers.push_back(item);
+    }
+}
+
+//  a synthetic file write microbench, not publiq's fs_state layout: a text
+//  file per account, read the balance and write it back, once for the
+//  sender and once for the receiver
+void apply_transfer(filesystem::path const& state, synthetic_transfer const& transfer)
+{
+    auto update = [&state](string const& address, int64_t delta)
+    {
+        filesystem::path path = state / address;
+        int64_t balance = 1000000;
+        {
+            filesystem::ifstream fl(path);
+            if (fl)
+                fl >> balance;
+        }
+        filesystem::ofstream fl(path, std::ios_base::trunc);
+        fl << balance + delta;
+    };
+
+    update(transfer.from, -int64_t(transfer.amount));
+    update(transfer.to, int64_t(transfer.amount));
+}
+
+string account_key(uint64_t index)
+{
+    static char const digits[] = "0123456789abcdef";
+    uint64_t hash = noahpp::detail::stable_hash(std::to_string(index));
+    string result = "NOAH";
+    for (size_t digit = 0; digit != 16; ++digit)
+        result += digits[(hash >> (digit * 4)) & 0xf];
+    return result;
+}
+
+//  a state of accounts balances in each kv_store backend: loading it,
+//  reading balances, transfers each a read and write of both sides in
+//  one batch, and listing up to 100 accounts by a prefix of the address
+void run_kv_benchmarks(uint64_t accounts,
+                       uint64_t iterations,
+                       vector<benchmark_result>& results)
+{
+    for (auto const& backend : noahpp::kv_backends())
+    {
+        filesystem::path path = filesystem::temp_directory_path() /
+                                filesystem::unique_path("noahd_bench_kv_%%%%%%%%");
+        {
+            auto store = noahpp::open_kv_store(backend, path);
+            string name = "kv_" + backend + "_";
+
+            results.push_back(run(name + "load_" + std::to_string(accounts), 1, [&store, accounts](uint64_t)
+            {
+                noahpp::kv_store::batch changes;
+                for (uint64_t index = 0; index != accounts; ++index)
+                {
+                    changes.put(account_key(index), "1000000");
+                    if (changes.changes.size() == 10000)
+                    {
+                        store->apply(changes);
+                        changes.changes.clear();
+                    }
+                }
+                store->apply(changes);
+                store->flush();
+            }));
+            results.back().iterations = accounts;
+
+            results.push_back(run(name + "get", iterations, [&store, accounts](uint64_t index)
+            {
+                string value;
+                if (false == store->get(account_key(index * 7919 % accounts), value))
+                    throw std::logic_error("missing account");
+            }));
+
+            results.push_back(run(name + "transfer", iterations, [&store, accounts](uint64_t index)
+            {
+                string from = account_key(index * 7919 % accounts);
+                string to = account_key((index * 104729 + 1) % accounts);
+                string from_balance;
+                string to_balance;
+                store->get(from, from_balance);
+                store->get(to, to_balance);
+
+                noahpp::kv_store::batch changes;
+                changes.put(from, std::to_string(std::stoll(from_balance) - 1));
+                changes.put(to, std::to_string(std::stoll(to_balance) + 1));
+                store->apply(changes);
+            }));
+
+            //  the files backend walks every file for a scan
+            uint64_t scans = ("files" == backend) ? std::min<uint64_t>(iterations, 10) : iterations;
+            results.push_back(run(name + "prefix_scan", scans, [&store, accounts](uint64_t index)
+            {
+                string prefix = account_key(index * 7919 % accounts).substr(0, 7);
+                size_t count = 0;
+                store->scan(prefix, prefix, [&count](string const&, string const&)
+                {
+                    return ++count < 100;
+                });
+                if (0 == count)
+                    throw std::logic_error("prefix scan");
+            }));
+        }
+        filesystem::remove_all(path);
+    }
+}
+
+//  a block of transfers between random accounts of a kv_store state,
+//  executed in each mode of the transaction executor. the changes are
+//  not applied, so every mode starts from the same state
+void run_execution_benchmarks(noahpp::worker_pool* pool,
+                              uint64_t accounts,
+                              uint64_t transactions,
+                              vector<benchmark_result>& results)
+{
+    filesystem::path path = filesystem::temp_directory_path() /
+                            filesystem::unique_path("noahd_bench_execute_%%%%%%%%");
+    {
+        auto store = noahpp::open_kv_store("lsm", path);
+        noahpp::kv_store::batch balances;
+        for (uint64_t index = 0; index != accounts; ++index)
+            balances.put(account_key(index), "1000000");
+        store->apply(balances);
+
+        vector<noahpp::transaction_executor::access> accesses;
+        for (uint64_t index = 0; index != transactions; ++index)
+        {
+            noahpp::transaction_executor::access item;
+            item.writes.push_back(account_key(noahpp::detail::stable_hash(std::to_string(index), 1) % accounts));
+            item.writes.push_back(account_key(noahpp::detail::stable_hash(std::to_string(index), 2) % accounts));
+            accesses.push_back(item);
+        }
+
+        auto transfer = [&accesses](size_t index,
+                                    noahpp::transaction_executor::view const& state,
+                                    noahpp::kv_store::batch& changes)
+        {
+            auto const& from = accesses[index].writes.front();
+            auto const& to = accesses[index].writes.back();
+            string from_balance;
+            string to_balance;
+            if (false == state.get(from, from_balance) ||
+                false == state.get(to, to_balance))
+                throw std::logic_error("missing account");
+
+            changes.put(from, std::to_string(std::stoll(from_balance) - 1));
+            changes.put(to, std::to_string(std::stoll(to_balance) + 1));
+        };
+
+        std::pair<string, noahpp::transaction_executor::mode> const modes[] =
+        {
+            {"serial", noahpp::transaction_executor::mode::serial},
+            {"parallel", noahpp::transaction_executor::mode::parallel},
+            {"verify", noahpp::transaction_executor::mode::verify}
+        };
+        for (auto const& item : modes)
+        {
+            noahpp::transaction_executor executor(pool, item.second);
+            auto result = run("execute_block_" + item.first, 1, [&executor, &store, &accesses, &transfer](uint64_t)
+            {
+                executor.execute(*store, accesses, transfer);
+            });
+            result.iterations = transactions;
+            results.push_back(result);
+        }
+    }
+    filesystem::remove_all(path);
+}
+
+//  noahd's listener in this process answering every message with Done,
+//  and one connection per benchmark: a new connection for each request,
+//  one kept alive, requests pipelined on it, and batches. all of them
+//  count requests per second over a single connection
+void run_rpc_benchmarks(unsigned short port,
+                        uint64_t iterations,
+                        vector<benchmark_result>& results)
+{
+    string const done = Done().to_string();
+    http_server::handler answer_done = [&done](http_request&&, http_server::responder respond)
+    {
+        http_response response;
+        response.content_type = "application/json";
+        response.body = done;
+        respond(std::move(response));
+    };
+    http_server server("127.0.0.1", port, [&answer_done](http_request&& request, http_server::responder respond)
+    {
+        if (is_rpc_batch(request.body))
+            handle_rpc_batch(std::move(request), respond, answer_done);
+        else
+            answer_done(std::move(request), respond);
+    });
+
+    LoggedTransactionsRequest message;
+    message.start_index = 0;
+    message.max_count = 1;
+    string const body = message.to_string();
+
+    //  the closed connections wait in TIME_WAIT, too many of them
+    //  would take all the local ports
+    results.push_back(run("rpc_connection_per_request", std::min<uint64_t>(iterations, 1000), [port, &body](uint64_t)
+    {
+        rpc_client client("127.0.0.1", port);
+        client.request(body);
+    }));
+
+    rpc_client client("127.0.0.1", port);
+    results.push_back(run("rpc_keep_alive", iterations, [&client, &body](uint64_t)
+    {
+        client.request(body);
+    }));
+
+    size_t const group = 100;
+    uint64_t groups = std::max<uint64_t>(1, iterations / group);
+    vector<string> bodies(group, body);
+    auto pipelined = run("rpc_pipelined_" + std::to_string(group), groups, [&client, &bodies](uint64_t)
+    {
+        client.request_all(bodies);
+    });
+    pipelined.iterations = groups * group;
+    results.push_back(pipelined);
+
+    string batch = "[" + body;
+    for (size_t index = 1; index != group; ++index)
+        batch += "," + body;
+    batch += "]";
+    auto batched = run("rpc_batched_" + std::to_string(group), groups, [&client, &batch](uint64_t)
+    {
+        client.request(batch);
+    });
+    batched.iterations = groups * group;
+    results.push_back(batched);
+}
+
+int main(int argc, char** argv)
+{
+    string block_store_directory;
+    string format = "json";
+    size_t iterations = 10000;
+    size_t transactions = 1000;
+    size_t threads = 0;
+    size_t accounts = 0;
+    unsigned short rpc_port = 0;
+
+    if (false == process_command_line(argc, argv,
+                                      block_store_directory,
+                                      format,
+                                      iterations,
+                                      transactions,
+                                      threads,
+                                      accounts,
+                                      rpc_port))
+        return 1;
+
+    try
+    {
+        meshpp::config::set_public_key_prefix("NOAH");
+
+        unique_ptr<noahpp::worker_pool> pool(new noahpp::worker_pool(threads));
+        vector<benchmark_result> results;
+
+        //  the genesis block unless real blocks are given
+        vector<string> blocks;
+        if (false == block_store_directory.empty())
+        {
+            noahpp::block_store store(block_store_directory, true);
+            for (uint64_t index = 0; index != store.length() && blocks.size() != iterations; ++index)
+            {
+                string block = store.at(index).to_string();
+                if (noahpp::binary_codec::is_binary(block))
+                    block = noahpp::binary_codec::decode(block);
+                blocks.push_back(block);
+            }
+        }
+        if (blocks.empty())
+        {
+            SignedBlock genesis;
+            genesis.from_string(noahpp::genesis_signed_block(false), nullptr);
+            blocks.push_back(genesis.to_string());
+        }
+
+        vector<SignedBlock> signed_blocks(blocks.size());
+        vector<string> encoded;
+        for (size_t index = 0; index != blocks.size(); ++index)
+        {
+            signed_blocks[index].from_string(blocks[index], nullptr);
+            encoded.push_back(noahpp::binary_codec::encode(blocks[index]));
+        }
+
+        results.push_back(run("signed_block_from_string", iterations, [&blocks](uint64_t index)
+        {
+            SignedBlock signed_block;
+            signed_block.from_string(blocks[index % blocks.size()], nullptr);
+        }));
+        results.push_back(run("signed_block_to_string", iterations, [&signed_blocks](uint64_t index)
+        {
+            signed_blocks[index % signed_blocks.size()].to_string();
+        }));
+        results.push_back(run("json_parse", iterations, [&blocks](uint64_t index)
+        {
+            noahpp::json::parse(blocks[index % blocks.size()]);
+        }));
+        noahpp::arena memory;
+        results.push_back(run("json_parse_arena", iterations, [&blocks, &memory](uint64_t index)
+        {
+            noahpp::json::parse(blocks[index % blocks.size()], memory);
+            memory.reset();
+        }));
+        results.push_back(run("binary_encode", iterations, [&blocks](uint64_t index)
+        {
+            noahpp::binary_codec::encode(blocks[index % blocks.size()]);
+        }));
+        results.push_back(run("binary_decode", iterations, [&encoded](uint64_t index)
+        {
+            noahpp::binary_codec::decode(encoded[index % encoded.size()]);
+        }));
+
+        //  the coin amounts of the whole reward schedule, summed and taken apart
+        auto rewards = noahpp::block_reward_array();
+        results.push_back(run("coin_reward_schedule", iterations, [&rewards](uint64_t)
+        {
+            publiqpp::coin total;
+            for (auto const& reward : rewards)
+                total += reward;
+            for (auto const& reward : rewards)
+                total -= reward;
+            if (false == total.empty())
+                throw std::logic_error("coin arithmetic");
+        }));
+
+        vector<SignedTransaction> signed_transactions;
+        vector<synthetic_transfer> transfers;
+        make_synthetic_block(transactions, signed_transactions, transfers);
+
+        vector<noahpp::signature_verifier::item> items;
+        for (auto const& signed_transaction : signed_transactions)
+            noahpp::signature_verifier::collect(signed_transaction, items);
+
+        results.push_back(run("signature_verify_serial", items.size(), [&items](uint64_t index)
+        {
+            if (false == noahpp::signature_verifier::check(items[index]))
+                throw std::logic_error("signature");
+        }));
+
+        noahpp::signature_verifier verifier(pool.get());
+        auto parallel = run("signature_verify_parallel", 1, [&verifier, &items](uint64_t)
+        {
+            verifier.verify(items);
+        });
+        parallel.iterations = items.size();
+        results.push_back(parallel);
+
+        //  the synthetic block's transfers go around 100 accounts, so
+        //  this is the scheduling cost more than a typical grouping
+        vector<noahpp::transaction_executor::access> accesses;
+        for (auto const& signed_transaction : signed_transactions)
+            accesses.push_back(noahpp::transaction_executor::access_of(signed_transaction));
+        auto schedule = run("transaction_schedule", 1, [&accesses](uint64_t)
+        {
+            noahpp::transaction_executor::schedule(accesses);
+        });
+        schedule.iterations = accesses.size();
+        results.push_back(schedule);
+
+        //  signature checks and small file writes in a throwaway directory,
+        //  removed again at the end
+        filesystem::path state = filesystem::temp_directory_path() /
+                                 filesystem::unique_path("noahd_bench_%%%%%%%%");
+        filesystem::create_directories(state);
+        auto apply = run("synthetic_file_write_block_" + std::to_string(transactions), 1,
+                         [&verifier, &signed_transactions, &transfers, &state](uint64_t)
+        {
+            auto valid = verifier.filter(std::move(signed_transactions));
+            if (valid.size() != transfers.size())
+                throw std::logic_error("synthetic block signatures");
+
+            for (auto const& transfer : transfers)
+                apply_transfer(state, transfer);
+        });
+        apply.iterations = transfers.size();
+        results.push_back(apply);
+        filesystem::remove_all(state);
+
+        if (rpc_port > 0)
+            run_rpc_benchmarks(rpc_port, iterations, results);
+
+        if (accounts > 0)
+        {
+            run_kv_benchmarks(accounts, iterations, results);
+            run_execution_benchmarks(pool.get(), accounts, transactions, results);
+        }
+
+        if ("csv" == format)
+        {
+            cout << "benchmark,iterations,seconds,per_second,allocations_per_iteration" << endl;
+            for (auto const& result : results)
+                cout << result.name << ","
+                     << result.iterations << ","
+                     << std::setprecision(9) << result.seconds << ","
+                     << std::setprecision(12) << per_second(result) << ","
+                     << std::setprecision(6) << allocations_per_iteration(result) << endl;
+        }
+        else
+        {
+            cout << "{\"threads\":" << pool->size() << ",\"results\":[";
+            for (size_t index = 0; index != results.size(); ++index)
+            {
+                auto const& result = results[index];
+                if (index > 0)
+                    cout << ",";
+                cout << endl << "{\"benchmark\":\"" << result.name << "\""
+                     << ",\"iterations\":" << result.iterations
+                     << ",\"seconds\":" << std::setprecision(9) << result.seconds
+                     << ",\"per_second\":" << std::setprecision(12) << per_second(result)
+                     << ",\"allocations_per_iteration\":" << std::setprecision(6)
+                     << allocations_per_iteration(result) << "}";
+            }
+            cout << endl << "]}" << endl;
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        cout << "exception cought: " << ex.what() << endl;
+        return 1;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool process_command_line(int argc, char** argv,
+                          string& block_store_directory,
+                          string& format,
+                          size_t& iterations,
+                          size_t& transactions,
+                          size_t& threads,
+                          size_t& accounts,
+                          unsigned short& rpc_port)
+{
+    program_options::options_description options_description;
+    try
+    {
+        auto desc_init = options_description.add_options()
+            ("help,h", "Print this help message and exit.")
+            ("block_store,s", program_options::value<string>(&block_store_directory),
+                            "Block store directory to take the blocks from, genesis block is used otherwise")
+            ("format,f", program_options::value<string>(&format),
+                            "Output format, json or csv")
+            ("iterations,n", program_options::value<size_t>(&iterations),
+                            "Iterations of the per block benchmarks")
+            ("transactions,t", program_options::value<size_t>(&transactions),
+                            "Transactions in the synthetic block")
+            ("threads,w", program_options::value<size_t>(&threads),
+                            "Worker threads for the parallel benchmarks, 0 for all cores")
+            ("accounts", program_options::value<size_t>(&accounts),
+                            "Accounts in the state for the kv store benchmarks, 0 skips them")
+            ("rpc_port", program_options::value<unsigned short>(&rpc_port),
+                            "Local port for the rpc benchmarks, 0 skips them");
+        (void)(desc_init);
+
+        program_options::variables_map options;
+
+        program_options::store(
+                    program_options::parse_command_line(argc, argv, options_description),
+                    options);
+
+        program_options::notify(options);
+
+        if (options.count("help"))
+        {
+            throw std::runtime_error("");
+        }
+
+        if (format != "json" && format != "csv")
+            throw std::runtime_error("unknown format: " + format);
+        if (0 == iterations || 0 == transactions)
+            throw std::runtime_error("iterations and transactions can't be 0");
+    }
+    catch (std::exception const& ex)
+    {
+        std::stringstream ss;
+        ss << options_description;
+
+        string ex_message = ex.what();
+        if (false == ex_message.empty())
+            cout << ex.what() << endl << endl;
+        cout << ss.str();
+        return false;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,301 @@
+#include <belt.pp/global.hpp>
+
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <noah.pp/block_store.hpp>
+#include <noah.pp/binary_codec.hpp>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <sstream>
+#include <vector>
+
+using namespace BlockchainMessage;
+namespace program_options = boost::program_options;
+namespace filesystem = boost::filesystem;
+
+using std::string;
+using std::cout;
+using std::endl;
+using std::vector;
+using std::runtime_error;
+
+class block_location
+{
+public:
+    uint64_t block_number;
+    size_t file_index;
+    size_t offset;
+    size_t length;
+};
+
+string read_file(filesystem::path const& path);
+void find_signed_blocks(string const& text, vector<std::pair<size_t, size_t>>& objects);
+bool process_command_line(int argc, char** argv,
+                          string& blockchain_directory,
+                          string& block_store_directory,
+                          string& block_number,
+                          bool& binary);
+
+//  one shot migration from the blockchain directory written by publiq.pp
+//  to the memory mapped block store, and a way to look into the result
+int main(int argc, char** argv)
+{
+    string blockchain_directory;
+    string block_store_directory;
+    string block_number;
+    bool binary = false;
+
+    if (false == process_command_line(argc, argv,
+                                      blockchain_directory,
+                                      block_store_directory,
+                                      block_number,
+                                      binary))
+        return 1;
+
+    try
+    {
+        if (false == block_number.empty())
+        {
+            noahpp::block_store store(block_store_directory, true);
+            string block = store.at(std::stoull(block_number)).to_string();
+            if (noahpp::binary_codec::is_binary(block))
+                block = noahpp::binary_codec::decode(block);
+            cout << block << endl;
+            return 0;
+        }
+
+        if (blockchain_directory.empty())
+        {
+            noahpp::block_store store(block_store_directory, true);
+            cout << "blocks: " << store.length() << endl;
+            if (store.first() > 0)
+                cout << "pruned before: " << store.first() << endl;
+            return 0;
+        }
+
+        //  the existing layout keeps blocks as JSON, possibly several per
+        //  file and wrapped in other objects, so the files are scanned for
+        //  SignedBlock objects and those are ordered by block number
+        vector<filesystem::path> files;
+        for (filesystem::recursive_directory_iterator it(blockchain_directory), end;
+             it != end; ++it)
+        {
+            if (filesystem::is_regular_file(it->path()))
+                files.push_back(it->path());
+        }
+
+        vector<block_location> locations;
+        for (size_t file_index = 0; file_index != files.size(); ++file_index)
+        {
+            string text = read_file(files[file_index]);
+            vector<std::pair<size_t, size_t>> objects;
+            find_signed_blocks(text, objects);
+
+            for (auto const& object : objects)
+            {
+                SignedBlock signed_block;
+                signed_block.from_string(text.substr(object.first, object.second), nullptr);
+
+                block_location location;
+                location.block_number = signed_block.block_details.header.block_number;
+                location.file_index = file_index;
+                location.offset = object.first;
+                location.length = object.second;
+                locations.push_back(location);
+            }
+        }
+
+        std::stable_sort(locations.begin(), locations.end(),
+                         [](block_location const& first, block_location const& second)
+        {
+            return first.block_number < second.block_number;
+        });
+
+        noahpp::block_store store(block_store_directory);
+        if (store.length() > 0)
+            throw runtime_error("block store is not empty: " + block_store_directory);
+
+        size_t current_file = files.size();
+        string text;
+        for (auto const& location : locations)
+        {
+            if (location.block_number < store.length())
+                continue;   //  same block found twice
+            if (location.block_number != store.length())
+                throw runtime_error("block " + std::to_string(store.length()) + " is missing");
+
+            if (current_file != location.file_index)
+            {
+                current_file = location.file_index;
+                text = read_file(files[current_file]);
+            }
+
+            SignedBlock signed_block;
+            signed_block.from_string(text.substr(location.offset, location.length), nullptr);
+            if (binary)
+                store.push_back(noahpp::binary_codec::encode(signed_block.to_string()));
+            else
+                store.push_back(signed_block.to_string());
+
+            if (0 == store.length() % 10000)
+                cout << "blocks: " << store.length() << endl;
+        }
+        store.flush();
+
+        cout << "migrated blocks: " << store.length() << endl;
+    }
+    catch (std::exception const& ex)
+    {
+        cout << "exception cought: " << ex.what() << endl;
+        return 1;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+string read_file(filesystem::path const& path)
+{
+    filesystem::ifstream fl;
+    fl.open(path, std::ios_base::binary);
+    if (!fl)
+        throw runtime_error("cannot open: " + path.string());
+
+    return string(std::istreambuf_iterator<char>(fl),
+                  std::istreambuf_iterator<char>());
+}
+
+//  collects offset and length of the outermost JSON objects
+//  that start with the SignedBlock type tag
+void find_signed_blocks(string const& text, vector<std::pair<size_t, size_t>>& objects)
+{
+    string const tag = "\"rtt\"";
+    string const rtt = std::to_string(SignedBlock::rvalue);
+
+    class open_object
+    {
+    public:
+        size_t offset;
+        bool signed_block;
+    };
+    vector<open_object> stack;
+    size_t open_signed_blocks = 0;
+    bool in_string = false;
+
+    for (size_t index = 0; index < text.size(); ++index)
+    {
+        char ch = text[index];
+        if (in_string)
+        {
+            if ('\\' == ch)
+                ++index;
+            else if ('"' == ch)
+                in_string = false;
+            continue;
+        }
+
+        if ('"' == ch)
+            in_string = true;
+        else if ('{' == ch)
+        {
+            open_object item;
+            item.offset = index;
+            item.signed_block = false;
+
+            size_t pos = text.find_first_not_of(" \t\r\n", index + 1);
+            if (pos != string::npos && 0 == text.compare(pos, tag.length(), tag))
+            {
+                pos = text.find_first_not_of(" \t\r\n", pos + tag.length());
+                if (pos != string::npos && ':' == text[pos])
+                {
+                    pos = text.find_first_not_of(" \t\r\n", pos + 1);
+                    size_t end = text.find_first_not_of("0123456789", pos);
+                    item.signed_block = (pos != string::npos &&
+                                         0 == text.compare(pos, end - pos, rtt));
+                }
+            }
+
+            if (item.signed_block)
+                ++open_signed_blocks;
+            stack.push_back(item);
+        }
+        else if ('}' == ch && false == stack.empty())
+        {
+            open_object item = stack.back();
+            stack.pop_back();
+
+            if (item.signed_block)
+            {
+                --open_signed_blocks;
+                if (0 == open_signed_blocks)
+                    objects.push_back(std::make_pair(item.offset, index - item.offset + 1));
+            }
+        }
+    }
+}
+
+bool process_command_line(int argc, char** argv,
+                          string& blockchain_directory,
+                          string& block_store_directory,
+                          string& block_number,
+                          bool& binary)
+{
+    program_options::options_description options_description;
+    try
+    {
+        auto desc_init = options_description.add_options()
+            ("help,h", "Print this help message and exit.")
+            ("blockchain,b", program_options::value<string>(&blockchain_directory),
+                            "Existing blockchain directory to migrate from")
+            ("block_store,s", program_options::value<string>(&block_store_directory)->required(),
+                            "Block store directory")
+            ("block_number,n", program_options::value<string>(&block_number),
+                            "Print the block with this number and exit")
+            ("binary", "Keep the migrated blocks in binary encoding");
+        (void)(desc_init);
+
+        program_options::variables_map options;
+
+        program_options::store(
+                    program_options::parse_command_line(argc, argv, options_description),
+                    options);
+
+        program_options::notify(options);
+
+        if (options.count("help"))
+        {
+            throw std::runtime_error("");
+        }
+        binary = options.count("binary");
+    }
+    catch (std::exception const& ex)
+    {
+        std::stringstream ss;
+        ss << options_description;
+
+        string ex_message = ex.what();
+        if (false == ex_message.empty())
+            cout << ex.what() << endl << endl;
+        cout << ss.str();
+        return false;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,901 @@
+#include <belt.pp/global.hpp>
+
+#include <mesh.pp/cryptoutility.hpp>
+
+#include <publiq.pp/coin.hpp>
+#include <publiq.pp/message.tmpl.hpp>
+
+#include <noah.pp/json.hpp>
+#include <noah.pp/kv_store.hpp>
+
+#include "http_server.hpp"
+#include "rpc_client.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+
+#ifndef B_OS_WINDOWS
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace BlockchainMessage;
+namespace program_options = boost::program_options;
+namespace filesystem = boost::filesystem;
+
+using std::string;
+using std::cout;
+using std::endl;
+using std::vector;
+using std::unique_ptr;
+using std::runtime_error;
+using steady_clock = std::chrono::steady_clock;
+
+class load_options
+{
+public:
+    //  a local network of this many noahd processes, or the rpc
+    //  interfaces of a running one
+    string noahd = "noahd";
+    size_t nodes = 3;
+    vector<string> rpc_addresses;
+    bool testnet = false;
+    string work_directory;
+    unsigned short base_port = 21000;
+    vector<string> node_keys;
+    vector<string> noahd_arguments;
+
+    //  the synthetic load
+    string seed = "noahd_load";
+    size_t accounts = 100;
+    vector<string> account_keys;
+    double rate = 10;
+    double duration = 60;
+    size_t connections = 4;
+    double settle = 30;
+
+    //  recording and replaying
+    string record_path;
+    string listen;
+    string target;
+    string replay_path;
+    double speed = 1;
+};
+
+bool process_command_line(int argc, char** argv, load_options& options);
+
+static std::atomic<bool> g_termination_handled(false);
+void termination_handler(int /*signum*/)
+{
+    g_termination_handled = true;
+}
+
+std::pair<string, unsigned short> split_address(string const& address)
+{
+    auto separator = address.rfind(':');
+    if (separator == string::npos ||
+        separator + 1 == address.size() ||
+        address.find_first_not_of("0123456789", separator + 1) != string::npos)
+        throw runtime_error("expecting address:port, got: " + address);
+
+    return std::make_pair(address.substr(0, separator),
+                          static_cast<unsigned short>(std::stoul(address.substr(separator + 1))));
+}
+
+double percentile(vector<double> values, double fraction)
+{
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = size_t(std::ceil(fraction * double(values.size())));
+    return values[std::min(std::max<size_t>(index, 1), values.size()) - 1];
+}
+
+string percentiles_json(vector<double> const& values)
+{
+    std::ostringstream result;
+    result << std::setprecision(6)
+           << "{\"count\":" << values.size()
+           << ",\"p50\":" << percentile(values, 0.5)
+           << ",\"p90\":" << percentile(values, 0.9)
+           << ",\"p99\":" << percentile(values, 0.99)
+           << ",\"max\":" << percentile(values, 1) << "}";
+    return result.str();
+}
+
+//  one transfer of the synthetic load, offset from the start of the run
+class scheduled_transfer
+{
+public:
+    std::chrono::microseconds offset;
+    size_t from;
+    size_t to;
+    uint64_t amount;    //  in coin fractions
+};
+
+//  the same seed gives the same schedule, the gaps between the transfers
+//  and who sends how much to whom. std::mt19937_64 gives the same numbers
+//  everywhere, the distributions of <random> do not, those are done here
+vector<scheduled_transfer> make_schedule(string const& seed, double rate, double duration, size_t accounts)
+{
+    std::mt19937_64 engine(noahpp::detail::stable_hash(seed));
+    auto uniform = [&engine]
+    {
+        return double(engine() >> 11) / double(uint64_t(1) << 53);
+    };
+
+    vector<scheduled_transfer> result;
+    double seconds = 0;
+    while (true)
+    {
+        //  poisson arrivals, exponential gaps
+        seconds += -std::log(1 - uniform()) / rate;
+        if (seconds >= duration)
+            break;
+
+        scheduled_transfer item;
+        item.offset = std::chrono::microseconds(int64_t(seconds * 1000000));
+        item.from = size_t(engine() % accounts);
+        item.to = size_t((item.from + 1 + engine() % (accounts - 1)) % accounts);
+        item.amount = 1 + engine() % 1000;
+        result.push_back(item);
+    }
+    return result;
+}
+
+//  what happened to one request sent
+class sent_request
+{
+public:
+    bool done = false;
+    string result;          //  rtt of the response, "error" when there was none
+    double rpc_seconds = 0;
+    double lag_seconds = 0; //  behind the schedule when sent
+    steady_clock::time_point sent;
+};
+
+//  sends the requests at their offsets, from connections threads, each
+//  keeps one connection to one of the nodes. the bodies are made right
+//  before sending
+template <typename MAKE_BODY>
+void send_all(vector<std::chrono::microseconds> const& offsets,
+              MAKE_BODY make_body,
+              vector<std::pair<string, unsigned short>> const& nodes,
+              size_t connections,
+              steady_clock::time_point start,
+              vector<sent_request>& requests)
+{
+    std::atomic<size_t> next(0);
+    vector<std::thread> threads;
+    for (size_t connection = 0; connection != connections; ++connection)
+    {
+        threads.emplace_back([&, connection]
+        {
+            auto const& node = nodes[connection % nodes.size()];
+            rpc_client client(node.first, node.second);
+            while (false == g_termination_handled)
+            {
+                size_t index = next++;
+                if (index >= offsets.size())
+                    break;
+
+                auto due = start + offsets[index];
+                std::this_thread::sleep_until(due);
+
+                auto& item = requests[index];
+                item.sent = steady_clock::now();
+                std::chrono::duration<double> lag = item.sent - due;
+                item.lag_seconds = lag.count();
+                try
+                {
+                    auto response = noahpp::json::parse(client.request(make_body(index)));
+                    auto rtt = response.find("rtt");
+                    item.result = rtt ? rtt->text : string("unknown");
+                }
+                catch (std::exception const&)
+                {
+                    item.result = "error";
+                }
+                std::chrono::duration<double> rpc_seconds = steady_clock::now() - item.sent;
+                item.rpc_seconds = rpc_seconds.count();
+                item.done = true;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+}
+
+//  reads the action log of a node and notes when each marked transfer
+//  shows up in it. the log before start() is skipped
+class confirmation_watcher
+{
+public:
+    confirmation_watcher(std::pair<string, unsigned short> const& node, string const& marker)
+        : m_client(node.first, node.second)
+        , m_marker(marker)
+        , m_cursor(0)
+        , m_count(0)
+        , m_stopped(false)
+    {}
+
+    void start(size_t count)
+    {
+        //  to the end of the log first, what is there is not ours
+        while (poll() > 0)
+        {}
+
+        m_count = count;
+        m_thread = std::thread([this]
+        {
+            while (false == m_stopped)
+            {
+                size_t count = 0;
+                try
+                {
+                    count = poll();
+                }
+                catch (std::exception const& ex)
+                {
+                    cout << "action log: " << ex.what() << endl;
+                }
+                if (0 == count)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        });
+    }
+
+    void stop()
+    {
+        m_stopped = true;
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    //  by the index of the transfer, when it was seen first
+    std::map<size_t, steady_clock::time_point> seen() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_seen;
+    }
+    size_t seen_count() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_seen.size();
+    }
+
+private:
+    //  the actions read, a revert of a block shows the transfers again
+    //  and only the first time they are seen counts
+    size_t poll()
+    {
+        LoggedTransactionsRequest request;
+        request.start_index = m_cursor;
+        request.max_count = 1000;
+        string body = m_client.request(request.to_string());
+        auto now = steady_clock::now();
+
+        auto parsed = noahpp::json::parse(body);
+        auto actions = parsed.find("actions");
+        if (nullptr == actions)
+            throw runtime_error("unexpected response: " + body.substr(0, 512));
+        m_cursor += actions->items.size();
+
+        for (size_t position = body.find(m_marker);
+             position != string::npos;
+             position = body.find(m_marker, position + 1))
+        {
+            auto digits = position + m_marker.size();
+            auto end = body.find_first_not_of("0123456789", digits);
+            if (end == digits || end == string::npos)
+                continue;
+            size_t index = size_t(std::stoull(body.substr(digits, end - digits)));
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (index < m_count)
+                m_seen.insert(std::make_pair(index, now));
+        }
+        return actions->items.size();
+    }
+
+    rpc_client m_client;
+    string m_marker;
+    uint64_t m_cursor;
+    size_t m_count;         //  transfers in this run, 0 until start()
+    std::atomic<bool> m_stopped;
+    std::thread m_thread;
+    mutable std::mutex m_mutex;
+    std::map<size_t, steady_clock::time_point> m_seen;
+};
+
+//  one noahd of the local network, a process of its own so that its
+//  cpu and memory can be told apart
+class node_process
+{
+public:
+    class usage
+    {
+    public:
+        double cpu_seconds = 0;
+        uint64_t rss_bytes = 0;
+        uint64_t max_rss_bytes = 0;
+    };
+
+    node_process(string const& noahd, vector<string> const& arguments, filesystem::path const& output)
+        : m_pid(0)
+    {
+#ifdef B_OS_WINDOWS
+        (void)(noahd);
+        (void)(arguments);
+        (void)(output);
+        throw runtime_error("starting nodes is not supported on windows, use --rpc");
+#else
+        vector<string> strings;
+        strings.push_back(noahd);
+        strings.insert(strings.end(), arguments.begin(), arguments.end());
+        vector<char*> argv;
+        for (auto& item : strings)
+            argv.push_back(&item[0]);
+        argv.push_back(nullptr);
+        string output_path = output.string();
+
+        m_pid = ::fork();
+        if (m_pid < 0)
+            throw runtime_error("cannot start " + noahd);
+        if (0 == m_pid)
+        {
+            int fd = ::open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0)
+            {
+                ::dup2(fd, 1);
+                ::dup2(fd, 2);
+                ::close(fd);
+            }
+            ::execvp(argv[0], argv.data());
+            ::_exit(127);
+        }
+#endif
+    }
+    node_process(node_process const&) = delete;
+    ~node_process()
+    {
+        stop();
+    }
+
+    //  from /proc, zero where there is none
+    usage measure() const
+    {
+        usage result;
+        filesystem::ifstream stat(filesystem::path("/proc") / std::to_string(m_pid) / "stat");
+        string line;
+        if (std::getline(stat, line) && line.rfind(')') != string::npos)
+        {
+            //  the fields after the name, utime and stime are 14 and 15
+            std::istringstream fields(line.substr(line.rfind(')') + 2));
+            vector<string> values;
+            string value;
+            while (fields >> value)
+                values.push_back(value);
+#ifndef B_OS_WINDOWS
+            if (values.size() > 12)
+                result.cpu_seconds = double(std::stoull(values[11]) + std::stoull(values[12])) /
+                                     double(::sysconf(_SC_CLK_TCK));
+#endif
+        }
+
+        filesystem::ifstream status(filesystem::path("/proc") / std::to_string(m_pid) / "status");
+        while (std::getline(status, line))
+        {
+            std::istringstream fields(line);
+            string name;
+            uint64_t kilobytes = 0;
+            fields >> name >> kilobytes;
+            if ("VmRSS:" == name)
+                result.rss_bytes = kilobytes * 1024;
+            else if ("VmHWM:" == name)
+                result.max_rss_bytes = kilobytes * 1024;
+        }
+        return result;
+    }
+
+    //  noahd stops on SIGTERM, it is killed if it does not in time
+    void stop()
+    {
+#ifndef B_OS_WINDOWS
+        if (m_pid <= 0)
+            return;
+
+        ::kill(m_pid, SIGTERM);
+        for (size_t attempt = 0; attempt != 300; ++attempt)
+        {
+            if (::waitpid(m_pid, nullptr, WNOHANG) == m_pid)
+            {
+                m_pid = 0;
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        ::kill(m_pid, SIGKILL);
+        ::waitpid(m_pid, nullptr, 0);
+        m_pid = 0;
+#endif
+    }
+
+private:
+#ifdef B_OS_WINDOWS
+    int m_pid;
+#else
+    pid_t m_pid;
+#endif
+};
+
+//  the node answers rpc once it has opened its data directories
+void wait_for_rpc(std::pair<string, unsigned short> const& node, std::chrono::seconds timeout)
+{
+    auto deadline = steady_clock::now() + timeout;
+    while (true)
+    {
+        try
+        {
+            rpc_client client(node.first, node.second, std::chrono::seconds(5));
+            LoggedTransactionsRequest request;
+            request.max_count = 1;
+            client.request(request.to_string());
+            return;
+        }
+        catch (std::exception const& ex)
+        {
+            if (steady_clock::now() > deadline || g_termination_handled)
+                throw runtime_error("node rpc " + node.first + ":" + std::to_string(node.second) +
+                                    " does not answer: " + ex.what());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+}
+
+//  forwards the rpc requests to the target and writes each one to the
+//  file, a line with the milliseconds since the start, a tab and the
+//  body, until SIGINT or SIGTERM
+void record(load_options const& options)
+{
+    auto listen = split_address(options.listen);
+    auto target = split_address(options.target);
+
+    filesystem::ofstream file(options.record_path, std::ios_base::binary | std::ios_base::app);
+    if (!file)
+        throw runtime_error("cannot open: " + options.record_path);
+
+    std::mutex mutex;
+    vector<unique_ptr<rpc_client>> idle_clients;
+    uint64_t recorded = 0;
+    auto start = steady_clock::now();
+
+    http_server server(listen.first, listen.second,
+                       [&](http_request&& request, http_server::responder respond)
+    {
+        http_response response;
+        response.content_type = "application/json";
+        if (request.method != "POST")
+        {
+            response.status = 405;
+            response.body = "rpc expects POST";
+            return respond(std::move(response));
+        }
+
+        //  a newline can only be white space in JSON
+        string line = request.body;
+        std::replace(line.begin(), line.end(), '\n', ' ');
+        std::replace(line.begin(), line.end(), '\r', ' ');
+        std::chrono::duration<double, std::milli> offset = steady_clock::now() - start;
+
+        unique_ptr<rpc_client> client;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            file << uint64_t(offset.count()) << "\t" << line << "\n";
+            file.flush();
+            ++recorded;
+            if (false == idle_clients.empty())
+            {
+                client = std::move(idle_clients.back());
+                idle_clients.pop_back();
+            }
+        }
+        if (nullptr == client)
+            client.reset(new rpc_client(target.first, target.second));
+
+        try
+        {
+            response.body = client->request(request.body);
+            std::lock_guard<std::mutex> lock(mutex);
+            idle_clients.push_back(std::move(client));
+        }
+        catch (std::exception const& ex)
+        {
+            RemoteError error;
+            error.message = ex.what();
+            response.status = 502;
+            response.body = error.to_string();
+        }
+        respond(std::move(response));
+    }, options.connections);
+
+    cout << "recording " << options.listen << " -> " << options.target
+         << " to " << options.record_path << endl;
+    while (false == g_termination_handled)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    server.stop();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cout << "{\"recorded\":" << recorded << "}" << endl;
+}
+
+int main(int argc, char** argv)
+{
+    load_options options;
+    if (false == process_command_line(argc, argv, options))
+        return 1;
+
+#ifdef B_OS_WINDOWS
+    signal(SIGINT, termination_handler);
+#else
+    struct sigaction signal_handler;
+    signal_handler.sa_handler = termination_handler;
+    ::sigemptyset(&signal_handler.sa_mask);
+    signal_handler.sa_flags = 0;
+    ::sigaction(SIGINT, &signal_handler, nullptr);
+    ::sigaction(SIGTERM, &signal_handler, nullptr);
+#endif
+
+    vector<unique_ptr<node_process>> processes;
+    try
+    {
+        if (false == options.record_path.empty())
+        {
+            record(options);
+            return 0;
+        }
+
+        bool local = options.rpc_addresses.empty();
+        meshpp::config::set_public_key_prefix(local || options.testnet ? "TNOAH" : "NOAH");
+
+        vector<std::pair<string, unsigned short>> nodes;
+        if (local)
+        {
+            //  the testnet genesis, and the nodes only know each other
+            //  instead of the seed peers
+            filesystem::path work = options.work_directory.empty() ?
+                                        filesystem::temp_directory_path() /
+                                        filesystem::unique_path("noahd_load_%%%%%%%%") :
+                                        filesystem::path(options.work_directory);
+            meshpp::random_seed node_seed("noahd_load nodes " + options.seed);
+            for (size_t index = 0; index != options.nodes; ++index)
+            {
+                unsigned short p2p_port = static_cast<unsigned short>(options.base_port + 10 * index);
+                unsigned short rpc_port = static_cast<unsigned short>(p2p_port + 1);
+                auto directory = work / ("node_" + std::to_string(index));
+                filesystem::create_directories(directory);
+
+                vector<string> arguments = {"--testnet",
+                                            "--action_log",
+                                            "--p2p_local_interface", "127.0.0.1:" + std::to_string(p2p_port),
+                                            "--rpc_local_interface", "127.0.0.1:" + std::to_string(rpc_port),
+                                            "--data_directory", directory.string(),
+                                            "--node_private_key",
+                                            index < options.node_keys.size() ?
+                                                options.node_keys[index] :
+                                                node_seed.get_private_key(uint32_t(index)).get_base58_wif()};
+                for (size_t peer = 0; peer != options.nodes; ++peer)
+                {
+                    if (peer == index)
+                        continue;
+                    arguments.push_back("--p2p_remote_host");
+                    arguments.push_back("127.0.0.1:" + std::to_string(options.base_port + 10 * peer));
+                }
+                arguments.insert(arguments.end(), options.noahd_arguments.begin(), options.noahd_arguments.end());
+
+                processes.emplace_back(new node_process(options.noahd, arguments, directory / "noahd.out"));
+                nodes.push_back(std::make_pair(string("127.0.0.1"), rpc_port));
+            }
+            cout << "nodes in: " << work.string() << endl;
+        }
+        else
+        {
+            for (auto const& item : options.rpc_addresses)
+                nodes.push_back(split_address(item));
+        }
+
+        for (auto const& node : nodes)
+            wait_for_rpc(node, std::chrono::seconds(120));
+
+        vector<std::chrono::microseconds> offsets;
+        vector<scheduled_transfer> transfers;
+        vector<string> bodies;
+        if (false == options.replay_path.empty())
+        {
+            filesystem::ifstream file(options.replay_path, std::ios_base::binary);
+            if (!file)
+                throw runtime_error("cannot open: " + options.replay_path);
+            string line;
+            while (std::getline(file, line))
+            {
+                auto separator = line.find('\t');
+                if (separator == string::npos)
+                    continue;
+                double milliseconds = std::stod(line.substr(0, separator)) / options.speed;
+                offsets.push_back(std::chrono::microseconds(int64_t(milliseconds * 1000)));
+                bodies.push_back(line.substr(separator + 1));
+            }
+        }
+        else
+        {
+            transfers = make_schedule(options.seed, options.rate, options.duration, options.accounts);
+            for (auto const& item : transfers)
+                offsets.push_back(item.offset);
+        }
+
+        vector<meshpp::private_key> keys;
+        vector<string> addresses;
+        meshpp::random_seed account_seed("noahd_load accounts " + options.seed);
+        for (size_t index = 0; bodies.empty() && index != options.accounts; ++index)
+        {
+            if (index < options.account_keys.size())
+                keys.push_back(meshpp::private_key(options.account_keys[index]));
+            else
+                keys.push_back(account_seed.get_private_key(uint32_t(index)));
+            addresses.push_back(keys.back().get_public_key().to_string());
+        }
+
+        //  the transfers carry the marker in their message, so that the
+        //  watcher finds them in the action log
+        string marker = "noahd_load:" + options.seed + ":";
+        auto make_body = [&](size_t index) -> string
+        {
+            if (false == bodies.empty())
+                return bodies[index];
+
+            auto const& item = transfers[index];
+            Transfer transfer;
+            transfer.from = addresses[item.from];
+            transfer.to = addresses[item.to];
+            transfer.amount = publiqpp::coin(0, item.amount).to_Coin();
+            transfer.message = marker + std::to_string(index);
+
+            Transaction transaction;
+            transaction.creation.tm = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            transaction.expiry.tm = transaction.creation.tm + 3600;
+            transaction.fee = publiqpp::coin(0, 1).to_Coin();
+            transaction.action = transfer;
+
+            Authority authority;
+            authority.address = transfer.from;
+            authority.signature = keys[item.from].sign(transaction.to_string()).base58;
+
+            SignedTransaction signed_transaction;
+            signed_transaction.transaction_details = transaction;
+            signed_transaction.authorizations.push_back(authority);
+
+            Broadcast broadcast;
+            broadcast.package = signed_transaction;
+            return broadcast.to_string();
+        };
+
+        vector<node_process::usage> usage_before;
+        for (auto const& process : processes)
+            usage_before.push_back(process->measure());
+
+        vector<sent_request> requests(offsets.size());
+        confirmation_watcher watcher(nodes.front(), marker);
+        if (bodies.empty())
+            watcher.start(requests.size());
+
+        auto start = steady_clock::now();
+        send_all(offsets, make_body, nodes, options.connections, start, requests);
+        std::chrono::duration<double> sending = steady_clock::now() - start;
+
+        //  the blocks take a while to have the last transfers
+        string done = std::to_string(Done::rvalue);
+        size_t accepted = size_t(std::count_if(requests.begin(), requests.end(), [&done](sent_request const& item)
+        {
+            return item.done && item.result == done;
+        }));
+        auto settle_until = steady_clock::now() + std::chrono::milliseconds(int64_t(options.settle * 1000));
+        while (bodies.empty() &&
+               false == g_termination_handled &&
+               steady_clock::now() < settle_until &&
+               watcher.seen_count() < accepted)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        watcher.stop();
+        auto seen = watcher.seen();
+        std::chrono::duration<double> elapsed = steady_clock::now() - start;
+
+        vector<node_process::usage> usage_after;
+        for (auto const& process : processes)
+            usage_after.push_back(process->measure());
+
+        size_t sent = 0;
+        size_t confirmed = 0;
+        double max_lag = 0;
+        std::map<string, size_t> results;
+        vector<double> rpc_seconds;
+        vector<double> confirmation_seconds;
+        for (size_t index = 0; index != requests.size(); ++index)
+        {
+            auto const& item = requests[index];
+            if (false == item.done)
+                continue;
+            ++sent;
+            ++results[item.result];
+            max_lag = std::max(max_lag, item.lag_seconds);
+            rpc_seconds.push_back(item.rpc_seconds);
+
+            auto it = seen.find(index);
+            if (it != seen.end())
+            {
+                ++confirmed;
+                std::chrono::duration<double> latency = it->second - item.sent;
+                confirmation_seconds.push_back(latency.count());
+            }
+        }
+
+        cout << std::setprecision(6)
+             << "{\"mode\":\"" << (bodies.empty() ? "synthetic" : "replay") << "\""
+             << ",\"seed\":\"" << options.seed << "\""
+             << ",\"scheduled\":" << requests.size()
+             << ",\"sent\":" << sent
+             << ",\"sending_seconds\":" << sending.count()
+             << ",\"per_second\":" << double(sent) / std::max(sending.count(), 0.001)
+             << ",\"max_lag_seconds\":" << max_lag
+             << ",\"results\":{";
+        for (auto it = results.begin(); it != results.end(); ++it)
+            cout << (it == results.begin() ? "" : ",") << "\"" << it->first << "\":" << it->second;
+        cout << "}"
+             << ",\"rpc_seconds\":" << percentiles_json(rpc_seconds);
+        if (bodies.empty())
+            cout << ",\"confirmed\":" << confirmed
+                 << ",\"confirmation_seconds\":" << percentiles_json(confirmation_seconds);
+        cout << ",\"nodes\":[";
+        for (size_t index = 0; index != usage_after.size(); ++index)
+        {
+            double cpu_seconds = usage_after[index].cpu_seconds - usage_before[index].cpu_seconds;
+            cout << (index > 0 ? "," : "") << endl
+                 << "{\"node\":" << index
+                 << ",\"cpu_seconds\":" << cpu_seconds
+                 << ",\"cpu_percent\":" << 100 * cpu_seconds / std::max(elapsed.count(), 0.001)
+                 << ",\"rss_bytes\":" << usage_after[index].rss_bytes
+                 << ",\"max_rss_bytes\":" << usage_after[index].max_rss_bytes << "}";
+        }
+        cout << endl << "]}" << endl;
+    }
+    catch (std::exception const& ex)
+    {
+        cout << "exception cought: " << ex.what() << endl;
+        return 1;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+bool process_command_line(int argc, char** argv, load_options& options)
+{
+    program_options::options_description options_description;
+    try
+    {
+        auto desc_init = options_description.add_options()
+            ("help,h", "Print this help message and exit.")
+            ("noahd", program_options::value<string>(&options.noahd),
+                            "The noahd executable to start the local network with")
+            ("nodes,n", program_options::value<size_t>(&options.nodes),
+                            "Nodes in the local network, on loopback, testnet")
+            ("base_port", program_options::value<unsigned short>(&options.base_port),
+                            "Node N listens for p2p on base_port + 10 * N and for rpc on the port after")
+            ("work_directory", program_options::value<string>(&options.work_directory),
+                            "Where the local nodes keep their data directories, a new temporary directory otherwise")
+            ("node_key", program_options::value<vector<string>>(&options.node_keys),
+                            "Private key of the local node with the same position, generated from the seed otherwise")
+            ("noahd_argument", program_options::value<vector<string>>(&options.noahd_arguments),
+                            "Passed on to every local node, as --noahd_argument=--tx_pool_memory --noahd_argument=64")
+            ("rpc", program_options::value<vector<string>>(&options.rpc_addresses),
+                            "The rpc interface of a running node, instead of a local network. The first one's action log is watched")
+            ("testnet", "The nodes given with rpc are on testnet")
+            ("seed,s", program_options::value<string>(&options.seed),
+                            "The same seed gives the same accounts and the same schedule of transfers")
+            ("accounts", program_options::value<size_t>(&options.accounts),
+                            "Accounts sending transfers to each other")
+            ("account_key", program_options::value<vector<string>>(&options.account_keys),
+                            "Private key of the account with the same position, generated from the seed otherwise. "
+                            "Only accounts with coins get their transfers confirmed")
+            ("rate,r", program_options::value<double>(&options.rate),
+                            "Transfers per second, on average")
+            ("duration,t", program_options::value<double>(&options.duration),
+                            "Seconds of sending")
+            ("connections,c", program_options::value<size_t>(&options.connections),
+                            "Requests in flight at most, each on a connection of its own, spread over the nodes")
+            ("settle", program_options::value<double>(&options.settle),
+                            "Seconds to wait after sending for the transfers to show up in the action log")
+            ("record", program_options::value<string>(&options.record_path),
+                            "Pass the rpc requests from listen to target and append them to the file, until interrupted")
+            ("listen", program_options::value<string>(&options.listen),
+                            "With record, the address:port to take the requests on")
+            ("target", program_options::value<string>(&options.target),
+                            "With record, the node's rpc address:port")
+            ("replay", program_options::value<string>(&options.replay_path),
+                            "Send the requests of a recorded file at their offsets instead of the transfers")
+            ("speed", program_options::value<double>(&options.speed),
+                            "With replay, the offsets are divided by this");
+        (void)(desc_init);
+
+        program_options::variables_map variables;
+
+        program_options::store(
+                    program_options::parse_command_line(argc, argv, options_description),
+                    variables);
+
+        program_options::notify(variables);
+
+        if (variables.count("help"))
+        {
+            throw std::runtime_error("");
+        }
+        options.testnet = variables.count("testnet");
+
+        if (options.seed.empty() ||
+            options.seed.find_first_not_of("0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-") != string::npos)
+            throw std::runtime_error("seed can have letters, digits, _ and - only");
+        if (false == options.record_path.empty() &&
+            (options.listen.empty() || options.target.empty()))
+            throw std::runtime_error("record needs listen and target");
+        if (false == options.record_path.empty() && false == options.replay_path.empty())
+            throw std::runtime_error("record and replay can't be used together");
+        if (options.rpc_addresses.empty() && 0 == options.nodes)
+            throw std::runtime_error("nodes can't be 0 without rpc");
+        if (options.accounts < 2)
+            throw std::runtime_error("at least 2 accounts");
+        if (options.rate <= 0 || options.duration <= 0 || options.speed <= 0 || options.settle < 0)
+            throw std::runtime_error("rate, duration and speed have to be positive");
+        if (0 == options.connections)
+            throw std::runtime_error("connections can't be 0");
+    }
+    catch (std::exception const& ex)
+    {
+        std::stringstream ss;
+        ss << options_description;
+
+        string ex_message = ex.what();
+        if (false == ex_message.empty())
+            cout << ex.what() << endl << endl;
+        cout << ss.str();
+        return false;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,248 @@
+#include <belt.pp/global.hpp>
+
+#include <noah.pp/kv_backend.hpp>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <vector>
+
+namespace program_options = boost::program_options;
+namespace filesystem = boost::filesystem;
+
+using std::string;
+using std::cout;
+using std::endl;
+using std::vector;
+using std::runtime_error;
+
+string read_file(filesystem::path const& path);
+string relative_key(filesystem::path const& root, filesystem::path const& path);
+bool process_command_line(int argc, char** argv,
+                          string& state_directory,
+                          string& kv_store_directory,
+                          string& backend,
+                          string& key,
+                          string& prefix,
+                          bool& verify);
+
+//  one shot migration of a state directory, a file per entry, into a
+//  kv_store, and a way to look into the result. the key is the file's
+//  path relative to the state directory with '/' separators, the value
+//  is the file's content. nothing in noahd opens the result, the node
+//  keeps its state in the state directory, this is for measuring the
+//  layout
+int main(int argc, char** argv)
+{
+    string state_directory;
+    string kv_store_directory;
+    string backend = "lsm";
+    string key;
+    string prefix;
+    bool verify = false;
+
+    if (false == process_command_line(argc, argv,
+                                      state_directory,
+                                      kv_store_directory,
+                                      backend,
+                                      key,
+                                      prefix,
+                                      verify))
+        return 1;
+
+    try
+    {
+        if (false == key.empty())
+        {
+            auto store = noahpp::open_kv_store(backend, kv_store_directory);
+            string value;
+            if (false == store->get(key, value))
+                throw runtime_error("no such key: " + key);
+            cout << value << endl;
+            return 0;
+        }
+
+        if (state_directory.empty())
+        {
+            auto store = noahpp::open_kv_store(backend, kv_store_directory);
+            uint64_t count = 0;
+            uint64_t bytes = 0;
+            store->scan(prefix, prefix, [&count, &bytes, &prefix](string const& item_key, string const& value)
+            {
+                if (false == prefix.empty())
+                    cout << item_key << " " << value.size() << endl;
+                ++count;
+                bytes += value.size();
+                return true;
+            });
+            cout << "keys: " << count << ", bytes: " << bytes << endl;
+            return 0;
+        }
+
+        vector<filesystem::path> files;
+        for (filesystem::recursive_directory_iterator it(state_directory), end;
+             it != end; ++it)
+        {
+            if (filesystem::is_regular_file(it->path()))
+                files.push_back(it->path());
+        }
+
+        auto store = noahpp::open_kv_store(backend, kv_store_directory);
+        bool empty = true;
+        store->scan(string(), string(), [&empty](string const&, string const&)
+        {
+            empty = false;
+            return false;
+        });
+        if (false == empty)
+            throw runtime_error("kv store is not empty: " + kv_store_directory);
+
+        noahpp::kv_store::batch changes;
+        size_t changes_bytes = 0;
+        for (size_t index = 0; index != files.size(); ++index)
+        {
+            string value = read_file(files[index]);
+            changes_bytes += value.size();
+            changes.put(relative_key(state_directory, files[index]), value);
+
+            if (changes.changes.size() == 10000 || changes_bytes >= 64 * 1024 * 1024)
+            {
+                store->apply(changes);
+                changes.changes.clear();
+                changes_bytes = 0;
+                cout << "entries: " << index + 1 << endl;
+            }
+        }
+        store->apply(changes);
+        store->flush();
+
+        if (verify)
+        {
+            for (auto const& path : files)
+            {
+                string value;
+                if (false == store->get(relative_key(state_directory, path), value) ||
+                    value != read_file(path))
+                    throw runtime_error("verification failed: " + path.string());
+            }
+            cout << "verified entries: " << files.size() << endl;
+        }
+
+        cout << "migrated entries: " << files.size() << endl;
+    }
+    catch (std::exception const& ex)
+    {
+        cout << "exception cought: " << ex.what() << endl;
+        return 1;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+string read_file(filesystem::path const& path)
+{
+    filesystem::ifstream fl;
+    fl.open(path, std::ios_base::binary);
+    if (!fl)
+        throw runtime_error("cannot open: " + path.string());
+
+    return string(std::istreambuf_iterator<char>(fl),
+                  std::istreambuf_iterator<char>());
+}
+
+string relative_key(filesystem::path const& root, filesystem::path const& path)
+{
+    string result;
+    auto root_it = root.begin();
+    for (auto it = path.begin(); it != path.end(); ++it)
+    {
+        if (root_it != root.end() && *root_it == *it)
+        {
+            ++root_it;
+            continue;
+        }
+        if (false == result.empty())
+            result += "/";
+        result += it->string();
+    }
+    return result;
+}
+
+bool process_command_line(int argc, char** argv,
+                          string& state_directory,
+                          string& kv_store_directory,
+                          string& backend,
+                          string& key,
+                          string& prefix,
+                          bool& verify)
+{
+    program_options::options_description options_description(
+                "Copies a state directory into a key value store, to measure and look into that layout.\n"
+                "noahd does not open the result, the node keeps using its state directory");
+    try
+    {
+        auto desc_init = options_description.add_options()
+            ("help,h", "Print this help message and exit.")
+            ("state,t", program_options::value<string>(&state_directory),
+                            "Existing state directory to migrate from")
+            ("kv_store,s", program_options::value<string>(&kv_store_directory)->required(),
+                            "Key value store directory")
+            ("backend,b", program_options::value<string>(&backend),
+                            "Key value store backend, \"lsm\" by default or \"files\"")
+            ("key,k", program_options::value<string>(&key),
+                            "Print the value of the key and exit")
+            ("prefix,p", program_options::value<string>(&prefix),
+                            "List the keys starting with this and their value sizes, and exit")
+            ("verify", "Read every migrated entry back and compare it with its file");
+        (void)(desc_init);
+
+        program_options::variables_map options;
+
+        program_options::store(
+                    program_options::parse_command_line(argc, argv, options_description),
+                    options);
+
+        program_options::notify(options);
+
+        if (options.count("help"))
+        {
+            throw std::runtime_error("");
+        }
+        verify = options.count("verify");
+
+        auto backends = noahpp::kv_backends();
+        if (std::find(backends.begin(), backends.end(), backend) == backends.end())
+            throw std::runtime_error("backend can be \"lsm\" or \"files\"");
+    }
+    catch (std::exception const& ex)
+    {
+        std::stringstream ss;
+        ss << options_description;
+
+        string ex_message = ex.what();
+        if (false == ex_message.empty())
+            cout << ex.what() << endl << endl;
+        cout << ss.str();
+        return false;
+    }
+    catch (...)
+    {
+        cout << "always throw std::exceptions" << endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,72 @@
+#include <belt.pp/global.hpp>
+
+#include <noah.pp/arena.hpp>
+#include <noah.pp/binary_codec.hpp>
+#include <noah.pp/json.hpp>
+
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using std::string;
+using std::cout;
+using std::endl;
+
+namespace
+{
+size_t failures = 0;
+
+void check(bool condition, string const& what)
+{
+    if (condition)
+        return;
+    cout << "failed: " << what << endl;
+    ++failures;
+}
+
+bool refused(std::function<void()> const& fn)
+{
+    try
+    {
+        fn();
+    }
+    catch (std::runtime_error const&)
+    {
+        return true;
+    }
+    return false;
+}
+
+//  an rpc body can be anything, the deeply nested one has to be
+//  refused before it takes the whole stack
+void json_nesting()
+{
+    string nested(200000, '[');
+    noahpp::arena memory;
+    noahpp::json::lexer input(nested.data(), nested.data() + nested.size());
+    check(refused([&nested, &memory] { noahpp::json::parse(nested, memory); }), "json::parse refuses deep nesting");
+    check(refused([&nested] { noahpp::binary_codec::encode(nested); }), "binary_codec::encode refuses deep nesting");
+    check(refused([&input] { input.skip_value(); }), "lexer::skip_value refuses deep nesting");
+
+    string shallow = string(noahpp::json::max_depth, '[') + string(noahpp::json::max_depth, ']');
+    check(false == refused([&shallow, &memory] { noahpp::json::parse(shallow, memory); }),
+          "json::parse takes max_depth nesting");
+    check(false == refused([&shallow] { noahpp::binary_codec::encode(shallow); }),
+          "binary_codec::encode takes max_depth nesting");
+}
+}
+
+//  correctness checks, the process fails when any of them does
+int main()
+{
+    json_nesting();
+
+    if (failures > 0)
+    {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "all checks passed" << endl;
+    return 0;
+}